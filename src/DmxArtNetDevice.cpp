@@ -0,0 +1,141 @@
+/*
+ * Sends DMX as Art-Net (ArtDmx packets), see DmxNetDevice. The destination
+ * defaults to the limited broadcast address, the universe is the 15-bit
+ * Art-Net port-address (net, sub-net and universe).
+ *
+ * Art-Net carries null start code data only, so frames with another start code
+ * are not sent.
+ */
+#include <cstring>
+#include "DmxArtNetDevice.h"
+
+const int DmxArtNetDevice::PORT = 6454;
+const int DmxArtNetDevice::HEADER_LENGTH = 18;
+const int DmxArtNetDevice::UNIVERSE_MAX = 0x7FFF;
+const char* DmxArtNetDevice::BROADCAST_ADDRESS = "255.255.255.255";
+
+//private constants
+const unsigned char DmxArtNetDevice::ART_NET_ID[8] = { 'A', 'r', 't', '-', 'N', 'e', 't', 0 };
+const int DmxArtNetDevice::OPCODE_DMX = 0x5000;
+const int DmxArtNetDevice::PROTOCOL_VERSION = 14;
+const int DmxArtNetDevice::SEQUENCE_OFFSET = 12;
+const int DmxArtNetDevice::LENGTH_OFFSET = 16;
+
+
+DmxArtNetDevice::DmxArtNetDevice()
+: DmxNetDevice( PORT, 0, UNIVERSE_MAX )
+{
+	//the universe given to open(), fed by writeDmx() and publishDmx()
+	addUniverse( 0 );
+}
+
+DmxArtNetDevice::~DmxArtNetDevice()
+{
+	stopOutputThread();
+}
+
+
+/*
+ * Open the device (see DmxNetDevice::open()), broadcasting if no host is given.
+ */
+bool DmxArtNetDevice::open( const char* host, const char* serial, int universe )
+{
+	return DmxNetDevice::open( host != 0 ? host : BROADCAST_ADDRESS, serial, universe );
+}
+
+DmxDevice::DMX_DEVICE_TYPE DmxArtNetDevice::getType() const
+{
+	return DmxDevice::DMX_DEVICE_ARTNET;
+}
+
+/*
+ * Decode an ArtDmx packet. Since Art-Net only carries null start code data,
+ * the start code is always 0 and not part of the slots.
+ *
+ * Returns: 0 if successful or RV_PACKET_INVALID if the packet is not a valid
+ * ArtDmx packet.
+ */
+int DmxArtNetDevice::parsePacket( const unsigned char* packet, int length, packetInfo* info )
+{
+	if ( length < HEADER_LENGTH || std::memcmp( packet, ART_NET_ID, sizeof( ART_NET_ID ) ) != 0 ) {
+		return RV_PACKET_INVALID;
+	}
+	if ( ( packet[8] | packet[9] << 8 ) != OPCODE_DMX ) return RV_PACKET_INVALID;
+	
+	int slotCount = packet[LENGTH_OFFSET] << 8 | packet[LENGTH_OFFSET + 1];
+	if ( slotCount > 512 || HEADER_LENGTH + slotCount > length ) return RV_PACKET_INVALID;
+	
+	info->universe = packet[14] | ( packet[15] & 0x7F ) << 8;
+	info->sequence = ( packet[SEQUENCE_OFFSET] != 0 ) ? packet[SEQUENCE_OFFSET] : -1;
+	info->priority = -1;
+	info->options = 0;
+	info->cid = 0;
+	info->startCode = 0;
+	info->slots = packet + HEADER_LENGTH;
+	info->slotCount = slotCount;
+	
+	return 0;
+}
+
+bool DmxArtNetDevice::prepareSocket()
+{
+	return socket_->setBroadcast( true );
+}
+
+/*
+ * Write the ArtDmx header for the universe's port-address, with sequence
+ * number 0 and an empty data length.
+ */
+void DmxArtNetDevice::buildHeader( universe* u ) const
+{
+	unsigned char* packet = u->packet;
+	
+	std::memcpy( packet, ART_NET_ID, sizeof( ART_NET_ID ) );
+	packet[8] = OPCODE_DMX & 0xFF;
+	packet[9] = OPCODE_DMX >> 8;
+	packet[10] = 0;
+	packet[11] = PROTOCOL_VERSION;
+	packet[SEQUENCE_OFFSET] = 0;
+	packet[13] = 0; /* physical port */
+	packet[14] = u->number & 0xFF; /* sub-net and universe */
+	packet[15] = ( u->number >> 8 ) & 0x7F; /* net */
+	packet[LENGTH_OFFSET] = 0;
+	packet[LENGTH_OFFSET + 1] = 0;
+}
+
+/*
+ * Copy a frame (start code included) into the data part of the given packet
+ * and set its length, which must be even and at least 2.
+ *
+ * Returns: the length of the packet, or -1 if the frame is empty or its start
+ * code is not 0.
+ */
+int DmxArtNetDevice::setPacketData( unsigned char* packet, const unsigned char* data, int length ) const
+{
+	if ( length < 1 || data[0] != 0 ) return -1;
+	
+	int slots = length - 1;
+	if ( slots > 512 ) slots = 512;
+	int padded = slots + ( slots & 1 );
+	if ( padded < 2 ) padded = 2;
+	
+	std::memcpy( packet + HEADER_LENGTH, data + 1, slots );
+	if ( padded > slots ) std::memset( packet + HEADER_LENGTH + slots, 0, padded - slots );
+	packet[LENGTH_OFFSET] = padded >> 8;
+	packet[LENGTH_OFFSET + 1] = padded & 0xFF;
+	
+	return HEADER_LENGTH + padded;
+}
+
+/*
+ * Art-Net sequence numbers run from 1 to 255, 0 disables reordering.
+ */
+unsigned char DmxArtNetDevice::nextSequence( unsigned char sequence ) const
+{
+	return ( sequence >= 255 ) ? 1 : sequence + 1;
+}
+
+void DmxArtNetDevice::setSequence( unsigned char* packet, unsigned char sequence ) const
+{
+	packet[SEQUENCE_OFFSET] = sequence;
+}
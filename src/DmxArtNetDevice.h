@@ -0,0 +1,42 @@
+/*
+ */
+#ifndef DMX_ART_NET_DEVICE_H
+#define DMX_ART_NET_DEVICE_H
+
+#include "DmxNetDevice.h"
+
+class DmxArtNetDevice : public DmxNetDevice {
+public:
+	static const int PORT;
+	static const int HEADER_LENGTH;
+	static const int UNIVERSE_MAX;
+	static const char* BROADCAST_ADDRESS;
+	
+	
+	DmxArtNetDevice();
+	~DmxArtNetDevice();
+	
+	bool open( const char* host = 0, const char* serial = 0, int universe = 0 );
+	DMX_DEVICE_TYPE getType() const;
+	
+	static int parsePacket( const unsigned char* packet, int length, packetInfo* info );
+	
+protected:
+	bool prepareSocket();
+	void buildHeader( universe* u ) const;
+	int setPacketData( unsigned char* packet, const unsigned char* data, int length ) const;
+	unsigned char nextSequence( unsigned char sequence ) const;
+	void setSequence( unsigned char* packet, unsigned char sequence ) const;
+	
+private:
+	static const unsigned char ART_NET_ID[8];
+	static const int OPCODE_DMX;
+	static const int PROTOCOL_VERSION;
+	static const int SEQUENCE_OFFSET;
+	static const int LENGTH_OFFSET;
+	
+	DmxArtNetDevice( const DmxArtNetDevice& other );
+	DmxArtNetDevice& operator=( const DmxArtNetDevice& other );
+};
+
+#endif /* ! DMX_ART_NET_DEVICE_H */
@@ -0,0 +1,46 @@
+/*
+ * Monotonic time source used for scheduling and timestamping frames. All times
+ * are in nanoseconds since an arbitrary, fixed starting point; they are only
+ * meaningful relative to each other.
+ */
+#include <chrono>
+#include <thread>
+#if defined( __linux__ )
+# include <errno.h>
+# include <time.h> /* for clock_gettime() and clock_nanosleep() */
+#endif
+#include "DmxClock.h"
+
+/*
+ * Return the current monotonic time in nanoseconds.
+ */
+uint64_t DmxClock::now()
+{
+#if defined( __linux__ )
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now().time_since_epoch() ).count();
+#endif
+}
+
+/*
+ * Sleep until the given absolute monotonic time (as returned by now()). Since
+ * the deadline is absolute, time spent before the call (or oversleeping on a
+ * previous call) does not accumulate.
+ */
+void DmxClock::sleepUntil( uint64_t deadline )
+{
+#if defined( __linux__ )
+	struct timespec ts;
+	ts.tv_sec = deadline / 1000000000ULL;
+	ts.tv_nsec = deadline % 1000000000ULL;
+	while ( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0 ) == EINTR ) { /* retry */ }
+#else
+	std::chrono::steady_clock::time_point tp( std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+																						std::chrono::nanoseconds( deadline ) ) );
+	std::this_thread::sleep_until( tp );
+#endif
+}
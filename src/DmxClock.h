@@ -0,0 +1,19 @@
+/*
+ */
+#ifndef DMX_CLOCK_H
+#define DMX_CLOCK_H
+
+#include <stdint.h>
+
+class DmxClock {
+public:
+	static uint64_t now();
+	static void sleepUntil( uint64_t deadline );
+	
+private:
+	DmxClock();
+	DmxClock( const DmxClock& other );
+	DmxClock& operator=( const DmxClock& other );
+};
+
+#endif /* ! DMX_CLOCK_H */
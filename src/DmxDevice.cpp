@@ -6,19 +6,64 @@
  * relevant for external use is either forwarded here or has been declared
  * statically. In other words, from a user's point of view, the FtdiDevice
  * class' contents are not relevant.
+ *
+ * Optionally, a device can run its own output thread (see startOutputThread()).
+ * In that case frames are handed over with publishDmx() instead of writeDmx(),
+ * so the calling thread never has to wait for USB transfers. The output thread
+ * sends the newest frame at a fixed rate (see setOutputRate()), repeating the
+ * last one if nothing new has been published. Devices which keep refreshing the
+ * DMX line themselves only get sent frames that have changed, plus one every
+ * keep-alive interval (see setKeepAliveInterval()). Finally, the thread can
+ * shorten frames to the used part of the universe to increase the refresh rate
+ * (see setAdaptiveSlotCount()). Time left in between frames is offered to the
+ * device through serviceLine().
+ * Frames are handed to the device with submitDmxFrame(), which the DMX USB PRO
+ * implements with an asynchronous transfer; the thread handles its completion
+ * while waiting, so send times are measured up to the end of the transfer.
+ *
+ * Network devices (see DmxArtNetDevice) have no FtdiDevice; they override
+ * open(), close(), isOpen() and getLastError() instead.
  */
+#include <assert.h>
+#include <cstring>
+#include "DmxClock.h"
+#include "DmxKernels.h"
+#include "DmxTripleBuffer.h"
 #include "DmxDevice.h"
 
 /* NOTE: using a magic return value is not very elegant...oh well. */
 const int DmxDevice::RV_DEVICE_NOT_OPEN = FtdiDevice::RV_DEVICE_NOT_OPEN;
+const int DmxDevice::RV_NOT_SUPPORTED = -16000;
+const int DmxDevice::DMX_SLOTS_MIN = 24;
+
+//private constants
+const int DmxDevice::KEEP_ALIVE_INTERVAL_DEFAULT = 1000; /* in milliseconds */
+/* DMX512 transmitter timing in microseconds (ANSI E1.11) */
+const float DmxDevice::DMX_BREAK_TIME_MIN = 92.0f;
+const float DmxDevice::DMX_MAB_TIME_MIN = 12.0f;
+const float DmxDevice::DMX_SLOT_TIME = 44.0f;
 
 
 DmxDevice::DmxDevice()
-: ftdiDevice_( 0 )
+: ftdiDevice_( 0 ), outputFrames_( new DmxTripleBuffer() ),
+  outputScheduler_( new DmxFrameScheduler() ), outputRate_( 0 ),
+  keepAliveInterval_( KEEP_ALIVE_INTERVAL_DEFAULT ), adaptiveSlotCount_( false ),
+  patchedSlotCount_( 0 ), sentFrameCount_( 0 ),
+  suppressedFrameCount_( 0 ), sendTimeSum_( 0 ), sendTimeMax_( 0 ), newFrameCount_( 0 ), frameLatencySum_( 0 ),
+  frameLatencyMax_( 0 ), outputStartTime_( 0 ), outputStopTime_( 0 ), pendingFrameTimestamp_( 0 ), outputThread_( 0 ), outputThreadRunning_( false ),
+  inputSubscriptions_( new DmxSubscriptionIndex() )
 { /* empty */ }
 
+/*
+ * NOTE: subclasses must call stopOutputThread() in their destructor, since the
+ * output thread calls back into them.
+ */
 DmxDevice::~DmxDevice()
 {
+	stopOutputThread();
+	delete outputFrames_;
+	delete outputScheduler_;
+	delete inputSubscriptions_;
 	delete ftdiDevice_;
 }
 
@@ -51,7 +96,8 @@ bool DmxDevice::open( const char* description, const char* serial, int index )
 bool DmxDevice::close()
 {
 	bool success = true;
-	if ( isOpen() ) success = ftdiDevice_->close();
+	stopOutputThread();
+	if ( ftdiDevice_ != 0 && ftdiDevice_->isOpen() ) success = ftdiDevice_->close();
 	return success;
 }
 
@@ -64,6 +110,344 @@ bool DmxDevice::isOpen() const
 }
 
 
+
+/*
+ * Copy the most recently received DMX frame (start code included) into the
+ * given buffer. The default implementation is for devices without DMX input.
+ *
+ * Returns: the number of bytes copied, 0 if nothing has been received yet, or
+ * RV_NOT_SUPPORTED if the device cannot receive DMX.
+ */
+int DmxDevice::readDmx( const unsigned char* /*data*/, int /*length*/ ) const
+{
+	return RV_NOT_SUPPORTED;
+}
+
+/*
+ * Return a flag indicating whether the DMX line has to be refreshed by sending
+ * frames continuously, even if they do not change. This is the case unless the
+ * device repeats the last frame it received by itself.
+ */
+bool DmxDevice::needsContinuousRefresh() const
+{
+	return true;
+}
+
+/*
+ * Called when adaptive slot count is enabled, allowing the device to optimize
+ * its timing for short frames. The default implementation does nothing.
+ *
+ * Returns: true if successful, false otherwise.
+ */
+bool DmxDevice::prepareAdaptiveSlotCount()
+{
+	return true;
+}
+
+/*
+ * Called by the output thread in between frames, allowing the device to use
+ * the line for other traffic until the given deadline (see DmxClock), at which
+ * the next frame is due. The deadline is 0 if the output rate is unlimited.
+ * The default implementation does nothing.
+ */
+void DmxDevice::serviceLine( uint64_t /*deadline*/ )
+{ /* empty */ }
+
+/*
+ * Return a flag indicating whether the device has output of its own besides the
+ * frames published through publishDmx(). If so, the output thread calls
+ * writeDmxFrame() on every tick, even with an empty frame or one equal to the
+ * last frame sent. The default implementation returns false.
+ */
+bool DmxDevice::hasPendingOutput() const
+{
+	return false;
+}
+
+/*
+ * Called by devices supporting input for every received frame or update, with
+ * a bitmap of the changed slots (see DmxSubscriptionIndex::dispatch()), to
+ * notify the matching input subscriptions.
+ *
+ * Returns: the number of callbacks made.
+ */
+int DmxDevice::dispatchInput( const unsigned char* data, int length, const uint64_t* changed ) const
+{
+	return inputSubscriptions_->dispatch( data, length, changed );
+}
+
+/*
+ * Adjust USB settings (latency timer, transfer sizes) of the FTDI device for the
+ * best performance with this type of device. Subclasses call this when opened.
+ * The default implementation does nothing.
+ *
+ * Returns: true if settings could be applied, false otherwise.
+ */
+bool DmxDevice::autoTune()
+{
+	return true;
+}
+
+/*
+ * Write the data contained in the given frame buffer. Devices which need to wrap
+ * the data in a protocol packet may use the buffer's headroom and tailroom to do
+ * so in place, overwriting anything outside the first frame->length data bytes.
+ * The default implementation simply passes the data on to writeDmx().
+ *
+ * Returns: see writeDmx() in the respective subclass.
+ */
+int DmxDevice::writeDmxFrame( DmxFrameBuffer* frame ) const
+{
+	return writeDmx( frame->data, frame->length );
+}
+
+/*
+ * Start writing the given frame without waiting for it to be sent, like
+ * writeDmxFrame() does otherwise. The frame must remain valid until the
+ * callback has been called: immediately or, for devices writing through
+ * FtdiDevice::submitWrite(), from FtdiDevice::processWrites(). The default
+ * implementation writes synchronously.
+ *
+ * Returns: a value >= 0 if the frame has been submitted (the callback is called
+ * with the result), or < 0 if an error occured (the callback is not called).
+ */
+int DmxDevice::submitDmxFrame( DmxFrameBuffer* frame, FtdiDevice::writeCallback callback, void* userData ) const
+{
+	FtdiDevice::writeCompletion wc;
+	wc.submitTime = DmxClock::now();
+	wc.result = writeDmxFrame( frame );
+	wc.completeTime = DmxClock::now();
+	
+	if ( wc.result < 0 ) return wc.result;
+	if ( callback != 0 ) callback( &wc, userData );
+	return wc.result;
+}
+
+/*
+ * Start a thread which sends frames handed over through publishDmx() to the
+ * device, so the publishing thread does not block on USB I/O.
+ *
+ * Returns: true if the thread is running (also if it already was), false if the
+ * device is not open.
+ */
+bool DmxDevice::startOutputThread()
+{
+	if ( ! isOpen() ) return false;
+	if ( outputThread_ != 0 ) return true;
+	
+	outputScheduler_->setRate( getResolvedOutputRate() );
+	outputScheduler_->resetJitterStats();
+	sentFrameCount_ = suppressedFrameCount_ = sendTimeSum_ = sendTimeMax_ = 0;
+	newFrameCount_ = frameLatencySum_ = frameLatencyMax_ = 0;
+	outputStartTime_ = DmxClock::now();
+	outputStopTime_ = 0;
+	outputThreadRunning_ = true;
+	outputThread_ = new std::thread( &DmxDevice::runOutputThread, this );
+	
+	return true;
+}
+
+/*
+ * Stop the output thread if it is running and wait for it to finish its current
+ * frame.
+ */
+void DmxDevice::stopOutputThread()
+{
+	if ( outputThread_ == 0 ) return;
+	
+	outputThreadRunning_ = false;
+	outputThread_->join();
+	delete outputThread_; outputThread_ = 0;
+	outputStopTime_ = DmxClock::now();
+}
+
+bool DmxDevice::isOutputThreadRunning() const
+{
+	return outputThread_ != 0;
+}
+
+/*
+ * Hand over a frame to the output thread. The data is copied, so the buffer
+ * may be reused immediately. This never blocks and does not perform any system
+ * calls; if several frames are published before the output thread gets to
+ * send, only the newest one will be sent.
+ *
+ * Returns: 0 on success or RV_DEVICE_NOT_OPEN if the device is not open.
+ */
+int DmxDevice::publishDmx( const unsigned char* data, int length )
+{
+	assert( length <= DmxTripleBuffer::FRAME_MAX_LENGTH );
+	if ( ! isOpen() ) return RV_DEVICE_NOT_OPEN;
+	
+	DmxTripleBuffer::frame* f = outputFrames_->getWriteFrame();
+	std::memcpy( f->data, data, length );
+	f->length = length;
+	f->timestamp = DmxClock::now();
+	outputFrames_->publish();
+	
+	return 0;
+}
+
+/*
+ * Set the rate in frames per second at which the output thread sends frames.
+ * Passing 0 (the default) selects the rate returned by getDefaultRefreshRate()
+ * at the time the thread is started.
+ */
+void DmxDevice::setOutputRate( float rate )
+{
+	outputRate_ = ( rate > 0 ) ? rate : 0;
+	if ( outputThread_ != 0 ) {
+		outputScheduler_->setRate( getResolvedOutputRate() );
+	}
+}
+
+/*
+ * Return the rate the output thread sends frames at (or will, once started).
+ */
+float DmxDevice::getOutputRate() const
+{
+	if ( outputThread_ != 0 ) return outputScheduler_->getRate();
+	return getResolvedOutputRate();
+}
+
+/*
+ * Retrieve the deviation between the scheduled and actual send times of frames
+ * sent by the output thread since it has been started.
+ */
+void DmxDevice::getOutputJitter( DmxFrameScheduler::jitterStats* stats ) const
+{
+	outputScheduler_->getJitterStats( stats );
+}
+
+/*
+ * Retrieve timing statistics of frames sent by the output thread since it has
+ * been started. The send time is the time from submitting a frame to its USB
+ * transfer having finished, the frame latency is the time between publishing a
+ * frame and its transfer having finished.
+ */
+void DmxDevice::getOutputLatency( latencyStats* stats ) const
+{
+	uint64_t sent = sentFrameCount_, fresh = newFrameCount_;
+	
+	stats->frameCount = sent;
+	stats->meanSendTime = ( sent > 0 ) ? ( sendTimeSum_ / (double)sent ) / 1000.0 : 0;
+	stats->maxSendTime = sendTimeMax_ / 1000.0;
+	stats->meanFrameLatency = ( fresh > 0 ) ? ( frameLatencySum_ / (double)fresh ) / 1000.0 : 0;
+	stats->maxFrameLatency = frameLatencyMax_ / 1000.0;
+}
+
+/*
+ * Set the interval in milliseconds after which the output thread re-sends an
+ * unchanged frame to a device not needing continuous refreshing. Passing 0
+ * disables suppression of unchanged frames altogether.
+ */
+void DmxDevice::setKeepAliveInterval( int interval )
+{
+	keepAliveInterval_ = ( interval > 0 ) ? interval : 0;
+}
+
+int DmxDevice::getKeepAliveInterval() const
+{
+	return keepAliveInterval_;
+}
+
+/*
+ * Return the number of frames sent by the output thread since it has been
+ * started.
+ */
+unsigned long DmxDevice::getSentFrameCount() const
+{
+	return sentFrameCount_;
+}
+
+/*
+ * Return the rate at which the output thread actually sent frames since it has
+ * been started (until it was stopped), in frames per second. Only frames whose
+ * write completed successfully are counted.
+ */
+float DmxDevice::getSentFrameRate() const
+{
+	uint64_t start = outputStartTime_, stop = outputStopTime_;
+	if ( start == 0 ) return 0;
+	
+	uint64_t elapsed = ( ( stop > 0 ) ? stop : DmxClock::now() ) - start;
+	return ( elapsed > 0 ) ? (float)( sentFrameCount_ * 1000000000.0 / elapsed ) : 0;
+}
+
+/*
+ * Return the number of frames not sent by the output thread because they were
+ * identical to the previous one.
+ */
+unsigned long DmxDevice::getSuppressedFrameCount() const
+{
+	return suppressedFrameCount_;
+}
+
+/*
+ * Enable or disable adaptive slot count. When enabled, the output thread only
+ * sends slots up to the highest non-zero slot or the given number of patched
+ * slots, whichever is higher, padded to DMX_SLOTS_MIN. When the frame shrinks,
+ * it is sent once more at the previous length so receivers see the cut off
+ * slots drop to zero. Unless an output rate
+ * has been set explicitly, the rate follows the shortened frames up to the
+ * DMX512 maximum for their length (see getDmxRefreshRateMax()).
+ * Devices may additionally adjust their own timing when this is enabled.
+ *
+ * Returns: false if the device could not be prepared, true otherwise.
+ */
+bool DmxDevice::setAdaptiveSlotCount( bool enabled, int patchedSlotCount )
+{
+	bool success = true;
+	
+	patchedSlotCount_ = ( patchedSlotCount > 0 ) ? patchedSlotCount : 0;
+	if ( enabled ) success = prepareAdaptiveSlotCount();
+	adaptiveSlotCount_ = enabled && success;
+	
+	return success;
+}
+
+bool DmxDevice::isAdaptiveSlotCount() const
+{
+	return adaptiveSlotCount_;
+}
+
+/*
+ * Call back whenever any slot from firstSlot up to and including lastSlot of
+ * received DMX changes (for devices supporting input, see readDmx()). Callbacks
+ * are made on the device's input thread with the complete frame.
+ *
+ * Returns: a subscription id or < 0 if the range is invalid.
+ */
+int DmxDevice::subscribeInput( int firstSlot, int lastSlot, DmxSubscriptionIndex::callback cb, void* userData )
+{
+	return inputSubscriptions_->addRange( firstSlot, lastSlot, cb, userData );
+}
+
+/*
+ * Call back whenever the given slot of received DMX crosses the threshold in
+ * either direction (see subscribeInput()).
+ */
+int DmxDevice::subscribeInputThreshold( int slot, unsigned char threshold,
+																			 DmxSubscriptionIndex::callback cb, void* userData )
+{
+	return inputSubscriptions_->addThreshold( slot, threshold, cb, userData );
+}
+
+bool DmxDevice::unsubscribeInput( int id )
+{
+	return inputSubscriptions_->remove( id );
+}
+
+/*
+ * Returns the highest refresh rate at which frames of the given length (start
+ * code included) can be transmitted using minimum DMX512 timing.
+ */
+float DmxDevice::getDmxRefreshRateMax( int length )
+{
+	return 1000000.0f / ( DMX_BREAK_TIME_MIN + DMX_MAB_TIME_MIN + length * DMX_SLOT_TIME );
+}
+
+
 /************************
  * forwarding functions *
  ************************/
@@ -77,14 +461,141 @@ bool DmxDevice::isOpen() const
  * Returns: the last libftdi error or an empty string if the libftdi error is outdated.
  */
 const char* DmxDevice::getLastError() const
-{ return ftdiDevice_->getLastError(); }
+{ return ( ftdiDevice_ != 0 ) ? ftdiDevice_->getLastError() : ""; }
 
 /*
  * Return some information on the USB device itself to which the FTDI-device is
  * connected.
  *
  * Returns: a usbInformation struct containing information or NULL if such
- * information could not be retrieved when the device was opened.
+ * information could not be retrieved when the device was opened (or if it is
+ * not a USB device).
  */
 const struct FtdiDevice::usbInformation* DmxDevice::getUsbInformation() const
-{ return ftdiDevice_->getUsbInformation(); }
+{ return ( ftdiDevice_ != 0 ) ? ftdiDevice_->getUsbInformation() : 0; }
+
+
+/*********************
+ * PRIVATE FUNCTIONS *
+ *********************/
+
+/*
+ * Returns the output rate set by the user or, if none, the device's default.
+ */
+float DmxDevice::getResolvedOutputRate() const
+{
+	float rate = outputRate_;
+	return ( rate > 0 ) ? rate : getDefaultRefreshRate();
+}
+
+void DmxDevice::runOutputThread()
+{
+	bool continuous = needsContinuousRefresh();
+	int adaptiveLength = 0, highWaterLength = 0;
+	lastSentFrame_.length = 0;
+	
+	outputScheduler_->start();
+	
+	while ( outputThreadRunning_ ) {
+		serviceLine( outputScheduler_->getNextDeadline() );
+		outputScheduler_->waitForNextFrame();
+		
+		//the previous frame is handed back by acquireReadFrame(), so its write must have finished
+		if ( ! finishOutput( 0 ) ) continue;
+		
+		bool isNew;
+		DmxTripleBuffer::frame* f = outputFrames_->acquireReadFrame( &isNew );
+		if ( f->length <= 0 && ! hasPendingOutput() ) continue;
+		
+		if ( adaptiveSlotCount_ && f->length > 0 ) {
+			//NOTE: trimming the frame is fine, the reader owns it and only zeroes are cut off.
+			int length = DmxKernels::findLastNonZero( f->data, f->length ) + 1;
+			if ( length < patchedSlotCount_ + 1 ) length = patchedSlotCount_ + 1;
+			if ( length > f->length ) length = f->length;
+			if ( length < DMX_SLOTS_MIN + 1 ) length = DMX_SLOTS_MIN + 1;
+			if ( length > f->length ) std::memset( f->data + f->length, 0, length - f->length );
+			
+			//only shrink once the slots being cut off have been sent as zeroes, else they would hold their last level
+			int sendLength = length;
+			if ( sendLength < highWaterLength ) sendLength = ( highWaterLength < f->length ) ? highWaterLength : f->length;
+			f->length = sendLength;
+			highWaterLength = length;
+			
+			if ( sendLength != adaptiveLength && outputRate_ == 0 ) {
+				outputScheduler_->setRate( getDmxRefreshRateMax( sendLength ) );
+			}
+			adaptiveLength = sendLength;
+		} else if ( adaptiveLength != 0 ) {
+			outputScheduler_->setRate( getResolvedOutputRate() );
+			adaptiveLength = 0;
+			highWaterLength = 0;
+		}
+		
+		uint64_t tStart = DmxClock::now();
+		int keepAlive = keepAliveInterval_;
+		
+		if ( ! continuous && keepAlive > 0 ) {
+			bool expired = tStart - lastSentFrame_.timestamp >= (uint64_t)keepAlive * 1000000;
+			if ( ! expired && ! hasPendingOutput() && f->length == lastSentFrame_.length &&
+					DmxKernels::equal( f->data, lastSentFrame_.data, f->length ) ) {
+				suppressedFrameCount_++;
+				continue;
+			}
+			
+			std::memcpy( lastSentFrame_.data, f->data, f->length );
+			lastSentFrame_.length = f->length;
+			lastSentFrame_.timestamp = tStart;
+		}
+		
+		pendingFrameTimestamp_ = isNew ? f->timestamp : 0;
+		if ( submitDmxFrame( f, onFrameWritten, this ) >= 0 ) {
+			//wait for the write while there is time, so its completion is handled as it happens
+			finishOutput( outputScheduler_->getNextDeadline() );
+		} else if ( adaptiveLength > highWaterLength ) {
+			highWaterLength = adaptiveLength; //the zeroes did not go out, send them again
+		}
+	}
+	
+	if ( ftdiDevice_ != 0 ) ftdiDevice_->flushWrites();
+}
+
+/*
+ * Handle completion of the frame written by the output thread for at most
+ * until the given deadline (see DmxClock); a deadline of 0 or in the past only
+ * handles a completion which has already occured.
+ *
+ * Returns: true if no write is in flight anymore, false otherwise.
+ */
+bool DmxDevice::finishOutput( uint64_t deadline )
+{
+	if ( ftdiDevice_ == 0 || ftdiDevice_->getWritesInFlight() == 0 ) return true;
+	
+	uint64_t now = DmxClock::now();
+	int timeout = ( deadline > now ) ? ( deadline - now ) / 1000000 : 0;
+	ftdiDevice_->processWrites( timeout );
+	
+	return ftdiDevice_->getWritesInFlight() == 0;
+}
+
+/*
+ * Completion callback of frames written by the output thread, see
+ * FtdiDevice::writeCallback.
+ */
+void DmxDevice::onFrameWritten( const FtdiDevice::writeCompletion* completion, void* userData )
+{
+	DmxDevice* device = static_cast<DmxDevice*>( userData );
+	if ( completion->result < 0 ) return;
+	
+	uint64_t sendTime = completion->completeTime - completion->submitTime;
+	device->sendTimeSum_ += sendTime;
+	if ( sendTime > device->sendTimeMax_ ) device->sendTimeMax_ = sendTime;
+	device->sentFrameCount_++;
+	
+	uint64_t published = device->pendingFrameTimestamp_;
+	if ( published != 0 ) {
+		uint64_t latency = completion->completeTime - published;
+		device->frameLatencySum_ += latency;
+		if ( latency > device->frameLatencyMax_ ) device->frameLatencyMax_ = latency;
+		device->newFrameCount_++;
+	}
+}
@@ -1,16 +1,35 @@
 #ifndef DMX_DEVICE_H
 #define DMX_DEVICE_H
 
+#include <atomic>
+#include <thread>
+#include "DmxFrameBuffer.h"
+#include "DmxFrameScheduler.h"
+#include "DmxSubscriptionIndex.h"
 #include "FtdiDevice.h"
 
+class DmxTripleBuffer;
+
 class DmxDevice {
 public:
 	enum DMX_DEVICE_TYPE {
 		DMX_DEVICE_RAW,
-		DMX_DEVICE_ENTTECPRO
+		DMX_DEVICE_ENTTECPRO,
+		DMX_DEVICE_ARTNET,
+		DMX_DEVICE_SACN
+	};
+	
+	struct latencyStats {
+		unsigned long frameCount;
+		float meanSendTime; /* in microseconds */
+		float maxSendTime; /* in microseconds */
+		float meanFrameLatency; /* in microseconds */
+		float maxFrameLatency; /* in microseconds */
 	};
 	
 	static const int RV_DEVICE_NOT_OPEN;
+	static const int RV_NOT_SUPPORTED;
+	static const int DMX_SLOTS_MIN;
 	
 	
 	DmxDevice();
@@ -18,20 +37,85 @@ public:
 	
 	virtual bool open( const char* description = 0, const char* serial = 0, int index = 0 );
 	virtual bool close();
-	bool isOpen() const;
+	virtual bool isOpen() const;
 	
-	//virtual int readDmx( const unsigned char* data, int length ) const = 0;
+	virtual int readDmx( const unsigned char* data, int length ) const;
 	virtual int writeDmx( const unsigned char* data, int length ) const = 0;
+	virtual int writeDmxFrame( DmxFrameBuffer* frame ) const;
 	virtual DMX_DEVICE_TYPE getType() const = 0;
+	virtual float getDefaultRefreshRate() const = 0;
+	virtual bool needsContinuousRefresh() const;
+	virtual bool autoTune();
+	
+	bool startOutputThread();
+	void stopOutputThread();
+	bool isOutputThreadRunning() const;
+	int publishDmx( const unsigned char* data, int length );
+	void setOutputRate( float rate );
+	float getOutputRate() const;
+	void getOutputJitter( DmxFrameScheduler::jitterStats* stats ) const;
+	void getOutputLatency( latencyStats* stats ) const;
+	void setKeepAliveInterval( int interval );
+	int getKeepAliveInterval() const;
+	unsigned long getSentFrameCount() const;
+	float getSentFrameRate() const;
+	unsigned long getSuppressedFrameCount() const;
+	bool setAdaptiveSlotCount( bool enabled, int patchedSlotCount = 0 );
+	bool isAdaptiveSlotCount() const;
+	
+	int subscribeInput( int firstSlot, int lastSlot, DmxSubscriptionIndex::callback cb, void* userData = 0 );
+	int subscribeInputThreshold( int slot, unsigned char threshold,
+															DmxSubscriptionIndex::callback cb, void* userData = 0 );
+	bool unsubscribeInput( int id );
+	
+	static float getDmxRefreshRateMax( int length );
 	
 	//forwarding functions for FtdiDevice
-	const char* getLastError() const;
+	virtual const char* getLastError() const;
 	const struct FtdiDevice::usbInformation* getUsbInformation() const;
 	
 protected:
+	virtual bool prepareAdaptiveSlotCount();
+	int dispatchInput( const unsigned char* data, int length, const uint64_t* changed ) const;
+	virtual void serviceLine( uint64_t deadline );
+	virtual bool hasPendingOutput() const;
+	virtual int submitDmxFrame( DmxFrameBuffer* frame, FtdiDevice::writeCallback callback, void* userData ) const;
+	
 	FtdiDevice* ftdiDevice_;
 	
 private:
+	static const int KEEP_ALIVE_INTERVAL_DEFAULT;
+	static const float DMX_BREAK_TIME_MIN;
+	static const float DMX_MAB_TIME_MIN;
+	static const float DMX_SLOT_TIME;
+	
+	float getResolvedOutputRate() const;
+	void runOutputThread();
+	bool finishOutput( uint64_t deadline );
+	static void onFrameWritten( const FtdiDevice::writeCompletion* completion, void* userData );
+	
+	DmxTripleBuffer* outputFrames_;
+	DmxFrameScheduler* outputScheduler_;
+	std::atomic<float> outputRate_;
+	std::atomic<int> keepAliveInterval_;
+	std::atomic<bool> adaptiveSlotCount_;
+	std::atomic<int> patchedSlotCount_;
+	DmxFrameBuffer lastSentFrame_;
+	
+	std::atomic<uint64_t> sentFrameCount_;
+	std::atomic<uint64_t> suppressedFrameCount_;
+	std::atomic<uint64_t> sendTimeSum_;
+	std::atomic<uint64_t> sendTimeMax_;
+	std::atomic<uint64_t> newFrameCount_;
+	std::atomic<uint64_t> frameLatencySum_;
+	std::atomic<uint64_t> frameLatencyMax_;
+	std::atomic<uint64_t> outputStartTime_;
+	std::atomic<uint64_t> outputStopTime_; /* 0 while the output thread runs */
+	uint64_t pendingFrameTimestamp_; /* publish time of the frame being written, or 0 if not new */
+	std::thread* outputThread_;
+	std::atomic<bool> outputThreadRunning_;
+	DmxSubscriptionIndex* inputSubscriptions_;
+	
 	DmxDevice( const DmxDevice& other );
 	DmxDevice& operator=( const DmxDevice& other );
 };
@@ -0,0 +1,189 @@
+/*
+ * Drives a number of DMX devices from one process, each one representing a
+ * universe. Every device sends from its own output thread, so all universes
+ * go out in parallel and adding universes does not add latency to the others.
+ * The application just hands over frames per universe with writeUniverse(),
+ * which never blocks.
+ */
+#include <cstring>
+#include "DmxUsbProDevice.h"
+#include "ofxGenericDmx.h"
+#include "DmxEngine.h"
+
+const int DmxEngine::RV_UNIVERSE_UNKNOWN = -17000;
+
+
+DmxEngine::DmxEngine()
+: running_( false )
+{ /* empty */ }
+
+DmxEngine::~DmxEngine()
+{
+	closeAll();
+}
+
+
+/*
+ * Open all connected devices, assigning them consecutive universe numbers
+ * starting at firstUniverse in the order they are listed by getDeviceList().
+ * If usbProOnly is true, devices not identifying themselves as a DMX USB PRO
+ * are skipped, otherwise they are opened as raw devices.
+ *
+ * Returns: the number of devices opened.
+ */
+int DmxEngine::openAll( bool usbProOnly, int firstUniverse )
+{
+	std::vector<int> listIndices;
+	std::vector<DmxDevice::DMX_DEVICE_TYPE> types;
+	const FtdiDevice::vec_deviceInfo* devs = ofxGenericDmx::getDeviceList();
+	
+	if ( devs == 0 ) return 0;
+	
+	//NOTE: opening a device refreshes the device list, so collect everything first.
+	FtdiDevice::vec_deviceInfo::const_iterator it;
+	for ( it = devs->begin(); it != devs->end(); ++it ) {
+		const FtdiDevice::deviceInfo& di = *it;
+		
+		if ( di.usbInfo != 0 && std::strncmp( di.usbInfo->description,
+																				 DmxUsbProDevice::USB_DESCRIPTION,
+																				 std::strlen( DmxUsbProDevice::USB_DESCRIPTION ) ) == 0 ) {
+			types.push_back( DmxDevice::DMX_DEVICE_ENTTECPRO );
+		} else if ( ! usbProOnly ) {
+			types.push_back( DmxDevice::DMX_DEVICE_RAW );
+		} else {
+			continue;
+		}
+		listIndices.push_back( it - devs->begin() );
+	}
+	
+	int opened = 0, universe = firstUniverse;
+	for ( unsigned int i = 0; i < listIndices.size(); ++i ) {
+		while ( universes_.find( universe ) != universes_.end() ) universe++;
+		
+		DmxDevice* d = ofxGenericDmx::createDevice( types[i] );
+		if ( d->open( 0, 0, listIndices[i] ) ) {
+			addDevice( universe++, d );
+			opened++;
+		} else {
+			delete d;
+		}
+	}
+	
+	return opened;
+}
+
+/*
+ * Add an (opened) device as the given universe. The engine takes ownership of
+ * the device. If the engine is running, output is started on the device as well.
+ *
+ * Returns: true if the device has been added, false if the universe is already
+ * in use.
+ */
+bool DmxEngine::addDevice( int universe, DmxDevice* device )
+{
+	if ( device == 0 || universes_.find( universe ) != universes_.end() ) return false;
+	
+	universes_[universe] = device;
+	if ( running_ ) device->startOutputThread();
+	
+	return true;
+}
+
+/*
+ * Stop output, then close and delete all devices.
+ */
+void DmxEngine::closeAll()
+{
+	stop();
+	
+	map_universe::iterator it;
+	for ( it = universes_.begin(); it != universes_.end(); ++it ) {
+		it->second->close();
+		delete it->second;
+	}
+	universes_.clear();
+}
+
+/*
+ * Start the output threads of all devices. If rate is larger than 0, all
+ * devices will send at that rate, otherwise each one uses its own default.
+ *
+ * Returns: true if output could be started on all devices.
+ */
+bool DmxEngine::start( float rate )
+{
+	bool success = true;
+	
+	map_universe::iterator it;
+	for ( it = universes_.begin(); it != universes_.end(); ++it ) {
+		it->second->setOutputRate( rate );
+		success = it->second->startOutputThread() ? success : false;
+	}
+	running_ = true;
+	
+	return success;
+}
+
+void DmxEngine::stop()
+{
+	map_universe::iterator it;
+	for ( it = universes_.begin(); it != universes_.end(); ++it ) it->second->stopOutputThread();
+	running_ = false;
+}
+
+bool DmxEngine::isRunning() const
+{
+	return running_;
+}
+
+/*
+ * Hand over a frame for the given universe. The data is copied and sent by the
+ * device's output thread; this call does not block.
+ *
+ * Returns: 0 on success, RV_UNIVERSE_UNKNOWN if no device has been assigned to
+ * the universe or another value < 0 returned by DmxDevice::publishDmx().
+ */
+int DmxEngine::writeUniverse( int universe, const unsigned char* data, int length )
+{
+	map_universe::iterator it = universes_.find( universe );
+	if ( it == universes_.end() ) return RV_UNIVERSE_UNKNOWN;
+	
+	return it->second->publishDmx( data, length );
+}
+
+/*
+ * Returns the device assigned to the given universe or NULL if there is none.
+ */
+DmxDevice* DmxEngine::getDevice( int universe ) const
+{
+	map_universe::const_iterator it = universes_.find( universe );
+	return ( it != universes_.end() ) ? it->second : 0;
+}
+
+/*
+ * Returns the numbers of all universes in use, in ascending order.
+ */
+std::vector<int> DmxEngine::getUniverses() const
+{
+	std::vector<int> result;
+	
+	map_universe::const_iterator it;
+	for ( it = universes_.begin(); it != universes_.end(); ++it ) result.push_back( it->first );
+	
+	return result;
+}
+
+/*
+ * Retrieve send latency statistics for the given universe (see
+ * DmxDevice::getOutputLatency()).
+ *
+ * Returns: true if the universe exists, false otherwise.
+ */
+bool DmxEngine::getLatency( int universe, DmxDevice::latencyStats* stats ) const
+{
+	const DmxDevice* d = getDevice( universe );
+	if ( d == 0 ) return false;
+	
+	d->getOutputLatency( stats );
+	return true;
+}
@@ -0,0 +1,42 @@
+/*
+ */
+#ifndef DMX_ENGINE_H
+#define DMX_ENGINE_H
+
+#include <map>
+#include <vector>
+#include "DmxDevice.h"
+
+class DmxEngine {
+public:
+	typedef std::map<int, DmxDevice*> map_universe;
+	
+	static const int RV_UNIVERSE_UNKNOWN;
+	
+	
+	DmxEngine();
+	~DmxEngine();
+	
+	int openAll( bool usbProOnly = true, int firstUniverse = 0 );
+	bool addDevice( int universe, DmxDevice* device );
+	void closeAll();
+	
+	bool start( float rate = 0 );
+	void stop();
+	bool isRunning() const;
+	
+	int writeUniverse( int universe, const unsigned char* data, int length );
+	
+	DmxDevice* getDevice( int universe ) const;
+	std::vector<int> getUniverses() const;
+	bool getLatency( int universe, DmxDevice::latencyStats* stats ) const;
+	
+private:
+	DmxEngine( const DmxEngine& other );
+	DmxEngine& operator=( const DmxEngine& other );
+	
+	map_universe universes_;
+	bool running_;
+};
+
+#endif /* ! DMX_ENGINE_H */
@@ -0,0 +1,27 @@
+/*
+ * A buffer holding one frame of DMX data (start code included) with some room
+ * reserved before and after it. This allows devices to wrap their protocol
+ * header and footer around the data in place, so a frame can be handed to the
+ * USB layer without being copied or allocating a packet buffer.
+ */
+#ifndef DMX_FRAME_BUFFER_H
+#define DMX_FRAME_BUFFER_H
+
+#include <stdint.h>
+
+struct DmxFrameBuffer {
+	static const int HEADROOM = 4;
+	static const int TAILROOM = 1;
+	static const int CAPACITY = 600;
+	
+	unsigned char headroom[HEADROOM];
+	unsigned char data[CAPACITY + TAILROOM];
+	int length;
+	uint64_t timestamp; /* see DmxClock */
+	
+	DmxFrameBuffer()
+	: length( 0 ), timestamp( 0 )
+	{}
+};
+
+#endif /* ! DMX_FRAME_BUFFER_H */
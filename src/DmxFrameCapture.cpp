@@ -0,0 +1,133 @@
+/*
+ * Streams the frames written to a DmxFrameRing to a file from a thread of its
+ * own. Memory use is bounded by the ring: if writing to disk falls behind by
+ * more than the ring's capacity, the overwritten frames are skipped and counted
+ * as lost instead of being queued.
+ *
+ * The file starts with the 8 bytes "DMXCAP01", followed by one record per frame:
+ * an 8 byte timestamp in nanoseconds (see DmxClock), a 2 byte length and the
+ * frame data itself (start code included). All numbers are little-endian.
+ */
+#include "DmxClock.h"
+#include "DmxFrameBuffer.h"
+#include "DmxFrameRing.h"
+#include "DmxFrameCapture.h"
+
+//private constants
+const char DmxFrameCapture::FILE_MAGIC[8] = { 'D', 'M', 'X', 'C', 'A', 'P', '0', '1' };
+const int DmxFrameCapture::POLL_INTERVAL = 10; /* in milliseconds */
+
+
+DmxFrameCapture::DmxFrameCapture()
+: ring_( 0 ), firstSequence_( 0 ), file_( 0 ), thread_( 0 ), running_( false ),
+  capturedFrameCount_( 0 ), lostFrameCount_( 0 )
+{ /* empty */ }
+
+DmxFrameCapture::~DmxFrameCapture()
+{
+	stop();
+}
+
+
+/*
+ * Start capturing frames written to the given ring from now on to the file at
+ * the given path, which is overwritten if it exists.
+ *
+ * Returns: true if capturing was started or was already running, false if the
+ * file could not be opened.
+ */
+bool DmxFrameCapture::start( const DmxFrameRing* ring, const char* path )
+{
+	if ( thread_ != 0 ) return true;
+	
+	file_ = fopen( path, "wb" );
+	if ( file_ == 0 ) return false;
+	fwrite( FILE_MAGIC, 1, sizeof( FILE_MAGIC ), file_ );
+	
+	//taken here rather than by the thread, which may only start after the next frames
+	ring_ = ring;
+	firstSequence_ = ring->getWriteCount();
+	capturedFrameCount_ = 0;
+	lostFrameCount_ = 0;
+	running_ = true;
+	thread_ = new std::thread( &DmxFrameCapture::run, this );
+	
+	return true;
+}
+
+/*
+ * Stop capturing after writing out the frames still in the ring and close the
+ * file.
+ */
+void DmxFrameCapture::stop()
+{
+	if ( thread_ == 0 ) return;
+	
+	running_ = false;
+	thread_->join();
+	delete thread_; thread_ = 0;
+	
+	fclose( file_ ); file_ = 0;
+	ring_ = 0;
+}
+
+bool DmxFrameCapture::isRunning() const
+{
+	return thread_ != 0;
+}
+
+unsigned long DmxFrameCapture::getCapturedFrameCount() const
+{
+	return (unsigned long)capturedFrameCount_.load();
+}
+
+/*
+ * Returns the number of frames which were overwritten in the ring before they
+ * could be written to the file.
+ */
+unsigned long DmxFrameCapture::getLostFrameCount() const
+{
+	return (unsigned long)lostFrameCount_.load();
+}
+
+
+/*********************
+ * PRIVATE FUNCTIONS *
+ *********************/
+
+void DmxFrameCapture::run()
+{
+	DmxFrameBuffer frame;
+	unsigned char record[10];
+	uint64_t next = firstSequence_;
+	bool stopping = false;
+	
+	while ( ! stopping ) {
+		stopping = ! running_;
+		uint64_t count = ring_->getWriteCount();
+		uint64_t capacity = ring_->getCapacity();
+		
+		if ( count - next > capacity ) {
+			lostFrameCount_ += count - next - capacity;
+			next = count - capacity;
+		}
+		
+		for ( ; next < count; next++ ) {
+			if ( ! ring_->read( next, &frame ) ) {
+				lostFrameCount_++;
+				continue;
+			}
+			
+			for ( int i = 0; i < 8; i++ ) record[i] = ( frame.timestamp >> ( 8 * i ) ) & 0xFF;
+			record[8] = frame.length & 0xFF;
+			record[9] = ( frame.length >> 8 ) & 0xFF;
+			fwrite( record, 1, sizeof( record ), file_ );
+			fwrite( frame.data, 1, frame.length, file_ );
+			capturedFrameCount_++;
+		}
+		
+		if ( ! stopping ) DmxClock::sleepUntil( DmxClock::now() + (uint64_t)POLL_INTERVAL * 1000000 );
+	}
+	
+	fflush( file_ );
+}
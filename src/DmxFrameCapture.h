@@ -0,0 +1,43 @@
+/*
+ */
+#ifndef DMX_FRAME_CAPTURE_H
+#define DMX_FRAME_CAPTURE_H
+
+#include <atomic>
+#include <cstdio>
+#include <stdint.h>
+#include <thread>
+
+class DmxFrameRing;
+
+class DmxFrameCapture {
+public:
+	DmxFrameCapture();
+	~DmxFrameCapture();
+	
+	bool start( const DmxFrameRing* ring, const char* path );
+	void stop();
+	bool isRunning() const;
+	
+	unsigned long getCapturedFrameCount() const;
+	unsigned long getLostFrameCount() const;
+	
+private:
+	static const char FILE_MAGIC[8];
+	static const int POLL_INTERVAL;
+	
+	DmxFrameCapture( const DmxFrameCapture& other );
+	DmxFrameCapture& operator=( const DmxFrameCapture& other );
+	
+	void run();
+	
+	const DmxFrameRing* ring_;
+	uint64_t firstSequence_;
+	FILE* file_;
+	std::thread* thread_;
+	std::atomic<bool> running_;
+	std::atomic<uint64_t> capturedFrameCount_;
+	std::atomic<uint64_t> lostFrameCount_;
+};
+
+#endif /* ! DMX_FRAME_CAPTURE_H */
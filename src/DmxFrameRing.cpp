@@ -0,0 +1,119 @@
+/*
+ * Ring of timestamped DMX frames written by one thread (e.g. the input thread of
+ * a DmxUsbProDevice) and read by any number of others without locking. Every
+ * frame gets a sequence number; the ring keeps the last getCapacity() frames so
+ * readers can either take the latest frame or walk through the history.
+ * Each slot is protected by a version counter (a 'seqlock'): the writer makes
+ * it odd while filling the slot, readers copy the slot and retry or fail if the
+ * version changed meanwhile. The writer therefore never waits for readers, and
+ * readers which fall too far behind simply find their frames overwritten.
+ */
+#include <cstring>
+#include "DmxFrameRing.h"
+
+const int DmxFrameRing::CAPACITY_DEFAULT;
+
+
+/*
+ * NOTE: capacity is rounded up to a power of two.
+ */
+DmxFrameRing::DmxFrameRing( int capacity )
+: writeCount_( 0 )
+{
+	uint64_t size = 1;
+	while ( size < (uint64_t)capacity ) size <<= 1;
+	
+	slots_ = new slot[size];
+	for ( uint64_t i = 0; i < size; i++ ) slots_[i].version.store( 0, std::memory_order_relaxed );
+	mask_ = size - 1;
+}
+
+DmxFrameRing::~DmxFrameRing()
+{
+	delete [] slots_;
+}
+
+
+/*
+ * Return the frame to fill in for the next sequence number. It will not be
+ * visible to readers until commitWrite() is called.
+ */
+DmxFrameBuffer* DmxFrameRing::beginWrite()
+{
+	uint64_t sequence = writeCount_.load( std::memory_order_relaxed );
+	slot& s = slots_[sequence & mask_];
+	
+	s.version.store( 2 * sequence + 1, std::memory_order_relaxed );
+	std::atomic_thread_fence( std::memory_order_release );
+	return &s.frame;
+}
+
+/*
+ * Publish the frame returned by beginWrite().
+ */
+void DmxFrameRing::commitWrite()
+{
+	uint64_t sequence = writeCount_.load( std::memory_order_relaxed );
+	
+	slots_[sequence & mask_].version.store( 2 * sequence + 2, std::memory_order_release );
+	writeCount_.store( sequence + 1, std::memory_order_release );
+}
+
+/*
+ * Copy the most recently written frame and optionally return its sequence
+ * number.
+ *
+ * Returns: true if successful or false if nothing has been written yet.
+ */
+bool DmxFrameRing::readLatest( DmxFrameBuffer* frame, uint64_t* sequence ) const
+{
+	uint64_t count;
+	
+	//only fails if the writer laps us, so simply retry with the new latest frame
+	while ( ( count = writeCount_.load( std::memory_order_acquire ) ) > 0 ) {
+		if ( read( count - 1, frame ) ) {
+			if ( sequence != 0 ) *sequence = count - 1;
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+/*
+ * Copy the frame with the given sequence number.
+ *
+ * Returns: true if successful, false if the frame has not been written yet or
+ * has already been overwritten.
+ */
+bool DmxFrameRing::read( uint64_t sequence, DmxFrameBuffer* frame ) const
+{
+	const slot& s = slots_[sequence & mask_];
+	uint64_t version = s.version.load( std::memory_order_acquire );
+	
+	if ( version != 2 * sequence + 2 ) return false;
+	
+	int length = s.frame.length;
+	if ( length < 0 ) length = 0;
+	if ( length > DmxFrameBuffer::CAPACITY ) length = DmxFrameBuffer::CAPACITY;
+	std::memcpy( frame->data, s.frame.data, length );
+	frame->length = length;
+	frame->timestamp = s.frame.timestamp;
+	
+	std::atomic_thread_fence( std::memory_order_acquire );
+	return s.version.load( std::memory_order_relaxed ) == version;
+}
+
+/*
+ * Return the number of frames written so far, which is also the sequence number
+ * the next frame will get.
+ */
+uint64_t DmxFrameRing::getWriteCount() const
+{
+	return writeCount_.load( std::memory_order_acquire );
+}
+
+int DmxFrameRing::getCapacity() const
+{
+	return (int)( mask_ + 1 );
+}
@@ -0,0 +1,40 @@
+/*
+ */
+#ifndef DMX_FRAME_RING_H
+#define DMX_FRAME_RING_H
+
+#include <atomic>
+#include <stdint.h>
+#include "DmxFrameBuffer.h"
+
+class DmxFrameRing {
+public:
+	static const int CAPACITY_DEFAULT = 64;
+	
+	
+	DmxFrameRing( int capacity = CAPACITY_DEFAULT );
+	~DmxFrameRing();
+	
+	DmxFrameBuffer* beginWrite();
+	void commitWrite();
+	
+	bool readLatest( DmxFrameBuffer* frame, uint64_t* sequence = 0 ) const;
+	bool read( uint64_t sequence, DmxFrameBuffer* frame ) const;
+	uint64_t getWriteCount() const;
+	int getCapacity() const;
+	
+private:
+	struct slot {
+		std::atomic<uint64_t> version;
+		DmxFrameBuffer frame;
+	};
+	
+	DmxFrameRing( const DmxFrameRing& other );
+	DmxFrameRing& operator=( const DmxFrameRing& other );
+	
+	slot* slots_;
+	uint64_t mask_;
+	std::atomic<uint64_t> writeCount_;
+};
+
+#endif /* ! DMX_FRAME_RING_H */
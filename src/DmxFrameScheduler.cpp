@@ -0,0 +1,122 @@
+/*
+ * Paces frames at a fixed rate. Deadlines are computed as absolute times on
+ * the monotonic clock from the moment start() was called, so neither the time
+ * spent sending a frame nor oversleeping causes the rate to drift.
+ * The time between a deadline and the actual wake-up is recorded as jitter.
+ *
+ * waitForNextFrame() must only be called from a single thread; the rate and
+ * the statistics may be accessed from any thread.
+ */
+#include "DmxClock.h"
+#include "DmxFrameScheduler.h"
+
+
+DmxFrameScheduler::DmxFrameScheduler( float rate )
+: rate_( rate ), period_( 0 ), startTime_( 0 ), frameNumber_( 0 ), frameCount_( 0 ),
+  lateFrameCount_( 0 ), jitterSum_( 0 ), jitterMax_( 0 )
+{ /* empty */ }
+
+
+/*
+ * Set the rate in frames per second. A rate of 0 disables pacing, in which
+ * case waitForNextFrame() returns immediately. The new rate takes effect at the
+ * next frame.
+ */
+void DmxFrameScheduler::setRate( float rate )
+{
+	rate_ = ( rate > 0 ) ? rate : 0;
+}
+
+float DmxFrameScheduler::getRate() const
+{
+	return rate_;
+}
+
+/*
+ * (Re)start the schedule; the first deadline will be one period from now.
+ */
+void DmxFrameScheduler::start()
+{
+	float r = rate_;
+	period_ = ( r > 0 ) ? (uint64_t)( 1000000000.0 / r ) : 0;
+	startTime_ = DmxClock::now();
+	frameNumber_ = 0;
+}
+
+/*
+ * Sleep until the next deadline. The sleep is an absolute one on the monotonic
+ * clock (see DmxClock::sleepUntil()), which wakes up well within the DMX jitter
+ * budget, so the thread never spins. If the deadline has already been missed by a
+ * whole period or more, the missed frames are skipped instead of being sent in
+ * a burst and the frame is counted as late.
+ */
+void DmxFrameScheduler::waitForNextFrame()
+{
+	float r = rate_;
+	uint64_t period = ( r > 0 ) ? (uint64_t)( 1000000000.0 / r ) : 0;
+	
+	if ( period == 0 ) {
+		period_ = 0;
+		return;
+	}
+	
+	if ( period != period_ ) {
+		//rate changed: continue from the previous deadline with the new period
+		if ( period_ == 0 ) startTime_ = DmxClock::now();
+		else startTime_ += frameNumber_ * period_;
+		frameNumber_ = 0;
+		period_ = period;
+	}
+	
+	uint64_t now = DmxClock::now();
+	uint64_t deadline = startTime_ + ( frameNumber_ + 1 ) * period_;
+	
+	if ( now >= deadline + period_ ) {
+		frameNumber_ = ( now - startTime_ ) / period_;
+		deadline = startTime_ + ( frameNumber_ + 1 ) * period_;
+		lateFrameCount_++;
+	}
+	frameNumber_++;
+	
+	while ( now < deadline ) {
+		DmxClock::sleepUntil( deadline );
+		now = DmxClock::now();
+	}
+	
+	uint64_t jitter = now - deadline;
+	jitterSum_ += jitter;
+	if ( jitter > jitterMax_ ) jitterMax_ = jitter;
+	frameCount_++;
+}
+
+/*
+ * Return the deadline waitForNextFrame() will wait for if called now (and the
+ * rate does not change), or 0 if pacing is disabled. Like waitForNextFrame(),
+ * this must only be called from the scheduling thread.
+ */
+uint64_t DmxFrameScheduler::getNextDeadline() const
+{
+	if ( period_ == 0 ) return 0;
+	return startTime_ + ( frameNumber_ + 1 ) * period_;
+}
+
+/*
+ * Fill in the given struct with the jitter measured since the last reset.
+ */
+void DmxFrameScheduler::getJitterStats( jitterStats* stats ) const
+{
+	uint64_t count = frameCount_;
+	
+	stats->frameCount = count;
+	stats->lateFrameCount = lateFrameCount_;
+	stats->meanJitter = ( count > 0 ) ? ( jitterSum_ / (double)count ) / 1000.0 : 0;
+	stats->maxJitter = jitterMax_ / 1000.0;
+}
+
+void DmxFrameScheduler::resetJitterStats()
+{
+	frameCount_ = 0;
+	lateFrameCount_ = 0;
+	jitterSum_ = 0;
+	jitterMax_ = 0;
+}
@@ -0,0 +1,46 @@
+/*
+ */
+#ifndef DMX_FRAME_SCHEDULER_H
+#define DMX_FRAME_SCHEDULER_H
+
+#include <atomic>
+#include <stdint.h>
+
+class DmxFrameScheduler {
+public:
+	struct jitterStats {
+		unsigned long frameCount;
+		unsigned long lateFrameCount;
+		float meanJitter; /* in microseconds */
+		float maxJitter; /* in microseconds */
+	};
+	
+	
+	DmxFrameScheduler( float rate = 0 );
+	
+	void setRate( float rate );
+	float getRate() const;
+	
+	void start();
+	void waitForNextFrame();
+	uint64_t getNextDeadline() const;
+	
+	void getJitterStats( jitterStats* stats ) const;
+	void resetJitterStats();
+	
+private:
+	DmxFrameScheduler( const DmxFrameScheduler& other );
+	DmxFrameScheduler& operator=( const DmxFrameScheduler& other );
+	
+	std::atomic<float> rate_;
+	uint64_t period_;
+	uint64_t startTime_;
+	uint64_t frameNumber_;
+	
+	std::atomic<uint64_t> frameCount_;
+	std::atomic<uint64_t> lateFrameCount_;
+	std::atomic<uint64_t> jitterSum_;
+	std::atomic<uint64_t> jitterMax_;
+};
+
+#endif /* ! DMX_FRAME_SCHEDULER_H */
@@ -0,0 +1,246 @@
+/*
+ * Vectorized helper functions operating on DMX slot data. Each function has an
+ * SSE2 implementation, used when compiling for a target supporting it, and a
+ * portable fallback.
+ * The merge kernels also have an AVX2 implementation on x86 with GCC or Clang.
+ * Since builds rarely target AVX2, it is compiled for that target separately
+ * and selected at runtime if the CPU supports it.
+ */
+#include <cstring>
+#include <stdint.h>
+#if defined( __SSE2__ )
+# include <emmintrin.h>
+#endif
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+# include <immintrin.h>
+# define DMX_KERNELS_AVX2
+#endif
+#include "DmxKernels.h"
+
+#if defined( DMX_KERNELS_AVX2 )
+static bool hasAvx2()
+{
+	static const bool supported = __builtin_cpu_supports( "avx2" );
+	return supported;
+}
+
+__attribute__(( target( "avx2" ) ))
+static int mergeHtpLtpAvx2( unsigned char* out, const unsigned char* const* sources, int sourceCount,
+														const unsigned char* ltp, const unsigned char* ltpMask, int length )
+{
+	int i = 0;
+	
+	for ( ; i + 32 <= length; i += 32 ) {
+		__m256i htp = _mm256_setzero_si256();
+		for ( int s = 0; s < sourceCount; s++ ) {
+			htp = _mm256_max_epu8( htp, _mm256_loadu_si256( (const __m256i*)( sources[s] + i ) ) );
+		}
+		__m256i mask = _mm256_loadu_si256( (const __m256i*)( ltpMask + i ) );
+		__m256i v = _mm256_blendv_epi8( htp, _mm256_loadu_si256( (const __m256i*)( ltp + i ) ), mask );
+		_mm256_storeu_si256( (__m256i*)( out + i ), v );
+	}
+	
+	return i;
+}
+
+__attribute__(( target( "avx2" ) ))
+static int updateLtpAvx2( unsigned char* ltp, unsigned char* current, const unsigned char* data, int length )
+{
+	int i = 0;
+	
+	for ( ; i + 32 <= length; i += 32 ) {
+		__m256i c = _mm256_loadu_si256( (const __m256i*)( current + i ) );
+		__m256i d = _mm256_loadu_si256( (const __m256i*)( data + i ) );
+		__m256i l = _mm256_loadu_si256( (const __m256i*)( ltp + i ) );
+		__m256i same = _mm256_cmpeq_epi8( c, d );
+		_mm256_storeu_si256( (__m256i*)( ltp + i ), _mm256_blendv_epi8( d, l, same ) );
+		_mm256_storeu_si256( (__m256i*)( current + i ), d );
+	}
+	
+	return i;
+}
+#endif
+
+/*
+ * Compare the first length bytes of two buffers.
+ *
+ * Returns: true if they are equal, false otherwise.
+ */
+bool DmxKernels::equal( const unsigned char* a, const unsigned char* b, int length )
+{
+#if defined( __SSE2__ )
+	int i = 0;
+	
+	for ( ; i + 64 <= length; i += 64 ) {
+		__m128i e0 = _mm_cmpeq_epi8( _mm_loadu_si128( (const __m128i*)( a + i ) ),
+																 _mm_loadu_si128( (const __m128i*)( b + i ) ) );
+		__m128i e1 = _mm_cmpeq_epi8( _mm_loadu_si128( (const __m128i*)( a + i + 16 ) ),
+																 _mm_loadu_si128( (const __m128i*)( b + i + 16 ) ) );
+		__m128i e2 = _mm_cmpeq_epi8( _mm_loadu_si128( (const __m128i*)( a + i + 32 ) ),
+																 _mm_loadu_si128( (const __m128i*)( b + i + 32 ) ) );
+		__m128i e3 = _mm_cmpeq_epi8( _mm_loadu_si128( (const __m128i*)( a + i + 48 ) ),
+																 _mm_loadu_si128( (const __m128i*)( b + i + 48 ) ) );
+		__m128i e = _mm_and_si128( _mm_and_si128( e0, e1 ), _mm_and_si128( e2, e3 ) );
+		if ( _mm_movemask_epi8( e ) != 0xFFFF ) return false;
+	}
+	
+	for ( ; i + 16 <= length; i += 16 ) {
+		__m128i e = _mm_cmpeq_epi8( _mm_loadu_si128( (const __m128i*)( a + i ) ),
+																_mm_loadu_si128( (const __m128i*)( b + i ) ) );
+		if ( _mm_movemask_epi8( e ) != 0xFFFF ) return false;
+	}
+	
+	return std::memcmp( a + i, b + i, length - i ) == 0;
+#else
+	return std::memcmp( a, b, length ) == 0;
+#endif
+}
+
+/*
+ * Find the last non-zero byte in the first length bytes of the given buffer.
+ *
+ * Returns: the index of that byte or -1 if all bytes are zero.
+ */
+int DmxKernels::findLastNonZero( const unsigned char* data, int length )
+{
+	int i = length;
+	
+#if defined( __SSE2__ )
+	const __m128i zero = _mm_setzero_si128();
+	
+	for ( ; i >= 16; i -= 16 ) {
+		__m128i z = _mm_cmpeq_epi8( _mm_loadu_si128( (const __m128i*)( data + i - 16 ) ), zero );
+		int nonZeroMask = ~_mm_movemask_epi8( z ) & 0xFFFF;
+		if ( nonZeroMask != 0 ) {
+			int bit = 15;
+			while ( ( nonZeroMask & ( 1 << bit ) ) == 0 ) bit--;
+			return i - 16 + bit;
+		}
+	}
+#endif
+	
+	while ( --i >= 0 ) {
+		if ( data[i] != 0 ) return i;
+	}
+	
+	return -1;
+}
+
+/*
+ * Render the given bytes as an asynchronous serial waveform with one sample per
+ * bit: a start bit, 8 data bits (least significant first) and 2 stop bits. Each
+ * sample is either pinMask (line high) or 0 (line low), so the result can be
+ * written to an FTDI device in bit-bang mode. The samples buffer must hold
+ * length * 11 bytes.
+ * The 8 data bits of each byte are expanded into 8 samples at once using 64-bit
+ * arithmetic, instead of one by one.
+ *
+ * Returns: the number of samples written.
+ */
+int DmxKernels::renderSerialBits( const unsigned char* data, int length,
+																 unsigned char* samples, unsigned char pinMask )
+{
+	static const uint64_t SPREAD = 0x0101010101010101ULL;
+	static const uint64_t SELECT = 0x8040201008040201ULL;
+	static const uint64_t CARRY = 0x7F7F7F7F7F7F7F7FULL;
+	unsigned char* out = samples;
+	
+	for ( int i = 0; i < length; ++i ) {
+		//byte n of x holds only bit n of the data byte, which the addition moves to bit 7
+		uint64_t x = ( data[i] * SPREAD ) & SELECT;
+		x = ( ( ( x + CARRY ) >> 7 ) & SPREAD ) * pinMask;
+#if defined( __BYTE_ORDER__ ) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		x = __builtin_bswap64( x );
+#endif
+		
+		out[0] = 0;
+		std::memcpy( out + 1, &x, sizeof( x ) );
+		out[9] = pinMask;
+		out[10] = pinMask;
+		out += 11;
+	}
+	
+	return out - samples;
+}
+
+/*
+ * Merge the first length bytes of several sources into out: each byte is the
+ * highest value of that byte in all sources (HTP), or the byte of ltp if the
+ * corresponding byte of ltpMask is 0xFF. Mask bytes must be either 0 or 0xFF.
+ */
+void DmxKernels::mergeHtpLtp( unsigned char* out, const unsigned char* const* sources, int sourceCount,
+															const unsigned char* ltp, const unsigned char* ltpMask, int length )
+{
+	int i = 0;
+	
+#if defined( DMX_KERNELS_AVX2 )
+	if ( hasAvx2() ) i = mergeHtpLtpAvx2( out, sources, sourceCount, ltp, ltpMask, length );
+#endif
+	
+#if defined( __SSE2__ )
+	for ( ; i + 16 <= length; i += 16 ) {
+		__m128i htp = _mm_setzero_si128();
+		for ( int s = 0; s < sourceCount; s++ ) {
+			htp = _mm_max_epu8( htp, _mm_loadu_si128( (const __m128i*)( sources[s] + i ) ) );
+		}
+		__m128i mask = _mm_loadu_si128( (const __m128i*)( ltpMask + i ) );
+		__m128i v = _mm_or_si128( _mm_andnot_si128( mask, htp ),
+														 _mm_and_si128( mask, _mm_loadu_si128( (const __m128i*)( ltp + i ) ) ) );
+		_mm_storeu_si128( (__m128i*)( out + i ), v );
+	}
+#endif
+	
+	for ( ; i < length; i++ ) {
+		unsigned char htp = 0;
+		for ( int s = 0; s < sourceCount; s++ ) {
+			if ( sources[s][i] > htp ) htp = sources[s][i];
+		}
+		out[i] = ( htp & ~ltpMask[i] ) | ( ltp[i] & ltpMask[i] );
+	}
+}
+
+/*
+ * Apply a new frame of a source to the latest-takes-precedence values: every
+ * byte of data that differs from the source's current one is copied into ltp.
+ * Then data becomes the source's current frame.
+ */
+void DmxKernels::updateLtp( unsigned char* ltp, unsigned char* current, const unsigned char* data, int length )
+{
+	int i = 0;
+	
+#if defined( DMX_KERNELS_AVX2 )
+	if ( hasAvx2() ) i = updateLtpAvx2( ltp, current, data, length );
+#endif
+	
+#if defined( __SSE2__ )
+	for ( ; i + 16 <= length; i += 16 ) {
+		__m128i c = _mm_loadu_si128( (const __m128i*)( current + i ) );
+		__m128i d = _mm_loadu_si128( (const __m128i*)( data + i ) );
+		__m128i same = _mm_cmpeq_epi8( c, d );
+		__m128i l = _mm_loadu_si128( (const __m128i*)( ltp + i ) );
+		_mm_storeu_si128( (__m128i*)( ltp + i ), _mm_or_si128( _mm_and_si128( same, l ), _mm_andnot_si128( same, d ) ) );
+		_mm_storeu_si128( (__m128i*)( current + i ), d );
+	}
+#endif
+	
+	for ( ; i < length; i++ ) {
+		if ( data[i] != current[i] ) ltp[i] = data[i];
+		current[i] = data[i];
+	}
+}
+
+/*
+ * Returns the name of the instruction set used by the merge kernels on this
+ * machine ("AVX2", "SSE2" or "scalar").
+ */
+const char* DmxKernels::getMergeKernelName()
+{
+#if defined( DMX_KERNELS_AVX2 )
+	if ( hasAvx2() ) return "AVX2";
+#endif
+#if defined( __SSE2__ )
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
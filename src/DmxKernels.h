@@ -0,0 +1,23 @@
+/*
+ */
+#ifndef DMX_KERNELS_H
+#define DMX_KERNELS_H
+
+class DmxKernels {
+public:
+	static bool equal( const unsigned char* a, const unsigned char* b, int length );
+	static int findLastNonZero( const unsigned char* data, int length );
+	static int renderSerialBits( const unsigned char* data, int length,
+															unsigned char* samples, unsigned char pinMask );
+	static void mergeHtpLtp( unsigned char* out, const unsigned char* const* sources, int sourceCount,
+													 const unsigned char* ltp, const unsigned char* ltpMask, int length );
+	static void updateLtp( unsigned char* ltp, unsigned char* current, const unsigned char* data, int length );
+	static const char* getMergeKernelName();
+	
+private:
+	DmxKernels();
+	DmxKernels( const DmxKernels& other );
+	DmxKernels& operator=( const DmxKernels& other );
+};
+
+#endif /* ! DMX_KERNELS_H */
@@ -0,0 +1,183 @@
+/*
+ * Merges frames of one universe from several sources (e.g. two consoles, an
+ * application and a network input), slot by slot either as HTP (the highest
+ * value of all sources) or LTP (the value most recently changed by any source).
+ * Slots are HTP by default; see setMode().
+ *
+ * Sources hand over frames from any thread with publishSource(), through a
+ * triple buffer each. A single thread calls merge() in front of writing to a
+ * device, e.g. merger.merge( &frame ) followed by device.writeDmxFrame( &frame ).
+ * Merging first applies the new frames to the LTP values in order of their
+ * timestamps, so the later of two changes to a slot wins. Then all slots are
+ * merged in a single pass over the active sources (see DmxKernels), which
+ * costs about the same however the modes are mixed.
+ *
+ * Only null start code frames are merged; slot 0 of the result is always 0.
+ */
+#include <cstring>
+#include "DmxClock.h"
+#include "DmxKernels.h"
+#include "DmxTripleBuffer.h"
+#include "DmxMerger.h"
+
+const int DmxMerger::SLOT_COUNT;
+const int DmxMerger::SOURCE_COUNT_MAX = 64;
+
+const int DmxMerger::RV_INVALID_SOURCE = -16400;
+const int DmxMerger::RV_INVALID_SLOT = -16401;
+const int DmxMerger::RV_INVALID_START_CODE = -16402;
+
+const int DmxMerger::PADDED_LENGTH;
+
+
+DmxMerger::DmxMerger( int sourceCount )
+{
+	if ( sourceCount < 1 ) sourceCount = 1;
+	if ( sourceCount > SOURCE_COUNT_MAX ) sourceCount = SOURCE_COUNT_MAX;
+	
+	for ( int i = 0; i < sourceCount; i++ ) {
+		source* s = new source();
+		s->frames = new DmxTripleBuffer();
+		std::memset( s->current, 0, sizeof( s->current ) );
+		s->length = 0;
+		s->timestamp = 0;
+		sources_.push_back( s );
+	}
+	
+	updates_.reserve( sourceCount );
+	active_.reserve( sourceCount );
+	std::memset( ltp_, 0, sizeof( ltp_ ) );
+	std::memset( ltpMask_, 0, sizeof( ltpMask_ ) );
+}
+
+DmxMerger::~DmxMerger()
+{
+	for ( unsigned int i = 0; i < sources_.size(); i++ ) {
+		delete sources_[i]->frames;
+		delete sources_[i];
+	}
+}
+
+
+int DmxMerger::getSourceCount() const
+{
+	return sources_.size();
+}
+
+/*
+ * Set the merge mode of the slots from firstSlot up to and including lastSlot
+ * (slot 0 being the start code). This must be called from the thread calling
+ * merge().
+ *
+ * Returns: 0 on success, or RV_INVALID_SLOT if the range is invalid.
+ */
+int DmxMerger::setMode( int firstSlot, int lastSlot, MERGE_MODE mode )
+{
+	if ( firstSlot < 1 || lastSlot >= SLOT_COUNT || firstSlot > lastSlot ) return RV_INVALID_SLOT;
+	
+	std::memset( ltpMask_ + firstSlot, mode == MERGE_LTP ? 0xFF : 0, lastSlot - firstSlot + 1 );
+	return 0;
+}
+
+DmxMerger::MERGE_MODE DmxMerger::getMode( int slot ) const
+{
+	if ( slot < 0 || slot >= SLOT_COUNT ) return MERGE_HTP;
+	return ltpMask_[slot] != 0 ? MERGE_LTP : MERGE_HTP;
+}
+
+/*
+ * Hand over a frame (start code included) of the given source to be merged by
+ * the next call to merge(). Frames published before that replace each other.
+ * If no timestamp is given, the current time is used (see DmxClock). Each
+ * source may only be published from one thread at a time.
+ *
+ * Returns: 0 on success, or < 0 if an error occured.
+ */
+int DmxMerger::publishSource( int source, const unsigned char* data, int length, uint64_t timestamp )
+{
+	if ( source < 0 || source >= (int)sources_.size() ) return RV_INVALID_SOURCE;
+	if ( length < 0 || length > SLOT_COUNT ) return RV_INVALID_SLOT;
+	if ( length > 0 && data[0] != 0 ) return RV_INVALID_START_CODE;
+	
+	DmxTripleBuffer* frames = sources_[source]->frames;
+	DmxFrameBuffer* f = frames->getWriteFrame();
+	std::memcpy( f->data, data, length );
+	f->length = length;
+	f->timestamp = ( timestamp != 0 ) ? timestamp : DmxClock::now();
+	frames->publish();
+	
+	return 0;
+}
+
+/*
+ * Take a source out of the merge until it publishes again. It no longer
+ * contributes to HTP slots, while LTP slots keep their latest values.
+ *
+ * Returns: 0 on success, or RV_INVALID_SOURCE.
+ */
+int DmxMerger::releaseSource( int source )
+{
+	return publishSource( source, 0, 0 );
+}
+
+/*
+ * Merge the most recent frames of all sources into the given frame. Its length
+ * is that of the longest active source's frame, its timestamp that of the
+ * newest frame merged.
+ *
+ * Returns: the length of the merged frame, 0 if no source is active.
+ */
+int DmxMerger::merge( DmxFrameBuffer* frame )
+{
+	updates_.clear();
+	
+	for ( unsigned int i = 0; i < sources_.size(); i++ ) {
+		bool isNew;
+		DmxFrameBuffer* f = sources_[i]->frames->acquireReadFrame( &isNew );
+		if ( ! isNew ) continue;
+		
+		//keep the updates sorted by timestamp; there are only a few sources
+		update u = { f->timestamp, (int)i, f };
+		unsigned int j = updates_.size();
+		updates_.push_back( u );
+		for ( ; j > 0 && updates_[j - 1].timestamp > u.timestamp; j-- ) updates_[j] = updates_[j - 1];
+		updates_[j] = u;
+	}
+	
+	for ( unsigned int i = 0; i < updates_.size(); i++ ) {
+		source* s = sources_[updates_[i].source];
+		DmxFrameBuffer* f = updates_[i].frame;
+		
+		if ( f->length == 0 ) {
+			//released, which must not touch the LTP values
+			std::memset( s->current, 0, PADDED_LENGTH );
+		} else {
+			//slots beyond the frame count as 0, the read frame is ours to modify
+			std::memset( f->data + f->length, 0, PADDED_LENGTH - f->length );
+			DmxKernels::updateLtp( ltp_, s->current, f->data, PADDED_LENGTH );
+		}
+		s->length = f->length;
+		s->timestamp = f->timestamp;
+	}
+	
+	int length = 0;
+	uint64_t timestamp = 0;
+	active_.clear();
+	
+	for ( unsigned int i = 0; i < sources_.size(); i++ ) {
+		const source* s = sources_[i];
+		if ( s->length == 0 ) continue;
+		
+		active_.push_back( s->current );
+		if ( s->length > length ) length = s->length;
+		if ( s->timestamp > timestamp ) timestamp = s->timestamp;
+	}
+	
+	const unsigned char* const* active = active_.empty() ? 0 : &active_[0];
+	DmxKernels::mergeHtpLtp( frame->data, active, active_.size(), ltp_, ltpMask_, PADDED_LENGTH );
+	frame->data[0] = 0;
+	frame->length = length;
+	frame->timestamp = timestamp;
+	
+	return length;
+}
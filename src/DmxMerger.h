@@ -0,0 +1,65 @@
+/*
+ */
+#ifndef DMX_MERGER_H
+#define DMX_MERGER_H
+
+#include <stdint.h>
+#include <vector>
+#include "DmxFrameBuffer.h"
+
+class DmxTripleBuffer;
+
+class DmxMerger {
+public:
+	enum MERGE_MODE {
+		MERGE_HTP, /* highest takes precedence */
+		MERGE_LTP /* latest takes precedence */
+	};
+	
+	static const int SLOT_COUNT = 513;
+	static const int SOURCE_COUNT_MAX;
+	
+	static const int RV_INVALID_SOURCE;
+	static const int RV_INVALID_SLOT;
+	static const int RV_INVALID_START_CODE;
+	
+	
+	DmxMerger( int sourceCount );
+	~DmxMerger();
+	
+	int getSourceCount() const;
+	int setMode( int firstSlot, int lastSlot, MERGE_MODE mode );
+	MERGE_MODE getMode( int slot ) const;
+	
+	int publishSource( int source, const unsigned char* data, int length, uint64_t timestamp = 0 );
+	int releaseSource( int source );
+	int merge( DmxFrameBuffer* frame );
+	
+private:
+	//the slot count rounded up to a multiple of the widest kernel vector
+	static const int PADDED_LENGTH = ( SLOT_COUNT + 31 ) / 32 * 32;
+	
+	struct source {
+		DmxTripleBuffer* frames;
+		unsigned char current[PADDED_LENGTH];
+		int length;
+		uint64_t timestamp;
+	};
+	
+	struct update {
+		uint64_t timestamp;
+		int source;
+		DmxFrameBuffer* frame;
+	};
+	
+	DmxMerger( const DmxMerger& other );
+	DmxMerger& operator=( const DmxMerger& other );
+	
+	std::vector<source*> sources_;
+	std::vector<update> updates_;
+	std::vector<const unsigned char*> active_;
+	unsigned char ltp_[PADDED_LENGTH];
+	unsigned char ltpMask_[PADDED_LENGTH];
+};
+
+#endif /* ! DMX_MERGER_H */
@@ -0,0 +1,354 @@
+/*
+ * Base class for devices sending DMX over UDP (see DmxArtNetDevice and
+ * DmxSacnDevice). Instead of a USB interface, open() takes the destination
+ * host and the universe to send frames written or published through the
+ * DmxDevice interface to.
+ *
+ * Further universes can be added with addUniverse() and fed through
+ * publishUniverse(). Each universe keeps a complete packet whose header is
+ * built once by the subclass; per frame only the slot data, the length fields
+ * and the sequence number are patched in. On every tick of the output thread,
+ * all universes with a new frame (or due for a keep-alive refresh, see
+ * setKeepAliveInterval()) are sent in one batch (see DmxNetSocket::sendBatch()).
+ */
+#include <assert.h>
+#include <cstring>
+#include "DmxClock.h"
+#include "DmxTripleBuffer.h"
+#include "DmxNetDevice.h"
+
+const float DmxNetDevice::OUTPUT_RATE_MAX = 44.0f;
+
+const int DmxNetDevice::RV_UNIVERSE_INVALID = -20100;
+const int DmxNetDevice::RV_OUTPUT_THREAD_RUNNING = -20101;
+const int DmxNetDevice::RV_PACKET_INVALID = -20102;
+
+const int DmxNetDevice::PACKET_MAX_LENGTH;
+
+
+/*
+ * NOTE: subclasses must add the universe for writeDmx() and publishDmx() in
+ * their constructor, since it is built by them.
+ */
+DmxNetDevice::DmxNetDevice( int port, int universeMin, int universeMax )
+: socket_( new DmxNetSocket() ), hostAddress_( false ), port_( port ),
+  universeMin_( universeMin ), universeMax_( universeMax ),
+  packetCount_( 0 ), batchCount_( 0 ), batchTimeSum_( 0 )
+{
+	std::memset( &address_, 0, sizeof( address_ ) );
+}
+
+DmxNetDevice::~DmxNetDevice()
+{
+	stopOutputThread();
+	socket_->close();
+	
+	for ( unsigned int i = 0; i < universes_.size(); i++ ) {
+		delete universes_[i]->frames;
+		delete universes_[i];
+	}
+	delete socket_;
+}
+
+
+/*
+ * Open a socket for sending to the given host, or to the default destination
+ * of each universe if NULL (see getDefaultAddress()). The serial argument is
+ * ignored, the last one selects the universe for writeDmx() and publishDmx().
+ *
+ * Returns: true if the device was opened or already open, false otherwise (see
+ * getLastError()).
+ */
+bool DmxNetDevice::open( const char* host, const char* /*serial*/, int universe )
+{
+	if ( isOpen() ) return true;
+	if ( universe < universeMin_ || universe > universeMax_ ) return false;
+	
+	hostAddress_ = ( host != 0 );
+	if ( hostAddress_ && ! socket_->resolveAddress( host, port_, &address_ ) ) return false;
+	if ( ! socket_->open() || ! prepareSocket() ) {
+		socket_->close();
+		return false;
+	}
+	
+	universes_[0]->number = universe;
+	buildHeader( universes_[0] );
+	
+	for ( unsigned int i = 0; i < universes_.size(); i++ ) {
+		struct universe* u = universes_[i];
+		if ( u->defaultAddress ) getDefaultAddress( u->number, &u->address );
+	}
+	
+	return true;
+}
+
+bool DmxNetDevice::close()
+{
+	stopOutputThread();
+	socket_->close();
+	return true;
+}
+
+bool DmxNetDevice::isOpen() const
+{
+	return socket_->isOpen();
+}
+
+const char* DmxNetDevice::getLastError() const
+{
+	return socket_->getLastError();
+}
+
+/*
+ * Send a frame to the universe given to open() right away. Since this shares
+ * the packet and sequence number of that universe with the output thread, it
+ * cannot be used while the latter is running (use publishDmx() instead).
+ *
+ * Returns: 0 on success, DmxDevice::RV_NOT_SUPPORTED if the frame cannot be
+ * sent with this protocol, or < 0 if another error occured.
+ */
+int DmxNetDevice::writeDmx( const unsigned char* data, int length ) const
+{
+	return writeUniverse( 0, data, length );
+}
+
+/*
+ * Called by the output thread on every tick: stage new frames for all
+ * universes and send the ones that are due in a single batch.
+ *
+ * Returns: 0 on success, or < 0 if an error occured.
+ */
+int DmxNetDevice::writeDmxFrame( DmxFrameBuffer* frame ) const
+{
+	uint64_t now = DmxClock::now();
+	universe* u0 = universes_[0];
+	
+	if ( frame->length > 0 && frame->timestamp != u0->stagedTimestamp ) {
+		int packetLength = setPacketData( u0->packet, frame->data, frame->length );
+		if ( packetLength >= 0 ) {
+			u0->packetLength = packetLength;
+			u0->staged = true;
+		}
+		u0->stagedTimestamp = frame->timestamp;
+	}
+	
+	for ( unsigned int i = 1; i < universes_.size(); i++ ) {
+		universe* u = universes_[i];
+		bool isNew;
+		DmxFrameBuffer* f = u->frames->acquireReadFrame( &isNew );
+		if ( ! isNew ) continue;
+		
+		int packetLength = setPacketData( u->packet, f->data, f->length );
+		if ( packetLength >= 0 ) {
+			u->packetLength = packetLength;
+			u->staged = true;
+		}
+	}
+	
+	uint64_t keepAlive = (uint64_t)getKeepAliveInterval() * 1000000;
+	batchUniverses_.clear();
+	
+	for ( unsigned int i = 0; i < universes_.size(); i++ ) {
+		universe* u = universes_[i];
+		if ( ! u->staged && ( u->lastSent == 0 || now - u->lastSent < keepAlive ) ) continue;
+		batchUniverses_.push_back( u );
+	}
+	
+	if ( batchUniverses_.empty() ) return 0;
+	
+	//NOTE: sendUniverses() uses batch_, not batchUniverses_, so passing the latter is fine.
+	int r = sendUniverses( &batchUniverses_[0], batchUniverses_.size() );
+	return ( r < 0 ) ? r : 0;
+}
+
+/*
+ * Returns the maximum DMX512 refresh rate for a full universe, since network
+ * nodes put the data on the line as it arrives.
+ */
+float DmxNetDevice::getDefaultRefreshRate() const
+{
+	return OUTPUT_RATE_MAX;
+}
+
+/*
+ * Add a universe to be sent by the output thread, to the given host or to the
+ * universe's default destination if host is NULL. Universes cannot be added
+ * while the output thread is running.
+ *
+ * Returns: a handle for publishUniverse(), or < 0 if an error occured.
+ */
+int DmxNetDevice::addUniverse( int universe, const char* host )
+{
+	if ( universe < universeMin_ || universe > universeMax_ ) return RV_UNIVERSE_INVALID;
+	if ( isOutputThreadRunning() ) return RV_OUTPUT_THREAD_RUNNING;
+	
+	struct universe* u = new struct universe();
+	u->number = universe;
+	u->defaultAddress = ( host == 0 );
+	if ( host != 0 ) {
+		if ( ! socket_->resolveAddress( host, port_, &u->address ) ) {
+			delete u;
+			return DmxNetSocket::RV_ADDRESS_INVALID;
+		}
+	} else {
+		getDefaultAddress( universe, &u->address );
+	}
+	
+	//the first universe is fed through publishDmx() instead
+	u->frames = universes_.empty() ? 0 : new DmxTripleBuffer();
+	u->packetLength = 0;
+	u->sequence = 0;
+	u->staged = false;
+	u->stagedTimestamp = 0;
+	u->lastSent = 0;
+	buildHeader( u );
+	
+	universes_.push_back( u );
+	return universes_.size() - 1;
+}
+
+int DmxNetDevice::getUniverseCount() const
+{
+	return universes_.size();
+}
+
+/*
+ * Hand over a frame for the universe with the given handle to the output
+ * thread (see DmxDevice::publishDmx(), which is equivalent to handle 0).
+ *
+ * Returns: 0 on success, or < 0 if an error occured.
+ */
+int DmxNetDevice::publishUniverse( int handle, const unsigned char* data, int length )
+{
+	assert( length <= DmxTripleBuffer::FRAME_MAX_LENGTH );
+	if ( handle == 0 ) return publishDmx( data, length );
+	if ( handle < 0 || handle >= (int)universes_.size() ) return RV_UNIVERSE_INVALID;
+	if ( ! isOpen() ) return DmxDevice::RV_DEVICE_NOT_OPEN;
+	
+	DmxTripleBuffer* frames = universes_[handle]->frames;
+	DmxTripleBuffer::frame* f = frames->getWriteFrame();
+	std::memcpy( f->data, data, length );
+	f->length = length;
+	f->timestamp = DmxClock::now();
+	frames->publish();
+	
+	return 0;
+}
+
+/*
+ * Send a frame to the universe with the given handle right away (see
+ * writeDmx(), which is equivalent to handle 0). Like writeDmx(), this cannot be
+ * used while the output thread is running, but it may be called from several
+ * threads at once.
+ *
+ * Returns: 0 on success, DmxDevice::RV_NOT_SUPPORTED if the frame cannot be
+ * sent with this protocol, or < 0 if another error occured.
+ */
+int DmxNetDevice::writeUniverse( int handle, const unsigned char* data, int length ) const
+{
+	assert( length <= 513 );
+	if ( handle < 0 || handle >= (int)universes_.size() ) return RV_UNIVERSE_INVALID;
+	if ( ! isOpen() ) return DmxDevice::RV_DEVICE_NOT_OPEN;
+	if ( isOutputThreadRunning() ) return RV_OUTPUT_THREAD_RUNNING;
+	
+	std::lock_guard<std::mutex> lock( writeMutex_ );
+	universe* u = universes_[handle];
+	int packetLength = setPacketData( u->packet, data, length );
+	if ( packetLength < 0 ) return DmxDevice::RV_NOT_SUPPORTED;
+	u->packetLength = packetLength;
+	
+	int r = sendUniverses( &u, 1 );
+	if ( r < 0 ) return r;
+	
+	return ( r == 1 ) ? 0 : DmxNetSocket::RV_SOCKET_ERROR;
+}
+
+/*
+ * Retrieve statistics on the packets sent. The batch time is the time spent in
+ * sending all packets of a tick.
+ */
+void DmxNetDevice::getNetworkStats( networkStats* stats ) const
+{
+	uint64_t batches = batchCount_;
+	
+	stats->packetCount = packetCount_;
+	stats->batchCount = batches;
+	stats->syscallCount = socket_->getSyscallCount();
+	stats->errorCount = socket_->getErrorCount();
+	stats->meanBatchTime = ( batches > 0 ) ? ( batchTimeSum_ / (double)batches ) / 1000.0 : 0;
+}
+
+/*
+ * Returns true if universes besides the first have been added, which have to
+ * be serviced even if nothing is published through publishDmx().
+ */
+bool DmxNetDevice::hasPendingOutput() const
+{
+	return universes_.size() > 1;
+}
+
+/*
+ * Advance the sequence numbers of the given universes and send their packets in
+ * one batch. Universes whose packet could not be sent stay staged, so they are
+ * sent again on the next tick.
+ *
+ * Returns: the number of packets sent, or < 0 if an error occured.
+ */
+int DmxNetDevice::sendUniverses( universe* const* list, int count ) const
+{
+	uint64_t tStart = DmxClock::now();
+	batch_.clear();
+	
+	for ( int i = 0; i < count; i++ ) {
+		universe* u = list[i];
+		u->sequence = nextSequence( u->sequence );
+		setSequence( u->packet, u->sequence );
+		
+		DmxNetSocket::packet p = { u->packet, u->packetLength, &u->address, false };
+		batch_.push_back( p );
+	}
+	
+	int r = socket_->sendBatch( &batch_[0], count );
+	uint64_t tEnd = DmxClock::now();
+	
+	for ( int i = 0; i < count; i++ ) {
+		if ( ! batch_[i].sent ) continue;
+		list[i]->staged = false;
+		list[i]->lastSent = tStart;
+	}
+	
+	if ( r > 0 ) packetCount_ += r;
+	batchCount_++;
+	batchTimeSum_ += tEnd - tStart;
+	
+	return r;
+}
+
+/*
+ * Called when the socket has been opened to set it up for the protocol. The
+ * default implementation does nothing.
+ *
+ * Returns: true on success, false otherwise.
+ */
+bool DmxNetDevice::prepareSocket()
+{
+	return true;
+}
+
+/*
+ * Return the destination for a universe added without a host. The default
+ * implementation returns the host given to open().
+ */
+void DmxNetDevice::getDefaultAddress( int /*universe*/, struct sockaddr_in* address ) const
+{
+	*address = address_;
+}
+
+/*
+ * Returns the sequence number following the given one. The default
+ * implementation simply counts up and wraps around.
+ */
+unsigned char DmxNetDevice::nextSequence( unsigned char sequence ) const
+{
+	return sequence + 1;
+}
@@ -0,0 +1,108 @@
+/*
+ */
+#ifndef DMX_NET_DEVICE_H
+#define DMX_NET_DEVICE_H
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+#include "DmxDevice.h"
+#include "DmxNetSocket.h"
+
+class DmxNetDevice : public DmxDevice {
+public:
+	struct networkStats {
+		unsigned long packetCount;
+		unsigned long batchCount;
+		unsigned long syscallCount;
+		unsigned long errorCount;
+		float meanBatchTime; /* in microseconds */
+	};
+	
+	/* a decoded DMX packet, see the parsePacket() functions of the subclasses */
+	struct packetInfo {
+		int universe;
+		int sequence; /* -1 if not used */
+		int priority; /* -1 if not supported by the protocol */
+		unsigned char options;
+		const unsigned char* cid; /* NULL if not supported by the protocol */
+		unsigned char startCode;
+		const unsigned char* slots;
+		int slotCount;
+	};
+	
+	static const float OUTPUT_RATE_MAX;
+	
+	static const int RV_UNIVERSE_INVALID;
+	static const int RV_OUTPUT_THREAD_RUNNING;
+	static const int RV_PACKET_INVALID;
+
+
+	virtual ~DmxNetDevice();
+	
+	bool open( const char* host = 0, const char* serial = 0, int universe = 0 );
+	bool close();
+	bool isOpen() const;
+	const char* getLastError() const;
+	
+	int writeDmx( const unsigned char* data, int length ) const;
+	int writeDmxFrame( DmxFrameBuffer* frame ) const;
+	float getDefaultRefreshRate() const;
+	
+	int addUniverse( int universe, const char* host = 0 );
+	int getUniverseCount() const;
+	int publishUniverse( int handle, const unsigned char* data, int length );
+	int writeUniverse( int handle, const unsigned char* data, int length ) const;
+	void getNetworkStats( networkStats* stats ) const;
+
+protected:
+	static const int PACKET_MAX_LENGTH = 638;
+	
+	struct universe {
+		int number;
+		bool defaultAddress;
+		struct sockaddr_in address;
+		DmxTripleBuffer* frames;
+		unsigned char packet[PACKET_MAX_LENGTH];
+		int packetLength;
+		unsigned char sequence;
+		bool staged;
+		uint64_t stagedTimestamp;
+		uint64_t lastSent;
+	};
+	
+	DmxNetDevice( int port, int universeMin, int universeMax );
+	
+	bool hasPendingOutput() const;
+	int sendUniverses( universe* const* list, int count ) const;
+	
+	virtual bool prepareSocket();
+	virtual void getDefaultAddress( int universe, struct sockaddr_in* address ) const;
+	virtual void buildHeader( universe* u ) const = 0;
+	virtual int setPacketData( unsigned char* packet, const unsigned char* data, int length ) const = 0;
+	virtual unsigned char nextSequence( unsigned char sequence ) const;
+	virtual void setSequence( unsigned char* packet, unsigned char sequence ) const = 0;
+	
+	DmxNetSocket* socket_;
+	bool hostAddress_;
+	struct sockaddr_in address_;
+	std::vector<universe*> universes_;
+
+private:
+	DmxNetDevice( const DmxNetDevice& other );
+	DmxNetDevice& operator=( const DmxNetDevice& other );
+	
+	int port_;
+	int universeMin_;
+	int universeMax_;
+	mutable std::vector<DmxNetSocket::packet> batch_;
+	mutable std::vector<universe*> batchUniverses_;
+	mutable std::mutex writeMutex_;
+	
+	mutable std::atomic<uint64_t> packetCount_;
+	mutable std::atomic<uint64_t> batchCount_;
+	mutable std::atomic<uint64_t> batchTimeSum_;
+};
+
+#endif /* ! DMX_NET_DEVICE_H */
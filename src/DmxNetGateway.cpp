@@ -0,0 +1,404 @@
+/*
+ * Connects network universes to DMX USB PRO ports without going through the
+ * application or an output thread.
+ *
+ * Output routes hand every frame of a network universe from the DmxNetReceiver
+ * thread that decoded it to a writer thread of the routed device, through one
+ * DmxTripleBuffer per port. The writer wakes up right away and writes the
+ * newest frame of each port, framed in place (see
+ * DmxUsbProDevice::writeDmxFrame()). This way a slow USB transfer never holds
+ * up the receiver, which keeps draining the socket for all other universes; if
+ * frames arrive faster than the device takes them, only the newest one is
+ * written. Input routes work the other way around and send every frame
+ * received on a USB port to a network universe from the device's input thread
+ * (see DmxNetDevice::writeUniverse()).
+ *
+ * For both directions, the time from receiving a frame to having written it
+ * is recorded in a histogram with 1 microsecond resolution, from which
+ * percentiles are reported. On the network side, receiving means the kernel's
+ * receive timestamp; on the USB side it is the time the input thread decoded
+ * the frame.
+ */
+#include <cstring>
+#include "DmxClock.h"
+#include "DmxNetDevice.h"
+#include "DmxNetReceiver.h"
+#include "DmxNetGateway.h"
+
+const int DmxNetGateway::RV_ROUTE_INVALID = -20300;
+const int DmxNetGateway::RV_RUNNING = -20301;
+
+//private constants
+const int DmxNetGateway::UNIVERSE_COUNT;
+const int DmxNetGateway::BUCKET_COUNT;
+const uint64_t DmxNetGateway::BUCKET_WIDTH = 1000; /* in nanoseconds */
+
+
+/*
+ * The receiver is only needed for output routes and may be NULL otherwise. It
+ * must not be started by the caller.
+ */
+DmxNetGateway::DmxNetGateway( DmxNetReceiver* receiver )
+: receiver_( receiver ), outputIndex_( UNIVERSE_COUNT, -1 ), running_( false )
+{
+	reset( &outputLatency_ );
+	reset( &inputLatency_ );
+}
+
+DmxNetGateway::~DmxNetGateway()
+{
+	stop();
+	for ( unsigned int i = 0; i < inputRoutes_.size(); i++ ) delete inputRoutes_[i];
+	
+	for ( unsigned int i = 0; i < outputWriters_.size(); i++ ) {
+		outputWriter* w = outputWriters_[i];
+		for ( int p = 0; p < DmxUsbProDevice::PORT_COUNT; p++ ) delete w->frames[p];
+		delete w;
+	}
+}
+
+
+/*
+ * Send every frame received for the given network universe to the given port
+ * (1 or 2) of a DMX USB PRO. The universe is added to the receiver; a universe
+ * can be routed to several ports. The device's output thread should not be
+ * used for the same port at the same time.
+ *
+ * Returns: 0 on success, or < 0 if an error occured.
+ */
+int DmxNetGateway::addOutputRoute( int universe, DmxUsbProDevice* device, int port )
+{
+	if ( running_ ) return RV_RUNNING;
+	if ( receiver_ == 0 || device == 0 || port < 1 || port > DmxUsbProDevice::PORT_COUNT ) {
+		return RV_ROUTE_INVALID;
+	}
+	
+	int r = receiver_->addUniverse( universe );
+	if ( r < 0 ) return r;
+	
+	outputWriter* writer = 0;
+	for ( unsigned int i = 0; i < outputWriters_.size(); i++ ) {
+		if ( outputWriters_[i]->device == device ) writer = outputWriters_[i];
+	}
+	
+	if ( writer == 0 ) {
+		writer = new outputWriter();
+		writer->device = device;
+		for ( int p = 0; p < DmxUsbProDevice::PORT_COUNT; p++ ) writer->frames[p] = new DmxTripleBuffer();
+		writer->thread = 0;
+		writer->pending = false;
+		writer->running = false;
+		outputWriters_.push_back( writer );
+	}
+	
+	outputRoute route = { writer, port, outputIndex_[universe] };
+	outputIndex_[universe] = outputRoutes_.size();
+	outputRoutes_.push_back( route );
+	
+	return 0;
+}
+
+/*
+ * Send every frame received on the given port (1 or 2) of a DMX USB PRO to the
+ * network universe with the given handle (see DmxNetDevice::addUniverse()). The
+ * network device must be open and its output thread must not be running. Each
+ * port can be routed to one universe.
+ *
+ * Returns: 0 on success, or < 0 if an error occured.
+ */
+int DmxNetGateway::addInputRoute( DmxUsbProDevice* device, int port, DmxNetDevice* netDevice, int handle )
+{
+	if ( running_ ) return RV_RUNNING;
+	if ( device == 0 || netDevice == 0 || port < 1 || port > DmxUsbProDevice::PORT_COUNT ) {
+		return RV_ROUTE_INVALID;
+	}
+	if ( handle < 0 || handle >= netDevice->getUniverseCount() ) return DmxNetDevice::RV_UNIVERSE_INVALID;
+	
+	inputRoute* route = 0;
+	for ( unsigned int i = 0; i < inputRoutes_.size(); i++ ) {
+		if ( inputRoutes_[i]->device == device ) route = inputRoutes_[i];
+	}
+	
+	if ( route == 0 ) {
+		route = new inputRoute();
+		route->gateway = this;
+		route->device = device;
+		for ( int p = 0; p < DmxUsbProDevice::PORT_COUNT; p++ ) {
+			route->netDevices[p] = 0;
+			route->handles[p] = -1;
+		}
+		inputRoutes_.push_back( route );
+	}
+	
+	if ( route->netDevices[port - 1] != 0 ) return RV_ROUTE_INVALID;
+	route->netDevices[port - 1] = netDevice;
+	route->handles[port - 1] = handle;
+	
+	return 0;
+}
+
+/*
+ * Start forwarding: a writer thread is started for every device with output
+ * routes, the receiver is started with the given arguments (see
+ * DmxNetReceiver::start()) if there are output routes, and input is started on
+ * every device with input routes (see DmxUsbProDevice::startInput()). Input
+ * must not have been started on these devices already.
+ *
+ * Returns: true on success or if already running, false otherwise (see
+ * getLastError()).
+ */
+bool DmxNetGateway::start( int shardCount, const char* interfaceAddress )
+{
+	if ( running_ ) return true;
+	running_ = true;
+	
+	for ( unsigned int i = 0; i < inputRoutes_.size(); i++ ) {
+		DmxUsbProDevice* device = inputRoutes_[i]->device;
+		
+		if ( ! device->setInputFrameCallback( onUsbFrame, inputRoutes_[i] ) ) {
+			lastError_ = "input is already running on a routed device";
+			stop();
+			return false;
+		}
+		if ( ! device->startInput() ) {
+			lastError_ = device->getLastError();
+			stop();
+			return false;
+		}
+	}
+	
+	for ( unsigned int i = 0; i < outputWriters_.size(); i++ ) {
+		outputWriter* w = outputWriters_[i];
+		w->pending = false;
+		w->running = true;
+		w->thread = new std::thread( &DmxNetGateway::runWriter, this, w );
+	}
+	
+	if ( ! outputRoutes_.empty() ) {
+		receiver_->setFrameCallback( onNetworkFrame, this );
+		if ( ! receiver_->start( shardCount, interfaceAddress ) ) {
+			lastError_ = receiver_->getLastError();
+			stop();
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+/*
+ * Stop the receiver, the writer threads and the input of all devices with
+ * input routes. Frames handed to a writer but not written yet are dropped.
+ */
+void DmxNetGateway::stop()
+{
+	if ( ! running_ ) return;
+	
+	if ( ! outputRoutes_.empty() ) {
+		receiver_->stop();
+		receiver_->setFrameCallback( 0 );
+	}
+	
+	for ( unsigned int i = 0; i < outputWriters_.size(); i++ ) {
+		outputWriter* w = outputWriters_[i];
+		if ( w->thread == 0 ) continue;
+		
+		{
+			std::lock_guard<std::mutex> lock( w->mutex );
+			w->running = false;
+		}
+		w->wake.notify_one();
+		w->thread->join();
+		delete w->thread;
+		w->thread = 0;
+	}
+	
+	for ( unsigned int i = 0; i < inputRoutes_.size(); i++ ) {
+		DmxUsbProDevice* device = inputRoutes_[i]->device;
+		device->stopInput();
+		device->setInputFrameCallback( 0 );
+	}
+	
+	running_ = false;
+}
+
+bool DmxNetGateway::isRunning() const
+{
+	return running_;
+}
+
+/*
+ * Retrieve the latency of output routes: from the kernel receiving a network
+ * packet to the frame having been written to USB by the device's writer
+ * thread. Frames replaced by a newer one before being written are not counted.
+ */
+void DmxNetGateway::getOutputLatency( latencyStats* stats ) const
+{
+	getLatency( &outputLatency_, stats );
+}
+
+/*
+ * Retrieve the latency of input routes: from a frame having been received on
+ * USB to it having been sent to the network.
+ */
+void DmxNetGateway::getInputLatency( latencyStats* stats ) const
+{
+	getLatency( &inputLatency_, stats );
+}
+
+/*
+ * Clear the latency histograms of both directions.
+ */
+void DmxNetGateway::resetStats()
+{
+	reset( &outputLatency_ );
+	reset( &inputLatency_ );
+}
+
+const char* DmxNetGateway::getLastError() const
+{
+	return lastError_.c_str();
+}
+
+
+/*********************
+ * PRIVATE FUNCTIONS *
+ *********************/
+
+/*
+ * Frame callback of the receiver, see DmxNetReceiver::frameCallback. The frame
+ * is copied to the writer of every routed port, which is then woken up; the
+ * writer's lock is only held for the copy, never during a USB transfer. It also
+ * serializes shards handing over frames for the same port.
+ */
+void DmxNetGateway::onNetworkFrame( int universe, const DmxFrameBuffer* frame, void* userData )
+{
+	DmxNetGateway* gateway = static_cast<DmxNetGateway*>( userData );
+	
+	for ( int i = gateway->outputIndex_[universe]; i >= 0; ) {
+		const outputRoute& route = gateway->outputRoutes_[i];
+		outputWriter* w = route.writer;
+		
+		{
+			std::lock_guard<std::mutex> lock( w->mutex );
+			DmxTripleBuffer* frames = w->frames[route.port - 1];
+			DmxFrameBuffer* f = frames->getWriteFrame();
+			std::memcpy( f->data, frame->data, frame->length );
+			f->length = frame->length;
+			f->timestamp = frame->timestamp;
+			frames->publish();
+			w->pending = true;
+		}
+		w->wake.notify_one();
+		i = route.next;
+	}
+}
+
+/*
+ * The loop of a writer thread: wait until frames have been handed over, then
+ * write the newest frame of each port and record its latency.
+ */
+void DmxNetGateway::runWriter( outputWriter* writer )
+{
+	std::unique_lock<std::mutex> lock( writer->mutex );
+	
+	while ( true ) {
+		while ( writer->running && ! writer->pending ) writer->wake.wait( lock );
+		if ( ! writer->running ) break;
+		writer->pending = false;
+		lock.unlock();
+		
+		for ( int p = 0; p < DmxUsbProDevice::PORT_COUNT; p++ ) {
+			DmxTripleBuffer* frames = writer->frames[p];
+			if ( ! frames->hasNewFrame() ) continue;
+			
+			DmxFrameBuffer* f = frames->acquireReadFrame();
+			int r = writer->device->writeDmxFrame( p + 1, f );
+			record( &outputLatency_, f->timestamp, r >= 0 );
+		}
+		
+		lock.lock();
+	}
+}
+
+/*
+ * Input frame callback of the routed devices, see
+ * DmxUsbProDevice::inputFrameCallback.
+ */
+void DmxNetGateway::onUsbFrame( int port, const DmxFrameBuffer* frame, void* userData )
+{
+	inputRoute* route = static_cast<inputRoute*>( userData );
+	DmxNetDevice* netDevice = route->netDevices[port - 1];
+	if ( netDevice == 0 || frame->length < 1 ) return;
+	
+	int r = netDevice->writeUniverse( route->handles[port - 1], frame->data, frame->length );
+	record( &route->gateway->inputLatency_, frame->timestamp, r >= 0 );
+}
+
+void DmxNetGateway::record( histogram* h, uint64_t start, bool success )
+{
+	if ( ! success ) {
+		h->errorCount++;
+		return;
+	}
+	
+	uint64_t now = DmxClock::now();
+	uint64_t latency = ( now > start ) ? now - start : 0;
+	uint64_t bucket = latency / BUCKET_WIDTH;
+	if ( bucket >= (uint64_t)BUCKET_COUNT ) bucket = BUCKET_COUNT - 1;
+	
+	h->buckets[bucket].fetch_add( 1, std::memory_order_relaxed );
+	h->sum += latency;
+	h->count++;
+	
+	uint64_t max = h->max.load( std::memory_order_relaxed );
+	while ( latency > max && ! h->max.compare_exchange_weak( max, latency ) ) { /* retry */ }
+}
+
+void DmxNetGateway::reset( histogram* h )
+{
+	for ( int i = 0; i < BUCKET_COUNT; i++ ) h->buckets[i].store( 0 );
+	h->count = 0;
+	h->errorCount = 0;
+	h->sum = 0;
+	h->max = 0;
+}
+
+/*
+ * Compute statistics from a histogram. Percentiles are rounded up to the
+ * bucket width; beyond the last bucket, the maximum is reported.
+ */
+void DmxNetGateway::getLatency( const histogram* h, latencyStats* stats )
+{
+	uint64_t count = h->count;
+	uint64_t max = h->max;
+	
+	std::memset( stats, 0, sizeof( *stats ) );
+	stats->frameCount = count;
+	stats->errorCount = h->errorCount;
+	if ( count == 0 ) return;
+	
+	stats->meanLatency = ( h->sum / (double)count ) / 1000.0;
+	stats->maxLatency = max / 1000.0f;
+	
+	uint64_t p50Rank = ( count + 1 ) / 2;
+	uint64_t p99Rank = count - count / 100;
+	uint64_t cumulative = 0;
+	bool p50Found = false;
+	
+	for ( int i = 0; i < BUCKET_COUNT; i++ ) {
+		cumulative += h->buckets[i].load( std::memory_order_relaxed );
+		
+		uint64_t edge = ( i < BUCKET_COUNT - 1 ) ? ( i + 1 ) * BUCKET_WIDTH : max;
+		if ( edge > max ) edge = max;
+		
+		if ( ! p50Found && cumulative >= p50Rank ) {
+			stats->p50Latency = edge / 1000.0f;
+			p50Found = true;
+		}
+		if ( cumulative >= p99Rank ) {
+			stats->p99Latency = edge / 1000.0f;
+			break;
+		}
+	}
+}
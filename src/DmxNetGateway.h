@@ -0,0 +1,109 @@
+/*
+ */
+#ifndef DMX_NET_GATEWAY_H
+#define DMX_NET_GATEWAY_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "DmxFrameBuffer.h"
+#include "DmxTripleBuffer.h"
+#include "DmxUsbProDevice.h"
+
+class DmxNetDevice;
+class DmxNetReceiver;
+
+class DmxNetGateway {
+public:
+	struct latencyStats {
+		unsigned long frameCount;
+		unsigned long errorCount;
+		float meanLatency; /* in microseconds */
+		float p50Latency; /* in microseconds */
+		float p99Latency; /* in microseconds */
+		float maxLatency; /* in microseconds */
+	};
+	
+	static const int RV_ROUTE_INVALID;
+	static const int RV_RUNNING;
+
+
+	DmxNetGateway( DmxNetReceiver* receiver = 0 );
+	~DmxNetGateway();
+	
+	int addOutputRoute( int universe, DmxUsbProDevice* device, int port = 1 );
+	int addInputRoute( DmxUsbProDevice* device, int port, DmxNetDevice* netDevice, int handle = 0 );
+	
+	bool start( int shardCount = 1, const char* interfaceAddress = 0 );
+	void stop();
+	bool isRunning() const;
+	
+	void getOutputLatency( latencyStats* stats ) const;
+	void getInputLatency( latencyStats* stats ) const;
+	void resetStats();
+	const char* getLastError() const;
+
+private:
+	static const int UNIVERSE_COUNT = 65536;
+	static const int BUCKET_COUNT = 4096;
+	static const uint64_t BUCKET_WIDTH;
+	
+	struct histogram {
+		std::atomic<uint32_t> buckets[BUCKET_COUNT]; /* the last one collects everything beyond */
+		std::atomic<uint64_t> count;
+		std::atomic<uint64_t> errorCount;
+		std::atomic<uint64_t> sum;
+		std::atomic<uint64_t> max;
+	};
+	
+	/* writes the frames handed over for the ports of one device on its own thread */
+	struct outputWriter {
+		DmxUsbProDevice* device;
+		DmxTripleBuffer* frames[DmxUsbProDevice::PORT_COUNT];
+		std::thread* thread;
+		std::mutex mutex;
+		std::condition_variable wake;
+		bool pending;
+		bool running;
+	};
+	
+	struct outputRoute {
+		outputWriter* writer;
+		int port;
+		int next; /* index of the next route of the same universe, or -1 */
+	};
+	
+	struct inputRoute {
+		DmxNetGateway* gateway;
+		DmxUsbProDevice* device;
+		DmxNetDevice* netDevices[DmxUsbProDevice::PORT_COUNT];
+		int handles[DmxUsbProDevice::PORT_COUNT];
+	};
+	
+	DmxNetGateway( const DmxNetGateway& other );
+	DmxNetGateway& operator=( const DmxNetGateway& other );
+	
+	static void onNetworkFrame( int universe, const DmxFrameBuffer* frame, void* userData );
+	void runWriter( outputWriter* writer );
+	static void onUsbFrame( int port, const DmxFrameBuffer* frame, void* userData );
+	static void record( histogram* h, uint64_t start, bool success );
+	static void reset( histogram* h );
+	static void getLatency( const histogram* h, latencyStats* stats );
+	
+	DmxNetReceiver* receiver_;
+	std::vector<int> outputIndex_;
+	std::vector<outputRoute> outputRoutes_;
+	std::vector<outputWriter*> outputWriters_;
+	std::vector<inputRoute*> inputRoutes_;
+	bool running_;
+	std::string lastError_;
+	
+	histogram outputLatency_;
+	histogram inputLatency_;
+};
+
+#endif /* ! DMX_NET_GATEWAY_H */
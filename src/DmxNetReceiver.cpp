@@ -0,0 +1,367 @@
+/*
+ * Receives Art-Net or sACN (E1.31) DMX on one or more threads ('shards'). Each
+ * shard owns a socket bound to the protocol's port with SO_REUSEPORT and reads
+ * packets in batches (see DmxNetSocket::receiveBatch()), so thousands of
+ * universes per second cost few system calls.
+ * Traffic is spread over the shards by universe where possible: with sACN
+ * multicast, every shard only joins the groups of its own universes (universe
+ * index modulo shard count). Unicast traffic is spread by the kernel per
+ * source instead, so any shard may receive any universe. Broadcast traffic
+ * (e.g. Art-Net to 2.255.255.255) is delivered to every shard by Linux, so all
+ * but the first shard drop it before decoding.
+ *
+ * Each packet of an added universe is decoded straight into that universe's
+ * ring of DmxFrameBuffers (the layout the output code uses), stamped with the
+ * kernel receive time. Readers on other threads copy frames without locking
+ * (see DmxFrameRing); a frame callback can pick them up on the receiving
+ * thread directly. Packets arriving out of order (with a sequence number just
+ * below the previous one) are dropped.
+ */
+#include <cstring>
+#include <unistd.h>
+#include "DmxArtNetDevice.h"
+#include "DmxFrameRing.h"
+#include "DmxNetSocket.h"
+#include "DmxSacnDevice.h"
+#include "DmxNetReceiver.h"
+
+const int DmxNetReceiver::SHARD_COUNT_MAX = 64;
+const int DmxNetReceiver::RING_CAPACITY = 4;
+const int DmxNetReceiver::RECEIVE_TIMEOUT = 100; /* in milliseconds */
+const int DmxNetReceiver::RECEIVE_BUFFER_SIZE = 4 * 1024 * 1024;
+
+const int DmxNetReceiver::RV_UNIVERSE_INVALID = -20200;
+const int DmxNetReceiver::RV_RUNNING = -20201;
+
+//private constants
+const int DmxNetReceiver::UNIVERSE_COUNT;
+const int DmxNetReceiver::PACKET_MAX_LENGTH = 640;
+const int DmxNetReceiver::SEQUENCE_WINDOW = 20; /* as specified by E1.31 */
+
+
+DmxNetReceiver::DmxNetReceiver( PROTOCOL protocol, int port )
+: protocol_( protocol ), universeIndex_( UNIVERSE_COUNT, -1 ), running_( false ),
+  frameCallback_( 0 ), frameCallbackData_( 0 ), packetCallback_( 0 ), packetCallbackData_( 0 ),
+  groupErrorCount_( 0 )
+{
+	if ( port > 0 ) port_ = port;
+	else port_ = ( protocol == PROTOCOL_ARTNET ) ? DmxArtNetDevice::PORT : DmxSacnDevice::PORT;
+}
+
+DmxNetReceiver::~DmxNetReceiver()
+{
+	stop();
+	for ( unsigned int i = 0; i < universes_.size(); i++ ) {
+		delete universes_[i]->frames;
+		delete universes_[i];
+	}
+}
+
+
+/*
+ * Receive the given universe (an Art-Net port-address or an sACN universe
+ * number). Universes cannot be added while the receiver is running.
+ *
+ * Returns: 0 on success (also if the universe had already been added), or < 0
+ * if an error occured.
+ */
+int DmxNetReceiver::addUniverse( int universe )
+{
+	if ( universe < 0 || universe >= UNIVERSE_COUNT ) return RV_UNIVERSE_INVALID;
+	if ( running_ ) return RV_RUNNING;
+	if ( universeIndex_[universe] >= 0 ) return 0;
+	
+	universeSlot* u = new universeSlot();
+	u->number = universe;
+	u->frames = new DmxFrameRing( RING_CAPACITY );
+	u->writing = false;
+	u->lastSequence = -1;
+	std::memset( &u->lastSource, 0, sizeof( u->lastSource ) );
+	
+	universeIndex_[universe] = universes_.size();
+	universes_.push_back( u );
+	return 0;
+}
+
+/*
+ * Set a function to be called with every new frame (see frameCallback). It
+ * cannot be changed while the receiver is running.
+ */
+void DmxNetReceiver::setFrameCallback( frameCallback cb, void* userData )
+{
+	if ( running_ ) return;
+	frameCallback_ = cb;
+	frameCallbackData_ = userData;
+}
+
+/*
+ * Set a function to be called with every packet received for an added
+ * universe (see packetCallback), e.g. DmxSacnArbiter::onPacket(). It cannot be
+ * changed while the receiver is running.
+ */
+void DmxNetReceiver::setPacketCallback( packetCallback cb, void* userData )
+{
+	if ( running_ ) return;
+	packetCallback_ = cb;
+	packetCallbackData_ = userData;
+}
+
+/*
+ * Open the sockets and start the given number of receiving threads. If an
+ * interface address is given, sACN multicast groups are joined on that
+ * interface. Failing to join a group is counted (see getStats()) but not
+ * fatal, since the data may still arrive by unicast.
+ *
+ * Returns: true if the receiver has been started or already was running, false
+ * otherwise (see getLastError()).
+ */
+bool DmxNetReceiver::start( int shardCount, const char* interfaceAddress )
+{
+	if ( running_ ) return true;
+	if ( shardCount < 1 ) shardCount = 1;
+	if ( shardCount > SHARD_COUNT_MAX ) shardCount = SHARD_COUNT_MAX;
+	
+	for ( int i = 0; i < shardCount; i++ ) {
+		shard* s = new shard();
+		s->socket = new DmxNetSocket();
+		s->thread = 0;
+		s->receivesBroadcast = ( i == 0 );
+		s->packetCount = s->frameCount = s->discardedCount = s->ignoredCount = s->outOfOrderCount = 0;
+		s->duplicateCount = 0;
+		shards_.push_back( s );
+		
+		if ( ! openShard( s, i, shardCount, interfaceAddress ) ) {
+			lastError_ = s->socket->getLastError();
+			stop();
+			return false;
+		}
+	}
+	
+	running_ = true;
+	for ( unsigned int i = 0; i < shards_.size(); i++ ) {
+		shards_[i]->thread = new std::thread( &DmxNetReceiver::run, this, shards_[i] );
+	}
+	
+	return true;
+}
+
+/*
+ * Stop the receiving threads and close the sockets. The frames received remain
+ * available.
+ */
+void DmxNetReceiver::stop()
+{
+	running_ = false;
+	
+	for ( unsigned int i = 0; i < shards_.size(); i++ ) {
+		shard* s = shards_[i];
+		if ( s->thread != 0 ) {
+			s->thread->join();
+			delete s->thread;
+		}
+		delete s->socket;
+		delete s;
+	}
+	shards_.clear();
+}
+
+bool DmxNetReceiver::isRunning() const
+{
+	return running_;
+}
+
+/*
+ * Copy the most recent frame (start code included) of the given universe and
+ * optionally return its sequence number in the universe's ring.
+ *
+ * Returns: true if successful, false if nothing has been received yet or the
+ * universe has not been added.
+ */
+bool DmxNetReceiver::readUniverse( int universe, DmxFrameBuffer* frame, uint64_t* sequence ) const
+{
+	const DmxFrameRing* ring = getUniverseFrames( universe );
+	return ring != 0 && ring->readLatest( frame, sequence );
+}
+
+/*
+ * Returns the ring holding the most recently received frames of the given
+ * universe, or NULL if it has not been added.
+ */
+const DmxFrameRing* DmxNetReceiver::getUniverseFrames( int universe ) const
+{
+	if ( universe < 0 || universe >= UNIVERSE_COUNT ) return 0;
+	int index = universeIndex_[universe];
+	return ( index >= 0 ) ? universes_[index]->frames : 0;
+}
+
+DmxNetReceiver::PROTOCOL DmxNetReceiver::getProtocol() const
+{
+	return protocol_;
+}
+
+int DmxNetReceiver::getPort() const
+{
+	return port_;
+}
+
+/*
+ * Retrieve packet counts summed over all shards since the receiver has been
+ * started.
+ */
+void DmxNetReceiver::getStats( receiverStats* stats ) const
+{
+	std::memset( stats, 0, sizeof( *stats ) );
+	
+	for ( unsigned int i = 0; i < shards_.size(); i++ ) {
+		const shard* s = shards_[i];
+		stats->packetCount += s->packetCount;
+		stats->frameCount += s->frameCount;
+		stats->discardedCount += s->discardedCount;
+		stats->ignoredCount += s->ignoredCount;
+		stats->outOfOrderCount += s->outOfOrderCount;
+		stats->duplicateCount += s->duplicateCount;
+		stats->syscallCount += s->socket->getSyscallCount();
+	}
+	stats->groupErrorCount = groupErrorCount_;
+}
+
+const char* DmxNetReceiver::getLastError() const
+{
+	return lastError_.c_str();
+}
+
+
+/*********************
+ * PRIVATE FUNCTIONS *
+ *********************/
+
+/*
+ * Open the socket of a shard. For sACN, the shard joins the multicast groups of
+ * every universe whose index modulo the shard count equals its own index, so
+ * the kernel delivers each universe's multicast traffic to one shard only.
+ * With several shards, each one looks up the destination of its packets, so
+ * the copies of a broadcast packet can be told apart from unicast traffic.
+ * NOTE: Linux allows 20 group memberships per socket by default (see
+ * net.ipv4.igmp_max_memberships); more universes per shard need a higher limit.
+ */
+bool DmxNetReceiver::openShard( shard* s, int index, int count, const char* interfaceAddress )
+{
+	DmxNetSocket* socket = s->socket;
+	
+	if ( ! socket->open( port_, true ) ) return false;
+	if ( ! socket->setReceiveTimeout( RECEIVE_TIMEOUT ) ) return false;
+	socket->setReceiveBufferSize( RECEIVE_BUFFER_SIZE );
+	socket->setReceiveTimestamps( true );
+	if ( count > 1 ) socket->setReceiveDestination( true );
+	
+	if ( protocol_ != PROTOCOL_SACN ) return true;
+	
+	//only receive groups joined on this socket, not those of the other shards
+	socket->setMulticastAll( false );
+	
+	for ( unsigned int i = index; i < universes_.size(); i += count ) {
+		int number = universes_[i]->number;
+		if ( number < 1 || number > DmxSacnDevice::UNIVERSE_MAX ) continue;
+		
+		struct sockaddr_in group;
+		DmxSacnDevice::getMulticastAddress( number, &group );
+		if ( ! socket->joinGroup( &group, interfaceAddress ) ) groupErrorCount_++;
+	}
+	
+	return true;
+}
+
+/*
+ * The loop of a receiving thread: read packets in batches until stopped and
+ * store the DMX frames of the added universes.
+ */
+void DmxNetReceiver::run( shard* s )
+{
+	DmxNetSocket::message messages[DmxNetSocket::BATCH_MAX];
+	std::vector<unsigned char> buffer( DmxNetSocket::BATCH_MAX * PACKET_MAX_LENGTH );
+	
+	for ( int i = 0; i < DmxNetSocket::BATCH_MAX; i++ ) {
+		messages[i].data = &buffer[i * PACKET_MAX_LENGTH];
+		messages[i].capacity = PACKET_MAX_LENGTH;
+	}
+	
+	while ( running_ ) {
+		int count = s->socket->receiveBatch( messages, DmxNetSocket::BATCH_MAX );
+		if ( count < 0 ) {
+			//do not spin on a persistent error
+			usleep( RECEIVE_TIMEOUT * 1000 );
+			continue;
+		}
+		
+		s->packetCount += count;
+		for ( int i = 0; i < count; i++ ) {
+			const DmxNetSocket::message& m = messages[i];
+			DmxNetDevice::packetInfo info;
+			
+			//every shard gets a copy of a broadcast packet, only one may decode it
+			if ( m.broadcast && ! s->receivesBroadcast ) {
+				s->duplicateCount++;
+				continue;
+			}
+			
+			int r = ( protocol_ == PROTOCOL_ARTNET )
+					? DmxArtNetDevice::parsePacket( m.data, m.length, &info )
+					: DmxSacnDevice::parsePacket( m.data, m.length, &info );
+			if ( r < 0 ) {
+				s->discardedCount++;
+				continue;
+			}
+			
+			int index = universeIndex_[info.universe & ( UNIVERSE_COUNT - 1 )];
+			if ( index >= 0 && packetCallback_ != 0 ) packetCallback_( &info, m.timestamp, packetCallbackData_ );
+			
+			bool skip = ( index < 0 || info.startCode != 0 );
+			if ( info.options & ( DmxSacnDevice::OPTION_PREVIEW_DATA | DmxSacnDevice::OPTION_STREAM_TERMINATED ) ) skip = true;
+			if ( skip ) {
+				s->ignoredCount++;
+				continue;
+			}
+			
+			storeFrame( universes_[index], &info, &m, s );
+		}
+	}
+}
+
+/*
+ * Decode a packet into the next frame of a universe. Any shard may receive any
+ * universe with unicast traffic, so writers take the universe's lock; it is
+ * only contended if several shards receive the same universe at once. The
+ * frame callback is called after releasing it, so a slow callback does not
+ * make other shards spin.
+ */
+void DmxNetReceiver::storeFrame( universeSlot* u, const DmxNetDevice::packetInfo* info,
+																 const DmxNetSocket::message* m, shard* s )
+{
+	while ( u->writing.exchange( true, std::memory_order_acquire ) ) { /* spin */ }
+	
+	//sequence numbers are per source, so only compare with the previous packet's one
+	bool sameSource = ( m->source.sin_addr.s_addr == u->lastSource.sin_addr.s_addr &&
+										 m->source.sin_port == u->lastSource.sin_port );
+	if ( info->sequence >= 0 && u->lastSequence >= 0 && sameSource ) {
+		int diff = (signed char)( info->sequence - u->lastSequence );
+		if ( diff <= 0 && diff > -SEQUENCE_WINDOW ) {
+			u->writing.store( false, std::memory_order_release );
+			s->outOfOrderCount++;
+			return;
+		}
+	}
+	u->lastSequence = info->sequence;
+	u->lastSource = m->source;
+	
+	DmxFrameBuffer* f = u->frames->beginWrite();
+	f->data[0] = info->startCode;
+	std::memcpy( f->data + 1, info->slots, info->slotCount );
+	f->length = 1 + info->slotCount;
+	f->timestamp = m->timestamp;
+	u->frames->commitWrite();
+	s->frameCount++;
+	
+	u->writing.store( false, std::memory_order_release );
+	
+	if ( frameCallback_ != 0 ) frameCallback_( u->number, f, frameCallbackData_ );
+}
@@ -0,0 +1,126 @@
+/*
+ */
+#ifndef DMX_NET_RECEIVER_H
+#define DMX_NET_RECEIVER_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "DmxFrameBuffer.h"
+#include "DmxNetDevice.h"
+#include "DmxNetSocket.h"
+
+class DmxFrameRing;
+
+class DmxNetReceiver {
+public:
+	enum PROTOCOL {
+		PROTOCOL_ARTNET,
+		PROTOCOL_SACN
+	};
+	
+	/*
+	 * Called on a receiving thread with every new frame stored for a universe,
+	 * after the universe has been unlocked. The frame is the one in the
+	 * universe's ring and is only valid during the call; since other shards
+	 * may store frames of the same universe meanwhile, it should be copied out
+	 * right away rather than used for anything slow like a USB transfer.
+	 */
+	typedef void (*frameCallback)( int universe, const DmxFrameBuffer* frame, void* userData );
+	
+	/*
+	 * Called on a receiving thread with every valid packet of an added universe,
+	 * whatever its start code or options, before it is stored. Several threads
+	 * may call it at once, also for the same universe.
+	 */
+	typedef void (*packetCallback)( const DmxNetDevice::packetInfo* info, uint64_t timestamp, void* userData );
+	
+	struct receiverStats {
+		unsigned long packetCount;
+		unsigned long frameCount;
+		unsigned long discardedCount; /* not a DMX data packet */
+		unsigned long ignoredCount; /* universe not added, or not null start code data */
+		unsigned long outOfOrderCount;
+		unsigned long duplicateCount; /* broadcast copies dropped by all but the first shard */
+		unsigned long syscallCount;
+		unsigned long groupErrorCount;
+	};
+	
+	static const int SHARD_COUNT_MAX;
+	static const int RING_CAPACITY;
+	static const int RECEIVE_TIMEOUT;
+	static const int RECEIVE_BUFFER_SIZE;
+	
+	static const int RV_UNIVERSE_INVALID;
+	static const int RV_RUNNING;
+
+
+	DmxNetReceiver( PROTOCOL protocol, int port = 0 );
+	~DmxNetReceiver();
+	
+	int addUniverse( int universe );
+	void setFrameCallback( frameCallback cb, void* userData = 0 );
+	void setPacketCallback( packetCallback cb, void* userData = 0 );
+	
+	bool start( int shardCount = 1, const char* interfaceAddress = 0 );
+	void stop();
+	bool isRunning() const;
+	
+	bool readUniverse( int universe, DmxFrameBuffer* frame, uint64_t* sequence = 0 ) const;
+	const DmxFrameRing* getUniverseFrames( int universe ) const;
+	
+	PROTOCOL getProtocol() const;
+	int getPort() const;
+	void getStats( receiverStats* stats ) const;
+	const char* getLastError() const;
+
+private:
+	static const int UNIVERSE_COUNT = 65536;
+	static const int PACKET_MAX_LENGTH;
+	static const int SEQUENCE_WINDOW;
+	
+	struct universeSlot {
+		int number;
+		DmxFrameRing* frames;
+		std::atomic<bool> writing;
+		int lastSequence;
+		struct sockaddr_in lastSource;
+	};
+	
+	struct shard {
+		DmxNetSocket* socket;
+		std::thread* thread;
+		bool receivesBroadcast;
+		std::atomic<uint64_t> packetCount;
+		std::atomic<uint64_t> frameCount;
+		std::atomic<uint64_t> discardedCount;
+		std::atomic<uint64_t> ignoredCount;
+		std::atomic<uint64_t> outOfOrderCount;
+		std::atomic<uint64_t> duplicateCount;
+	};
+	
+	DmxNetReceiver( const DmxNetReceiver& other );
+	DmxNetReceiver& operator=( const DmxNetReceiver& other );
+	
+	bool openShard( shard* s, int index, int count, const char* interfaceAddress );
+	void run( shard* s );
+	void storeFrame( universeSlot* u, const DmxNetDevice::packetInfo* info,
+									 const DmxNetSocket::message* m, shard* s );
+	
+	PROTOCOL protocol_;
+	int port_;
+	std::vector<int> universeIndex_;
+	std::vector<universeSlot*> universes_;
+	std::vector<shard*> shards_;
+	std::atomic<bool> running_;
+	frameCallback frameCallback_;
+	void* frameCallbackData_;
+	packetCallback packetCallback_;
+	void* packetCallbackData_;
+	std::atomic<uint64_t> groupErrorCount_;
+	std::string lastError_;
+};
+
+#endif /* ! DMX_NET_RECEIVER_H */
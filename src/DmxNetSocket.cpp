@@ -0,0 +1,472 @@
+/*
+ * A UDP socket for the network DMX protocols. Its main purpose is sending many
+ * packets at once: on Linux, a batch goes out with sendmmsg(), so driving
+ * hundreds of universes costs a handful of system calls per frame instead of
+ * one per universe. Other platforms fall back to a sendto() per packet.
+ *
+ * A packet which cannot be sent (e.g. because its destination is unreachable)
+ * is counted as an error and skipped, so it does not hold up the rest of the
+ * batch.
+ *
+ * Receiving works the same way: receiveBatch() takes everything waiting on the
+ * socket with a single recvmmsg() call, along with the kernel's receive
+ * timestamps if enabled.
+ */
+#include <cerrno>
+#include <cstring>
+#include <time.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "DmxClock.h"
+#include "DmxNetSocket.h"
+
+const int DmxNetSocket::RV_SOCKET_ERROR = -20000;
+const int DmxNetSocket::RV_ADDRESS_INVALID = -20001;
+const int DmxNetSocket::BATCH_MAX;
+
+
+DmxNetSocket::DmxNetSocket()
+: fd_( -1 ), syscallCount_( 0 ), errorCount_( 0 )
+{ /* empty */ }
+
+DmxNetSocket::~DmxNetSocket()
+{
+	close();
+}
+
+
+/*
+ * Create the socket and bind it to the given local port (0 lets the system
+ * pick one). With reusePort, several sockets (and other applications) can bind
+ * to the same port; the kernel then spreads unicast traffic over them, while
+ * every one of them gets a copy of broadcast traffic.
+ *
+ * Returns: true if the socket is open (also if it already was), false otherwise
+ * (see getLastError()).
+ */
+bool DmxNetSocket::open( int port, bool reusePort )
+{
+	if ( fd_ >= 0 ) return true;
+	
+	fd_ = socket( AF_INET, SOCK_DGRAM, 0 );
+	if ( fd_ < 0 ) {
+		setError( "socket" );
+		return false;
+	}
+	
+	if ( reusePort ) {
+		int value = 1;
+		bool success = setOption( SOL_SOCKET, SO_REUSEADDR, &value, sizeof( value ) );
+#ifdef SO_REUSEPORT
+		if ( success ) success = setOption( SOL_SOCKET, SO_REUSEPORT, &value, sizeof( value ) );
+#endif
+		if ( ! success ) {
+			close();
+			return false;
+		}
+	}
+	
+	struct sockaddr_in local;
+	std::memset( &local, 0, sizeof( local ) );
+	local.sin_family = AF_INET;
+	local.sin_addr.s_addr = htonl( INADDR_ANY );
+	local.sin_port = htons( port );
+	
+	if ( bind( fd_, (struct sockaddr*)&local, sizeof( local ) ) < 0 ) {
+		setError( "bind" );
+		close();
+		return false;
+	}
+	
+	return true;
+}
+
+void DmxNetSocket::close()
+{
+	if ( fd_ < 0 ) return;
+	::close( fd_ );
+	fd_ = -1;
+}
+
+bool DmxNetSocket::isOpen() const
+{
+	return fd_ >= 0;
+}
+
+/*
+ * Allow or disallow sending to broadcast addresses.
+ *
+ * Returns: true on success, false otherwise.
+ */
+bool DmxNetSocket::setBroadcast( bool enabled )
+{
+	int value = enabled ? 1 : 0;
+	return setOption( SOL_SOCKET, SO_BROADCAST, &value, sizeof( value ) );
+}
+
+/*
+ * Set the number of router hops multicast packets may take.
+ */
+bool DmxNetSocket::setMulticastTtl( int ttl )
+{
+	unsigned char value = ttl;
+	return setOption( IPPROTO_IP, IP_MULTICAST_TTL, &value, sizeof( value ) );
+}
+
+/*
+ * Enable or disable delivery of sent multicast packets to receivers on this
+ * host (enabled by default).
+ */
+bool DmxNetSocket::setMulticastLoop( bool enabled )
+{
+	unsigned char value = enabled ? 1 : 0;
+	return setOption( IPPROTO_IP, IP_MULTICAST_LOOP, &value, sizeof( value ) );
+}
+
+/*
+ * Send multicast packets through the interface with the given (dotted)
+ * address instead of the one chosen by the routing table.
+ */
+bool DmxNetSocket::setMulticastInterface( const char* address )
+{
+	struct in_addr value;
+	if ( inet_pton( AF_INET, address, &value ) != 1 ) {
+		lastError_ = std::string( "invalid interface address " ) + address;
+		return false;
+	}
+	return setOption( IPPROTO_IP, IP_MULTICAST_IF, &value, sizeof( value ) );
+}
+
+/*
+ * Select whether the socket receives multicast packets for all groups joined
+ * on the host (the default) or only for those it has joined itself. Only
+ * supported on Linux; elsewhere this fails unless enabling.
+ */
+bool DmxNetSocket::setMulticastAll( bool enabled )
+{
+#ifdef IP_MULTICAST_ALL
+	int value = enabled ? 1 : 0;
+	return setOption( IPPROTO_IP, IP_MULTICAST_ALL, &value, sizeof( value ) );
+#else
+	if ( ! enabled ) lastError_ = "IP_MULTICAST_ALL is not supported";
+	return enabled;
+#endif
+}
+
+/*
+ * Join the given multicast group on the interface with the given (dotted)
+ * address, or on the one chosen by the system if NULL.
+ * NOTE: the number of groups per socket is limited by the system (on Linux,
+ * see net.ipv4.igmp_max_memberships, which defaults to 20).
+ */
+bool DmxNetSocket::joinGroup( const struct sockaddr_in* group, const char* interfaceAddress )
+{
+	struct ip_mreq request;
+	request.imr_multiaddr = group->sin_addr;
+	request.imr_interface.s_addr = htonl( INADDR_ANY );
+	
+	if ( interfaceAddress != 0 && inet_pton( AF_INET, interfaceAddress, &request.imr_interface ) != 1 ) {
+		lastError_ = std::string( "invalid interface address " ) + interfaceAddress;
+		return false;
+	}
+	return setOption( IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof( request ) );
+}
+
+/*
+ * Set the time in milliseconds after which receiveBatch() gives up waiting.
+ */
+bool DmxNetSocket::setReceiveTimeout( int timeout )
+{
+	struct timeval value;
+	value.tv_sec = timeout / 1000;
+	value.tv_usec = ( timeout % 1000 ) * 1000;
+	return setOption( SOL_SOCKET, SO_RCVTIMEO, &value, sizeof( value ) );
+}
+
+/*
+ * Set the size of the kernel's receive buffer in bytes, which absorbs bursts
+ * while the receiving thread is busy. The system may cap it.
+ */
+bool DmxNetSocket::setReceiveBufferSize( int size )
+{
+	return setOption( SOL_SOCKET, SO_RCVBUF, &size, sizeof( size ) );
+}
+
+/*
+ * Enable or disable kernel receive timestamps (see receiveBatch()). Only
+ * supported on Linux.
+ */
+bool DmxNetSocket::setReceiveTimestamps( bool enabled )
+{
+#ifdef SO_TIMESTAMPNS
+	int value = enabled ? 1 : 0;
+	return setOption( SOL_SOCKET, SO_TIMESTAMPNS, &value, sizeof( value ) );
+#else
+	if ( enabled ) lastError_ = "SO_TIMESTAMPNS is not supported";
+	return ! enabled;
+#endif
+}
+
+/*
+ * Enable or disable looking up the destination address of received packets,
+ * so receiveBatch() can flag those sent to a broadcast address. Only supported
+ * on Linux.
+ */
+bool DmxNetSocket::setReceiveDestination( bool enabled )
+{
+#ifdef __linux__
+	int value = enabled ? 1 : 0;
+	return setOption( IPPROTO_IP, IP_PKTINFO, &value, sizeof( value ) );
+#else
+	if ( enabled ) lastError_ = "IP_PKTINFO is not supported";
+	return ! enabled;
+#endif
+}
+
+/*
+ * Send a single packet.
+ *
+ * Returns: the number of bytes sent, or RV_SOCKET_ERROR.
+ */
+int DmxNetSocket::send( const unsigned char* data, int length, const struct sockaddr_in* address )
+{
+	syscallCount_++;
+	ssize_t r = sendto( fd_, data, length, 0, (const struct sockaddr*)address, sizeof( *address ) );
+	if ( r < 0 ) {
+		setError( "sendto" );
+		errorCount_++;
+		return RV_SOCKET_ERROR;
+	}
+	return (int)r;
+}
+
+/*
+ * Send the given packets, using as few system calls as possible. A packet
+ * which fails does not keep the others from being sent; the sent flag of each
+ * packet tells whether it went out.
+ *
+ * Returns: the number of packets sent, or RV_SOCKET_ERROR if the socket is not
+ * open.
+ */
+int DmxNetSocket::sendBatch( packet* packets, int count )
+{
+	for ( int i = 0; i < count; i++ ) packets[i].sent = false;
+	if ( fd_ < 0 ) return RV_SOCKET_ERROR;
+	
+	int sent = 0;
+	int done = 0;
+
+#ifdef __linux__
+	struct mmsghdr msgs[BATCH_MAX];
+	struct iovec iovs[BATCH_MAX];
+	
+	while ( done < count ) {
+		int n = count - done;
+		if ( n > BATCH_MAX ) n = BATCH_MAX;
+		
+		std::memset( msgs, 0, n * sizeof( msgs[0] ) );
+		for ( int i = 0; i < n; i++ ) {
+			const packet& p = packets[done + i];
+			iovs[i].iov_base = const_cast<unsigned char*>( p.data );
+			iovs[i].iov_len = p.length;
+			msgs[i].msg_hdr.msg_name = const_cast<struct sockaddr_in*>( p.address );
+			msgs[i].msg_hdr.msg_namelen = sizeof( *p.address );
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		
+		syscallCount_++;
+		int r = sendmmsg( fd_, msgs, n, 0 );
+		if ( r < 0 ) {
+			if ( errno == EINTR ) continue;
+			//the first packet failed, skip it and carry on with the rest
+			setError( "sendmmsg" );
+			errorCount_++;
+			done++;
+			continue;
+		}
+		
+		for ( int i = 0; i < r; i++ ) packets[done + i].sent = true;
+		sent += r;
+		done += r;
+	}
+#else
+	for ( ; done < count; done++ ) {
+		packet& p = packets[done];
+		p.sent = ( send( p.data, p.length, p.address ) >= 0 );
+		if ( p.sent ) sent++;
+	}
+#endif
+
+	return sent;
+}
+
+/*
+ * Receive up to count (at most BATCH_MAX) packets into the given messages,
+ * waiting for the first one until the receive timeout expires. Packets longer
+ * than a message's capacity are truncated.
+ * Timestamps are converted from the kernel's receive time if available (see
+ * setReceiveTimestamps()), otherwise they are taken after receiving. Packets
+ * are flagged as broadcast only if setReceiveDestination() is enabled: their
+ * destination is then neither a multicast group nor the local address of the
+ * receiving interface.
+ *
+ * Returns: the number of packets received, 0 on timeout, or RV_SOCKET_ERROR.
+ */
+int DmxNetSocket::receiveBatch( message* messages, int count )
+{
+	if ( fd_ < 0 ) return RV_SOCKET_ERROR;
+	if ( count > BATCH_MAX ) count = BATCH_MAX;
+	
+#ifdef __linux__
+	struct mmsghdr msgs[BATCH_MAX];
+	struct iovec iovs[BATCH_MAX];
+	union {
+		struct cmsghdr align;
+		char buffer[CMSG_SPACE( sizeof( struct timespec ) ) + CMSG_SPACE( sizeof( struct in_pktinfo ) )];
+	} controls[BATCH_MAX];
+	
+	std::memset( msgs, 0, count * sizeof( msgs[0] ) );
+	for ( int i = 0; i < count; i++ ) {
+		iovs[i].iov_base = messages[i].data;
+		iovs[i].iov_len = messages[i].capacity;
+		msgs[i].msg_hdr.msg_name = &messages[i].source;
+		msgs[i].msg_hdr.msg_namelen = sizeof( messages[i].source );
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = controls[i].buffer;
+		msgs[i].msg_hdr.msg_controllen = sizeof( controls[i].buffer );
+	}
+	
+	syscallCount_++;
+	int r = recvmmsg( fd_, msgs, count, MSG_WAITFORONE, 0 );
+	if ( r < 0 ) {
+		if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) return 0;
+		setError( "recvmmsg" );
+		errorCount_++;
+		return RV_SOCKET_ERROR;
+	}
+	
+	//kernel timestamps are on the realtime clock, DmxClock is monotonic
+	uint64_t now = DmxClock::now();
+	struct timespec realtime;
+	clock_gettime( CLOCK_REALTIME, &realtime );
+	int64_t offset = (int64_t)realtime.tv_sec * 1000000000 + realtime.tv_nsec - (int64_t)now;
+	
+	for ( int i = 0; i < r; i++ ) {
+		messages[i].length = msgs[i].msg_len;
+		messages[i].timestamp = now;
+		messages[i].broadcast = false;
+		
+		struct cmsghdr* cmsg;
+		for ( cmsg = CMSG_FIRSTHDR( &msgs[i].msg_hdr ); cmsg != 0; cmsg = CMSG_NXTHDR( &msgs[i].msg_hdr, cmsg ) ) {
+			if ( cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO ) {
+				struct in_pktinfo info;
+				std::memcpy( &info, CMSG_DATA( cmsg ), sizeof( info ) );
+				messages[i].broadcast = ( info.ipi_addr.s_addr != info.ipi_spec_dst.s_addr &&
+																	! IN_MULTICAST( ntohl( info.ipi_addr.s_addr ) ) );
+				continue;
+			}
+			if ( cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SO_TIMESTAMPNS ) continue;
+			
+			struct timespec ts;
+			std::memcpy( &ts, CMSG_DATA( cmsg ), sizeof( ts ) );
+			int64_t t = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec - offset;
+			if ( t > 0 && (uint64_t)t <= now ) messages[i].timestamp = t;
+		}
+	}
+	
+	return r;
+#else
+	int received = 0;
+	for ( ; received < count; received++ ) {
+		message& m = messages[received];
+		socklen_t addressLength = sizeof( m.source );
+		
+		syscallCount_++;
+		ssize_t r = recvfrom( fd_, m.data, m.capacity, received > 0 ? MSG_DONTWAIT : 0,
+												 (struct sockaddr*)&m.source, &addressLength );
+		if ( r < 0 ) {
+			if ( received > 0 || errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) break;
+			setError( "recvfrom" );
+			errorCount_++;
+			return RV_SOCKET_ERROR;
+		}
+		m.length = r;
+		m.timestamp = DmxClock::now();
+		m.broadcast = false;
+	}
+	return received;
+#endif
+}
+
+/*
+ * Return the number of send and receive calls made (with sendmmsg() and
+ * recvmmsg(), one per batch of up to BATCH_MAX packets).
+ */
+unsigned long DmxNetSocket::getSyscallCount() const
+{
+	return syscallCount_;
+}
+
+unsigned long DmxNetSocket::getErrorCount() const
+{
+	return errorCount_;
+}
+
+const char* DmxNetSocket::getLastError() const
+{
+	return lastError_.c_str();
+}
+
+/*
+ * Fill in the socket address for the given host name or dotted address and
+ * port. The socket does not need to be open for this.
+ *
+ * Returns: true if the host could be resolved, false otherwise.
+ */
+bool DmxNetSocket::resolveAddress( const char* host, int port, struct sockaddr_in* address )
+{
+	std::memset( address, 0, sizeof( *address ) );
+	address->sin_family = AF_INET;
+	address->sin_port = htons( port );
+	
+	if ( inet_pton( AF_INET, host, &address->sin_addr ) == 1 ) return true;
+	
+	struct addrinfo hints;
+	struct addrinfo* result = 0;
+	std::memset( &hints, 0, sizeof( hints ) );
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	
+	if ( getaddrinfo( host, 0, &hints, &result ) != 0 || result == 0 ) {
+		lastError_ = std::string( "cannot resolve host " ) + host;
+		return false;
+	}
+	address->sin_addr = ( (struct sockaddr_in*)result->ai_addr )->sin_addr;
+	freeaddrinfo( result );
+	
+	return true;
+}
+
+
+/*********************
+ * PRIVATE FUNCTIONS *
+ *********************/
+
+bool DmxNetSocket::setOption( int level, int name, const void* value, int length )
+{
+	if ( setsockopt( fd_, level, name, value, length ) < 0 ) {
+		setError( "setsockopt" );
+		return false;
+	}
+	return true;
+}
+
+void DmxNetSocket::setError( const char* function )
+{
+	lastError_ = std::string( function ) + ": " + std::strerror( errno );
+}
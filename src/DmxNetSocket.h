@@ -0,0 +1,74 @@
+/*
+ */
+#ifndef DMX_NET_SOCKET_H
+#define DMX_NET_SOCKET_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <netinet/in.h>
+
+class DmxNetSocket {
+public:
+	struct packet {
+		const unsigned char* data;
+		int length;
+		const struct sockaddr_in* address;
+		bool sent; /* set by sendBatch() */
+	};
+	
+	struct message {
+		unsigned char* data;
+		int capacity;
+		int length;
+		uint64_t timestamp; /* see DmxClock */
+		struct sockaddr_in source;
+		bool broadcast; /* see setReceiveDestination() */
+	};
+	
+	static const int RV_SOCKET_ERROR;
+	static const int RV_ADDRESS_INVALID;
+	static const int BATCH_MAX = 64;
+
+
+	DmxNetSocket();
+	~DmxNetSocket();
+	
+	bool open( int port = 0, bool reusePort = false );
+	void close();
+	bool isOpen() const;
+	bool setBroadcast( bool enabled );
+	bool setMulticastTtl( int ttl );
+	bool setMulticastLoop( bool enabled );
+	bool setMulticastInterface( const char* address );
+	bool setMulticastAll( bool enabled );
+	bool joinGroup( const struct sockaddr_in* group, const char* interfaceAddress = 0 );
+	bool setReceiveTimeout( int timeout );
+	bool setReceiveBufferSize( int size );
+	bool setReceiveTimestamps( bool enabled );
+	bool setReceiveDestination( bool enabled );
+	
+	int send( const unsigned char* data, int length, const struct sockaddr_in* address );
+	int sendBatch( packet* packets, int count );
+	int receiveBatch( message* messages, int count );
+	
+	unsigned long getSyscallCount() const;
+	unsigned long getErrorCount() const;
+	const char* getLastError() const;
+	
+	bool resolveAddress( const char* host, int port, struct sockaddr_in* address );
+
+private:
+	DmxNetSocket( const DmxNetSocket& other );
+	DmxNetSocket& operator=( const DmxNetSocket& other );
+	
+	bool setOption( int level, int name, const void* value, int length );
+	void setError( const char* function );
+	
+	int fd_;
+	std::string lastError_;
+	std::atomic<uint64_t> syscallCount_;
+	std::atomic<uint64_t> errorCount_;
+};
+
+#endif /* ! DMX_NET_SOCKET_H */
@@ -1,13 +1,68 @@
 /*
  * NOTE: this code has not been tested!
+ *
+ * By default, the chip is driven in bit-bang mode (see setOutputMode()). The
+ * complete waveform, including break and MAB, is rendered into a buffer with
+ * one sample per bit and sent in a single bulk write, so timing is exact, no
+ * control requests are needed per frame and consecutive frames follow each
+ * other on the line without gaps.
+ *
+ * Chips without bit-bang support are driven as a UART instead. The break is
+ * then generated by toggling the break condition through line property
+ * requests. Since those take effect immediately, each frame first waits for the
+ * previous one to have left the transmitter, then holds the break (and
+ * mark-after-break) for the configured time measured on the monotonic clock
+ * instead of however long the USB requests happen to take. The two extra
+ * requests per frame lower the achievable refresh rate somewhat.
  */
 #include <assert.h>
+#include <cstring>
+#include <math.h> /* for ceilf() */
+#include "DmxClock.h"
 #include "DmxDevice.h"
+#include "DmxKernels.h"
 #include "DmxRawDevice.h"
 
+/* maximum DMX512 refresh rate for a full universe: break (88us) + MAB (8us) + 513 * 44us
+ * is 44.1Hz; with the default break timing, a bit-bang frame takes 22684us (44.08Hz) */
+const float DmxRawDevice::OUTPUT_RATE_MAX = 44.0f;
+const float DmxRawDevice::BREAK_TIME_DEFAULT = 100.0f; /* in microseconds */
+const float DmxRawDevice::MAB_TIME_DEFAULT = 12.0f; /* in microseconds */
+/* NOTE: the factor of 64 is made up of two parts, only the first of which holds
+ * for every chip type:
+ * - libftdi multiplies the requested rate by 4 whenever bit-bang mode is enabled
+ *   (see ftdi_set_baudrate()), so the chip is set to 15624 baud, which its 3MHz
+ *   baud rate generator rounds to 15625 (divisor 192);
+ * - the FT232R and FT245R clock asynchronous bit-bang samples at 16 times the
+ *   baud rate (FTDI AN232R-01), giving exactly 250000 samples/s, one per 4us DMX
+ *   bit. The FT2232C/D have the same baud rate generator and are assumed to
+ *   behave alike. The H series (FT232H, FT2232H, FT4232H) derive the rate from a
+ *   12MHz base instead; for those (and anything else not listed here), check
+ *   the bit time with a scope and adjust with setBitBangBaudRate().
+ * The test emulator (tests/FtdiEmulator.cpp) models the FT232R. */
+const int DmxRawDevice::BITBANG_BAUD_RATE_DEFAULT = 250000 / 64;
+
+//private constants
+const float DmxRawDevice::SLOT_TIME = 44.0f; /* in microseconds (11 bits at 250kbit/s) */
+const float DmxRawDevice::BIT_TIME = 4.0f; /* in microseconds */
+const unsigned char DmxRawDevice::BITBANG_TX_PIN = 0x01; /* TXD is D0 */
+/* NOTE: timer slack and wakeup latency of a sleeping thread are typically below this */
+const uint64_t DmxRawDevice::SPIN_TIME = 200000; /* in nanoseconds */
+/* NOTE: a control request on a full speed bus usually completes well within this */
+const float DmxRawDevice::REQUEST_TIME = 1000.0f; /* in microseconds */
+
+
 DmxRawDevice::DmxRawDevice()
+: breakTime_( BREAK_TIME_DEFAULT ), mabTime_( MAB_TIME_DEFAULT ),
+  outputMode_( OUTPUT_MODE_BITBANG ), bitBangBaudRate_( BITBANG_BAUD_RATE_DEFAULT ), txDrainedTime_( 0 ),
+  measuredBreakTime_( 0 ), measuredMabTime_( 0 )
 { /* empty */ }
 
+DmxRawDevice::~DmxRawDevice()
+{
+	stopOutputThread();
+}
+
 
 bool DmxRawDevice::open( const char* description, const char* serial, int index )
 {
@@ -15,11 +70,17 @@ bool DmxRawDevice::open( const char* description, const char* serial, int index
 	
 	if ( success ) {
 		ftdiDevice_->reset();
-		success = ftdiDevice_->setBaudRate( 250000 );
-		if ( success ) success = ftdiDevice_->setLineProperties( FtdiDevice::DBITS_8, FtdiDevice::SBITS_2, FtdiDevice::PAR_NONE );
-		if ( success ) success = ftdiDevice_->setFlowControl( FtdiDevice::FLOW_NONE );
-		if ( success ) success = ftdiDevice_->setRts( false ) == 0;
-		if ( success ) success = ftdiDevice_->purgeBuffers() == 0;
+		if ( outputMode_ == OUTPUT_MODE_BITBANG ) {
+			success = setupBitBang();
+			//fall back to the UART for chips without bit-bang support
+			if ( ! success ) {
+				outputMode_ = OUTPUT_MODE_UART;
+				success = setupUart();
+			}
+		} else {
+			success = setupUart();
+		}
+		if ( success ) autoTune();
 		
 		if ( ! success ) close();
 	}
@@ -30,12 +91,209 @@ bool DmxRawDevice::open( const char* description, const char* serial, int index
 int DmxRawDevice::writeDmx( const unsigned char* data, int length ) const
 {
 	assert( length <= 513 );
-	ftdiDevice_->setBreak( FtdiDevice::BRK_ON );
-	ftdiDevice_->setBreak( FtdiDevice::BRK_OFF );
-	return ftdiDevice_->writeData( data, length );
+	if ( ! isOpen() ) return DmxDevice::RV_DEVICE_NOT_OPEN;
+	
+	return ( outputMode_ == OUTPUT_MODE_BITBANG ) ? writeBitBang( data, length ) : writeUart( data, length );
 }
 
 DmxDevice::DMX_DEVICE_TYPE DmxRawDevice::getType() const
 {
 	return DmxDevice::DMX_DEVICE_RAW;
 }
+
+/*
+ * Returns the rate at which full universes can be sent in the current output
+ * mode with the configured break timing, at most OUTPUT_RATE_MAX. In UART mode,
+ * this allows for the two break requests sent with every frame.
+ */
+float DmxRawDevice::getDefaultRefreshRate() const
+{
+	float frameTime;
+	if ( outputMode_ == OUTPUT_MODE_BITBANG ) {
+		frameTime = ( ceilf( breakTime_ / BIT_TIME ) + ceilf( mabTime_ / BIT_TIME ) ) * BIT_TIME + 513 * SLOT_TIME;
+	} else {
+		frameTime = breakTime_ + mabTime_ + 513 * SLOT_TIME + 2 * REQUEST_TIME;
+	}
+	
+	float rate = 1000000.0f / frameTime;
+	return ( rate < OUTPUT_RATE_MAX ) ? rate : OUTPUT_RATE_MAX;
+}
+
+/*
+ * Raw devices are only written to, so the latency timer (which only affects
+ * reads) is irrelevant. The write chunk size is set so a complete frame,
+ * including a full bit-bang waveform, goes out in a single USB transfer.
+ */
+bool DmxRawDevice::autoTune()
+{
+	if ( ! isOpen() ) return false;
+	
+	int frameSize = (int)ceilf( ( breakTime_ + mabTime_ ) / BIT_TIME ) + 513 * 11;
+	unsigned int chunkSize = 512;
+	while ( (int)chunkSize < frameSize ) chunkSize *= 2;
+	
+	return ftdiDevice_->setWriteChunkSize( chunkSize );
+}
+
+/*
+ * Set the minimum break and mark-after-break times in microseconds. The actual
+ * times are longer due to USB latency; see getMeasuredBreakTime() and
+ * getMeasuredMabTime().
+ */
+void DmxRawDevice::setBreakTiming( float breakTime, float mabTime )
+{
+	breakTime_ = breakTime;
+	mabTime_ = mabTime;
+}
+
+/*
+ * Returns the time in microseconds between the requests starting and ending the
+ * break of the last frame. In bit-bang mode, this is the exact rendered time.
+ */
+float DmxRawDevice::getMeasuredBreakTime() const
+{
+	return measuredBreakTime_;
+}
+
+/*
+ * Returns the time in microseconds between the request ending the break and the
+ * start of the data write of the last frame. In bit-bang mode, this is the exact
+ * rendered time.
+ */
+float DmxRawDevice::getMeasuredMabTime() const
+{
+	return measuredMabTime_;
+}
+
+/*
+ * Select whether frames are sent as a rendered waveform in bit-bang mode (the
+ * default) or using the UART with break requests. Bit-bang mode requires a
+ * chip supporting it (e.g. an FT232R) with TXD wired to the DMX line driver;
+ * open() falls back to UART mode if the chip does not support it.
+ * The mode may be changed while the device is open, but not while its output
+ * thread is running.
+ *
+ * Returns: true if the mode could be set, false otherwise.
+ */
+bool DmxRawDevice::setOutputMode( OUTPUT_MODE mode )
+{
+	if ( isOutputThreadRunning() ) return false;
+	
+	bool success = true;
+	if ( isOpen() && mode != outputMode_ ) {
+		success = ( mode == OUTPUT_MODE_BITBANG ) ? setupBitBang() : setupUart();
+	}
+	if ( success ) outputMode_ = mode;
+	
+	return success;
+}
+
+DmxRawDevice::OUTPUT_MODE DmxRawDevice::getOutputMode() const
+{
+	return outputMode_;
+}
+
+/*
+ * Set the baud rate which determines the bit-bang sample clock (see
+ * BITBANG_BAUD_RATE_DEFAULT). Takes effect when bit-bang mode is next set up.
+ */
+void DmxRawDevice::setBitBangBaudRate( int baudRate )
+{
+	bitBangBaudRate_ = baudRate;
+}
+
+
+/*********************
+ * PRIVATE FUNCTIONS *
+ *********************/
+
+bool DmxRawDevice::setupUart()
+{
+	bool success = ftdiDevice_->setBitMode( 0, FtdiDevice::BMODE_RESET );
+	if ( success ) success = ftdiDevice_->setBaudRate( 250000 );
+	if ( success ) success = ftdiDevice_->setLineProperties( FtdiDevice::DBITS_8, FtdiDevice::SBITS_2, FtdiDevice::PAR_NONE );
+	if ( success ) success = ftdiDevice_->setFlowControl( FtdiDevice::FLOW_NONE );
+	if ( success ) success = ftdiDevice_->setRts( false ) == 0;
+	if ( success ) success = ftdiDevice_->purgeBuffers() == 0;
+	return success;
+}
+
+bool DmxRawDevice::setupBitBang()
+{
+	bool success = ftdiDevice_->setBitMode( BITBANG_TX_PIN, FtdiDevice::BMODE_BITBANG );
+	if ( success ) success = ftdiDevice_->setBaudRate( bitBangBaudRate_ );
+	if ( success ) success = ftdiDevice_->setFlowControl( FtdiDevice::FLOW_NONE );
+	if ( success ) success = ftdiDevice_->purgeBuffers() == 0;
+	
+	//idle the line (mark) until the first frame is sent
+	if ( success ) success = ftdiDevice_->writeData( &BITBANG_TX_PIN, 1 ) == 1;
+	return success;
+}
+
+/*
+ * Sleep until shortly before the given monotonic time (see DmxClock), then spin
+ * for the remainder so break and MAB are timed without scheduler latency.
+ */
+void DmxRawDevice::waitUntil( uint64_t deadline )
+{
+	uint64_t now = DmxClock::now();
+	if ( deadline > now + SPIN_TIME ) DmxClock::sleepUntil( deadline - SPIN_TIME );
+	while ( DmxClock::now() < deadline ) { /* spin */ }
+}
+
+int DmxRawDevice::writeUart( const unsigned char* data, int length ) const
+{
+	//a break while the previous frame is still being shifted out would truncate it
+	waitUntil( txDrainedTime_ );
+	
+	int r = ftdiDevice_->setBreak( FtdiDevice::BRK_ON );
+	if ( r <= 0 ) return r < 0 ? r : -1;
+	uint64_t tBreak = DmxClock::now();
+	waitUntil( tBreak + (uint64_t)( breakTime_ * 1000 ) );
+	
+	r = ftdiDevice_->setBreak( FtdiDevice::BRK_OFF );
+	if ( r <= 0 ) return r < 0 ? r : -1;
+	uint64_t tMark = DmxClock::now();
+	waitUntil( tMark + (uint64_t)( mabTime_ * 1000 ) );
+	
+	uint64_t tData = DmxClock::now();
+	r = ftdiDevice_->writeData( data, length );
+	
+	measuredBreakTime_ = ( tMark - tBreak ) / 1000.0f;
+	measuredMabTime_ = ( tData - tMark ) / 1000.0f;
+	//The chip starts shifting out as soon as the first bytes arrive and the write only
+	//returns once the rest fits into its transmit FIFO, so time the drain from the start
+	//of the write (allowing one slot for the data reaching the chip after the request).
+	txDrainedTime_ = tData + (uint64_t)( ( length + 1 ) * SLOT_TIME * 1000 );
+	
+	return r;
+}
+
+/*
+ * Render break, mark-after-break and the data as one waveform and send it in a
+ * single write. The line is left high (mark) afterwards by the stop bits.
+ *
+ * Returns: the number of DMX bytes written or a value < 0 on error.
+ */
+int DmxRawDevice::writeBitBang( const unsigned char* data, int length ) const
+{
+	int breakSamples = (int)ceilf( breakTime_ / BIT_TIME );
+	int mabSamples = (int)ceilf( mabTime_ / BIT_TIME );
+	int total = breakSamples + mabSamples + length * 11;
+	
+	if ( (int)waveform_.size() < total ) waveform_.resize( total );
+	unsigned char* w = &waveform_[0];
+	
+	std::memset( w, 0, breakSamples );
+	std::memset( w + breakSamples, BITBANG_TX_PIN, mabSamples );
+	DmxKernels::renderSerialBits( data, length, w + breakSamples + mabSamples, BITBANG_TX_PIN );
+	
+	int r = ftdiDevice_->writeData( w, total );
+	
+	measuredBreakTime_ = breakSamples * BIT_TIME;
+	measuredMabTime_ = mabSamples * BIT_TIME;
+	
+	if ( r < 0 ) return r;
+	if ( r == total ) return length;
+	return ( r > breakSamples + mabSamples ) ? ( r - breakSamples - mabSamples ) / 11 : 0;
+}
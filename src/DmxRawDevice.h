@@ -4,19 +4,62 @@
 #ifndef DMX_RAW_DEVICE_H
 #define DMX_RAW_DEVICE_H
 
+#include <stdint.h>
+#include <vector>
 #include "DmxDevice.h"
 
 class DmxRawDevice : public DmxDevice {
 public:
+	enum OUTPUT_MODE {
+		OUTPUT_MODE_UART,
+		OUTPUT_MODE_BITBANG
+	};
+	
+	static const float OUTPUT_RATE_MAX;
+	static const float BREAK_TIME_DEFAULT;
+	static const float MAB_TIME_DEFAULT;
+	static const int BITBANG_BAUD_RATE_DEFAULT;
+	
 	DmxRawDevice();
+	~DmxRawDevice();
 	
 	bool open( const char* description = 0, const char* serial = 0, int index = 0 );
 	
 	int writeDmx( const unsigned char* data, int length ) const;
 	DMX_DEVICE_TYPE getType() const;
+	float getDefaultRefreshRate() const;
+	bool autoTune();
+	
+	void setBreakTiming( float breakTime, float mabTime );
+	float getMeasuredBreakTime() const;
+	float getMeasuredMabTime() const;
+	
+	bool setOutputMode( OUTPUT_MODE mode );
+	OUTPUT_MODE getOutputMode() const;
+	void setBitBangBaudRate( int baudRate );
 	
 private:
-	static const int REQUEST_REPLY_DELAY;
+	static const float SLOT_TIME;
+	static const float BIT_TIME;
+	static const unsigned char BITBANG_TX_PIN;
+	static const uint64_t SPIN_TIME;
+	static const float REQUEST_TIME;
+	
+	bool setupUart();
+	bool setupBitBang();
+	static void waitUntil( uint64_t deadline );
+	int writeUart( const unsigned char* data, int length ) const;
+	int writeBitBang( const unsigned char* data, int length ) const;
+	
+	float breakTime_;
+	float mabTime_;
+	OUTPUT_MODE outputMode_;
+	int bitBangBaudRate_;
+	mutable std::vector<unsigned char> waveform_;
+	
+	mutable uint64_t txDrainedTime_;
+	mutable float measuredBreakTime_;
+	mutable float measuredMabTime_;
 };
 
 #endif /* DMX_RAW_DEVICE_H */
@@ -0,0 +1,165 @@
+/*
+ * Encoding and decoding of RDM (ANSI E1.20) packets. UIDs are represented as
+ * 48-bit numbers: the manufacturer id in the upper 16 bits and the device id in
+ * the lower 32.
+ */
+#include <cstring>
+#include "DmxRdm.h"
+
+const unsigned char DmxRdm::START_CODE = 0xCC;
+const unsigned char DmxRdm::SUB_START_CODE = 0x01;
+const uint64_t DmxRdm::UID_BROADCAST = 0xFFFFFFFFFFFFULL;
+const uint64_t DmxRdm::UID_MAX = 0xFFFFFFFFFFFEULL;
+const int DmxRdm::HEADER_LENGTH;
+const int DmxRdm::DATA_MAX_LENGTH;
+const int DmxRdm::PACKET_MAX_LENGTH;
+const int DmxRdm::DISCOVERY_RESPONSE_LENGTH;
+
+const int DmxRdm::RV_PACKET_INVALID = -16200;
+const int DmxRdm::RV_CHECKSUM_MISMATCH = -16201;
+
+//private constants
+static const unsigned char DISCOVERY_PREAMBLE = 0xFE;
+static const unsigned char DISCOVERY_PREAMBLE_SEPARATOR = 0xAA;
+static const int DISCOVERY_PREAMBLE_MAX_LENGTH = 7;
+
+
+/*
+ * Encode the message into the given buffer, which must be able to hold
+ * PACKET_MAX_LENGTH bytes.
+ *
+ * Returns: the length of the packet, start code and checksum included.
+ */
+int DmxRdm::buildPacket( const message* msg, unsigned char* buffer )
+{
+	int length = HEADER_LENGTH + msg->dataLength;
+	
+	buffer[0] = START_CODE;
+	buffer[1] = SUB_START_CODE;
+	buffer[2] = length;
+	writeUid( msg->destination, buffer + 3 );
+	writeUid( msg->source, buffer + 9 );
+	buffer[15] = msg->transaction;
+	buffer[16] = msg->portId;
+	buffer[17] = msg->messageCount;
+	buffer[18] = ( msg->subDevice >> 8 ) & 0xFF;
+	buffer[19] = msg->subDevice & 0xFF;
+	buffer[20] = msg->commandClass;
+	buffer[21] = ( msg->pid >> 8 ) & 0xFF;
+	buffer[22] = msg->pid & 0xFF;
+	buffer[23] = msg->dataLength;
+	std::memcpy( buffer + HEADER_LENGTH, msg->data, msg->dataLength );
+	
+	unsigned int checksum = 0;
+	for ( int i = 0; i < length; i++ ) checksum += buffer[i];
+	buffer[length] = ( checksum >> 8 ) & 0xFF;
+	buffer[length + 1] = checksum & 0xFF;
+	
+	return length + 2;
+}
+
+/*
+ * Decode an RDM packet (start code included).
+ *
+ * Returns: 0 if successful, RV_PACKET_INVALID if the packet is malformed or
+ * RV_CHECKSUM_MISMATCH if the checksum is incorrect.
+ */
+int DmxRdm::parsePacket( const unsigned char* buffer, int length, message* msg )
+{
+	if ( length < HEADER_LENGTH + 2 ) return RV_PACKET_INVALID;
+	if ( buffer[0] != START_CODE || buffer[1] != SUB_START_CODE ) return RV_PACKET_INVALID;
+	
+	int messageLength = buffer[2];
+	if ( messageLength < HEADER_LENGTH || messageLength + 2 > length ) return RV_PACKET_INVALID;
+	if ( buffer[23] != messageLength - HEADER_LENGTH ) return RV_PACKET_INVALID;
+	
+	unsigned int checksum = 0;
+	for ( int i = 0; i < messageLength; i++ ) checksum += buffer[i];
+	if ( ( checksum & 0xFFFF ) != (unsigned int)( ( buffer[messageLength] << 8 ) | buffer[messageLength + 1] ) ) {
+		return RV_CHECKSUM_MISMATCH;
+	}
+	
+	msg->destination = readUid( buffer + 3 );
+	msg->source = readUid( buffer + 9 );
+	msg->transaction = buffer[15];
+	msg->portId = buffer[16];
+	msg->messageCount = buffer[17];
+	msg->subDevice = ( buffer[18] << 8 ) | buffer[19];
+	msg->commandClass = buffer[20];
+	msg->pid = ( buffer[21] << 8 ) | buffer[22];
+	msg->dataLength = buffer[23];
+	std::memcpy( msg->data, buffer + HEADER_LENGTH, msg->dataLength );
+	
+	return 0;
+}
+
+/*
+ * Encode the reply a responder sends to a DISC_UNIQUE_BRANCH request (without
+ * preamble) into the given buffer of at least DISCOVERY_RESPONSE_LENGTH bytes.
+ * This is mostly useful for simulating responders.
+ *
+ * Returns: the length of the encoded response.
+ */
+int DmxRdm::encodeDiscoveryResponse( uint64_t uid, unsigned char* buffer )
+{
+	unsigned char raw[6];
+	unsigned int checksum = 0;
+	
+	buffer[0] = DISCOVERY_PREAMBLE_SEPARATOR;
+	writeUid( uid, raw );
+	for ( int i = 0; i < 6; i++ ) {
+		buffer[1 + 2 * i] = raw[i] | 0xAA;
+		buffer[2 + 2 * i] = raw[i] | 0x55;
+		checksum += buffer[1 + 2 * i] + buffer[2 + 2 * i];
+	}
+	buffer[13] = ( checksum >> 8 ) | 0xAA;
+	buffer[14] = ( checksum >> 8 ) | 0x55;
+	buffer[15] = ( checksum & 0xFF ) | 0xAA;
+	buffer[16] = ( checksum & 0xFF ) | 0x55;
+	
+	return 17;
+}
+
+/*
+ * Decode the reply to a DISC_UNIQUE_BRANCH request. If several responders
+ * replied at once, the result is usually garbled, which shows as an invalid
+ * packet or checksum mismatch.
+ *
+ * Returns: 0 if successful, RV_PACKET_INVALID or RV_CHECKSUM_MISMATCH.
+ */
+int DmxRdm::decodeDiscoveryResponse( const unsigned char* buffer, int length, uint64_t* uid )
+{
+	int p = 0;
+	
+	while ( p < length && p < DISCOVERY_PREAMBLE_MAX_LENGTH && buffer[p] == DISCOVERY_PREAMBLE ) p++;
+	if ( p >= length || buffer[p] != DISCOVERY_PREAMBLE_SEPARATOR ) return RV_PACKET_INVALID;
+	p++;
+	if ( length - p < 16 ) return RV_PACKET_INVALID;
+	
+	const unsigned char* euid = buffer + p;
+	unsigned char raw[6];
+	unsigned int checksum = 0;
+	
+	for ( int i = 0; i < 6; i++ ) {
+		raw[i] = euid[2 * i] & euid[2 * i + 1];
+		checksum += euid[2 * i] + euid[2 * i + 1];
+	}
+	
+	unsigned int received = ( ( euid[12] & euid[13] ) << 8 ) | ( euid[14] & euid[15] );
+	if ( ( checksum & 0xFFFF ) != received ) return RV_CHECKSUM_MISMATCH;
+	
+	*uid = readUid( raw );
+	return 0;
+}
+
+void DmxRdm::writeUid( uint64_t uid, unsigned char* buffer )
+{
+	for ( int i = 0; i < 6; i++ ) buffer[i] = ( uid >> ( 8 * ( 5 - i ) ) ) & 0xFF;
+}
+
+uint64_t DmxRdm::readUid( const unsigned char* buffer )
+{
+	uint64_t uid = 0;
+	for ( int i = 0; i < 6; i++ ) uid = ( uid << 8 ) | buffer[i];
+	return uid;
+}
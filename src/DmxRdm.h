@@ -0,0 +1,113 @@
+/*
+ */
+#ifndef DMX_RDM_H
+#define DMX_RDM_H
+
+#include <stdint.h>
+
+/*
+ * Interface for devices able to transmit RDM requests and receive replies.
+ */
+class DmxRdmTransport {
+public:
+	enum TRANSACTION_TYPE {
+		TRANSACTION_REQUEST,		/* a reply is expected */
+		TRANSACTION_DISCOVERY,	/* a (possibly garbled) discovery response may follow */
+		TRANSACTION_BROADCAST		/* nothing will be replied */
+	};
+	
+	virtual ~DmxRdmTransport() {}
+	
+	/*
+	 * Send the given RDM packet (start code included) and receive the reply.
+	 *
+	 * Returns: the length of the reply, 0 if nothing was received in time, or
+	 * < 0 if an error occured.
+	 */
+	virtual int sendRdm( const unsigned char* request, int length, TRANSACTION_TYPE type,
+											 unsigned char* response, int maxLength ) = 0;
+};
+
+
+class DmxRdm {
+public:
+	static const unsigned char START_CODE;
+	static const unsigned char SUB_START_CODE;
+	static const uint64_t UID_BROADCAST;
+	static const uint64_t UID_MAX;
+	static const int HEADER_LENGTH = 24;
+	static const int DATA_MAX_LENGTH = 231;
+	static const int PACKET_MAX_LENGTH = HEADER_LENGTH + DATA_MAX_LENGTH + 2;
+	static const int DISCOVERY_RESPONSE_LENGTH = 24; /* at most, preamble included */
+	
+	static const int RV_PACKET_INVALID;
+	static const int RV_CHECKSUM_MISMATCH;
+	
+	enum COMMAND_CLASS {
+		DISCOVERY_COMMAND						= 0x10,
+		DISCOVERY_COMMAND_RESPONSE	= 0x11,
+		GET_COMMAND									= 0x20,
+		GET_COMMAND_RESPONSE				= 0x21,
+		SET_COMMAND									= 0x30,
+		SET_COMMAND_RESPONSE				= 0x31
+	};
+	
+	enum RESPONSE_TYPE {
+		RESPONSE_TYPE_ACK						= 0x00,
+		RESPONSE_TYPE_ACK_TIMER			= 0x01,
+		RESPONSE_TYPE_NACK_REASON		= 0x02,
+		RESPONSE_TYPE_ACK_OVERFLOW	= 0x03
+	};
+	
+	enum STATUS_TYPE {
+		STATUS_NONE									= 0x00,
+		STATUS_GET_LAST_MESSAGE			= 0x01,
+		STATUS_ADVISORY							= 0x02,
+		STATUS_WARNING							= 0x03,
+		STATUS_ERROR								= 0x04
+	};
+	
+	enum PARAMETER_ID {
+		PID_DISC_UNIQUE_BRANCH			= 0x0001,
+		PID_DISC_MUTE								= 0x0002,
+		PID_DISC_UN_MUTE						= 0x0003,
+		PID_QUEUED_MESSAGE					= 0x0020,
+		PID_STATUS_MESSAGES					= 0x0030,
+		PID_SUPPORTED_PARAMETERS		= 0x0050,
+		PID_DEVICE_INFO							= 0x0060,
+		PID_DEVICE_LABEL						= 0x0082,
+		PID_DMX_START_ADDRESS				= 0x00F0,
+		PID_SENSOR_DEFINITION				= 0x0200,
+		PID_SENSOR_VALUE						= 0x0201,
+		PID_IDENTIFY_DEVICE					= 0x1000
+	};
+	
+	struct message {
+		uint64_t destination;
+		uint64_t source;
+		unsigned char transaction;
+		unsigned char portId; /* response type in responses */
+		unsigned char messageCount;
+		unsigned int subDevice;
+		unsigned char commandClass;
+		unsigned int pid;
+		unsigned char dataLength;
+		unsigned char data[DATA_MAX_LENGTH];
+	};
+	
+	
+	static int buildPacket( const message* msg, unsigned char* buffer );
+	static int parsePacket( const unsigned char* buffer, int length, message* msg );
+	static int encodeDiscoveryResponse( uint64_t uid, unsigned char* buffer );
+	static int decodeDiscoveryResponse( const unsigned char* buffer, int length, uint64_t* uid );
+	
+	static void writeUid( uint64_t uid, unsigned char* buffer );
+	static uint64_t readUid( const unsigned char* buffer );
+	
+private:
+	DmxRdm();
+	DmxRdm( const DmxRdm& other );
+	DmxRdm& operator=( const DmxRdm& other );
+};
+
+#endif /* ! DMX_RDM_H */
@@ -0,0 +1,377 @@
+/*
+ * Cache of RDM parameters, keyed by responder UID, parameter id and (for
+ * parameters like SENSOR_VALUE) the request's parameter data. Values expire
+ * after a time-to-live which can be set per parameter.
+ *
+ * get() serves fresh values from the cache straight away; otherwise the request
+ * is queued and the callback is made once the reply arrives. Requests for a
+ * value which is already queued or in flight join the outstanding request, so
+ * many readers of the same parameter cost a single transaction.
+ * The queue is worked off by process(), which can be called from any thread
+ * (e.g. the output thread in between frames) and limited to a number of
+ * transactions or a deadline. Since RDM is half-duplex, transactions are made
+ * back to back. After an ACK_TIMER reply, the response is collected with GET
+ * QUEUED_MESSAGE once the time indicated by the responder has passed, without
+ * holding up the rest of the queue. ACK_OVERFLOW replies are collected until
+ * complete. A request fails if its data grows beyond OVERFLOW_SIZE_MAX or it
+ * takes more than ROUND_TRIPS_MAX transactions, so a misbehaving responder
+ * cannot occupy the line indefinitely.
+ */
+#include "DmxClock.h"
+#include "DmxRdmCache.h"
+
+const int DmxRdmCache::TTL_DEFAULT = 5000; /* in milliseconds */
+const int DmxRdmCache::RV_NO_RESPONSE = -16300;
+const int DmxRdmCache::RV_NACK = -16301;
+const int DmxRdmCache::RV_INVALID_RESPONSE = -16302;
+const int DmxRdmCache::RV_RESPONSE_TOO_LONG = -16303;
+const int DmxRdmCache::RV_TOO_MANY_ROUND_TRIPS = -16304;
+const int DmxRdmCache::RV_REQUEST_TOO_LONG = -16305;
+
+//private constants
+const int DmxRdmCache::ATTEMPTS_MAX = 3;
+const int DmxRdmCache::ROUND_TRIPS_MAX = 32;
+const int DmxRdmCache::OVERFLOW_SIZE_MAX = 4096; /* in bytes */
+/* NOTE: used if a queued message is not available yet, so it is polled for again */
+const int DmxRdmCache::QUEUED_MESSAGE_DELAY = 100; /* in milliseconds */
+
+
+bool DmxRdmCache::key::operator<( const key& other ) const
+{
+	if ( uid != other.uid ) return uid < other.uid;
+	if ( pid != other.pid ) return pid < other.pid;
+	return data < other.data;
+}
+
+
+DmxRdmCache::DmxRdmCache( DmxRdmTransport* transport, uint64_t controllerUid )
+: transport_( transport ), controllerUid_( controllerUid ), transaction_( 0 ), ttl_( TTL_DEFAULT ),
+  hitCount_( 0 ), missCount_( 0 ), coalescedCount_( 0 ), completedCount_( 0 ), queueLatencySum_( 0 ),
+  queueLatencyMax_( 0 )
+{ /* empty */ }
+
+
+/*
+ * Set the time-to-live in milliseconds for parameters without one of their own.
+ */
+void DmxRdmCache::setTtl( int ttl )
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	ttl_ = ttl;
+}
+
+/*
+ * Set the time-to-live in milliseconds for the given parameter; e.g. DEVICE_INFO
+ * hardly ever changes while sensor values may be stale within a second.
+ */
+void DmxRdmCache::setTtl( unsigned int pid, int ttl )
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	pidTtl_[pid] = ttl;
+}
+
+/*
+ * Request the given parameter of the given responder (see below).
+ */
+bool DmxRdmCache::get( uint64_t uid, unsigned int pid, callback cb, void* userData )
+{
+	return get( uid, pid, 0, 0, cb, userData );
+}
+
+/*
+ * Request the given parameter of the given responder, with optional parameter
+ * data for the GET request. If the value is cached and has not expired, the
+ * callback is made immediately. Otherwise the request is queued and the
+ * callback is made from process() (the callback may be NULL to prefetch).
+ * Parameter data longer than DmxRdm::DATA_MAX_LENGTH is rejected right away,
+ * with RV_REQUEST_TOO_LONG passed to the callback.
+ *
+ * Returns: true if the callback has already been made (the value was served
+ * from the cache or the request was rejected), false if it has been queued.
+ */
+bool DmxRdmCache::get( uint64_t uid, unsigned int pid, const unsigned char* data, int length,
+											callback cb, void* userData )
+{
+	if ( length > DmxRdm::DATA_MAX_LENGTH ) {
+		if ( cb != 0 ) cb( uid, pid, RV_REQUEST_TOO_LONG, 0, 0, userData );
+		return true;
+	}
+	
+	key k;
+	k.uid = uid;
+	k.pid = pid;
+	if ( length > 0 ) k.data.assign( data, data + length );
+	
+	std::unique_lock<std::mutex> lock( mutex_ );
+	
+	map_entry::const_iterator it = entries_.find( k );
+	if ( it != entries_.end() && it->second.expires > DmxClock::now() ) {
+		hitCount_++;
+		vec_uchar value = it->second.data;
+		lock.unlock();
+		if ( cb != 0 ) cb( uid, pid, 0, value.empty() ? 0 : &value[0], value.size(), userData );
+		return true;
+	}
+	
+	missCount_++;
+	waiter w = { cb, userData };
+	
+	map_request::iterator pending = requests_.find( k );
+	if ( pending != requests_.end() ) {
+		coalescedCount_++;
+		if ( cb != 0 ) pending->second.waiters.push_back( w );
+		return false;
+	}
+	
+	request& req = requests_[k];
+	if ( cb != 0 ) req.waiters.push_back( w );
+	req.notBefore = 0;
+	req.collectQueued = false;
+	req.queued = DmxClock::now();
+	req.attempts = 0;
+	req.roundTrips = 0;
+	queue_.push_back( k );
+	
+	return false;
+}
+
+/*
+ * Discard all cached values of the given responder.
+ */
+void DmxRdmCache::invalidate( uint64_t uid )
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	
+	key first;
+	first.uid = uid;
+	first.pid = 0;
+	
+	map_entry::iterator it = entries_.lower_bound( first );
+	while ( it != entries_.end() && it->first.uid == uid ) entries_.erase( it++ );
+}
+
+/*
+ * Discard all cached values. Queued requests are kept.
+ */
+void DmxRdmCache::clear()
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	entries_.clear();
+}
+
+/*
+ * Work off queued requests, making at most maxTransactions transactions (if
+ * > 0) and not starting any after the given deadline (if > 0, see DmxClock).
+ *
+ * Returns: the number of transactions made.
+ */
+int DmxRdmCache::process( int maxTransactions, uint64_t deadline )
+{
+	std::lock_guard<std::mutex> processLock( processMutex_ );
+	int count = 0;
+	
+	while ( maxTransactions <= 0 || count < maxTransactions ) {
+		uint64_t now = DmxClock::now();
+		if ( deadline > 0 && now >= deadline ) break;
+		
+		key k;
+		vec_uchar overflow;
+		int attempts = 0;
+		bool collectQueued = false;
+		bool found = false;
+		
+		{
+			std::lock_guard<std::mutex> lock( mutex_ );
+			for ( std::deque<key>::iterator it = queue_.begin(); it != queue_.end(); ++it ) {
+				request& req = requests_[*it];
+				if ( req.notBefore <= now ) {
+					k = *it;
+					overflow = req.overflow;
+					attempts = req.attempts;
+					collectQueued = req.collectQueued;
+					queue_.erase( it );
+					found = true;
+					break;
+				}
+			}
+		}
+		if ( ! found ) break;
+		
+		vec_uchar data;
+		int responseType = DmxRdm::RESPONSE_TYPE_ACK;
+		uint64_t tStart = DmxClock::now();
+		int r = transact( k, collectQueued, &data, &responseType );
+		uint64_t tEnd = DmxClock::now();
+		count++;
+		
+		int result = 1; /* > 0: not complete yet */
+		std::vector<waiter> waiters;
+		
+		{
+			std::lock_guard<std::mutex> lock( mutex_ );
+			request& req = requests_[k];
+			pidAccumulator& acc = pidStats_[k.pid];
+			
+			acc.transactionCount++;
+			if ( r == RV_NO_RESPONSE ) acc.timeoutCount++;
+			else acc.roundTripSum += tEnd - tStart;
+			
+			req.roundTrips++;
+			if ( r == RV_NO_RESPONSE || r == RV_INVALID_RESPONSE ) {
+				req.attempts = attempts + 1;
+				if ( req.attempts < ATTEMPTS_MAX ) queue_.push_back( k );
+				else result = r;
+			} else if ( r < 0 ) {
+				result = r;
+			} else if ( req.roundTrips >= ROUND_TRIPS_MAX && ( r > 0 || ( responseType != DmxRdm::RESPONSE_TYPE_ACK &&
+								 responseType != DmxRdm::RESPONSE_TYPE_NACK_REASON ) ) ) {
+				result = RV_TOO_MANY_ROUND_TRIPS;
+			} else if ( r > 0 ) {
+				//the queued message was not (yet) the one waited for
+				req.notBefore = tEnd + (uint64_t)QUEUED_MESSAGE_DELAY * 1000000;
+				queue_.push_back( k );
+			} else if ( responseType == DmxRdm::RESPONSE_TYPE_ACK_OVERFLOW ) {
+				if ( req.overflow.size() + data.size() > (size_t)OVERFLOW_SIZE_MAX ) {
+					result = RV_RESPONSE_TOO_LONG;
+				} else {
+					req.overflow.insert( req.overflow.end(), data.begin(), data.end() );
+					queue_.push_front( k );
+				}
+			} else if ( responseType == DmxRdm::RESPONSE_TYPE_ACK_TIMER ) {
+				int delay = ( data.size() >= 2 ) ? ( ( data[0] << 8 ) | data[1] ) * 100 : QUEUED_MESSAGE_DELAY;
+				req.notBefore = tEnd + (uint64_t)delay * 1000000;
+				req.collectQueued = true;
+				queue_.push_back( k );
+			} else if ( responseType == DmxRdm::RESPONSE_TYPE_NACK_REASON ) {
+				result = RV_NACK;
+			} else {
+				overflow.insert( overflow.end(), data.begin(), data.end() );
+				data.swap( overflow );
+				entry& e = entries_[k];
+				e.data = data;
+				e.expires = tEnd + (uint64_t)getTtl( k.pid ) * 1000000;
+				result = 0;
+			}
+			
+			if ( result <= 0 ) {
+				uint64_t latency = tEnd - req.queued;
+				completedCount_++;
+				queueLatencySum_ += latency;
+				if ( latency > queueLatencyMax_ ) queueLatencyMax_ = latency;
+				
+				waiters.swap( req.waiters );
+				requests_.erase( k );
+			}
+		}
+		
+		for ( size_t i = 0; i < waiters.size(); i++ ) {
+			waiters[i].cb( k.uid, k.pid, result, data.empty() ? 0 : &data[0], data.size(), waiters[i].userData );
+		}
+	}
+	
+	return count;
+}
+
+int DmxRdmCache::getQueueLength() const
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	return queue_.size();
+}
+
+void DmxRdmCache::getStats( cacheStats* stats ) const
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	
+	stats->hitCount = hitCount_;
+	stats->missCount = missCount_;
+	stats->coalescedCount = coalescedCount_;
+	stats->hitRate = ( hitCount_ + missCount_ > 0 ) ? (float)hitCount_ / ( hitCount_ + missCount_ ) : 0;
+	stats->queueLength = queue_.size();
+	stats->completedCount = completedCount_;
+	stats->meanQueueLatency = ( completedCount_ > 0 ) ? queueLatencySum_ / 1000000.0f / completedCount_ : 0;
+	stats->maxQueueLatency = queueLatencyMax_ / 1000000.0f;
+}
+
+/*
+ * Returns: true if statistics are available for the given parameter, false if
+ * it has not been requested yet.
+ */
+bool DmxRdmCache::getPidStats( unsigned int pid, pidStats* stats ) const
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	
+	std::map<unsigned int, pidAccumulator>::const_iterator it = pidStats_.find( pid );
+	if ( it == pidStats_.end() ) return false;
+	
+	const pidAccumulator& acc = it->second;
+	unsigned long answered = acc.transactionCount - acc.timeoutCount;
+	stats->transactionCount = acc.transactionCount;
+	stats->timeoutCount = acc.timeoutCount;
+	stats->meanRoundTrip = ( answered > 0 ) ? acc.roundTripSum / 1000.0f / answered : 0;
+	return true;
+}
+
+
+/*********************
+ * PRIVATE FUNCTIONS *
+ *********************/
+
+int DmxRdmCache::getTtl( unsigned int pid ) const
+{
+	std::map<unsigned int, int>::const_iterator it = pidTtl_.find( pid );
+	return ( it != pidTtl_.end() ) ? it->second : ttl_;
+}
+
+/*
+ * Send a GET request for the given key and check the reply. If collectQueued
+ * is true, the reply to an earlier request which was answered with ACK_TIMER
+ * is collected with GET QUEUED_MESSAGE instead.
+ *
+ * Returns: 0 if a valid reply has been received (its data and response type
+ * are returned), 1 if a queued message was requested but the responder sent
+ * another one (or had none), RV_NO_RESPONSE, RV_INVALID_RESPONSE or another
+ * value < 0 if the transport failed.
+ */
+int DmxRdmCache::transact( const key& k, bool collectQueued, vec_uchar* data, int* responseType )
+{
+	DmxRdm::message msg;
+	unsigned char packet[DmxRdm::PACKET_MAX_LENGTH];
+	unsigned char response[DmxRdm::PACKET_MAX_LENGTH];
+	
+	msg.destination = k.uid;
+	msg.source = controllerUid_;
+	msg.transaction = transaction_++;
+	msg.portId = 1;
+	msg.messageCount = 0;
+	msg.subDevice = 0;
+	msg.commandClass = DmxRdm::GET_COMMAND;
+	if ( collectQueued ) {
+		msg.pid = DmxRdm::PID_QUEUED_MESSAGE;
+		msg.dataLength = 1;
+		msg.data[0] = DmxRdm::STATUS_ERROR; /* only errors are reported in between */
+	} else {
+		//get() makes sure the data fits
+		msg.pid = k.pid;
+		msg.dataLength = k.data.size();
+		for ( size_t i = 0; i < k.data.size(); i++ ) msg.data[i] = k.data[i];
+	}
+	
+	int length = DmxRdm::buildPacket( &msg, packet );
+	int r = transport_->sendRdm( packet, length, DmxRdmTransport::TRANSACTION_REQUEST,
+															response, sizeof( response ) );
+	if ( r < 0 ) return r;
+	if ( r == 0 ) return RV_NO_RESPONSE;
+	
+	DmxRdm::message reply;
+	if ( DmxRdm::parsePacket( response, r, &reply ) != 0 ) return RV_INVALID_RESPONSE;
+	if ( reply.source != k.uid || reply.commandClass != DmxRdm::GET_COMMAND_RESPONSE ||
+			reply.transaction != msg.transaction ) {
+		return RV_INVALID_RESPONSE;
+	}
+	//NOTE: a queued message for another parameter is dropped, the responder then sends the next one.
+	if ( reply.pid != k.pid ) return ( collectQueued ) ? 1 : RV_INVALID_RESPONSE;
+	
+	*responseType = reply.portId;
+	data->assign( reply.data, reply.data + reply.dataLength );
+	return 0;
+}
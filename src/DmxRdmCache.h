@@ -0,0 +1,135 @@
+/*
+ */
+#ifndef DMX_RDM_CACHE_H
+#define DMX_RDM_CACHE_H
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+#include "DmxRdm.h"
+
+class DmxRdmCache {
+public:
+	/* result is 0 on success or one of the RV_ values below */
+	typedef void ( *callback )( uint64_t uid, unsigned int pid, int result,
+														 const unsigned char* data, int length, void* userData );
+	
+	struct cacheStats {
+		unsigned long hitCount;
+		unsigned long missCount;
+		unsigned long coalescedCount; /* misses joining an outstanding request */
+		float hitRate;
+		int queueLength;
+		unsigned long completedCount; /* requests answered or failed */
+		float meanQueueLatency; /* from get() to callback, in milliseconds */
+		float maxQueueLatency; /* in milliseconds */
+	};
+	
+	struct pidStats {
+		unsigned long transactionCount;
+		unsigned long timeoutCount;
+		float meanRoundTrip; /* in microseconds */
+	};
+	
+	static const int TTL_DEFAULT;
+	static const int RV_NO_RESPONSE;
+	static const int RV_NACK;
+	static const int RV_INVALID_RESPONSE;
+	static const int RV_RESPONSE_TOO_LONG;
+	static const int RV_TOO_MANY_ROUND_TRIPS;
+	static const int RV_REQUEST_TOO_LONG;
+	
+	
+	DmxRdmCache( DmxRdmTransport* transport, uint64_t controllerUid );
+	
+	void setTtl( int ttl );
+	void setTtl( unsigned int pid, int ttl );
+	
+	bool get( uint64_t uid, unsigned int pid, callback cb, void* userData = 0 );
+	bool get( uint64_t uid, unsigned int pid, const unsigned char* data, int length,
+					 callback cb, void* userData = 0 );
+	void invalidate( uint64_t uid );
+	void clear();
+	
+	int process( int maxTransactions = 0, uint64_t deadline = 0 );
+	int getQueueLength() const;
+	
+	void getStats( cacheStats* stats ) const;
+	bool getPidStats( unsigned int pid, pidStats* stats ) const;
+	
+private:
+	typedef std::vector<unsigned char> vec_uchar;
+	
+	struct key {
+		uint64_t uid;
+		unsigned int pid;
+		vec_uchar data;
+		
+		bool operator<( const key& other ) const;
+	};
+	
+	struct entry {
+		vec_uchar data;
+		uint64_t expires;
+	};
+	
+	struct waiter {
+		callback cb;
+		void* userData;
+	};
+	
+	struct request {
+		std::vector<waiter> waiters;
+		vec_uchar overflow; /* data received so far with ACK_OVERFLOW */
+		uint64_t notBefore; /* for ACK_TIMER */
+		bool collectQueued; /* the reply is to be collected with QUEUED_MESSAGE */
+		uint64_t queued;
+		int attempts;
+		int roundTrips;
+	};
+	
+	struct pidAccumulator {
+		unsigned long transactionCount;
+		unsigned long timeoutCount;
+		uint64_t roundTripSum;
+	};
+	
+	typedef std::map<key, entry> map_entry;
+	typedef std::map<key, request> map_request;
+	
+	static const int ATTEMPTS_MAX;
+	static const int ROUND_TRIPS_MAX;
+	static const int OVERFLOW_SIZE_MAX;
+	static const int QUEUED_MESSAGE_DELAY;
+	
+	DmxRdmCache( const DmxRdmCache& other );
+	DmxRdmCache& operator=( const DmxRdmCache& other );
+	
+	int getTtl( unsigned int pid ) const;
+	int transact( const key& k, bool collectQueued, vec_uchar* data, int* responseType );
+	
+	DmxRdmTransport* transport_;
+	uint64_t controllerUid_;
+	unsigned char transaction_;
+	int ttl_;
+	std::map<unsigned int, int> pidTtl_;
+	
+	map_entry entries_;
+	map_request requests_;
+	std::deque<key> queue_;
+	
+	unsigned long hitCount_;
+	unsigned long missCount_;
+	unsigned long coalescedCount_;
+	unsigned long completedCount_;
+	uint64_t queueLatencySum_;
+	uint64_t queueLatencyMax_;
+	std::map<unsigned int, pidAccumulator> pidStats_;
+	
+	mutable std::mutex mutex_;
+	std::mutex processMutex_;
+};
+
+#endif /* ! DMX_RDM_CACHE_H */
@@ -0,0 +1,241 @@
+/*
+ * RDM discovery (ANSI E1.20 section 7) using a binary search over the UID space
+ * with DISC_UNIQUE_BRANCH requests. Whenever a branch yields a single valid
+ * response, that responder is muted and the same branch is queried again right
+ * away, so densely populated branches are emptied one responder at a time
+ * without descending further. Only garbled responses (collisions) cause a
+ * branch to be split in halves.
+ *
+ * The UIDs found are kept between runs. Unless a full discovery is requested,
+ * a run first mutes each known responder, which both confirms it is still there
+ * and silences it, so the subsequent search only descends into branches
+ * containing new responders. After a small patch change, rediscovery therefore
+ * costs a handful of requests instead of a complete walk.
+ *
+ * All communication goes through a DmxRdmTransport, so a simulated population
+ * of responders can be substituted for a real device.
+ */
+#include <algorithm>
+#include "DmxClock.h"
+#include "DmxRdmDiscovery.h"
+
+//private constants
+const int DmxRdmDiscovery::MUTE_ATTEMPTS = 2;
+
+
+DmxRdmDiscovery::DmxRdmDiscovery( DmxRdmTransport* transport, uint64_t controllerUid )
+: transport_( transport ), controllerUid_( controllerUid ), transaction_( 0 )
+{
+	stats_.branchCount = stats_.collisionCount = stats_.muteCount = 0;
+	stats_.foundCount = stats_.lostCount = 0;
+	stats_.duration = 0;
+}
+
+
+/*
+ * Run discovery. Unless full is true, the responders found by previous runs
+ * are verified first and only new ones are searched for.
+ *
+ * Returns: the number of responders known after discovery, or < 0 if a
+ * transport error occured (in which case the previously known UIDs which have
+ * been verified so far are retained).
+ */
+int DmxRdmDiscovery::discover( bool full )
+{
+	uint64_t tStart = DmxClock::now();
+	int r = search( full );
+	stats_.duration = ( DmxClock::now() - tStart ) / 1000000.0f;
+	
+	return r;
+}
+
+/*
+ * Discard all known UIDs, so the next discovery starts from scratch.
+ */
+void DmxRdmDiscovery::forget()
+{
+	uids_.clear();
+}
+
+/*
+ * Returns the UIDs of all known responders in ascending order.
+ */
+const DmxRdmDiscovery::vec_uid& DmxRdmDiscovery::getUids() const
+{
+	return uids_;
+}
+
+bool DmxRdmDiscovery::isKnown( uint64_t uid ) const
+{
+	return std::binary_search( uids_.begin(), uids_.end(), uid );
+}
+
+uint64_t DmxRdmDiscovery::getControllerUid() const
+{
+	return controllerUid_;
+}
+
+/*
+ * Returns statistics about the last discovery run.
+ */
+void DmxRdmDiscovery::getStats( discoveryStats* stats ) const
+{
+	*stats = stats_;
+}
+
+
+/*********************
+ * PRIVATE FUNCTIONS *
+ *********************/
+
+/*
+ * Implementation of discover(), which adds timing.
+ */
+int DmxRdmDiscovery::search( bool full )
+{
+	int r;
+	
+	stats_.branchCount = stats_.collisionCount = stats_.muteCount = 0;
+	stats_.foundCount = stats_.lostCount = 0;
+	
+	if ( full ) uids_.clear();
+	
+	r = unmuteAll();
+	if ( r < 0 ) return r;
+	
+	//verify known responders, muting them so they stay out of the search
+	vec_uid known;
+	known.swap( uids_ );
+	for ( size_t i = 0; i < known.size(); i++ ) {
+		r = mute( known[i] );
+		if ( r < 0 ) {
+			uids_.insert( uids_.end(), known.begin() + i, known.end() );
+			return r;
+		}
+		if ( r > 0 ) uids_.push_back( known[i] );
+		else stats_.lostCount++;
+	}
+	
+	std::vector<branch> pending;
+	branch root = { 0, DmxRdm::UID_MAX };
+	pending.push_back( root );
+	
+	while ( ! pending.empty() ) {
+		branch b = pending.back();
+		uint64_t uid;
+		
+		r = uniqueBranch( b.lower, b.upper, &uid );
+		if ( r < 0 ) return r;
+		if ( r == 0 ) {
+			pending.pop_back();
+			continue;
+		}
+		
+		//a single responder answered; mute it and query this branch again
+		if ( r == 1 && uid >= b.lower && uid <= b.upper && ! isKnown( uid ) ) {
+			int m = mute( uid );
+			if ( m < 0 ) return m;
+			if ( m > 0 ) {
+				addUid( uid );
+				stats_.foundCount++;
+				continue;
+			}
+		}
+		
+		//several responders answered at once (or one could not be muted)
+		stats_.collisionCount++;
+		pending.pop_back();
+		if ( b.lower < b.upper ) {
+			uint64_t middle = b.lower + ( b.upper - b.lower ) / 2;
+			branch upperHalf = { middle + 1, b.upper };
+			branch lowerHalf = { b.lower, middle };
+			pending.push_back( upperHalf );
+			pending.push_back( lowerHalf );
+		}
+	}
+	
+	return uids_.size();
+}
+
+int DmxRdmDiscovery::sendDiscovery( unsigned int pid, uint64_t destination,
+																	 const unsigned char* data, int dataLength,
+																	 DmxRdmTransport::TRANSACTION_TYPE type,
+																	 unsigned char* response, int maxLength )
+{
+	DmxRdm::message msg;
+	unsigned char packet[DmxRdm::PACKET_MAX_LENGTH];
+	
+	msg.destination = destination;
+	msg.source = controllerUid_;
+	msg.transaction = transaction_++;
+	msg.portId = 1;
+	msg.messageCount = 0;
+	msg.subDevice = 0;
+	msg.commandClass = DmxRdm::DISCOVERY_COMMAND;
+	msg.pid = pid;
+	msg.dataLength = dataLength;
+	for ( int i = 0; i < dataLength; i++ ) msg.data[i] = data[i];
+	
+	int length = DmxRdm::buildPacket( &msg, packet );
+	return transport_->sendRdm( packet, length, type, response, maxLength );
+}
+
+/*
+ * Send a DISC_UNIQUE_BRANCH request for the given UID range.
+ *
+ * Returns: 0 if nobody answered, 1 if a valid response was received (its UID
+ * is returned in uid), 2 if the response was garbled, or < 0 on error.
+ */
+int DmxRdmDiscovery::uniqueBranch( uint64_t lower, uint64_t upper, uint64_t* uid )
+{
+	unsigned char bounds[12];
+	unsigned char response[DmxRdm::PACKET_MAX_LENGTH];
+	
+	DmxRdm::writeUid( lower, bounds );
+	DmxRdm::writeUid( upper, bounds + 6 );
+	
+	stats_.branchCount++;
+	int r = sendDiscovery( DmxRdm::PID_DISC_UNIQUE_BRANCH, DmxRdm::UID_BROADCAST, bounds, sizeof( bounds ),
+												DmxRdmTransport::TRANSACTION_DISCOVERY, response, sizeof( response ) );
+	if ( r <= 0 ) return r;
+	
+	return ( DmxRdm::decodeDiscoveryResponse( response, r, uid ) == 0 ) ? 1 : 2;
+}
+
+/*
+ * Send DISC_MUTE to the given responder, retrying once if no valid reply is
+ * received.
+ *
+ * Returns: 1 if the responder acknowledged, 0 if it did not, or < 0 on error.
+ */
+int DmxRdmDiscovery::mute( uint64_t uid )
+{
+	unsigned char response[DmxRdm::PACKET_MAX_LENGTH];
+	DmxRdm::message reply;
+	
+	for ( int attempt = 0; attempt < MUTE_ATTEMPTS; attempt++ ) {
+		stats_.muteCount++;
+		int r = sendDiscovery( DmxRdm::PID_DISC_MUTE, uid, 0, 0,
+													DmxRdmTransport::TRANSACTION_REQUEST, response, sizeof( response ) );
+		if ( r < 0 ) return r;
+		
+		if ( r > 0 && DmxRdm::parsePacket( response, r, &reply ) == 0 &&
+				reply.source == uid && reply.commandClass == DmxRdm::DISCOVERY_COMMAND_RESPONSE &&
+				reply.pid == DmxRdm::PID_DISC_MUTE && reply.portId == DmxRdm::RESPONSE_TYPE_ACK ) {
+			return 1;
+		}
+	}
+	
+	return 0;
+}
+
+int DmxRdmDiscovery::unmuteAll()
+{
+	return sendDiscovery( DmxRdm::PID_DISC_UN_MUTE, DmxRdm::UID_BROADCAST, 0, 0,
+											 DmxRdmTransport::TRANSACTION_BROADCAST, 0, 0 );
+}
+
+void DmxRdmDiscovery::addUid( uint64_t uid )
+{
+	uids_.insert( std::lower_bound( uids_.begin(), uids_.end(), uid ), uid );
+}
@@ -0,0 +1,60 @@
+/*
+ */
+#ifndef DMX_RDM_DISCOVERY_H
+#define DMX_RDM_DISCOVERY_H
+
+#include <stdint.h>
+#include <vector>
+#include "DmxRdm.h"
+
+class DmxRdmDiscovery {
+public:
+	struct discoveryStats {
+		unsigned long branchCount; /* DISC_UNIQUE_BRANCH requests sent */
+		unsigned long collisionCount;
+		unsigned long muteCount;
+		unsigned long foundCount; /* responders not known before */
+		unsigned long lostCount; /* known responders not found anymore */
+		float duration; /* in milliseconds */
+	};
+	
+	typedef std::vector<uint64_t> vec_uid;
+	
+	
+	DmxRdmDiscovery( DmxRdmTransport* transport, uint64_t controllerUid );
+	
+	int discover( bool full = false );
+	void forget();
+	
+	const vec_uid& getUids() const;
+	bool isKnown( uint64_t uid ) const;
+	uint64_t getControllerUid() const;
+	void getStats( discoveryStats* stats ) const;
+	
+private:
+	struct branch {
+		uint64_t lower;
+		uint64_t upper;
+	};
+	
+	static const int MUTE_ATTEMPTS;
+	
+	DmxRdmDiscovery( const DmxRdmDiscovery& other );
+	DmxRdmDiscovery& operator=( const DmxRdmDiscovery& other );
+	
+	int search( bool full );
+	int sendDiscovery( unsigned int pid, uint64_t destination, const unsigned char* data, int dataLength,
+										DmxRdmTransport::TRANSACTION_TYPE type, unsigned char* response, int maxLength );
+	int uniqueBranch( uint64_t lower, uint64_t upper, uint64_t* uid );
+	int mute( uint64_t uid );
+	int unmuteAll();
+	void addUid( uint64_t uid );
+	
+	DmxRdmTransport* transport_;
+	uint64_t controllerUid_;
+	unsigned char transaction_;
+	vec_uid uids_;
+	discoveryStats stats_;
+};
+
+#endif /* ! DMX_RDM_DISCOVERY_H */
@@ -0,0 +1,456 @@
+/*
+ * Arbitrates between several sACN (E1.31) sources sending the same universe,
+ * the way E1.31 receivers are expected to: sources are told apart by their CID,
+ * the highest priority wins and sources of equal priority are merged HTP.
+ * Sources can also send per-address priorities (start code 0xDD), in which case
+ * each slot is won separately; a per-address priority of 0 means the source
+ * does not send that slot. As is common practice, a universe priority of 0 is
+ * treated like a per-address priority of 1.
+ *
+ * Packets are fed in with receivePacket(), usually straight from a
+ * DmxNetReceiver (see DmxNetReceiver::setPacketCallback() and onPacket()).
+ * Arbitration is incremental: each universe remembers the lowest priority
+ * winning any of its slots, so a packet from a source which could not have won
+ * anything before and cannot win anything now is only stored. Likewise, a
+ * winning source repeating its levels does not cause a merge.
+ *
+ * A source is lost when it sends a stream terminated packet or nothing for
+ * SOURCE_TIMEOUT milliseconds (which update() has to be called regularly to
+ * notice). Depending on setSourceLoss(), it is then dropped, held at its last
+ * levels for a while or faded out, still at its own priority.
+ *
+ * The result of every merge that changes it is stored in a ring per universe,
+ * ready to be sent (see readUniverse()), and optionally published to a device.
+ */
+#include <cstring>
+#include "DmxClock.h"
+#include "DmxDevice.h"
+#include "DmxFrameRing.h"
+#include "DmxKernels.h"
+#include "DmxSacnDevice.h"
+#include "DmxSacnArbiter.h"
+
+const int DmxSacnArbiter::SLOT_COUNT;
+const int DmxSacnArbiter::SOURCE_COUNT_MAX = 16;
+const int DmxSacnArbiter::SOURCE_TIMEOUT = 2500; /* in milliseconds, as specified by E1.31 */
+const int DmxSacnArbiter::RING_CAPACITY = 4;
+const unsigned char DmxSacnArbiter::START_CODE_PRIORITY = 0xDD;
+
+const int DmxSacnArbiter::RV_UNIVERSE_INVALID = -20400;
+const int DmxSacnArbiter::RV_PACKET_IGNORED = -20401;
+
+//private constants
+const int DmxSacnArbiter::UNIVERSE_COUNT;
+const int DmxSacnArbiter::CID_LENGTH;
+const int DmxSacnArbiter::SEQUENCE_WINDOW = 20;
+
+
+DmxSacnArbiter::DmxSacnArbiter()
+: universeIndex_( UNIVERSE_COUNT, -1 ), lossMode_( LOSS_RELEASE ), lossDuration_( 0 ),
+  packetCount_( 0 ), skippedCount_( 0 ), mergeCount_( 0 ), outOfOrderCount_( 0 ),
+  sourceLossCount_( 0 ), sourceLimitCount_( 0 )
+{ /* empty */ }
+
+DmxSacnArbiter::~DmxSacnArbiter()
+{
+	for ( unsigned int i = 0; i < universes_.size(); i++ ) {
+		universe* u = universes_[i];
+		for ( unsigned int j = 0; j < u->sources.size(); j++ ) delete u->sources[j];
+		delete u->frames;
+		delete u;
+	}
+}
+
+
+/*
+ * Arbitrate the given universe. If a device is given, every new result is
+ * published to it (see DmxDevice::publishDmx()). Universes must be added before
+ * packets are fed in.
+ *
+ * Returns: 0 on success (also if the universe had already been added), or
+ * RV_UNIVERSE_INVALID.
+ */
+int DmxSacnArbiter::addUniverse( int number, DmxDevice* device )
+{
+	if ( number < 1 || number > DmxSacnDevice::UNIVERSE_MAX ) return RV_UNIVERSE_INVALID;
+	if ( universeIndex_[number] >= 0 ) return 0;
+	
+	universe* u = new universe();
+	u->number = number;
+	u->sources.reserve( SOURCE_COUNT_MAX );
+	u->minWinningPriority = 0;
+	std::memset( u->output, 0, sizeof( u->output ) );
+	std::memset( u->winningPriorities, 0, sizeof( u->winningPriorities ) );
+	u->outputLength = 0;
+	u->frames = new DmxFrameRing( RING_CAPACITY );
+	u->device = device;
+	
+	universeIndex_[number] = universes_.size();
+	universes_.push_back( u );
+	return 0;
+}
+
+/*
+ * Set what happens to a source once it is lost: with LOSS_HOLD its last levels
+ * are kept for the given duration in milliseconds (0 meaning until it comes
+ * back), with LOSS_FADE they fade out over the given duration. Either way, the
+ * source keeps competing at its own priority meanwhile. The default is
+ * LOSS_RELEASE.
+ */
+void DmxSacnArbiter::setSourceLoss( LOSS_MODE mode, int duration )
+{
+	lossMode_ = mode;
+	lossDuration_ = ( duration > 0 ) ? duration : 0;
+}
+
+/*
+ * Take a received packet into account. Packets other than sACN data (null start
+ * code) and per-address priority packets are ignored, as are preview packets
+ * and packets out of sequence. This may be called from several threads at once.
+ *
+ * Returns: 0 if the packet has been taken into account, RV_PACKET_IGNORED if
+ * not, or RV_UNIVERSE_INVALID if the universe has not been added.
+ */
+int DmxSacnArbiter::receivePacket( const DmxNetDevice::packetInfo* info, uint64_t timestamp )
+{
+	packetCount_++;
+	
+	if ( info->cid == 0 || info->priority < 0 ) return RV_PACKET_IGNORED;
+	if ( info->options & DmxSacnDevice::OPTION_PREVIEW_DATA ) return RV_PACKET_IGNORED;
+	if ( info->startCode != 0 && info->startCode != START_CODE_PRIORITY ) return RV_PACKET_IGNORED;
+	
+	int index = universeIndex_[info->universe & ( UNIVERSE_COUNT - 1 )];
+	if ( index < 0 ) return RV_UNIVERSE_INVALID;
+	universe* u = universes_[index];
+	
+	std::lock_guard<std::mutex> lock( u->mutex );
+	
+	bool terminated = ( info->options & DmxSacnDevice::OPTION_STREAM_TERMINATED ) != 0;
+	int sourceIndex = findSource( u, info->cid, ! terminated );
+	if ( sourceIndex < 0 ) {
+		if ( ! terminated ) sourceLimitCount_++;
+		return RV_PACKET_IGNORED;
+	}
+	source* s = u->sources[sourceIndex];
+	
+	if ( s->lastSequence >= 0 ) {
+		int diff = (signed char)( info->sequence - s->lastSequence );
+		if ( diff <= 0 && diff > -SEQUENCE_WINDOW ) {
+			outOfOrderCount_++;
+			return RV_PACKET_IGNORED;
+		}
+	}
+	s->lastSequence = info->sequence;
+	if ( s->lastSeen == 0 ) s->lastSeen = s->lastPrioritySeen = timestamp;
+	
+	if ( terminated ) {
+		if ( s->state == SOURCE_ACTIVE ) {
+			loseSource( u, sourceIndex, timestamp );
+			merge( u, timestamp );
+		}
+		return 0;
+	}
+	
+	//a held or fading source coming back always counts
+	bool wasActive = ( s->state == SOURCE_ACTIVE );
+	bool wasRelevant = s->relevant || ! wasActive;
+	int slotCount = info->slotCount;
+	if ( slotCount > SLOT_COUNT - 1 ) slotCount = SLOT_COUNT - 1;
+	s->state = SOURCE_ACTIVE;
+	
+	if ( info->startCode == 0 ) {
+		s->lastSeen = timestamp;
+		
+		//a winning source repeating itself changes nothing
+		bool unchanged = ( s->length == slotCount + 1 && s->priority == info->priority &&
+											 DmxKernels::equal( s->levels + 1, info->slots, slotCount ) );
+		if ( unchanged && wasActive && s->relevant ) {
+			skippedCount_++;
+			return 0;
+		}
+		
+		s->priority = info->priority;
+		s->levels[0] = 0;
+		std::memcpy( s->levels + 1, info->slots, slotCount );
+		s->length = slotCount + 1;
+	} else {
+		s->lastPrioritySeen = timestamp;
+		s->priorities[0] = 0;
+		std::memcpy( s->priorities + 1, info->slots, slotCount );
+		s->priorityLength = slotCount + 1;
+	}
+	updateMaxPriority( s );
+	
+	//a source which could not win a slot before and cannot now does not change the result
+	if ( ! wasRelevant && s->maxPriority < u->minWinningPriority && s->length <= u->outputLength ) {
+		skippedCount_++;
+		return 0;
+	}
+	
+	merge( u, timestamp );
+	return 0;
+}
+
+/*
+ * Packet callback for DmxNetReceiver::setPacketCallback(), with the arbiter as
+ * user data.
+ */
+void DmxSacnArbiter::onPacket( const DmxNetDevice::packetInfo* info, uint64_t timestamp, void* userData )
+{
+	static_cast<DmxSacnArbiter*>( userData )->receivePacket( info, timestamp );
+}
+
+/*
+ * Handle sources that have timed out, expired per-address priorities and the
+ * progress of holds and fades. This should be called regularly, e.g. at the
+ * output rate, from any thread.
+ *
+ * Returns: the number of universes whose result has been recomputed.
+ */
+int DmxSacnArbiter::update( uint64_t now )
+{
+	if ( now == 0 ) now = DmxClock::now();
+	int mergedCount = 0;
+	
+	for ( unsigned int i = 0; i < universes_.size(); i++ ) {
+		universe* u = universes_[i];
+		std::lock_guard<std::mutex> lock( u->mutex );
+		
+		if ( expireSources( u, now ) ) {
+			merge( u, now );
+			mergedCount++;
+		}
+	}
+	
+	return mergedCount;
+}
+
+/*
+ * Copy the most recent result of the given universe (start code included) and
+ * optionally return its sequence number in the universe's ring.
+ *
+ * Returns: true if successful, false if there is no result yet or the universe
+ * has not been added.
+ */
+bool DmxSacnArbiter::readUniverse( int number, DmxFrameBuffer* frame, uint64_t* sequence ) const
+{
+	const DmxFrameRing* ring = getUniverseFrames( number );
+	return ring != 0 && ring->readLatest( frame, sequence );
+}
+
+/*
+ * Returns the ring holding the most recent results of the given universe, or
+ * NULL if it has not been added.
+ */
+const DmxFrameRing* DmxSacnArbiter::getUniverseFrames( int number ) const
+{
+	if ( number < 0 || number >= UNIVERSE_COUNT ) return 0;
+	int index = universeIndex_[number];
+	return ( index >= 0 ) ? universes_[index]->frames : 0;
+}
+
+/*
+ * Returns the number of sources tracked for the given universe (including lost
+ * ones being held or faded), or RV_UNIVERSE_INVALID.
+ */
+int DmxSacnArbiter::getSourceCount( int number ) const
+{
+	if ( number < 0 || number >= UNIVERSE_COUNT || universeIndex_[number] < 0 ) return RV_UNIVERSE_INVALID;
+	
+	universe* u = universes_[universeIndex_[number]];
+	std::lock_guard<std::mutex> lock( u->mutex );
+	return u->sources.size();
+}
+
+void DmxSacnArbiter::getStats( arbiterStats* stats ) const
+{
+	stats->packetCount = packetCount_;
+	stats->skippedCount = skippedCount_;
+	stats->mergeCount = mergeCount_;
+	stats->outOfOrderCount = outOfOrderCount_;
+	stats->sourceLossCount = sourceLossCount_;
+	stats->sourceLimitCount = sourceLimitCount_;
+}
+
+
+/*********************
+ * PRIVATE FUNCTIONS *
+ *********************/
+
+/*
+ * Returns: the index of the source with the given CID, which is added if it is
+ * not tracked yet and create is true, or -1 if it is not found or there are too
+ * many sources already.
+ */
+int DmxSacnArbiter::findSource( universe* u, const unsigned char* cid, bool create )
+{
+	for ( unsigned int i = 0; i < u->sources.size(); i++ ) {
+		if ( std::memcmp( u->sources[i]->cid, cid, CID_LENGTH ) == 0 ) return i;
+	}
+	if ( ! create || (int)u->sources.size() >= SOURCE_COUNT_MAX ) return -1;
+	
+	source* s = new source();
+	std::memcpy( s->cid, cid, CID_LENGTH );
+	s->state = SOURCE_ACTIVE;
+	s->priority = 0;
+	s->maxPriority = 0;
+	s->relevant = false;
+	s->lastSequence = -1;
+	s->lastSeen = 0;
+	s->lastPrioritySeen = 0;
+	s->lostTime = 0;
+	s->length = 0;
+	s->priorityLength = 0;
+	
+	u->sources.push_back( s );
+	return u->sources.size() - 1;
+}
+
+/*
+ * Drop, hold or start fading a source which has been lost, see setSourceLoss().
+ */
+void DmxSacnArbiter::loseSource( universe* u, int index, uint64_t now )
+{
+	LOSS_MODE mode = (LOSS_MODE)lossMode_.load();
+	source* s = u->sources[index];
+	
+	sourceLossCount_++;
+	if ( mode == LOSS_RELEASE || ( mode == LOSS_FADE && lossDuration_ == 0 ) ) {
+		removeSource( u, index );
+	} else {
+		s->state = ( mode == LOSS_HOLD ) ? SOURCE_HELD : SOURCE_FADING;
+		s->lostTime = now;
+	}
+}
+
+void DmxSacnArbiter::removeSource( universe* u, int index )
+{
+	delete u->sources[index];
+	u->sources.erase( u->sources.begin() + index );
+}
+
+/*
+ * Apply timeouts to the sources of a universe, see update().
+ *
+ * Returns: true if the universe has to be merged again.
+ */
+bool DmxSacnArbiter::expireSources( universe* u, uint64_t now )
+{
+	const uint64_t timeout = (uint64_t)SOURCE_TIMEOUT * 1000000;
+	const uint64_t duration = (uint64_t)lossDuration_ * 1000000;
+	bool changed = false;
+	
+	for ( int i = u->sources.size() - 1; i >= 0; i-- ) {
+		source* s = u->sources[i];
+		
+		if ( s->state == SOURCE_ACTIVE ) {
+			if ( s->priorityLength > 0 && now > s->lastPrioritySeen + timeout ) {
+				s->priorityLength = 0;
+				updateMaxPriority( s );
+				changed = true;
+			}
+			if ( now > s->lastSeen + timeout ) {
+				loseSource( u, i, now );
+				changed = true;
+			}
+		} else if ( s->state == SOURCE_HELD ) {
+			if ( duration == 0 || now - s->lostTime < duration ) continue;
+			removeSource( u, i );
+			changed = true;
+		} else {
+			//fading sources change the result on every update
+			if ( now - s->lostTime >= duration ) removeSource( u, i );
+			changed = true;
+		}
+	}
+	
+	return changed;
+}
+
+/*
+ * Compute the highest priority any slot of the source has.
+ */
+void DmxSacnArbiter::updateMaxPriority( source* s ) const
+{
+	if ( s->priorityLength == 0 ) {
+		s->maxPriority = ( s->priority > 0 ) ? s->priority : 1;
+		return;
+	}
+	
+	int max = 0;
+	for ( int i = 1; i < s->priorityLength; i++ ) {
+		if ( s->priorities[i] > max ) max = s->priorities[i];
+	}
+	s->maxPriority = max;
+}
+
+/*
+ * Recompute the result of a universe from all of its sources, store it if it
+ * has changed and note which sources could win a slot.
+ */
+void DmxSacnArbiter::merge( universe* u, uint64_t now )
+{
+	unsigned char output[SLOT_COUNT];
+	unsigned char* winning = u->winningPriorities;
+	const uint64_t duration = (uint64_t)lossDuration_ * 1000000;
+	int length = 0;
+	
+	std::memset( output, 0, sizeof( output ) );
+	std::memset( winning, 0, SLOT_COUNT );
+	
+	for ( unsigned int i = 0; i < u->sources.size(); i++ ) {
+		const source* s = u->sources[i];
+		
+		//levels in 1/256 steps, only fading sources are scaled
+		unsigned int scale = 256;
+		if ( s->state == SOURCE_FADING ) {
+			uint64_t elapsed = now - s->lostTime;
+			scale = ( elapsed < duration ) ? 256 * ( duration - elapsed ) / duration : 0;
+		}
+		
+		int universePriority = ( s->priority > 0 ) ? s->priority : 1;
+		for ( int slot = 1; slot < s->length; slot++ ) {
+			int priority = universePriority;
+			if ( s->priorityLength > 0 ) priority = ( slot < s->priorityLength ) ? s->priorities[slot] : 0;
+			if ( priority == 0 ) continue;
+			
+			unsigned char level = ( s->levels[slot] * scale ) >> 8;
+			if ( priority > winning[slot] ) {
+				winning[slot] = priority;
+				output[slot] = level;
+			} else if ( priority == winning[slot] && level > output[slot] ) {
+				output[slot] = level;
+			}
+		}
+		
+		if ( s->length > length ) length = s->length;
+	}
+	
+	//without any source, keep sending zeros at the last length
+	if ( length == 0 ) length = u->outputLength;
+	
+	int minWinning = ( length > 1 ) ? 255 : 0;
+	for ( int slot = 1; slot < length; slot++ ) {
+		if ( winning[slot] < minWinning ) minWinning = winning[slot];
+	}
+	u->minWinningPriority = minWinning;
+	
+	for ( unsigned int i = 0; i < u->sources.size(); i++ ) {
+		source* s = u->sources[i];
+		s->relevant = ( s->maxPriority >= minWinning );
+	}
+	mergeCount_++;
+	
+	if ( length == u->outputLength && DmxKernels::equal( output, u->output, length ) ) return;
+	
+	std::memcpy( u->output, output, length );
+	u->outputLength = length;
+	
+	DmxFrameBuffer* f = u->frames->beginWrite();
+	std::memcpy( f->data, output, length );
+	f->length = length;
+	f->timestamp = now;
+	u->frames->commitWrite();
+	
+	if ( u->device != 0 ) u->device->publishDmx( output, length );
+}
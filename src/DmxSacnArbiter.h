@@ -0,0 +1,120 @@
+/*
+ */
+#ifndef DMX_SACN_ARBITER_H
+#define DMX_SACN_ARBITER_H
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+#include "DmxFrameBuffer.h"
+#include "DmxNetDevice.h"
+
+class DmxDevice;
+class DmxFrameRing;
+
+class DmxSacnArbiter {
+public:
+	enum LOSS_MODE {
+		LOSS_RELEASE, /* drop a lost source right away */
+		LOSS_HOLD, /* keep its last look for a while, or forever */
+		LOSS_FADE /* fade its levels out */
+	};
+	
+	struct arbiterStats {
+		unsigned long packetCount;
+		unsigned long skippedCount; /* packets which could not change the result */
+		unsigned long mergeCount;
+		unsigned long outOfOrderCount;
+		unsigned long sourceLossCount;
+		unsigned long sourceLimitCount; /* packets of new sources beyond SOURCE_COUNT_MAX */
+	};
+	
+	static const int SLOT_COUNT = 513;
+	static const int SOURCE_COUNT_MAX;
+	static const int SOURCE_TIMEOUT;
+	static const int RING_CAPACITY;
+	static const unsigned char START_CODE_PRIORITY;
+	
+	static const int RV_UNIVERSE_INVALID;
+	static const int RV_PACKET_IGNORED;
+	
+	
+	DmxSacnArbiter();
+	~DmxSacnArbiter();
+	
+	int addUniverse( int universe, DmxDevice* device = 0 );
+	void setSourceLoss( LOSS_MODE mode, int duration = 0 );
+	
+	int receivePacket( const DmxNetDevice::packetInfo* info, uint64_t timestamp );
+	static void onPacket( const DmxNetDevice::packetInfo* info, uint64_t timestamp, void* userData );
+	int update( uint64_t now = 0 );
+	
+	bool readUniverse( int universe, DmxFrameBuffer* frame, uint64_t* sequence = 0 ) const;
+	const DmxFrameRing* getUniverseFrames( int universe ) const;
+	int getSourceCount( int universe ) const;
+	void getStats( arbiterStats* stats ) const;
+	
+private:
+	static const int UNIVERSE_COUNT = 65536;
+	static const int CID_LENGTH = 16;
+	static const int SEQUENCE_WINDOW;
+	
+	enum SOURCE_STATE {
+		SOURCE_ACTIVE,
+		SOURCE_HELD,
+		SOURCE_FADING
+	};
+	
+	struct source {
+		unsigned char cid[CID_LENGTH];
+		SOURCE_STATE state;
+		int priority;
+		int maxPriority; /* the highest priority of any slot */
+		bool relevant; /* whether it could win a slot at the last merge */
+		int lastSequence;
+		uint64_t lastSeen;
+		uint64_t lastPrioritySeen;
+		uint64_t lostTime;
+		int length;
+		int priorityLength; /* 0 if no per-address priority is in effect */
+		unsigned char levels[SLOT_COUNT];
+		unsigned char priorities[SLOT_COUNT];
+	};
+	
+	struct universe {
+		int number;
+		std::mutex mutex;
+		std::vector<source*> sources;
+		int minWinningPriority;
+		unsigned char output[SLOT_COUNT];
+		unsigned char winningPriorities[SLOT_COUNT];
+		int outputLength;
+		DmxFrameRing* frames;
+		DmxDevice* device;
+	};
+	
+	DmxSacnArbiter( const DmxSacnArbiter& other );
+	DmxSacnArbiter& operator=( const DmxSacnArbiter& other );
+	
+	int findSource( universe* u, const unsigned char* cid, bool create );
+	void loseSource( universe* u, int index, uint64_t now );
+	void removeSource( universe* u, int index );
+	bool expireSources( universe* u, uint64_t now );
+	void updateMaxPriority( source* s ) const;
+	void merge( universe* u, uint64_t now );
+	
+	std::vector<int> universeIndex_;
+	std::vector<universe*> universes_;
+	std::atomic<int> lossMode_;
+	std::atomic<int> lossDuration_;
+	
+	std::atomic<uint64_t> packetCount_;
+	std::atomic<uint64_t> skippedCount_;
+	std::atomic<uint64_t> mergeCount_;
+	std::atomic<uint64_t> outOfOrderCount_;
+	std::atomic<uint64_t> sourceLossCount_;
+	std::atomic<uint64_t> sourceLimitCount_;
+};
+
+#endif /* ! DMX_SACN_ARBITER_H */
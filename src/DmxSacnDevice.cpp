@@ -0,0 +1,349 @@
+/*
+ * Sends DMX as streaming ACN (ANSI E1.31), see DmxNetDevice. Unless a host is
+ * given, each universe is sent to its own multicast group (239.255.x.y, with
+ * x.y being the universe number). Senders do not join the groups themselves;
+ * setMulticastInterface() selects the network to send them to.
+ *
+ * Every device has its own randomly generated component identifier (CID),
+ * which receivers use to tell sources apart, see setCid() to keep it stable
+ * across runs. When closed, the device marks its streams as terminated, so
+ * receivers release them right away instead of waiting for a timeout.
+ */
+#include <cstring>
+#include <random>
+#include <arpa/inet.h>
+#include "DmxSacnDevice.h"
+
+const int DmxSacnDevice::PORT = 5568;
+const int DmxSacnDevice::HEADER_LENGTH = 125;
+const int DmxSacnDevice::UNIVERSE_MIN = 1;
+const int DmxSacnDevice::UNIVERSE_MAX = 63999;
+const int DmxSacnDevice::PRIORITY_DEFAULT = 100;
+const int DmxSacnDevice::PRIORITY_MAX = 200;
+const int DmxSacnDevice::CID_LENGTH;
+const int DmxSacnDevice::SOURCE_NAME_LENGTH;
+const char* DmxSacnDevice::SOURCE_NAME_DEFAULT = "ofxGenericDmx";
+const unsigned char DmxSacnDevice::OPTION_PREVIEW_DATA = 0x80;
+const unsigned char DmxSacnDevice::OPTION_STREAM_TERMINATED = 0x40;
+
+//private constants
+const unsigned char DmxSacnDevice::ACN_PACKET_IDENTIFIER[12] =
+		{ 'A', 'S', 'C', '-', 'E', '1', '.', '1', '7', 0, 0, 0 };
+const uint32_t DmxSacnDevice::VECTOR_ROOT_E131_DATA = 0x00000004;
+const uint32_t DmxSacnDevice::VECTOR_E131_DATA_PACKET = 0x00000002;
+const unsigned char DmxSacnDevice::VECTOR_DMP_SET_PROPERTY = 0x02;
+const int DmxSacnDevice::ROOT_LENGTH_OFFSET = 16;
+const int DmxSacnDevice::FRAMING_LENGTH_OFFSET = 38;
+const int DmxSacnDevice::SEQUENCE_OFFSET = 111;
+const int DmxSacnDevice::OPTIONS_OFFSET = 112;
+const int DmxSacnDevice::DMP_LENGTH_OFFSET = 115;
+const int DmxSacnDevice::PROPERTY_COUNT_OFFSET = 123;
+const int DmxSacnDevice::TERMINATION_PACKET_COUNT = 3;
+
+static uint32_t readUint32( const unsigned char* field )
+{
+	return (uint32_t)field[0] << 24 | field[1] << 16 | field[2] << 8 | field[3];
+}
+
+/* writes a PDU flags and length field (length counted from the field itself) */
+static void writeFlagsAndLength( unsigned char* field, int length )
+{
+	field[0] = 0x70 | ( ( length >> 8 ) & 0x0F );
+	field[1] = length & 0xFF;
+}
+
+static void writeUint32( unsigned char* field, uint32_t value )
+{
+	field[0] = value >> 24;
+	field[1] = ( value >> 16 ) & 0xFF;
+	field[2] = ( value >> 8 ) & 0xFF;
+	field[3] = value & 0xFF;
+}
+
+
+DmxSacnDevice::DmxSacnDevice()
+: DmxNetDevice( PORT, UNIVERSE_MIN, UNIVERSE_MAX ), priority_( PRIORITY_DEFAULT ), multicastTtl_( 0 )
+{
+	std::random_device rd;
+	for ( int i = 0; i < CID_LENGTH; i++ ) cid_[i] = rd() & 0xFF;
+	cid_[6] = ( cid_[6] & 0x0F ) | 0x40; /* version 4 (random) UUID */
+	cid_[8] = ( cid_[8] & 0x3F ) | 0x80;
+	
+	std::memset( sourceName_, 0, sizeof( sourceName_ ) );
+	std::strncpy( sourceName_, SOURCE_NAME_DEFAULT, SOURCE_NAME_LENGTH - 1 );
+	
+	//the universe given to open(), fed by writeDmx() and publishDmx()
+	addUniverse( UNIVERSE_MIN );
+}
+
+DmxSacnDevice::~DmxSacnDevice()
+{
+	close();
+}
+
+
+/*
+ * Open the device (see DmxNetDevice::open()). Universes are numbered from 1 to
+ * 63999; if no host is given, they are multicast. Universe 0 is taken as
+ * UNIVERSE_MIN, since that is what a call through DmxDevice::open() passes by
+ * default.
+ */
+bool DmxSacnDevice::open( const char* host, const char* serial, int universe )
+{
+	if ( universe == 0 ) universe = UNIVERSE_MIN;
+	return DmxNetDevice::open( host, serial, universe );
+}
+
+/*
+ * Stop the output thread, mark all streams sent as terminated and close the
+ * socket.
+ */
+bool DmxSacnDevice::close()
+{
+	stopOutputThread();
+	if ( isOpen() ) terminateStreams();
+	return DmxNetDevice::close();
+}
+
+DmxDevice::DMX_DEVICE_TYPE DmxSacnDevice::getType() const
+{
+	return DmxDevice::DMX_DEVICE_SACN;
+}
+
+/*
+ * Set the user-readable name of this source (at most SOURCE_NAME_LENGTH - 1
+ * characters are used). This cannot be done while the output thread is running.
+ *
+ * Returns: true if the name has been set, false otherwise.
+ */
+bool DmxSacnDevice::setSourceName( const char* name )
+{
+	if ( isOutputThreadRunning() ) return false;
+	
+	std::memset( sourceName_, 0, sizeof( sourceName_ ) );
+	std::strncpy( sourceName_, name, SOURCE_NAME_LENGTH - 1 );
+	return rebuildHeaders();
+}
+
+const char* DmxSacnDevice::getSourceName() const
+{
+	return sourceName_;
+}
+
+/*
+ * Set the priority (0 to PRIORITY_MAX) receivers use to choose between sources
+ * sending the same universe. This cannot be done while the output thread is
+ * running.
+ *
+ * Returns: true if the priority has been set, false otherwise.
+ */
+bool DmxSacnDevice::setPriority( int priority )
+{
+	if ( isOutputThreadRunning() || priority < 0 || priority > PRIORITY_MAX ) return false;
+	
+	priority_ = priority;
+	return rebuildHeaders();
+}
+
+int DmxSacnDevice::getPriority() const
+{
+	return priority_;
+}
+
+/*
+ * Set the component identifier (CID_LENGTH bytes). This cannot be done while
+ * the output thread is running.
+ *
+ * Returns: true if the CID has been set, false otherwise.
+ */
+bool DmxSacnDevice::setCid( const unsigned char* cid )
+{
+	if ( isOutputThreadRunning() ) return false;
+	
+	std::memcpy( cid_, cid, CID_LENGTH );
+	return rebuildHeaders();
+}
+
+const unsigned char* DmxSacnDevice::getCid() const
+{
+	return cid_;
+}
+
+/*
+ * Set the (dotted) address of the interface to send multicast packets through,
+ * or NULL to let the routing table decide. Takes effect when the device is next
+ * opened.
+ */
+void DmxSacnDevice::setMulticastInterface( const char* address )
+{
+	multicastInterface_ = ( address != 0 ) ? address : "";
+}
+
+/*
+ * Set the number of router hops multicast packets may take, 0 selecting the
+ * system default. Takes effect when the device is next opened.
+ */
+void DmxSacnDevice::setMulticastTtl( int ttl )
+{
+	multicastTtl_ = ttl;
+}
+
+/*
+ * Fill in the multicast group address and port for the given universe.
+ */
+void DmxSacnDevice::getMulticastAddress( int universe, struct sockaddr_in* address )
+{
+	std::memset( address, 0, sizeof( *address ) );
+	address->sin_family = AF_INET;
+	address->sin_port = htons( PORT );
+	address->sin_addr.s_addr = htonl( 0xEFFF0000 | ( universe & 0xFFFF ) );
+}
+
+/*
+ * Decode an E1.31 data packet. Other E1.31 packets (synchronization and
+ * universe discovery) are not handled.
+ *
+ * Returns: 0 if successful or RV_PACKET_INVALID if the packet is not a valid
+ * data packet.
+ */
+int DmxSacnDevice::parsePacket( const unsigned char* packet, int length, packetInfo* info )
+{
+	if ( length < HEADER_LENGTH + 1 ) return RV_PACKET_INVALID;
+	if ( std::memcmp( packet + 4, ACN_PACKET_IDENTIFIER, sizeof( ACN_PACKET_IDENTIFIER ) ) != 0 ) {
+		return RV_PACKET_INVALID;
+	}
+	if ( readUint32( packet + 18 ) != VECTOR_ROOT_E131_DATA ) return RV_PACKET_INVALID;
+	if ( readUint32( packet + 40 ) != VECTOR_E131_DATA_PACKET ) return RV_PACKET_INVALID;
+	if ( packet[117] != VECTOR_DMP_SET_PROPERTY || packet[118] != 0xA1 ) return RV_PACKET_INVALID;
+	
+	int count = packet[PROPERTY_COUNT_OFFSET] << 8 | packet[PROPERTY_COUNT_OFFSET + 1];
+	if ( count < 1 || count > 513 || HEADER_LENGTH + count > length ) return RV_PACKET_INVALID;
+	
+	info->universe = packet[113] << 8 | packet[114];
+	info->sequence = packet[SEQUENCE_OFFSET];
+	info->priority = packet[108];
+	info->options = packet[OPTIONS_OFFSET];
+	info->cid = packet + 22;
+	info->startCode = packet[HEADER_LENGTH];
+	info->slots = packet + HEADER_LENGTH + 1;
+	info->slotCount = count - 1;
+	
+	return 0;
+}
+
+bool DmxSacnDevice::prepareSocket()
+{
+	bool success = socket_->setMulticastLoop( true );
+	if ( success && multicastTtl_ > 0 ) success = socket_->setMulticastTtl( multicastTtl_ );
+	if ( success && ! multicastInterface_.empty() ) {
+		success = socket_->setMulticastInterface( multicastInterface_.c_str() );
+	}
+	return success;
+}
+
+/*
+ * Universes are multicast to their own group unless a host was given to
+ * open().
+ */
+void DmxSacnDevice::getDefaultAddress( int universe, struct sockaddr_in* address ) const
+{
+	if ( hostAddress_ ) *address = address_;
+	else getMulticastAddress( universe, address );
+}
+
+/*
+ * Write the root, framing and DMP layer headers of an E1.31 data packet for the
+ * given universe. Only the sequence number, the length fields and the property
+ * values change afterwards.
+ */
+void DmxSacnDevice::buildHeader( universe* u ) const
+{
+	unsigned char* packet = u->packet;
+	std::memset( packet, 0, HEADER_LENGTH );
+	
+	//root layer
+	packet[1] = 0x10; /* preamble size */
+	std::memcpy( packet + 4, ACN_PACKET_IDENTIFIER, sizeof( ACN_PACKET_IDENTIFIER ) );
+	writeUint32( packet + 18, VECTOR_ROOT_E131_DATA );
+	std::memcpy( packet + 22, cid_, CID_LENGTH );
+	
+	//framing layer
+	writeUint32( packet + 40, VECTOR_E131_DATA_PACKET );
+	std::memcpy( packet + 44, sourceName_, SOURCE_NAME_LENGTH );
+	packet[108] = priority_;
+	packet[113] = u->number >> 8;
+	packet[114] = u->number & 0xFF;
+	
+	//DMP layer
+	packet[117] = VECTOR_DMP_SET_PROPERTY;
+	packet[118] = 0xA1; /* address and data type */
+	packet[122] = 0x01; /* address increment */
+	
+	if ( u->packetLength > HEADER_LENGTH ) setPacketData( packet, packet + HEADER_LENGTH, u->packetLength - HEADER_LENGTH );
+}
+
+/*
+ * Copy a frame (start code included) into the property values of the given
+ * packet and update the length fields.
+ *
+ * Returns: the length of the packet, or -1 if the frame is empty.
+ */
+int DmxSacnDevice::setPacketData( unsigned char* packet, const unsigned char* data, int length ) const
+{
+	if ( length < 1 ) return -1;
+	if ( length > 513 ) length = 513;
+	
+	int total = HEADER_LENGTH + length;
+	if ( data != packet + HEADER_LENGTH ) std::memcpy( packet + HEADER_LENGTH, data, length );
+	
+	writeFlagsAndLength( packet + ROOT_LENGTH_OFFSET, total - ROOT_LENGTH_OFFSET );
+	writeFlagsAndLength( packet + FRAMING_LENGTH_OFFSET, total - FRAMING_LENGTH_OFFSET );
+	writeFlagsAndLength( packet + DMP_LENGTH_OFFSET, total - DMP_LENGTH_OFFSET );
+	packet[PROPERTY_COUNT_OFFSET] = length >> 8;
+	packet[PROPERTY_COUNT_OFFSET + 1] = length & 0xFF;
+	
+	return total;
+}
+
+void DmxSacnDevice::setSequence( unsigned char* packet, unsigned char sequence ) const
+{
+	packet[SEQUENCE_OFFSET] = sequence;
+}
+
+
+/*********************
+ * PRIVATE FUNCTIONS *
+ *********************/
+
+/*
+ * Rebuild the headers of all universes after a change to the source settings,
+ * keeping the data they hold.
+ *
+ * Returns: true.
+ */
+bool DmxSacnDevice::rebuildHeaders()
+{
+	for ( unsigned int i = 0; i < universes_.size(); i++ ) buildHeader( universes_[i] );
+	return true;
+}
+
+/*
+ * Send the last frame of every universe sent so far with the stream terminated
+ * option set, the number of times recommended by E1.31.
+ */
+void DmxSacnDevice::terminateStreams()
+{
+	std::vector<universe*> active;
+	for ( unsigned int i = 0; i < universes_.size(); i++ ) {
+		if ( universes_[i]->lastSent != 0 ) active.push_back( universes_[i] );
+	}
+	if ( active.empty() ) return;
+	
+	for ( unsigned int i = 0; i < active.size(); i++ ) active[i]->packet[OPTIONS_OFFSET] |= OPTION_STREAM_TERMINATED;
+	for ( int n = 0; n < TERMINATION_PACKET_COUNT; n++ ) sendUniverses( &active[0], active.size() );
+	
+	for ( unsigned int i = 0; i < active.size(); i++ ) {
+		active[i]->packet[OPTIONS_OFFSET] &= ~OPTION_STREAM_TERMINATED;
+		active[i]->lastSent = 0;
+	}
+}
@@ -0,0 +1,76 @@
+/*
+ */
+#ifndef DMX_SACN_DEVICE_H
+#define DMX_SACN_DEVICE_H
+
+#include <string>
+#include "DmxNetDevice.h"
+
+class DmxSacnDevice : public DmxNetDevice {
+public:
+	static const int PORT;
+	static const int HEADER_LENGTH;
+	static const int UNIVERSE_MIN;
+	static const int UNIVERSE_MAX;
+	static const int PRIORITY_DEFAULT;
+	static const int PRIORITY_MAX;
+	static const int CID_LENGTH = 16;
+	static const int SOURCE_NAME_LENGTH = 64;
+	static const char* SOURCE_NAME_DEFAULT;
+	static const unsigned char OPTION_PREVIEW_DATA;
+	static const unsigned char OPTION_STREAM_TERMINATED;
+	
+	
+	DmxSacnDevice();
+	~DmxSacnDevice();
+	
+	bool open( const char* host = 0, const char* serial = 0, int universe = 1 );
+	bool close();
+	DMX_DEVICE_TYPE getType() const;
+	
+	bool setSourceName( const char* name );
+	const char* getSourceName() const;
+	bool setPriority( int priority );
+	int getPriority() const;
+	bool setCid( const unsigned char* cid );
+	const unsigned char* getCid() const;
+	void setMulticastInterface( const char* address );
+	void setMulticastTtl( int ttl );
+	
+	static void getMulticastAddress( int universe, struct sockaddr_in* address );
+	static int parsePacket( const unsigned char* packet, int length, packetInfo* info );
+	
+protected:
+	bool prepareSocket();
+	void getDefaultAddress( int universe, struct sockaddr_in* address ) const;
+	void buildHeader( universe* u ) const;
+	int setPacketData( unsigned char* packet, const unsigned char* data, int length ) const;
+	void setSequence( unsigned char* packet, unsigned char sequence ) const;
+	
+private:
+	static const unsigned char ACN_PACKET_IDENTIFIER[12];
+	static const uint32_t VECTOR_ROOT_E131_DATA;
+	static const uint32_t VECTOR_E131_DATA_PACKET;
+	static const unsigned char VECTOR_DMP_SET_PROPERTY;
+	static const int ROOT_LENGTH_OFFSET;
+	static const int FRAMING_LENGTH_OFFSET;
+	static const int SEQUENCE_OFFSET;
+	static const int OPTIONS_OFFSET;
+	static const int DMP_LENGTH_OFFSET;
+	static const int PROPERTY_COUNT_OFFSET;
+	static const int TERMINATION_PACKET_COUNT;
+	
+	DmxSacnDevice( const DmxSacnDevice& other );
+	DmxSacnDevice& operator=( const DmxSacnDevice& other );
+	
+	bool rebuildHeaders();
+	void terminateStreams();
+	
+	unsigned char cid_[CID_LENGTH];
+	char sourceName_[SOURCE_NAME_LENGTH];
+	int priority_;
+	std::string multicastInterface_;
+	int multicastTtl_;
+};
+
+#endif /* ! DMX_SACN_DEVICE_H */
@@ -0,0 +1,188 @@
+/*
+ * Index of subscriptions to DMX input slots. Subscriptions either cover a range
+ * of slots (notified whenever any of them changes) or watch a single slot for
+ * crossing a threshold (notified when it goes from below to at or above it, or
+ * back).
+ * Every subscription is listed with each block of BLOCK_SIZE slots it overlaps.
+ * Dispatching a frame only visits the blocks containing changed slots and the
+ * subscriptions listed there, so its cost depends on how much has changed, not
+ * on how many subscriptions exist. A subscription overlapping several changed
+ * blocks is still notified once per frame (tracked with an epoch counter).
+ * The affected subscriptions are collected with the index locked, but notified
+ * after unlocking it, so callbacks may take their time and may add or remove
+ * subscriptions without holding up (or deadlocking) other users of the index.
+ */
+#include "DmxSubscriptionIndex.h"
+
+const int DmxSubscriptionIndex::SLOT_COUNT;
+const int DmxSubscriptionIndex::BLOCK_SIZE;
+const int DmxSubscriptionIndex::BLOCK_COUNT;
+const int DmxSubscriptionIndex::BITMAP_WORDS;
+
+const int DmxSubscriptionIndex::RV_INVALID_SLOT = -16100;
+
+
+static inline int lowestBit( uint64_t w )
+{
+#if defined( __GNUC__ )
+	return __builtin_ctzll( w );
+#else
+	int n = 0;
+	while ( ( w & 1 ) == 0 ) { w >>= 1; n++; }
+	return n;
+#endif
+}
+
+
+DmxSubscriptionIndex::DmxSubscriptionIndex()
+: epoch_( 0 ), count_( 0 )
+{ /* empty */ }
+
+
+/*
+ * Subscribe to changes of any slot from firstSlot up to and including lastSlot
+ * (slot 0 being the start code).
+ *
+ * Returns: the id of the new subscription or RV_INVALID_SLOT.
+ */
+int DmxSubscriptionIndex::addRange( int firstSlot, int lastSlot, callback cb, void* userData )
+{
+	if ( firstSlot < 0 || lastSlot >= SLOT_COUNT || firstSlot > lastSlot ) return RV_INVALID_SLOT;
+	
+	subscription sub = { firstSlot, lastSlot, true, false, 0, 0, cb, userData, 0 };
+	return add( sub );
+}
+
+/*
+ * Subscribe to the given slot crossing the threshold in either direction. The
+ * slot is assumed to start at 0, so the first frame may already trigger it.
+ *
+ * Returns: the id of the new subscription or RV_INVALID_SLOT.
+ */
+int DmxSubscriptionIndex::addThreshold( int slot, unsigned char threshold, callback cb, void* userData )
+{
+	if ( slot < 0 || slot >= SLOT_COUNT ) return RV_INVALID_SLOT;
+	
+	subscription sub = { slot, slot, true, true, threshold, 0, cb, userData, 0 };
+	return add( sub );
+}
+
+/*
+ * Returns: true if the subscription has been removed, false if it did not exist.
+ */
+bool DmxSubscriptionIndex::remove( int id )
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	
+	if ( id < 0 || id >= (int)subscriptions_.size() || ! subscriptions_[id].active ) return false;
+	
+	subscription& sub = subscriptions_[id];
+	for ( int b = sub.firstSlot / BLOCK_SIZE; b <= sub.lastSlot / BLOCK_SIZE; b++ ) {
+		std::vector<int>& block = blocks_[b];
+		for ( size_t i = 0; i < block.size(); i++ ) {
+			if ( block[i] == id ) {
+				block[i] = block.back();
+				block.pop_back();
+				break;
+			}
+		}
+	}
+	
+	sub.active = false;
+	freeIds_.push_back( id );
+	count_--;
+	return true;
+}
+
+int DmxSubscriptionIndex::getCount() const
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	return count_;
+}
+
+/*
+ * Notify the subscriptions affected by the slots flagged in changed (a bitmap
+ * of BITMAP_WORDS words, bit n of word n / 64 representing slot n). The frame
+ * is passed on to the callbacks, which are called on the dispatching thread.
+ * Callbacks may add or remove subscriptions, but must not dispatch. Note that a
+ * subscription removed while a dispatch is in progress may still be notified
+ * by it.
+ *
+ * Returns: the number of callbacks made.
+ */
+int DmxSubscriptionIndex::dispatch( const unsigned char* data, int length, const uint64_t* changed )
+{
+	std::lock_guard<std::mutex> dispatchLock( dispatchMutex_ );
+	hits_.clear();
+	
+	std::unique_lock<std::mutex> lock( mutex_ );
+	epoch_++;
+	
+	for ( int w = 0; w < BITMAP_WORDS; w++ ) {
+		uint64_t bits = changed[w];
+		//ignore bits past the last slot, they have no block
+		if ( w == BITMAP_WORDS - 1 && SLOT_COUNT % 64 != 0 ) bits &= ( 1ULL << ( SLOT_COUNT % 64 ) ) - 1;
+		
+		while ( bits != 0 ) {
+			int byte = lowestBit( bits ) / 8;
+			unsigned int blockMask = ( bits >> ( byte * 8 ) ) & 0xFF;
+			bits &= ~( (uint64_t)0xFF << ( byte * 8 ) );
+			
+			int b = w * ( 64 / BLOCK_SIZE ) + byte;
+			int blockStart = b * BLOCK_SIZE;
+			const std::vector<int>& block = blocks_[b];
+			
+			for ( size_t i = 0; i < block.size(); i++ ) {
+				subscription& sub = subscriptions_[block[i]];
+				if ( sub.epoch == epoch_ ) continue;
+				
+				int lo = ( sub.firstSlot > blockStart ? sub.firstSlot : blockStart ) - blockStart;
+				int hi = ( sub.lastSlot < blockStart + BLOCK_SIZE - 1 ? sub.lastSlot : blockStart + BLOCK_SIZE - 1 ) - blockStart;
+				unsigned int subMask = ( ( 1u << ( hi - lo + 1 ) ) - 1 ) << lo;
+				if ( ( subMask & blockMask ) == 0 ) continue;
+				
+				sub.epoch = epoch_;
+				
+				if ( sub.isThreshold ) {
+					unsigned char value = ( sub.firstSlot < length ) ? data[sub.firstSlot] : 0;
+					bool crossed = ( sub.lastValue < sub.threshold ) != ( value < sub.threshold );
+					sub.lastValue = value;
+					if ( ! crossed ) continue;
+				}
+				
+				hit h = { block[i], sub.cb, sub.userData };
+				hits_.push_back( h );
+			}
+		}
+	}
+	lock.unlock();
+	
+	for ( size_t i = 0; i < hits_.size(); i++ ) hits_[i].cb( hits_[i].id, data, length, hits_[i].userData );
+	
+	return hits_.size();
+}
+
+
+/*********************
+ * PRIVATE FUNCTIONS *
+ *********************/
+
+int DmxSubscriptionIndex::add( const subscription& sub )
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	int id;
+	
+	if ( ! freeIds_.empty() ) {
+		id = freeIds_.back();
+		freeIds_.pop_back();
+		subscriptions_[id] = sub;
+	} else {
+		id = subscriptions_.size();
+		subscriptions_.push_back( sub );
+	}
+	
+	for ( int b = sub.firstSlot / BLOCK_SIZE; b <= sub.lastSlot / BLOCK_SIZE; b++ ) blocks_[b].push_back( id );
+	
+	count_++;
+	return id;
+}
@@ -0,0 +1,66 @@
+/*
+ */
+#ifndef DMX_SUBSCRIPTION_INDEX_H
+#define DMX_SUBSCRIPTION_INDEX_H
+
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+class DmxSubscriptionIndex {
+public:
+	typedef void ( *callback )( int id, const unsigned char* data, int length, void* userData );
+	
+	static const int SLOT_COUNT = 513;
+	static const int BLOCK_SIZE = 8;
+	static const int BLOCK_COUNT = ( SLOT_COUNT + BLOCK_SIZE - 1 ) / BLOCK_SIZE;
+	static const int BITMAP_WORDS = ( SLOT_COUNT + 63 ) / 64;
+	
+	static const int RV_INVALID_SLOT;
+	
+	
+	DmxSubscriptionIndex();
+	
+	int addRange( int firstSlot, int lastSlot, callback cb, void* userData = 0 );
+	int addThreshold( int slot, unsigned char threshold, callback cb, void* userData = 0 );
+	bool remove( int id );
+	int getCount() const;
+	
+	int dispatch( const unsigned char* data, int length, const uint64_t* changed );
+	
+private:
+	struct subscription {
+		int firstSlot;
+		int lastSlot;
+		bool active;
+		bool isThreshold;
+		unsigned char threshold;
+		unsigned char lastValue;
+		callback cb;
+		void* userData;
+		uint64_t epoch;
+	};
+	
+	struct hit {
+		int id;
+		callback cb;
+		void* userData;
+	};
+	
+	DmxSubscriptionIndex( const DmxSubscriptionIndex& other );
+	DmxSubscriptionIndex& operator=( const DmxSubscriptionIndex& other );
+	
+	int add( const subscription& sub );
+	
+	std::vector<subscription> subscriptions_;
+	std::vector<int> freeIds_;
+	std::vector<int> blocks_[BLOCK_COUNT];
+	uint64_t epoch_;
+	int count_;
+	mutable std::mutex mutex_;
+	
+	std::mutex dispatchMutex_; /* serializes dispatch(), which reuses hits_ */
+	std::vector<hit> hits_;
+};
+
+#endif /* ! DMX_SUBSCRIPTION_INDEX_H */
@@ -0,0 +1,72 @@
+/*
+ * Lock-free triple buffer for handing DMX frames from one writer thread (the
+ * application) to one reader thread (the output thread of a DmxDevice).
+ * The writer always owns a back buffer it can fill at leisure, the reader
+ * always owns a front buffer it can send from. Publishing swaps the back buffer
+ * with the shared middle one, acquiring swaps the front buffer with it, so
+ * neither side ever waits for the other and the reader always gets the most
+ * recently completed frame (intermediate frames are simply overwritten).
+ */
+#include "DmxTripleBuffer.h"
+
+const int DmxTripleBuffer::FRAME_MAX_LENGTH;
+
+//private constants
+const unsigned char DmxTripleBuffer::INDEX_MASK = 0x03;
+const unsigned char DmxTripleBuffer::NEW_FLAG = 0x04;
+
+
+DmxTripleBuffer::DmxTripleBuffer()
+: back_( 0 ), middle_( 1 ), front_( 2 )
+{ /* empty */ }
+
+
+/*
+ * Return the frame owned by the writer. It may be filled in freely and remains
+ * valid until publish() is called.
+ */
+DmxTripleBuffer::frame* DmxTripleBuffer::getWriteFrame()
+{
+	return &frames_[back_];
+}
+
+/*
+ * Make the frame returned by getWriteFrame() available to the reader. This is
+ * a single atomic exchange, it never blocks.
+ */
+void DmxTripleBuffer::publish()
+{
+	unsigned char prev = middle_.exchange( back_ | NEW_FLAG, std::memory_order_acq_rel );
+	back_ = prev & INDEX_MASK;
+}
+
+/*
+ * Return the most recently published frame, which is owned by the reader until
+ * the next call (so it may for instance be framed in place). If isNew is given,
+ * it is set to indicate whether the frame has been published since the
+ * previous call.
+ *
+ * Returns: a frame pointer, which is never NULL (before anything has been
+ * published, an empty frame is returned).
+ */
+DmxTripleBuffer::frame* DmxTripleBuffer::acquireReadFrame( bool* isNew )
+{
+	bool n = ( middle_.load( std::memory_order_relaxed ) & NEW_FLAG ) != 0;
+
+	if ( n ) {
+		unsigned char prev = middle_.exchange( front_, std::memory_order_acq_rel );
+		front_ = prev & INDEX_MASK;
+	}
+
+	if ( isNew != 0 ) *isNew = n;
+	return &frames_[front_];
+}
+
+/*
+ * Return a flag indicating whether a frame has been published which has not
+ * been acquired yet.
+ */
+bool DmxTripleBuffer::hasNewFrame() const
+{
+	return ( middle_.load( std::memory_order_relaxed ) & NEW_FLAG ) != 0;
+}
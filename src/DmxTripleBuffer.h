@@ -0,0 +1,39 @@
+/*
+ */
+#ifndef DMX_TRIPLE_BUFFER_H
+#define DMX_TRIPLE_BUFFER_H
+
+#include <atomic>
+#include "DmxFrameBuffer.h"
+
+class DmxTripleBuffer {
+public:
+	static const int FRAME_MAX_LENGTH = 513;
+
+	typedef DmxFrameBuffer frame;
+
+
+	DmxTripleBuffer();
+
+	frame* getWriteFrame();
+	void publish();
+
+	frame* acquireReadFrame( bool* isNew = 0 );
+	bool hasNewFrame() const;
+
+private:
+	static const unsigned char INDEX_MASK;
+	static const unsigned char NEW_FLAG;
+
+	DmxTripleBuffer( const DmxTripleBuffer& other );
+	DmxTripleBuffer& operator=( const DmxTripleBuffer& other );
+
+	frame frames_[3];
+
+	//NOTE: back_ is only touched by the writer, front_ only by the reader.
+	unsigned char back_;
+	std::atomic<unsigned char> middle_;
+	unsigned char front_;
+};
+
+#endif /* ! DMX_TRIPLE_BUFFER_H */
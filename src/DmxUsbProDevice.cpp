@@ -2,8 +2,10 @@
  * TODO:
  * - force sending a minimum of 25 channels? (by padding 0-valued channels)
  *   this may be necessary since the API mentions a mininum size of 25 bytes on page 5
+ *   (the output thread does pad frames when adaptive slot count is enabled)
  * - purging buffers in open() seems not to work since an invalid header is
  *   (often) received anyway after just having killed the process previously.
+ *   (incoming data now goes through DmxUsbProParser, which skips such garbage)
  *
  * FIXME:
  * - writing user configuration data somehow seems to write at most 256 bytes,
@@ -11,11 +13,19 @@
  *   Where is the bug?
  */
 #include <assert.h>
+#include <chrono>
+#include <cstddef> /* for offsetof() */
 #include <cstring>
 #include <iostream> /* TEMP: for user configuration bug warnings */
 #include <math.h> /* for lroundf() */
 #include <unistd.h> /* for usleep() */
+#include "DmxClock.h"
 #include "DmxDevice.h"
+#include "DmxFrameCapture.h"
+#include "DmxFrameRing.h"
+#include "DmxRdmCache.h"
+#include "DmxRdmDiscovery.h"
+#include "DmxTripleBuffer.h"
 #include "DmxUsbProDevice.h"
 
 //public constants
@@ -25,6 +35,9 @@ const unsigned int DmxUsbProDevice::BREAK_TIME_UNITS_MAX = 127;
 const unsigned int DmxUsbProDevice::MAB_TIME_UNITS_MIN = 1;
 const unsigned int DmxUsbProDevice::MAB_TIME_UNITS_MAX = 127;
 const unsigned int DmxUsbProDevice::OUTPUT_RATE_MAX = 40;
+const int DmxUsbProDevice::PORT_COUNT;
+const int DmxUsbProDevice::INPUT_UNIVERSE_LENGTH;
+const int DmxUsbProDevice::SLOT_BITMAP_WORDS;
 const unsigned int DmxUsbProDevice::USER_CONFIG_MAX_LENGTH = 508;
 const char* DmxUsbProDevice::USB_DESCRIPTION = "DMX USB PRO";
 
@@ -41,32 +54,345 @@ const unsigned char DmxUsbProDevice::PACKET_START_CODE = 0x7E;
 const unsigned char DmxUsbProDevice::PACKET_END_CODE = 0xE7;
 const unsigned int DmxUsbProDevice::PACKET_MAX_DATA_SIZE = 600;
 
-const int DmxUsbProDevice::REQUEST_REPLY_DELAY = 5; /* in milliseconds */
+//NOTE: the timeout is long but this should not be a problem as long as not too much data is requested.
+const int DmxUsbProDevice::READ_TIMEOUT = 10000; /* in milliseconds */
+const int DmxUsbProDevice::AUTOTUNE_READ_TIMEOUT = 100; /* in milliseconds */
+const int DmxUsbProDevice::AUTOTUNE_PROBE_COUNT = 3;
+const int DmxUsbProDevice::READ_CHUNK_LENGTH;
+const int DmxUsbProDevice::INPUT_READ_TIMEOUT = 100; /* in milliseconds */
+const int DmxUsbProDevice::RDM_RESPONSE_TIMEOUT = 30; /* in milliseconds */
+const unsigned int DmxUsbProDevice::RDM_MANUFACTURER_ID = 0x454E; /* Enttec's ESTA id */
+const float DmxUsbProDevice::MINIMUM_DMX_RATE_DEFAULT = 25.0f;
+const uint64_t DmxUsbProDevice::LINE_MARGIN = 500000; /* in nanoseconds */
+const uint64_t DmxUsbProDevice::RDM_TRANSACTION_TIME_DEFAULT = 5000000; /* in nanoseconds */
+const unsigned char DmxUsbProDevice::INPUT_STATUS_QUEUE_OVERFLOW = 0x01;
+const unsigned char DmxUsbProDevice::INPUT_STATUS_OVERRUN = 0x02;
+
+DmxUsbProDevice::map_autoTuneResult DmxUsbProDevice::s_autoTuneResults;
+std::mutex DmxUsbProDevice::s_autoTuneMutex;
+
+//sendUsbProFrame() relies on the header directly preceding the data
+static_assert( offsetof( DmxFrameBuffer, data ) == DmxFrameBuffer::HEADROOM,
+							"DmxFrameBuffer headroom must directly precede its data" );
+//the changed slot bitmap is passed on to input subscriptions as is
+static_assert( DmxUsbProDevice::SLOT_BITMAP_WORDS == DmxSubscriptionIndex::BITMAP_WORDS,
+							"input bitmap must match DmxSubscriptionIndex" );
 
 
 DmxUsbProDevice::DmxUsbProDevice()
-: widgetParams_( 0 ), userConfigData_( 0 ), serialNumber_( 0 )
-{ /* empty */ }
+: parser_( onUsbProPacket, this ), reply_( 0 ),
+  widgetParams_( 0 ), userConfigData_( 0 ), serialNumber_( 0 ), roundTripTime_( 0 ),
+  defaultRefreshRate_( OUTPUT_RATE_MAX ),
+  inputCapture_( new DmxFrameCapture() ), inputThread_( 0 ),
+  inputThreadRunning_( false ), inputChangesOnly_( false ),
+  inputFrameCallback_( 0 ), inputFrameCallbackData_( 0 ),
+  queueOverflowCount_( 0 ), overrunCount_( 0 ), rdmDiscovery_( 0 ), rdmCache_( 0 ),
+  minimumDmxRate_( MINIMUM_DMX_RATE_DEFAULT ), outputLength_( 513 ), rdmTimeoutLimit_( 0 ),
+  rdmTransactionTime_( RDM_TRANSACTION_TIME_DEFAULT ), rdmTimeSum_( 0 ), rdmBurstMax_( 0 ),
+  rdmTransactionCount_( 0 ), lineStatsStart_( 0 ), port2Enabled_( false ),
+  port2Frames_( new DmxTripleBuffer() )
+{
+	for ( int p = 0; p < PORT_COUNT; p++ ) {
+		inputPort& ip = inputPorts_[p];
+		ip.frames = new DmxFrameRing();
+		std::memset( ip.universe, 0, sizeof( ip.universe ) );
+		ip.universeLength = 0;
+		for ( int i = 0; i < SLOT_BITMAP_WORDS; i++ ) ip.changedSlots[i].store( 0 );
+	}
+	std::memset( &port2Config_, 0, sizeof( port2Config_ ) );
+}
 
 DmxUsbProDevice::~DmxUsbProDevice()
 {
+	stopOutputThread();
+	stopInput();
+	delete inputCapture_;
+	for ( int p = 0; p < PORT_COUNT; p++ ) delete inputPorts_[p].frames;
+	delete port2Frames_;
+	delete rdmDiscovery_;
+	delete rdmCache_.load();
 	delete widgetParams_;
 	delete userConfigData_;
 	delete serialNumber_;
 }
 
 
+/*
+ * Open the device (see DmxDevice::open()), tune its USB settings for short
+ * request/reply round trips and fetch the widget parameters, so the default
+ * refresh rate is known before any output thread runs. The settings are only
+ * measured the first time a widget is opened (see autoTune()).
+ */
+bool DmxUsbProDevice::open( const char* description, const char* serial, int index )
+{
+	bool success = DmxDevice::open( description, serial, index );
+	if ( success ) {
+		defaultRefreshRate_ = OUTPUT_RATE_MAX;
+		if ( ! applyAutoTuneResult() ) autoTune();
+		fetchWidgetParameters();
+	}
+	return success;
+}
+
+/*
+ * Stop DMX input (if running) and close the device (see DmxDevice::close()).
+ * Port 2 has to be enabled again after reopening.
+ */
+bool DmxUsbProDevice::close()
+{
+	stopInput();
+	port2Enabled_ = false;
+	return DmxDevice::close();
+}
+
+/*
+ * Copy the most recently received frame into the given buffer. DMX input must
+ * have been started with startInput().
+ *
+ * Returns: the number of bytes copied (at most length), 0 if no frame has been
+ * received yet, or < 0 if an error occured.
+ */
+int DmxUsbProDevice::readDmx( const unsigned char* data, int length ) const
+{
+	return readDmx( 1, data, length );
+}
+
+/*
+ * Like readDmx() above, for the given port (1 or 2, see enablePort2()).
+ */
+int DmxUsbProDevice::readDmx( int port, const unsigned char* data, int length ) const
+{
+	if ( ! isOpen() ) return DmxDevice::RV_DEVICE_NOT_OPEN;
+	if ( port < 1 || port > PORT_COUNT ) return DmxDevice::RV_NOT_SUPPORTED;
+	
+	DmxFrameBuffer frame;
+	if ( ! inputPorts_[port - 1].frames->readLatest( &frame ) ) return 0;
+	
+	if ( length > frame.length ) length = frame.length;
+	std::memcpy( const_cast<unsigned char*>( data ), frame.data, length );
+	return length;
+}
+
 int DmxUsbProDevice::writeDmx( const unsigned char* data, int length ) const
 {
 	assert( length <= 513 );
 	return sendUsbProPacket( SET_DMX_TX_MODE, data, length );
 }
 
+/*
+ * Write a frame to the given port (1 or 2). Port 2 must have been enabled.
+ *
+ * Returns: see sendUsbProPacket(), or DmxDevice::RV_NOT_SUPPORTED if the port
+ * is not available.
+ */
+int DmxUsbProDevice::writeDmx( int port, const unsigned char* data, int length ) const
+{
+	assert( length <= 513 );
+	if ( port == 1 ) return sendUsbProPacket( SET_DMX_TX_MODE, data, length );
+	if ( port != 2 || ! port2Enabled_ ) return DmxDevice::RV_NOT_SUPPORTED;
+	
+	return sendUsbProPacket( port2Config_.sendDmxLabel, data, length );
+}
+
+/*
+ * Write a frame to each port in a single USB transfer, so both universes are
+ * updated together and the per-transfer overhead is paid only once.
+ *
+ * Returns: see writeDmx( int, ... ).
+ */
+int DmxUsbProDevice::writeDmxPorts( const unsigned char* data1, int length1,
+																		const unsigned char* data2, int length2 ) const
+{
+	assert( length1 <= 513 && length2 <= 513 );
+	if ( ! isOpen() ) return DmxDevice::RV_DEVICE_NOT_OPEN;
+	if ( ! port2Enabled_ ) return DmxDevice::RV_NOT_SUPPORTED;
+	
+	unsigned char packets[2 * ( 513 + 5 )];
+	int length = encodeUsbProPacket( SET_DMX_TX_MODE, data1, length1, packets );
+	length += encodeUsbProPacket( port2Config_.sendDmxLabel, data2, length2, packets + length );
+	
+	std::lock_guard<std::mutex> lock( usbTxMutex_ );
+	int r = ftdiDevice_->writeData( packets, length );
+	
+	if ( r < 0 ) return r;
+	
+	return ( r == length ) ? 0 : RV_PACKET_SHORT_WRITE;
+}
+
+/*
+ * Write the given frame without copying its data; the packet header and end
+ * code are written into the frame's headroom and tailroom. If a new frame has
+ * been published for port 2, both are combined into one transfer instead, or
+ * the port 2 frame is sent by itself if the given frame is empty.
+ */
+int DmxUsbProDevice::writeDmxFrame( DmxFrameBuffer* frame ) const
+{
+	assert( frame->length <= 513 );
+	if ( port2Enabled_ && port2Frames_->hasNewFrame() ) {
+		DmxFrameBuffer* f2 = port2Frames_->acquireReadFrame();
+		if ( frame->length <= 0 ) return sendUsbProFrame( port2Config_.sendDmxLabel, f2 );
+		
+		outputLength_ = frame->length;
+		return writeDmxPorts( frame->data, frame->length, f2->data, f2->length );
+	}
+	
+	outputLength_ = frame->length;
+	return sendUsbProFrame( SET_DMX_TX_MODE, frame );
+}
+
+/*
+ * Like writeDmxFrame( DmxFrameBuffer* ), but the USB transfer is only submitted
+ * (see FtdiDevice::submitWrite()), so the output thread does not block on it.
+ * Frames combined with port 2 are written synchronously.
+ */
+int DmxUsbProDevice::submitDmxFrame( DmxFrameBuffer* frame, FtdiDevice::writeCallback callback,
+																		 void* userData ) const
+{
+	assert( frame->length <= 513 );
+	if ( port2Enabled_ && port2Frames_->hasNewFrame() ) {
+		return DmxDevice::submitDmxFrame( frame, callback, userData );
+	}
+	
+	if ( ! isOpen() ) return DmxDevice::RV_DEVICE_NOT_OPEN;
+	outputLength_ = frame->length;
+	
+	int length = frameUsbProPacket( SET_DMX_TX_MODE, frame );
+	if ( length < 0 ) return length;
+	
+	std::lock_guard<std::mutex> lock( usbTxMutex_ );
+	return ftdiDevice_->submitWrite( frame->headroom, length, callback, userData );
+}
+
+/*
+ * Returns true if a frame published for port 2 is waiting, so the output thread
+ * sends it even if nothing has been published for port 1.
+ */
+bool DmxUsbProDevice::hasPendingOutput() const
+{
+	return port2Enabled_ && port2Frames_->hasNewFrame();
+}
+
+/*
+ * Write the given frame to the given port (1 or 2) without copying its data,
+ * like writeDmxFrame( DmxFrameBuffer* ) does. This is meant for sending frames
+ * as they arrive (e.g. from the network, see DmxNetGateway) rather than through
+ * the output thread.
+ *
+ * Returns: see writeDmx( int, ... ).
+ */
+int DmxUsbProDevice::writeDmxFrame( int port, DmxFrameBuffer* frame ) const
+{
+	assert( frame->length <= 513 );
+	if ( port == 1 ) return sendUsbProFrame( SET_DMX_TX_MODE, frame );
+	if ( port != 2 || ! port2Enabled_ ) return DmxDevice::RV_NOT_SUPPORTED;
+	
+	return sendUsbProFrame( port2Config_.sendDmxLabel, frame );
+}
+
 DmxDevice::DMX_DEVICE_TYPE DmxUsbProDevice::getType() const
 {
 	return DmxDevice::DMX_DEVICE_ENTTECPRO;
 }
 
+/*
+ * Returns the refresh rate configured in the widget, as fetched when the device
+ * was opened or last set with setWidgetParameters(). No USB requests are made,
+ * so this is safe to call while the output thread runs. If the widget is set to
+ * send as fast as possible (a rate of 0) or the parameters could not be
+ * retrieved, OUTPUT_RATE_MAX is returned.
+ */
+float DmxUsbProDevice::getDefaultRefreshRate() const
+{
+	return defaultRefreshRate_;
+}
+
+/*
+ * The widget keeps sending the last frame it received, so unchanged frames do
+ * not need to be sent.
+ */
+bool DmxUsbProDevice::needsContinuousRefresh() const
+{
+	return false;
+}
+
+
+/*
+ * Measure request/reply round trips (using serial number requests) for a range
+ * of latency timer and read chunk size settings and apply the fastest
+ * combination. Settings the chip rejects are skipped. The write chunk size is
+ * set to fit the largest packet.
+ * If the widget does not reply, the FTDI defaults are restored.
+ * The sweep takes up to 30 round trips, so the result is remembered by USB
+ * serial number for the rest of the process and open() applies it to the same
+ * widget without measuring again. Calling this measures anew.
+ *
+ * Returns: true if a setting has been found and applied, false otherwise.
+ */
+bool DmxUsbProDevice::autoTune()
+{
+	static const int LATENCIES[] = { 1, 2, 4, 8, 16 };
+	static const unsigned int READ_CHUNK_SIZES[] = { 512, 4096 };
+	static const int NUM_LATENCIES = sizeof( LATENCIES ) / sizeof( LATENCIES[0] );
+	static const int NUM_READ_CHUNK_SIZES = sizeof( READ_CHUNK_SIZES ) / sizeof( READ_CHUNK_SIZES[0] );
+	
+	if ( ! isOpen() ) return false;
+	
+	ftdiDevice_->setWriteChunkSize( 1024 );
+	
+	int bestLatency = 0;
+	unsigned int bestChunkSize = 0;
+	int64_t bestRoundTrip = -1;
+	bool replied = true;
+	
+	for ( int c = 0; c < NUM_READ_CHUNK_SIZES && replied; ++c ) {
+		for ( int l = 0; l < NUM_LATENCIES && replied; ++l ) {
+			if ( ftdiDevice_->setReadChunkSize( READ_CHUNK_SIZES[c] ) <= 0 ) continue;
+			if ( ftdiDevice_->setLatencyTimer( LATENCIES[l] ) <= 0 ) continue;
+			
+			int64_t total = 0;
+			for ( int p = 0; p < AUTOTUNE_PROBE_COUNT && replied; ++p ) {
+				int64_t rtt = measureRoundTrip();
+				replied = ( rtt >= 0 );
+				total += rtt;
+			}
+			
+			if ( replied && ( bestRoundTrip < 0 || total < bestRoundTrip ) ) {
+				bestRoundTrip = total;
+				bestLatency = LATENCIES[l];
+				bestChunkSize = READ_CHUNK_SIZES[c];
+			}
+		}
+	}
+	
+	//without (valid) replies, the measurements are meaningless
+	if ( ! replied || bestRoundTrip < 0 ) {
+		ftdiDevice_->setReadChunkSize( 4096 );
+		ftdiDevice_->setLatencyTimer( 16 );
+		return false;
+	}
+	
+	ftdiDevice_->setReadChunkSize( bestChunkSize );
+	ftdiDevice_->setLatencyTimer( bestLatency );
+	roundTripTime_ = bestRoundTrip / (float)AUTOTUNE_PROBE_COUNT / 1000.0f;
+	
+	const FtdiDevice::usbInformation* info = getUsbInformation();
+	if ( info != 0 && info->serial[0] != '\0' ) {
+		autoTuneResult result = { bestLatency, bestChunkSize, roundTripTime_ };
+		std::lock_guard<std::mutex> lock( s_autoTuneMutex );
+		s_autoTuneResults[info->serial] = result;
+	}
+	
+	return true;
+}
+
+/*
+ * Returns the average request/reply round trip time in microseconds measured
+ * by autoTune() for the chosen settings, or 0 if it has not been measured.
+ */
+float DmxUsbProDevice::getRoundTripTime() const
+{
+	return roundTripTime_;
+}
 
 /*
  * Attempt to set widget parameters, passing any user configuration data as a
@@ -118,18 +444,19 @@ bool DmxUsbProDevice::setWidgetParameters( const widgetParameters* params,
 	bool success = true;
 	int r;
 	
-	unsigned char* buf = new unsigned char[sizeof( setParams ) + userConfigDataLength];
-	std::memcpy( buf, &setParams, sizeof( setParams ) );
+	DmxFrameBuffer frame;
+	std::memcpy( frame.data, &setParams, sizeof( setParams ) );
 	if ( userConfigDataLength > 0 ) {
-		std::memcpy( buf + sizeof( setParams ), userConfigData, userConfigDataLength );
+		std::memcpy( frame.data + sizeof( setParams ), userConfigData, userConfigDataLength );
 	}
+	frame.length = sizeof( setParams ) + userConfigDataLength;
 	
-	r = sendUsbProPacket( SET_WIDGET_PARAMS_RQ, buf,
-											 sizeof( setParams ) + userConfigDataLength );
+	r = sendUsbProFrame( SET_WIDGET_PARAMS_RQ, &frame );
 	success = ( r >= 0 );
 	
-	delete[] buf;
-	
+	if ( success ) {
+		defaultRefreshRate_ = ( setParams.refreshRate > 0 ) ? setParams.refreshRate : OUTPUT_RATE_MAX;
+	}
 	if ( success && widgetParams_ != 0 ) {
 		widgetParams_->breakTime = setParams.breakTime * BREAK_TIME_UNIT;
 		widgetParams_->mabTime = setParams.maBTime * MAB_TIME_UNIT;
@@ -177,6 +504,420 @@ const uint32_t* DmxUsbProDevice::getSerialNumber() const
 { return serialNumber_; }
 
 
+/*
+ * Start receiving DMX. A background thread reads everything the widget sends;
+ * received frames are stored with a timestamp in the ring returned by
+ * getInputFrames() and the latest one is available through readDmx(). While
+ * input is running, replies to requests (e.g. fetchExtendedInfo()) are handed
+ * over by the input thread.
+ * If changesOnly is true, the widget only sends the slots which have changed.
+ * These are patched into a resident copy of the universe, which is stored in
+ * the ring in turn, so there is much less USB traffic if the input is mostly
+ * static. Either way, takeChangedSlots() tells which slots have changed.
+ *
+ * Returns: true if input has been started or was already running, false
+ * otherwise.
+ */
+bool DmxUsbProDevice::startInput( bool changesOnly )
+{
+	if ( ! isOpen() ) return false;
+	if ( inputThread_ != 0 ) return true;
+	
+	unsigned char onChange = changesOnly ? 1 : 0;
+	if ( sendUsbProPacket( RECEIVE_DMX_ON_CHANGE, &onChange, 1 ) < 0 ) return false;
+	if ( port2Enabled_ &&
+			sendUsbProPacket( port2Config_.receiveDmxOnChangeLabel, &onChange, 1 ) < 0 ) return false;
+	
+	inputChangesOnly_ = changesOnly;
+	for ( int p = 0; p < PORT_COUNT; p++ ) {
+		inputPorts_[p].universeLength = changesOnly ? INPUT_UNIVERSE_LENGTH : 0;
+	}
+	inputThreadRunning_ = true;
+	inputThread_ = new std::thread( &DmxUsbProDevice::runInputThread, this );
+	return true;
+}
+
+/*
+ * Stop the input thread (and capturing, if active).
+ */
+void DmxUsbProDevice::stopInput()
+{
+	stopCapture();
+	if ( inputThread_ == 0 ) return;
+	
+	inputThreadRunning_ = false;
+	inputThread_->join();
+	delete inputThread_; inputThread_ = 0;
+}
+
+bool DmxUsbProDevice::isInputRunning() const
+{
+	return inputThread_ != 0;
+}
+
+bool DmxUsbProDevice::isInputChangesOnly() const
+{
+	return inputChangesOnly_;
+}
+
+/*
+ * Set a function to be called on the input thread with every frame stored in
+ * the input ring of a port, right after it has been stored. The frame is only
+ * valid during the call. The callback cannot be changed while input is
+ * running.
+ *
+ * Returns: true on success, false if input is running.
+ */
+bool DmxUsbProDevice::setInputFrameCallback( inputFrameCallback cb, void* userData )
+{
+	if ( inputThread_ != 0 ) return false;
+	
+	inputFrameCallback_ = cb;
+	inputFrameCallbackData_ = userData;
+	return true;
+}
+
+/*
+ * OR a bitmap of the slots of the given port which have changed since the
+ * previous call into the given one (SLOT_BITMAP_WORDS words, bit n of word
+ * n / 64 representing slot n, with slot 0 being the start code) and clear them.
+ * The new values can then be read with readDmx().
+ *
+ * Returns: the number of changed slots.
+ */
+int DmxUsbProDevice::takeChangedSlots( uint64_t* bitmap, int port ) const
+{
+	int count = 0;
+	
+	if ( port < 1 || port > PORT_COUNT ) return 0;
+	std::atomic<uint64_t>* changedSlots = inputPorts_[port - 1].changedSlots;
+	
+	for ( int i = 0; i < SLOT_BITMAP_WORDS; i++ ) {
+		uint64_t w = changedSlots[i].exchange( 0, std::memory_order_acquire );
+		bitmap[i] |= w;
+		for ( ; w != 0; w &= w - 1 ) count++;
+	}
+	
+	return count;
+}
+
+/*
+ * Returns the ring holding the most recently received frames of the given port,
+ * which can be read from any thread without blocking the input thread, or NULL
+ * if there is no such port.
+ */
+const DmxFrameRing* DmxUsbProDevice::getInputFrames( int port ) const
+{
+	if ( port < 1 || port > PORT_COUNT ) return 0;
+	return inputPorts_[port - 1].frames;
+}
+
+void DmxUsbProDevice::getInputStats( inputStats* stats ) const
+{
+	stats->frameCount = (unsigned long)inputPorts_[0].frames->getWriteCount();
+	stats->queueOverflowCount = (unsigned long)queueOverflowCount_.load();
+	stats->overrunCount = (unsigned long)overrunCount_.load();
+}
+
+/*
+ * Stream all frames received from now on to the file at the given path (see
+ * DmxFrameCapture for the format). Memory use is bounded: if the disk cannot
+ * keep up, frames are dropped from the capture rather than queued.
+ *
+ * Returns: true if capturing has been started or was already active, false if
+ * input is not running or the file could not be opened.
+ */
+bool DmxUsbProDevice::startCapture( const char* path )
+{
+	if ( ! isInputRunning() ) return false;
+	return inputCapture_->start( inputPorts_[0].frames, path );
+}
+
+void DmxUsbProDevice::stopCapture()
+{
+	inputCapture_->stop();
+}
+
+bool DmxUsbProDevice::isCapturing() const
+{
+	return inputCapture_->isRunning();
+}
+
+
+/*
+ * Enable the second port of a DMX USB PRO Mk2 by sending the API key and
+ * configuring both ports for DMX. The configuration is fixed until the device
+ * is closed. If input is running, port 2 receives in the same mode as port 1.
+ *
+ * Returns: true if port 2 has been enabled or already was, false otherwise.
+ */
+bool DmxUsbProDevice::enablePort2( const port2Configuration* config )
+{
+	if ( ! isOpen() ) return false;
+	if ( port2Enabled_ ) return true;
+	
+	unsigned char key[4];
+	for ( int i = 0; i < 4; i++ ) key[i] = ( config->apiKey >> ( 8 * i ) ) & 0xFF;
+	if ( sendUsbProPacket( SET_API_KEY, key, sizeof( key ) ) < 0 ) return false;
+	
+	//one byte per port, 1 meaning DMX (as opposed to MIDI or disabled)
+	const unsigned char assignment[PORT_COUNT] = { 1, 1 };
+	if ( sendUsbProPacket( config->portAssignmentLabel, assignment, sizeof( assignment ) ) < 0 ) return false;
+	
+	if ( isInputRunning() ) {
+		unsigned char onChange = inputChangesOnly_ ? 1 : 0;
+		if ( sendUsbProPacket( config->receiveDmxOnChangeLabel, &onChange, 1 ) < 0 ) return false;
+	}
+	
+	port2Config_ = *config;
+	port2Enabled_.store( true, std::memory_order_release );
+	return true;
+}
+
+bool DmxUsbProDevice::isPort2Enabled() const
+{
+	return port2Enabled_;
+}
+
+/*
+ * Hand over a frame for port 2 to the output thread, like publishDmx() does
+ * for port 1, so the output thread must be running. It is sent in the same
+ * transfer as the next frame for port 1, or by itself if nothing has been
+ * published for port 1 yet.
+ *
+ * Returns: 0 on success, or < 0 if an error occured.
+ */
+int DmxUsbProDevice::publishDmxPort2( const unsigned char* data, int length )
+{
+	assert( length <= DmxTripleBuffer::FRAME_MAX_LENGTH );
+	if ( ! isOpen() ) return DmxDevice::RV_DEVICE_NOT_OPEN;
+	if ( ! port2Enabled_ ) return DmxDevice::RV_NOT_SUPPORTED;
+	
+	DmxTripleBuffer::frame* f = port2Frames_->getWriteFrame();
+	std::memcpy( f->data, data, length );
+	f->length = length;
+	f->timestamp = DmxClock::now();
+	port2Frames_->publish();
+	
+	return 0;
+}
+
+
+/*
+ * Send an RDM packet (start code included) and wait for the reply, which is
+ * returned without the widget's status byte. Discovery requests are sent using
+ * the widget's discovery request, which does not expect a well-formed reply.
+ * Note that RDM replies arrive like received DMX, so DMX input should not be
+ * running meanwhile.
+ *
+ * Returns: the length of the reply, 0 if nothing was received in time, or < 0
+ * if an error occured.
+ */
+int DmxUsbProDevice::sendRdm( const unsigned char* request, int length, TRANSACTION_TYPE type,
+														 unsigned char* response, int maxLength )
+{
+	if ( ! isOpen() ) return DmxDevice::RV_DEVICE_NOT_OPEN;
+	
+	int label = ( type == TRANSACTION_DISCOVERY ) ? SEND_RDM_DISCOVERY_RQ : SEND_DMX_RDM_TX;
+	std::lock_guard<std::mutex> lock( transactionMutex_ );
+	if ( type == TRANSACTION_BROADCAST ) return sendUsbProPacket( label, request, length );
+	
+	int timeout = RDM_RESPONSE_TIMEOUT;
+	int limit = rdmTimeoutLimit_;
+	if ( limit > 0 && limit < timeout ) timeout = limit;
+	
+	DmxFrameBuffer reply;
+	int replyLength = 0;
+	int r = requestUsbProPacket( label, request, length, RECEIVED_DMX_PACKET, reply.data, PACKET_MAX_DATA_SIZE,
+															 timeout, &replyLength );
+	if ( r == RV_PACKET_SHORT_READ ) return 0;
+	if ( r < 0 ) return r;
+	if ( replyLength < 1 ) return 0;
+	
+	int n = ( replyLength - 1 < maxLength ) ? replyLength - 1 : maxLength;
+	std::memcpy( response, reply.data + 1, n );
+	return n;
+}
+
+/*
+ * Discover the RDM responders connected to the widget (see DmxRdmDiscovery).
+ * Responders found earlier are remembered, so unless full is true, only
+ * changes are searched for. Use getRdmDiscovery() to retrieve the UIDs.
+ *
+ * Returns: the number of responders or < 0 if an error occured.
+ */
+int DmxUsbProDevice::discoverRdm( bool full )
+{
+	if ( ! isOpen() ) return DmxDevice::RV_DEVICE_NOT_OPEN;
+	
+	if ( rdmDiscovery_ == 0 ) rdmDiscovery_ = new DmxRdmDiscovery( this, getRdmUid() );
+	return rdmDiscovery_->discover( full );
+}
+
+/*
+ * Returns the discovery state, or NULL if discoverRdm() has not been called.
+ */
+const DmxRdmDiscovery* DmxUsbProDevice::getRdmDiscovery() const
+{
+	return rdmDiscovery_;
+}
+
+/*
+ * Returns the RDM parameter cache for this widget (see DmxRdmCache), which is
+ * created on first use. Its queue is worked off by calling process() on it.
+ */
+DmxRdmCache* DmxUsbProDevice::getRdmCache()
+{
+	if ( rdmCache_ == 0 ) rdmCache_ = new DmxRdmCache( this, getRdmUid() );
+	return rdmCache_.load();
+}
+
+/*
+ * Set the DMX refresh rate which must be maintained while RDM requests queued
+ * in the cache (see getRdmCache()) are sent by the output thread. RDM only gets
+ * the time left over in between frames, and no more than what still allows the
+ * widget to refresh a frame at this rate. Transactions that would not fit
+ * (judged by the measured mean transaction time) wait for a later frame, and
+ * waiting for replies is cut short at the end of the available time.
+ * A rate of 0 disables the guarantee, using whatever time is left before the
+ * next frame.
+ */
+void DmxUsbProDevice::setMinimumDmxRate( float rate )
+{
+	minimumDmxRate_ = ( rate > 0 ) ? rate : 0;
+}
+
+float DmxUsbProDevice::getMinimumDmxRate() const
+{
+	return minimumDmxRate_;
+}
+
+/*
+ * Fill in the given struct with statistics on how the line is shared between
+ * DMX and RDM since the output thread started servicing RDM.
+ */
+void DmxUsbProDevice::getLineStats( lineStats* stats ) const
+{
+	uint64_t start = lineStatsStart_;
+	uint64_t elapsed = ( start > 0 ) ? DmxClock::now() - start : 0;
+	float load = ( elapsed > 0 ) ? (float)( rdmTimeSum_ / (double)elapsed ) : 0;
+	float rate = getOutputRate();
+	double frameTime = 1000000000.0 / getDmxRefreshRateMax( outputLength_ );
+	uint64_t burstMax = rdmBurstMax_;
+	
+	stats->dmxRate = getSentFrameRate();
+	stats->dmxRateMin = rate;
+	if ( burstMax > 0 ) {
+		float worst = (float)( 1000000000.0 / ( burstMax + frameTime ) );
+		if ( worst < rate ) stats->dmxRateMin = worst;
+	}
+	stats->rdmLoad = load;
+	stats->rdmTransactionTime = rdmTransactionTime_ / 1000000.0f;
+	stats->rdmTransactionCount = (unsigned long)rdmTransactionCount_.load();
+	
+	stats->rdmQueueLength = 0;
+	stats->meanRdmQueueLatency = stats->maxRdmQueueLatency = 0;
+	DmxRdmCache* cache = rdmCache_;
+	if ( cache != 0 ) {
+		DmxRdmCache::cacheStats cs;
+		cache->getStats( &cs );
+		stats->rdmQueueLength = cs.queueLength;
+		stats->meanRdmQueueLatency = cs.meanQueueLatency;
+		stats->maxRdmQueueLatency = cs.maxQueueLatency;
+	}
+}
+
+/*
+ * Returns the UID used as source of RDM requests, which is made up of Enttec's
+ * manufacturer id and the widget's serial number.
+ */
+uint64_t DmxUsbProDevice::getRdmUid() const
+{
+	uint32_t deviceId = 1;
+	
+	if ( fetchSerialNumber() && *serialNumber_ != SN_NOT_PROGRAMMED ) deviceId = *serialNumber_;
+	return ( (uint64_t)RDM_MANUFACTURER_ID << 32 ) | deviceId;
+}
+
+
+/***********************
+ * PROTECTED FUNCTIONS *
+ ***********************/
+
+/*
+ * Configure the widget for the highest possible refresh rate: minimum break and
+ * mark-after-break times and sending as fast as possible (a refresh rate of 0).
+ * The widget then refreshes short frames much faster than full ones.
+ */
+bool DmxUsbProDevice::prepareAdaptiveSlotCount()
+{
+	widgetParameters params;
+	params.breakTime = BREAK_TIME_UNITS_MIN * BREAK_TIME_UNIT;
+	params.mabTime = MAB_TIME_UNITS_MIN * MAB_TIME_UNIT;
+	params.refreshRate = 0;
+	
+	return setWidgetParameters( &params, (const unsigned char*)0, 0 );
+}
+
+
+/*
+ * Send queued RDM requests in the time left before the next frame, limited by the
+ * minimum DMX rate (see setMinimumDmxRate()). The mean transaction time is
+ * tracked to decide whether another transaction fits; if it never does, the
+ * estimate slowly decays so RDM is not locked out by a few slow transactions.
+ */
+void DmxUsbProDevice::serviceLine( uint64_t deadline )
+{
+	uint64_t now = DmxClock::now();
+	if ( lineStatsStart_ == 0 ) lineStatsStart_ = now;
+	
+	DmxRdmCache* cache = rdmCache_;
+	if ( cache == 0 || cache->getQueueLength() == 0 ) return;
+	
+	uint64_t estimate = rdmTransactionTime_;
+	uint64_t budget;
+	float minRate = minimumDmxRate_;
+	
+	if ( deadline > 0 ) budget = ( deadline > now + LINE_MARGIN ) ? deadline - now - LINE_MARGIN : 0;
+	else budget = ( minRate > 0 ) ? UINT64_MAX : estimate; /* unpaced: one transaction per frame */
+	
+	if ( minRate > 0 ) {
+		double gap = 1000000000.0 / minRate - 1000000000.0 / getDmxRefreshRateMax( outputLength_ );
+		//keep the same margin as before a deadline, for a transaction overrunning the estimate
+		uint64_t maxGap = ( gap > LINE_MARGIN ) ? (uint64_t)gap - LINE_MARGIN : 0;
+		if ( budget > maxGap ) budget = maxGap;
+	}
+	
+	uint64_t used = 0;
+	bool starved = false;
+	
+	while ( true ) {
+		if ( used + estimate > budget ) {
+			starved = ( used == 0 );
+			break;
+		}
+		
+		int limit = (int)( ( budget - used ) / 1000000 );
+		rdmTimeoutLimit_ = ( limit > 0 ) ? limit : 1;
+		
+		uint64_t tStart = DmxClock::now();
+		int n = cache->process( 1 );
+		uint64_t duration = DmxClock::now() - tStart;
+		if ( n == 0 ) break;
+		
+		used += duration;
+		rdmTransactionCount_++;
+		estimate = (uint64_t)( (int64_t)estimate + ( (int64_t)duration - (int64_t)estimate ) / 8 );
+	}
+	rdmTimeoutLimit_ = 0;
+	
+	if ( starved ) estimate -= estimate / 64;
+	rdmTransactionTime_ = estimate;
+	rdmTimeSum_ += used;
+	if ( used > rdmBurstMax_ ) rdmBurstMax_ = used;
+}
+
+
 /*********************
  * PRIVATE FUNCTIONS *
  *********************/
@@ -204,39 +945,38 @@ bool DmxUsbProDevice::fetchWidgetParameters( unsigned int userConfigLength ) con
 		( userConfigLength >> 8	) & 0xFF
 	};
 	int replyLen = sizeof( DMXUSBPROParamsType ) + userConfigLength;
-	unsigned char* replyBuffer = new unsigned char[replyLen];
+	DmxFrameBuffer reply;
+	unsigned char* replyBuffer = reply.data;
 	
-	r = sendUsbProPacket( GET_WIDGET_PARAMS_RQ, reqParams, sizeof( reqParams ) );
+	std::lock_guard<std::mutex> lock( transactionMutex_ );
+	r = requestUsbProPacket( GET_WIDGET_PARAMS_RQ, reqParams, sizeof( reqParams ),
+													 GET_WIDGET_PARAMS_REPLY, replyBuffer, replyLen );
 	if ( r >= 0 ) {
-		usleep( REQUEST_REPLY_DELAY * 1000 );
-		r = receiveUsbProPacket( GET_WIDGET_PARAMS_REPLY, replyBuffer, replyLen );
-		if ( r >= 0 ) {
-			DMXUSBPROParamsType* pData = static_cast<DMXUSBPROParamsType*>( (void*)replyBuffer );
-			if ( widgetParams_ != 0 ) {
-				delete widgetParams_; widgetParams_ = 0;
-			}
-			widgetParams_ = new widgetParameters();
-			//FIXME: is this interpretation of the firmware version correct?
-			widgetParams_->firmwareVersionMajor = pData->firmwareMSB;
-			widgetParams_->firmwareVersionMajor = pData->firmwareLSB;
-			
-			widgetParams_->breakTime = pData->breakTime * BREAK_TIME_UNIT;
-			widgetParams_->mabTime = pData->maBTime * MAB_TIME_UNIT;
-			widgetParams_->refreshRate = pData->refreshRate;
-			
-			if ( userConfigLength > 0 ) {
-				unsigned char* ucd = replyBuffer + sizeof( DMXUSBPROParamsType );
-				if ( userConfigData_ != 0 ) {
-					delete userConfigData_; userConfigData_ = 0;
-				}
-				userConfigData_ = new vec_uchar( userConfigLength );
-				std::memcpy( &(*userConfigData_)[0], ucd, userConfigLength );
+		DMXUSBPROParamsType* pData = static_cast<DMXUSBPROParamsType*>( (void*)replyBuffer );
+		if ( widgetParams_ != 0 ) {
+			delete widgetParams_; widgetParams_ = 0;
+		}
+		widgetParams_ = new widgetParameters();
+		//FIXME: is this interpretation of the firmware version correct?
+		widgetParams_->firmwareVersionMajor = pData->firmwareMSB;
+		widgetParams_->firmwareVersionMajor = pData->firmwareLSB;
+		
+		widgetParams_->breakTime = pData->breakTime * BREAK_TIME_UNIT;
+		widgetParams_->mabTime = pData->maBTime * MAB_TIME_UNIT;
+		widgetParams_->refreshRate = pData->refreshRate;
+		defaultRefreshRate_ = ( pData->refreshRate > 0 ) ? pData->refreshRate : OUTPUT_RATE_MAX;
+		
+		if ( userConfigLength > 0 ) {
+			unsigned char* ucd = replyBuffer + sizeof( DMXUSBPROParamsType );
+			if ( userConfigData_ != 0 ) {
+				delete userConfigData_; userConfigData_ = 0;
 			}
-			
-			success = true;
+			userConfigData_ = new vec_uchar( userConfigLength );
+			std::memcpy( &(*userConfigData_)[0], ucd, userConfigLength );
 		}
+		
+		success = true;
 	}
-	delete[] replyBuffer;
 	
 	return success;
 }
@@ -250,25 +990,22 @@ bool DmxUsbProDevice::fetchSerialNumber() const
 	int r;
 	unsigned char serialNum[4];
 	
-	r = sendUsbProPacket( GET_WIDGET_SN_RQ, 0, 0 );
+	std::lock_guard<std::mutex> lock( transactionMutex_ );
+	r = requestUsbProPacket( GET_WIDGET_SN_RQ, 0, 0, GET_WIDGET_SN_REPLY, serialNum, sizeof( serialNum ) );
 	if ( r >= 0 ) {
-		usleep( REQUEST_REPLY_DELAY * 1000 );
-		r = receiveUsbProPacket( GET_WIDGET_SN_REPLY, serialNum, sizeof( serialNum ) );
-		if ( r >= 0 ) {
-			//FIXME: I'm not completely sure if the snAdded code is correct and especially unsure about the BCD code.
-			serialNumber_ = new uint32_t( 0 );
-			uint32_t snAdded = serialNum[0] + serialNum[1] * 0x100 + serialNum[2] * 0x10000 + serialNum[3] * 0x1000000;
-			if ( snAdded != SN_NOT_PROGRAMMED ) {
-				//NOTE: to display the number 'correctly' pad it to 8 characters with leading zeroes
-				*serialNumber_ += ( serialNum[0] & 0xF ) + ( serialNum[0] >> 4 ) * 10;
-				*serialNumber_ += ( ( serialNum[1] & 0xF ) + ( serialNum[1] >> 4 ) * 10 ) * 100;
-				*serialNumber_ += ( ( serialNum[2] & 0xF ) + ( serialNum[2] >> 4 ) * 10 ) * 10000;
-				*serialNumber_ += ( ( serialNum[3] & 0xF ) + ( serialNum[3] >> 4 ) * 10 ) * 1000000;
-			} else {
-				*serialNumber_ = SN_NOT_PROGRAMMED;
-			}
-			success = true;
+		//FIXME: I'm not completely sure if the snAdded code is correct and especially unsure about the BCD code.
+		serialNumber_ = new uint32_t( 0 );
+		uint32_t snAdded = serialNum[0] + serialNum[1] * 0x100 + serialNum[2] * 0x10000 + serialNum[3] * 0x1000000;
+		if ( snAdded != SN_NOT_PROGRAMMED ) {
+			//NOTE: to display the number 'correctly' pad it to 8 characters with leading zeroes
+			*serialNumber_ += ( serialNum[0] & 0xF ) + ( serialNum[0] >> 4 ) * 10;
+			*serialNumber_ += ( ( serialNum[1] & 0xF ) + ( serialNum[1] >> 4 ) * 10 ) * 100;
+			*serialNumber_ += ( ( serialNum[2] & 0xF ) + ( serialNum[2] >> 4 ) * 10 ) * 10000;
+			*serialNumber_ += ( ( serialNum[3] & 0xF ) + ( serialNum[3] >> 4 ) * 10 ) * 1000000;
+		} else {
+			*serialNumber_ = SN_NOT_PROGRAMMED;
 		}
+		success = true;
 	}
 	
 	return success;
@@ -276,65 +1013,263 @@ bool DmxUsbProDevice::fetchSerialNumber() const
 
 
 /*
- * Attempts to read the requested number of bytes into the given buffer.
+ * Send a serial number request and wait for the reply.
+ *
+ * Returns: the round trip time in nanoseconds or < 0 if no valid reply was
+ * received.
+ */
+/*
+ * Apply the settings autoTune() has chosen for this widget before, if any.
+ *
+ * Returns: true if a result was known and has been applied, false otherwise.
+ */
+bool DmxUsbProDevice::applyAutoTuneResult()
+{
+	const FtdiDevice::usbInformation* info = getUsbInformation();
+	if ( info == 0 || info->serial[0] == '\0' ) return false;
+	
+	autoTuneResult result;
+	{
+		std::lock_guard<std::mutex> lock( s_autoTuneMutex );
+		map_autoTuneResult::const_iterator it = s_autoTuneResults.find( info->serial );
+		if ( it == s_autoTuneResults.end() ) return false;
+		result = it->second;
+	}
+	
+	ftdiDevice_->setWriteChunkSize( 1024 );
+	ftdiDevice_->setReadChunkSize( result.readChunkSize );
+	ftdiDevice_->setLatencyTimer( result.latencyTimer );
+	roundTripTime_ = result.roundTripTime;
+	
+	return true;
+}
+
+int64_t DmxUsbProDevice::measureRoundTrip() const
+{
+	unsigned char serialNum[4];
+	uint64_t tStart = DmxClock::now();
+	
+	std::lock_guard<std::mutex> lock( transactionMutex_ );
+	int r = requestUsbProPacket( GET_WIDGET_SN_RQ, 0, 0, GET_WIDGET_SN_REPLY, serialNum, sizeof( serialNum ),
+															 AUTOTUNE_READ_TIMEOUT );
+	
+	return ( r >= 0 ) ? (int64_t)( DmxClock::now() - tStart ) : -1;
+}
+
+/*
+ * Send a packet with the given request label and data, then wait at most
+ * timeout milliseconds for a packet with the given reply label and read its
+ * payload, which must be of exactly the requested length, into the given
+ * buffer. If receivedLength is given, shorter payloads are accepted too and
+ * their length is returned in it. The reply is expected before the request is
+ * sent, so it cannot be missed by the input thread however fast it arrives.
+ * Received data is fed through the packet parser, so any garbage or other
+ * packets preceding the reply are skipped without having to purge the device's
+ * buffers.
  *
  * Returns: 0 if the packet has been read successfully, or < 0 if an error occured.
  * If the device is not open, DmxDevice::DEVICE_NOT_OPEN is returned.
  */
-int DmxUsbProDevice::receiveUsbProPacket( int label, const unsigned char* data, unsigned int length ) const
+int DmxUsbProDevice::requestUsbProPacket( int requestLabel, const unsigned char* request, unsigned int requestLength,
+																				 int label, const unsigned char* data, unsigned int length,
+																				 int timeout, int* receivedLength ) const
 {
-	//fprintf( stderr, "receiveUsbProPacket: about to read payload of %i bytes.\n", length ); //LOG
-	
-	int result, r;
-	unsigned char ftdi_header[4];
-	//NOTE: the timeout is long but this should not be a problem as long as not too much data is requested.
-	static const unsigned int READ_TIMEOUT = 10000;
+	//fprintf( stderr, "requestUsbProPacket: about to read payload of %i bytes.\n", length ); //LOG
 	
 	if ( ! isOpen() ) return DmxDevice::RV_DEVICE_NOT_OPEN;
 	if ( length > PACKET_MAX_DATA_SIZE ) return RV_PACKET_TOO_LONG;
 	
-	r = ftdiDevice_->readData( ftdi_header, sizeof( ftdi_header ) / sizeof( unsigned char ), READ_TIMEOUT );
+	pendingReply reply = { label, const_cast<unsigned char*>( data ), length, receivedLength,
+												 RV_PACKET_SHORT_READ, false };
+	unsigned long errorCount = parser_.getErrorCount();
 	
-	if ( r < 0 ) return r;
-	if ( r < (int)sizeof( ftdi_header ) ) return RV_PACKET_SHORT_READ;
+	{
+		std::lock_guard<std::mutex> lock( replyMutex_ );
+		reply_ = &reply;
+	}
 	
-	if ( ftdi_header[0] != PACKET_START_CODE ) {
-		ftdiDevice_->purgeBuffers( FtdiDevice::RX_BUFFER );
-		return RV_PACKET_INVALID;
+	int r = sendUsbProPacket( requestLabel, request, requestLength );
+	if ( r < 0 ) {
+		std::lock_guard<std::mutex> lock( replyMutex_ );
+		reply_ = 0;
+		return r;
 	}
-	if ( ftdi_header[1] != label ) {
-		ftdiDevice_->purgeBuffers( FtdiDevice::RX_BUFFER );
-		return RV_PACKET_NO_MATCH;
+	
+	//the input thread is reading, so wait for it to hand over the reply
+	if ( inputThreadRunning_ ) {
+		std::unique_lock<std::mutex> lock( replyMutex_ );
+		replyCond_.wait_for( lock, std::chrono::milliseconds( timeout ), [&reply] { return reply.done; } );
+		reply_ = 0;
+		return reply.result;
+	}
+	
+	unsigned char chunk[READ_CHUNK_LENGTH];
+	uint64_t deadline = DmxClock::now() + (uint64_t)timeout * 1000000;
+	
+	while ( ! reply.done ) {
+		uint64_t now = DmxClock::now();
+		if ( now >= deadline ) break;
+		
+		int remaining = (int)( ( deadline - now + 999999 ) / 1000000 );
+		int r = ftdiDevice_->readAvailable( chunk, sizeof( chunk ), remaining );
+		if ( r < 0 ) {
+			reply.result = r;
+			break;
+		}
+		parser_.feed( chunk, r );
 	}
-	int len = ftdi_header[2] + ( ftdi_header[3] << 8 );
-	if ( len != (int)length ) {
-		ftdiDevice_->purgeBuffers( FtdiDevice::RX_BUFFER );
-		return RV_PACKET_NO_MATCH;
+	{
+		std::lock_guard<std::mutex> lock( replyMutex_ );
+		reply_ = 0;
 	}
 	
-	unsigned char* buf = new unsigned char[length + 1];
+	if ( ! reply.done && reply.result == RV_PACKET_SHORT_READ && parser_.getErrorCount() != errorCount ) {
+		reply.result = RV_PACKET_INVALID;
+	}
 	
-	result = ftdiDevice_->readData( buf, length + 1, READ_TIMEOUT );
+	return reply.result;
+}
+
+/*
+ * Parser callback. Packets complete the reply being waited for by
+ * requestUsbProPacket() if they match it. Otherwise, received DMX is passed on
+ * to receiveDmxPacket() or receiveDmxChanges() and other packets are ignored.
+ */
+void DmxUsbProDevice::onUsbProPacket( int label, const unsigned char* data, int length, void* userData )
+{
+	const DmxUsbProDevice* self = static_cast<const DmxUsbProDevice*>( userData );
 	
-	if ( result < 0 ) return result;
+	{
+		std::lock_guard<std::mutex> lock( self->replyMutex_ );
+		pendingReply* reply = self->reply_;
+		
+		if ( reply != 0 && ! reply->done && label == reply->label ) {
+			if ( length == (int)reply->length ||
+					( reply->receivedLength != 0 && length <= (int)reply->length ) ) {
+				std::memcpy( reply->data, data, length );
+				if ( reply->receivedLength != 0 ) *reply->receivedLength = length;
+				reply->result = 0;
+			} else {
+				reply->result = RV_PACKET_NO_MATCH;
+			}
+			reply->done = true;
+			self->replyCond_.notify_all();
+			return;
+		}
+	}
 	
-	if ( result < (int)length + 1 ) {
-		delete[] buf;
-		return RV_PACKET_SHORT_READ;
+	if ( label == RECEIVED_DMX_PACKET ) {
+		self->receiveDmxPacket( 0, data, length );
+	} else if ( label == RECEIVED_DMX_COS_TYPE ) {
+		self->receiveDmxChanges( 0, data, length );
+	} else if ( self->port2Enabled_.load( std::memory_order_acquire ) ) {
+		if ( label == self->port2Config_.receivedDmxLabel ) self->receiveDmxPacket( 1, data, length );
+		else if ( label == self->port2Config_.receivedDmxCosLabel ) self->receiveDmxChanges( 1, data, length );
 	}
+}
+
+/*
+ * Store a received DMX packet (a status byte followed by the frame, start code
+ * included) and mark the slots which differ from the previous frame as changed.
+ */
+void DmxUsbProDevice::receiveDmxPacket( int port, const unsigned char* data, int length ) const
+{
+	inputPort& ip = inputPorts_[port];
+	
+	if ( length < 1 ) return;
+	
+	if ( data[0] & INPUT_STATUS_QUEUE_OVERFLOW ) queueOverflowCount_++;
+	if ( data[0] & INPUT_STATUS_OVERRUN ) overrunCount_++;
 	
-	if ( buf[length] != PACKET_END_CODE ) {
-		//Apparently this was not the end of the packet (even though the header
-		//indicated it should be), so purge the read buffer.
-		ftdiDevice_->purgeBuffers( FtdiDevice::RX_BUFFER );
-		delete[] buf;
-		return RV_PACKET_INVALID;
+	const unsigned char* frame = data + 1;
+	int frameLength = length - 1;
+	if ( frameLength > INPUT_UNIVERSE_LENGTH ) frameLength = INPUT_UNIVERSE_LENGTH;
+	
+	uint64_t changed[SLOT_BITMAP_WORDS] = { 0 };
+	for ( int i = 0; i < frameLength; i++ ) {
+		if ( frame[i] != ip.universe[i] || i >= ip.universeLength ) {
+			ip.universe[i] = frame[i];
+			changed[i / 64] |= (uint64_t)1 << ( i % 64 );
+		}
 	}
+	ip.universeLength = frameLength;
+	
+	publishInputUniverse( port, changed );
+}
+
+/*
+ * Patch a change-of-state packet into the resident universe and publish it. The
+ * packet holds the number of the first 8-slot block it covers, a bitmap of the
+ * 40 slots from there on and one value for every bit set, in order.
+ */
+void DmxUsbProDevice::receiveDmxChanges( int port, const unsigned char* data, int length ) const
+{
+	ReceivedDmxCosStruct cos;
+	const int headerLength = sizeof( cos.startChangedByteNumber ) + sizeof( cos.changedByteArray );
 	
-	std::memcpy( const_cast<unsigned char*>( data ), buf, length );
-	delete[] buf;
+	if ( length < headerLength ) return;
+	if ( length > (int)sizeof( cos ) ) length = sizeof( cos );
+	std::memcpy( &cos, data, length );
 	
-	return 0;
+	uint64_t changed[SLOT_BITMAP_WORDS] = { 0 };
+	int first = cos.startChangedByteNumber * 8;
+	int valueCount = length - headerLength;
+	int v = 0;
+	
+	for ( int bit = 0; bit < 40 && v < valueCount; bit++ ) {
+		if ( ( cos.changedByteArray[bit / 8] & ( 1 << ( bit % 8 ) ) ) == 0 ) continue;
+		
+		int slot = first + bit;
+		unsigned char value = cos.changedByteData[v++];
+		if ( slot >= INPUT_UNIVERSE_LENGTH ) break;
+		
+		inputPorts_[port].universe[slot] = value;
+		changed[slot / 64] |= (uint64_t)1 << ( slot % 64 );
+	}
+	
+	publishInputUniverse( port, changed );
+}
+
+/*
+ * Store the resident universe of a port in its input ring and then flag the
+ * given slots as changed, so anyone seeing the flags also finds the new values
+ * in the ring. Finally, the input frame callback and input subscriptions
+ * (port 1 only) are notified.
+ */
+void DmxUsbProDevice::publishInputUniverse( int port, const uint64_t* changed ) const
+{
+	inputPort& ip = inputPorts_[port];
+	
+	DmxFrameBuffer* frame = ip.frames->beginWrite();
+	frame->length = ip.universeLength;
+	frame->timestamp = DmxClock::now();
+	std::memcpy( frame->data, ip.universe, ip.universeLength );
+	ip.frames->commitWrite();
+	
+	for ( int i = 0; i < SLOT_BITMAP_WORDS; i++ ) {
+		if ( changed[i] != 0 ) ip.changedSlots[i].fetch_or( changed[i], std::memory_order_release );
+	}
+	
+	if ( inputFrameCallback_ != 0 ) inputFrameCallback_( port + 1, frame, inputFrameCallbackData_ );
+	if ( port == 0 ) dispatchInput( ip.universe, ip.universeLength, changed );
+}
+
+/*
+ * Body of the input thread: feed everything the widget sends to the parser.
+ */
+void DmxUsbProDevice::runInputThread()
+{
+	unsigned char chunk[READ_CHUNK_LENGTH];
+	
+	while ( inputThreadRunning_ ) {
+		int r = ftdiDevice_->readAvailable( chunk, sizeof( chunk ), INPUT_READ_TIMEOUT );
+		if ( r < 0 ) {
+			//avoid spinning if the device has gone away
+			usleep( INPUT_READ_TIMEOUT * 1000 );
+			continue;
+		}
+		parser_.feed( chunk, r );
+	}
 }
 
 /*
@@ -350,19 +1285,73 @@ int DmxUsbProDevice::sendUsbProPacket( int label, const unsigned char* data, uns
 	if ( ! isOpen() ) return DmxDevice::RV_DEVICE_NOT_OPEN;
 	if ( length > PACKET_MAX_DATA_SIZE ) return RV_PACKET_TOO_LONG;
 	
-	unsigned char* packet = new unsigned char[5 + length];
+	DmxFrameBuffer frame;
+	if ( length > 0 ) std::memcpy( frame.data, data, length );
+	frame.length = length;
 	
-	packet[0] = PACKET_START_CODE;
-	packet[1] = label;
-	packet[2] = length & 0xFF;
-	packet[3] = length >> 8;
-	packet[4 + length] = PACKET_END_CODE;
+	return sendUsbProFrame( label, &frame );
+}
+
+/*
+ * Encode a packet into the given buffer, which must have room for length + 5
+ * bytes.
+ *
+ * Returns: the length of the packet.
+ */
+int DmxUsbProDevice::encodeUsbProPacket( int label, const unsigned char* data, int length,
+																				 unsigned char* buffer ) const
+{
+	buffer[0] = PACKET_START_CODE;
+	buffer[1] = label;
+	buffer[2] = length & 0xFF;
+	buffer[3] = length >> 8;
+	if ( length > 0 ) std::memcpy( buffer + 4, data, length );
+	buffer[4 + length] = PACKET_END_CODE;
+	
+	return length + 5;
+}
+
+/*
+ * Writes the data in the given frame buffer as a packet with the given label.
+ * The packet header is written into the headroom of the frame and the end code
+ * directly after the data, so no copying is involved.
+ *
+ * Returns: see sendUsbProPacket().
+ */
+int DmxUsbProDevice::sendUsbProFrame( int label, DmxFrameBuffer* frame ) const
+{
+	if ( ! isOpen() ) return DmxDevice::RV_DEVICE_NOT_OPEN;
 	
-	std::memcpy( &( packet[4] ), data, length );
+	int length = frameUsbProPacket( label, frame );
+	if ( length < 0 ) return length;
 	
-	int r = ftdiDevice_->writeData( packet, length + 5 );
+	std::lock_guard<std::mutex> lock( usbTxMutex_ );
+	int r = ftdiDevice_->writeData( frame->headroom, length );
 	
 	if ( r < 0 ) return r;
 	
-	return ( r == (int)length + 5 ) ? 0 : RV_PACKET_SHORT_WRITE;
+	return ( r == length ) ? 0 : RV_PACKET_SHORT_WRITE;
+}
+
+/*
+ * Wraps the packet header and end code for the given label around the data in
+ * the given frame buffer, using its headroom and tailroom.
+ *
+ * Returns: the length of the packet starting at frame->headroom, or
+ * RV_PACKET_TOO_LONG.
+ */
+int DmxUsbProDevice::frameUsbProPacket( int label, DmxFrameBuffer* frame ) const
+{
+	unsigned int length = frame->length;
+	if ( length > PACKET_MAX_DATA_SIZE ) return RV_PACKET_TOO_LONG;
+	
+	unsigned char* packet = frame->headroom;
+	
+	packet[0] = PACKET_START_CODE;
+	packet[1] = label;
+	packet[2] = length & 0xFF;
+	packet[3] = length >> 8;
+	frame->data[length] = PACKET_END_CODE;
+	
+	return length + 5;
 }
@@ -3,11 +3,24 @@
 #ifndef DMX_USB_PRO_DEVICE_H
 #define DMX_USB_PRO_DEVICE_H
 
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
 #include <stdint.h>
+#include <string>
+#include <thread>
 #include <vector>
 #include "DmxDevice.h"
+#include "DmxRdm.h"
+#include "DmxUsbProParser.h"
 
-class DmxUsbProDevice : public DmxDevice {
+class DmxFrameCapture;
+class DmxFrameRing;
+class DmxRdmCache;
+class DmxRdmDiscovery;
+
+class DmxUsbProDevice : public DmxDevice, public DmxRdmTransport {
 public:
 	struct widgetParameters {
 		unsigned int firmwareVersionMajor;
@@ -17,6 +30,42 @@ public:
 		unsigned int refreshRate;
 	};
 	
+	struct inputStats {
+		unsigned long frameCount;
+		unsigned long queueOverflowCount; /* frames dropped by the widget */
+		unsigned long overrunCount; /* frames received incompletely */
+	};
+	
+	struct lineStats {
+		float dmxRate; /* achieved DMX refresh rate (see DmxDevice::getSentFrameRate()) */
+		float dmxRateMin; /* DMX refresh rate during the longest RDM burst */
+		float rdmLoad; /* fraction of line time used by RDM */
+		float rdmTransactionTime; /* mean, in milliseconds */
+		unsigned long rdmTransactionCount;
+		int rdmQueueLength;
+		float meanRdmQueueLatency; /* in milliseconds */
+		float maxRdmQueueLatency; /* in milliseconds */
+	};
+	
+	/*
+	 * The labels for the second port of the DMX USB PRO Mk2 are disclosed by
+	 * Enttec together with the API key, so they have to be supplied to use it.
+	 */
+	struct port2Configuration {
+		uint32_t apiKey;
+		int portAssignmentLabel;
+		int sendDmxLabel;
+		int receivedDmxLabel;
+		int receiveDmxOnChangeLabel;
+		int receivedDmxCosLabel;
+	};
+	
+	/*
+	 * Called on the input thread with every frame stored for a port (1 or 2),
+	 * see setInputFrameCallback().
+	 */
+	typedef void (*inputFrameCallback)( int port, const DmxFrameBuffer* frame, void* userData );
+	
 	typedef std::vector<unsigned char> vec_uchar;
 	
 	static const unsigned int SN_NOT_PROGRAMMED;
@@ -26,6 +75,9 @@ public:
 	static const unsigned int MAB_TIME_UNITS_MAX;
 	
 	static const unsigned int OUTPUT_RATE_MAX;
+	static const int PORT_COUNT = 2;
+	static const int INPUT_UNIVERSE_LENGTH = 513;
+	static const int SLOT_BITMAP_WORDS = ( INPUT_UNIVERSE_LENGTH + 63 ) / 64;
 	static const unsigned int USER_CONFIG_MAX_LENGTH;
 	static const char* USB_DESCRIPTION;
 	
@@ -39,8 +91,22 @@ public:
 	DmxUsbProDevice();
 	~DmxUsbProDevice();
 	
+	bool open( const char* description = 0, const char* serial = 0, int index = 0 );
+	bool close();
+	
+	int readDmx( const unsigned char* data, int length ) const;
+	int readDmx( int port, const unsigned char* data, int length ) const;
 	int writeDmx( const unsigned char* data, int length ) const;
+	int writeDmx( int port, const unsigned char* data, int length ) const;
+	int writeDmxPorts( const unsigned char* data1, int length1,
+										const unsigned char* data2, int length2 ) const;
+	int writeDmxFrame( DmxFrameBuffer* frame ) const;
+	int writeDmxFrame( int port, DmxFrameBuffer* frame ) const;
 	DMX_DEVICE_TYPE getType() const;
+	float getDefaultRefreshRate() const;
+	bool needsContinuousRefresh() const;
+	bool autoTune();
+	float getRoundTripTime() const;
 	
 	bool setWidgetParameters( const widgetParameters* params, const vec_uchar* userConfigData = 0 ) const;
 	bool setWidgetParameters( const widgetParameters* params,
@@ -51,6 +117,38 @@ public:
 	const vec_uchar* getUserConfigurationData() const;
 	const uint32_t* getSerialNumber() const;
 	
+	bool enablePort2( const port2Configuration* config );
+	bool isPort2Enabled() const;
+	int publishDmxPort2( const unsigned char* data, int length );
+	
+	bool startInput( bool changesOnly = false );
+	void stopInput();
+	bool isInputRunning() const;
+	bool isInputChangesOnly() const;
+	bool setInputFrameCallback( inputFrameCallback cb, void* userData = 0 );
+	int takeChangedSlots( uint64_t* bitmap, int port = 1 ) const;
+	const DmxFrameRing* getInputFrames( int port = 1 ) const;
+	void getInputStats( inputStats* stats ) const;
+	bool startCapture( const char* path );
+	void stopCapture();
+	bool isCapturing() const;
+	
+	int sendRdm( const unsigned char* request, int length, TRANSACTION_TYPE type,
+							unsigned char* response, int maxLength );
+	int discoverRdm( bool full = false );
+	const DmxRdmDiscovery* getRdmDiscovery() const;
+	DmxRdmCache* getRdmCache();
+	void setMinimumDmxRate( float rate );
+	float getMinimumDmxRate() const;
+	void getLineStats( lineStats* stats ) const;
+	uint64_t getRdmUid() const;
+	
+protected:
+	bool prepareAdaptiveSlotCount();
+	void serviceLine( uint64_t deadline );
+	bool hasPendingOutput() const;
+	int submitDmxFrame( DmxFrameBuffer* frame, FtdiDevice::writeCallback callback, void* userData ) const;
+	
 private:
 	/* START Enttec Dmx Usb Pro device declarations */
 	
@@ -88,13 +186,15 @@ private:
 		SET_WIDGET_PARAMS_RQ			= 4,
 		
 		SET_DMX_RX_MODE						= 5,
+		RECEIVED_DMX_PACKET				= 5,
 		SET_DMX_TX_MODE						= 6,
 		SEND_DMX_RDM_TX						= 7,
 		RECEIVE_DMX_ON_CHANGE			= 8,
 		RECEIVED_DMX_COS_TYPE			= 9,
 		GET_WIDGET_SN_RQ					= 10,
 		GET_WIDGET_SN_REPLY				= 10,
-		SEND_RDM_DISCOVERY_RQ			= 11
+		SEND_RDM_DISCOVERY_RQ			= 11,
+		SET_API_KEY								= 13
 	};
 	
 	static const float BREAK_TIME_UNIT;
@@ -107,19 +207,109 @@ private:
 	/* END Enttec Dmx Usb Pro device declarations */
 	
 	
-	static const int REQUEST_REPLY_DELAY;
+	static const int READ_TIMEOUT;
+	static const int AUTOTUNE_READ_TIMEOUT;
+	static const int AUTOTUNE_PROBE_COUNT;
+	static const int READ_CHUNK_LENGTH = 512;
+	static const int INPUT_READ_TIMEOUT;
+	static const int RDM_RESPONSE_TIMEOUT;
+	static const unsigned int RDM_MANUFACTURER_ID;
+	static const float MINIMUM_DMX_RATE_DEFAULT;
+	static const uint64_t LINE_MARGIN;
+	static const uint64_t RDM_TRANSACTION_TIME_DEFAULT;
+	static const unsigned char INPUT_STATUS_QUEUE_OVERFLOW;
+	static const unsigned char INPUT_STATUS_OVERRUN;
+	
+	struct inputPort {
+		DmxFrameRing* frames;
+		unsigned char universe[INPUT_UNIVERSE_LENGTH];
+		int universeLength;
+		std::atomic<uint64_t> changedSlots[SLOT_BITMAP_WORDS];
+	};
+	
+	struct pendingReply {
+		int label;
+		unsigned char* data;
+		unsigned int length;
+		int* receivedLength;
+		int result;
+		bool done;
+	};
+	
+	struct autoTuneResult {
+		int latencyTimer;
+		unsigned int readChunkSize;
+		float roundTripTime; /* in microseconds */
+	};
+	
+	typedef std::map<std::string, autoTuneResult> map_autoTuneResult;
+	
+	/* autoTune() results by USB serial number, see applyAutoTuneResult() */
+	static map_autoTuneResult s_autoTuneResults;
+	static std::mutex s_autoTuneMutex;
 	
 	DmxUsbProDevice( const DmxUsbProDevice& other );
 	DmxUsbProDevice& operator=( const DmxUsbProDevice& other );
 	
 	bool fetchWidgetParameters( unsigned int userConfigLength = 0 ) const;
 	bool fetchSerialNumber() const;
-	int receiveUsbProPacket( int label, const unsigned char* data, unsigned int length ) const;
+	int requestUsbProPacket( int requestLabel, const unsigned char* request, unsigned int requestLength,
+													int label, const unsigned char* data, unsigned int length,
+													int timeout = READ_TIMEOUT, int* receivedLength = 0 ) const;
+	static void onUsbProPacket( int label, const unsigned char* data, int length, void* userData );
+	void receiveDmxPacket( int port, const unsigned char* data, int length ) const;
+	void receiveDmxChanges( int port, const unsigned char* data, int length ) const;
+	void publishInputUniverse( int port, const uint64_t* changed ) const;
+	int encodeUsbProPacket( int label, const unsigned char* data, int length, unsigned char* buffer ) const;
+	void runInputThread();
+	bool applyAutoTuneResult();
+	int64_t measureRoundTrip() const;
 	int sendUsbProPacket( int label, const unsigned char* data, unsigned int length ) const;
+	int sendUsbProFrame( int label, DmxFrameBuffer* frame ) const;
+	int frameUsbProPacket( int label, DmxFrameBuffer* frame ) const;
 	
+	/*
+	 * Serializes all USB writes: sendUsbProFrame() (and so every request and
+	 * sendUsbProPacket()), writeDmxPorts() and submitDmxFrame(). Packets from the
+	 * application, output, input and gateway threads thus never interleave.
+	 */
+	mutable std::mutex usbTxMutex_;
+	mutable std::mutex transactionMutex_;
+	mutable DmxUsbProParser parser_;
+	mutable pendingReply* reply_;
+	mutable std::mutex replyMutex_;
+	mutable std::condition_variable replyCond_;
 	mutable widgetParameters* widgetParams_;
 	mutable vec_uchar* userConfigData_;
 	mutable uint32_t* serialNumber_;
+	float roundTripTime_;
+	mutable std::atomic<float> defaultRefreshRate_;
+	
+	mutable inputPort inputPorts_[PORT_COUNT];
+	DmxFrameCapture* inputCapture_;
+	std::thread* inputThread_;
+	std::atomic<bool> inputThreadRunning_;
+	bool inputChangesOnly_;
+	inputFrameCallback inputFrameCallback_;
+	void* inputFrameCallbackData_;
+	mutable std::atomic<uint64_t> queueOverflowCount_;
+	mutable std::atomic<uint64_t> overrunCount_;
+	
+	DmxRdmDiscovery* rdmDiscovery_;
+	std::atomic<DmxRdmCache*> rdmCache_;
+	
+	std::atomic<float> minimumDmxRate_;
+	mutable std::atomic<int> outputLength_;
+	std::atomic<int> rdmTimeoutLimit_;
+	std::atomic<uint64_t> rdmTransactionTime_;
+	std::atomic<uint64_t> rdmTimeSum_;
+	std::atomic<uint64_t> rdmBurstMax_;
+	std::atomic<uint64_t> rdmTransactionCount_;
+	std::atomic<uint64_t> lineStatsStart_;
+	
+	port2Configuration port2Config_;
+	std::atomic<bool> port2Enabled_;
+	DmxTripleBuffer* port2Frames_;
 };
 
 #endif /* DMX_USB_PRO_DEVICE_H */
@@ -0,0 +1,162 @@
+/*
+ * Incremental parser for packets sent by the Enttec DMX USB PRO. Data can be
+ * fed in chunks of any size, split anywhere; each complete and valid packet is
+ * passed to the callback as soon as its end code has been seen.
+ * If a packet turns out to be invalid (too long or not terminated by the end
+ * code), it is dropped and parsing resumes at the next start code, so there is
+ * no need to purge the device's buffers to recover.
+ * Packets which are contained in a single chunk are passed to the callback
+ * directly from the chunk, only packets split across chunks are copied into an
+ * internal buffer. In both cases, the data is only valid during the callback.
+ */
+#include <cstring>
+#include "DmxUsbProParser.h"
+
+const unsigned char DmxUsbProParser::PACKET_START_CODE = 0x7E;
+const unsigned char DmxUsbProParser::PACKET_END_CODE = 0xE7;
+const int DmxUsbProParser::PACKET_MAX_DATA_SIZE;
+
+
+DmxUsbProParser::DmxUsbProParser( packetCallback callback, void* userData )
+: callback_( callback ), userData_( userData ), state_( STATE_START ), label_( 0 ),
+  length_( 0 ), received_( 0 ), packetCount_( 0 ), errorCount_( 0 )
+{ /* empty */ }
+
+
+void DmxUsbProParser::setCallback( packetCallback callback, void* userData )
+{
+	callback_ = callback;
+	userData_ = userData;
+}
+
+/*
+ * Parse the given chunk of data, calling the callback for every packet
+ * completed by it.
+ *
+ * Returns: the number of packets completed.
+ */
+int DmxUsbProParser::feed( const unsigned char* data, int length )
+{
+	const unsigned char* p = data;
+	const unsigned char* end = data + length;
+	int packets = 0;
+	
+	while ( p < end ) {
+		switch ( state_ ) {
+			case STATE_START: {
+				const void* s = std::memchr( p, PACKET_START_CODE, end - p );
+				if ( s == 0 ) {
+					p = end;
+				} else {
+					p = static_cast<const unsigned char*>( s ) + 1;
+					state_ = STATE_LABEL;
+				}
+				break;
+			}
+			case STATE_LABEL:
+				header_[0] = *p++;
+				label_ = header_[0];
+				state_ = STATE_LENGTH_LSB;
+				break;
+			case STATE_LENGTH_LSB:
+				header_[1] = *p++;
+				state_ = STATE_LENGTH_MSB;
+				break;
+			case STATE_LENGTH_MSB:
+				header_[2] = *p++;
+				length_ = header_[1] | ( header_[2] << 8 );
+				received_ = 0;
+				if ( length_ > PACKET_MAX_DATA_SIZE ) {
+					errorCount_++;
+					packets += resync();
+				} else {
+					state_ = ( length_ > 0 ) ? STATE_DATA : STATE_END;
+				}
+				break;
+			case STATE_DATA: {
+				int available = end - p;
+				
+				//the whole packet is in this chunk: hand it over without copying
+				if ( received_ == 0 && available > length_ && p[length_] == PACKET_END_CODE ) {
+					if ( callback_ != 0 ) callback_( label_, p, length_, userData_ );
+					packetCount_++; packets++;
+					p += length_ + 1;
+					state_ = STATE_START;
+					break;
+				}
+				
+				//NOTE: memmove since resync() feeds data from buffer_ itself
+				int n = ( available < length_ - received_ ) ? available : length_ - received_;
+				std::memmove( buffer_ + received_, p, n );
+				received_ += n;
+				p += n;
+				if ( received_ == length_ ) state_ = STATE_END;
+				break;
+			}
+			case STATE_END:
+				if ( *p == PACKET_END_CODE ) {
+					p++;
+					if ( callback_ != 0 ) callback_( label_, buffer_, length_, userData_ );
+					packetCount_++; packets++;
+					state_ = STATE_START;
+				} else {
+					//not a valid packet; this byte is reparsed after the dropped bytes
+					errorCount_++;
+					packets += resync();
+				}
+				break;
+		}
+	}
+	
+	return packets;
+}
+
+/*
+ * Drop the packet being parsed and reparse the bytes following its start code,
+ * since the start code may have been a stray byte while the actual packet
+ * starts somewhere in between.
+ *
+ * Returns: the number of packets completed.
+ */
+int DmxUsbProParser::resync()
+{
+	unsigned char header[3];
+	int dataLength = received_;
+	
+	std::memcpy( header, header_, sizeof( header ) );
+	state_ = STATE_START;
+	received_ = 0;
+	
+	int packets = feed( header, sizeof( header ) );
+	
+	//NOTE: bytes are always read from buffer_ at a higher offset than they are
+	//stored at again, so this is safe.
+	packets += feed( buffer_, dataLength );
+	
+	return packets;
+}
+
+/*
+ * Discard any partially received packet.
+ */
+void DmxUsbProParser::reset()
+{
+	state_ = STATE_START;
+	received_ = 0;
+}
+
+/*
+ * Returns the number of valid packets parsed so far.
+ */
+unsigned long DmxUsbProParser::getPacketCount() const
+{
+	return packetCount_;
+}
+
+/*
+ * Returns the number of invalid packets dropped so far.
+ */
+unsigned long DmxUsbProParser::getErrorCount() const
+{
+	return errorCount_;
+}
@@ -0,0 +1,53 @@
+/*
+ */
+#ifndef DMX_USB_PRO_PARSER_H
+#define DMX_USB_PRO_PARSER_H
+
+class DmxUsbProParser {
+public:
+	typedef void ( *packetCallback )( int label, const unsigned char* data, int length, void* userData );
+	
+	static const unsigned char PACKET_START_CODE;
+	static const unsigned char PACKET_END_CODE;
+	static const int PACKET_MAX_DATA_SIZE = 600;
+	
+	
+	DmxUsbProParser( packetCallback callback = 0, void* userData = 0 );
+	
+	void setCallback( packetCallback callback, void* userData = 0 );
+	int feed( const unsigned char* data, int length );
+	void reset();
+	
+	unsigned long getPacketCount() const;
+	unsigned long getErrorCount() const;
+	
+private:
+	enum PARSER_STATE {
+		STATE_START,
+		STATE_LABEL,
+		STATE_LENGTH_LSB,
+		STATE_LENGTH_MSB,
+		STATE_DATA,
+		STATE_END
+	};
+	
+	DmxUsbProParser( const DmxUsbProParser& other );
+	DmxUsbProParser& operator=( const DmxUsbProParser& other );
+	
+	int resync();
+	
+	packetCallback callback_;
+	void* userData_;
+	
+	PARSER_STATE state_;
+	int label_;
+	int length_;
+	int received_;
+	unsigned char header_[3];
+	unsigned char buffer_[PACKET_MAX_DATA_SIZE];
+	
+	unsigned long packetCount_;
+	unsigned long errorCount_;
+};
+
+#endif /* ! DMX_USB_PRO_PARSER_H */
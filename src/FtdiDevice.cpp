@@ -5,12 +5,15 @@
  * - (getDeviceList) generate warning if fetchUsbInformation() returns null?
  */
 #include <unistd.h> /* for usleep() */
-#include <sys/time.h> /* for gettimeofday and related macros */
+#include <sys/time.h> /* for struct timeval */
 #include <assert.h>
+#include "DmxClock.h"
 #include "FtdiDevice.h"
 
 /* public constants */
 const int FtdiDevice::RV_DEVICE_NOT_OPEN = -19999;
+const int FtdiDevice::RV_TOO_MANY_WRITES = -19998;
+const int FtdiDevice::WRITES_IN_FLIGHT_MAX = 8;
 
 /* private (constant) statics */
 const int FtdiDevice::USB_VENDOR_ID = 0x0403;
@@ -19,10 +22,28 @@ const int FtdiDevice::USB_INFO_FIELD_LENGTH = 256;
 FtdiDevice::vec_deviceInfo* FtdiDevice::s_deviceList = 0;
 ftdi_device_list* FtdiDevice::s_ftdiDeviceList = 0;
 
+/* number of modem status bytes at the start of each packet received from the device */
+static const int FTDI_STATUS_LENGTH = 2;
+
+/* marks a read transfer as finished (successfully or not) */
+static void LIBUSB_CALL readTransferCallback( struct libusb_transfer* transfer )
+{
+	*static_cast<int*>( transfer->user_data ) = 1;
+}
+
+/* converts a duration in nanoseconds to a timeval */
+static struct timeval toTimeval( uint64_t ns )
+{
+	struct timeval tv;
+	tv.tv_sec = ns / 1000000000; tv.tv_usec = ( ns % 1000000000 ) / 1000;
+	return tv;
+}
+
 
 FtdiDevice::FtdiDevice()
 : context_( 0 ), usbInfo_( 0 ), hasFtdiError_( false ), dataBits_( DBITS_8 ),
-  stopBits_( SBITS_2 ), parity_( PAR_NONE ), breakType_( BRK_OFF )
+  stopBits_( SBITS_2 ), parity_( PAR_NONE ), breakType_( BRK_OFF ),
+  breakTypeValid_( false ), readTransfer_( 0 )
 {}
 
 FtdiDevice::~FtdiDevice()
@@ -110,7 +131,11 @@ bool FtdiDevice::close()
 	bool success = true;
 	
 	if ( isOpen() ) {
+		flushWrites();
 		purgeBuffers();
+		if ( readTransfer_ != 0 ) {
+			libusb_free_transfer( readTransfer_ ); readTransfer_ = 0;
+		}
 		int r = ftdi_usb_close( context_ );
 		if ( r < 0 ) {
 			success = false;
@@ -146,6 +171,7 @@ int FtdiDevice::setLineProperties( FTDI_DATABITS_TYPE dataBits, FTDI_STOPBITS_TY
 	int r = ftdi_set_line_property2( context_, (ftdi_bits_type)dataBits,
 																	(ftdi_stopbits_type)stopBits, (ftdi_parity_type)parity,
 																	(ftdi_break_type)breakType );
+	breakTypeValid_ = ( r >= 0 );
 	
 	return ( r < 0 ) ? false : true;
 }
@@ -157,10 +183,89 @@ int FtdiDevice::setFlowControl( FTDI_FLOWCTL_TYPE flowCtl ) const
 	return ( r < 0 ) ? false : true;
 }
 
+/*
+ * Switch the device to one of the bit-bang modes, in which every byte written
+ * is put on the data pins selected as outputs by bitMask at the rate set with
+ * setBaudRate(). Use BMODE_RESET to return to regular serial operation.
+ */
+int FtdiDevice::setBitMode( unsigned char bitMask, FTDI_BITMODE_TYPE mode ) const
+{
+	if ( context_ == 0 ) return RV_DEVICE_NOT_OPEN;
+	int r = ftdi_set_bitmode( context_, bitMask, mode );
+	if ( r < 0 ) hasFtdiError_ = true;
+	return ( r < 0 ) ? false : true;
+}
+
+/*
+ * Set the latency timer in milliseconds (1-255). The device sends received data
+ * to the host when its buffer is full or when this much time has passed since
+ * the last transfer, so it directly adds to request/reply round trips.
+ */
+int FtdiDevice::setLatencyTimer( int latency ) const
+{
+	if ( context_ == 0 ) return RV_DEVICE_NOT_OPEN;
+	if ( latency < 1 || latency > 255 ) return false;
+	int r = ftdi_set_latency_timer( context_, latency );
+	if ( r < 0 ) hasFtdiError_ = true;
+	return ( r < 0 ) ? false : true;
+}
+
+/*
+ * Returns: the latency timer in milliseconds or a value < 0 on error.
+ */
+int FtdiDevice::getLatencyTimer() const
+{
+	if ( context_ == 0 ) return RV_DEVICE_NOT_OPEN;
+	unsigned char latency;
+	int r = ftdi_get_latency_timer( context_, &latency );
+	if ( r < 0 ) hasFtdiError_ = true;
+	return ( r < 0 ) ? r : latency;
+}
+
+/*
+ * Set the size of the USB transfers used to read data. Smaller sizes may reduce
+ * latency for short replies, larger ones increase throughput.
+ */
+int FtdiDevice::setReadChunkSize( unsigned int chunkSize ) const
+{
+	if ( context_ == 0 ) return RV_DEVICE_NOT_OPEN;
+	int r = ftdi_read_data_set_chunksize( context_, chunkSize );
+	return ( r < 0 ) ? false : true;
+}
+
+int FtdiDevice::getReadChunkSize() const
+{
+	if ( context_ == 0 ) return RV_DEVICE_NOT_OPEN;
+	unsigned int chunkSize;
+	int r = ftdi_read_data_get_chunksize( context_, &chunkSize );
+	return ( r < 0 ) ? r : (int)chunkSize;
+}
+
+/*
+ * Set the maximum size of the USB transfers used to write data; writes larger
+ * than this are split into several transfers.
+ */
+int FtdiDevice::setWriteChunkSize( unsigned int chunkSize ) const
+{
+	if ( context_ == 0 ) return RV_DEVICE_NOT_OPEN;
+	int r = ftdi_write_data_set_chunksize( context_, chunkSize );
+	return ( r < 0 ) ? false : true;
+}
+
+int FtdiDevice::getWriteChunkSize() const
+{
+	if ( context_ == 0 ) return RV_DEVICE_NOT_OPEN;
+	unsigned int chunkSize;
+	int r = ftdi_write_data_get_chunksize( context_, &chunkSize );
+	return ( r < 0 ) ? r : (int)chunkSize;
+}
+
 int FtdiDevice::purgeBuffers( int bufType ) const
 {
 	if ( ! isOpen() ) return RV_DEVICE_NOT_OPEN;
 	
+	if ( bufType == RX_BUFFER || bufType == RX_TX_BUFFER ) readPending_.clear();
+	
 	int rv;
 	switch ( bufType ) {
 		case RX_BUFFER: rv = ftdi_usb_purge_rx_buffer( context_ ); break;
@@ -179,7 +284,14 @@ int FtdiDevice::reset() const
 	return ( context_ != 0 ) ? ftdi_usb_reset( context_ ) : 0;
 }
 
+/*
+ * Set or clear the break condition, leaving the other line properties as they
+ * are. If the break state would not change, no request is sent to the device;
+ * after a failed request it is always sent, since the state is then unknown.
+ */
 int FtdiDevice::setBreak( FTDI_BREAK_TYPE breakType ) const {
+	if ( context_ == 0 ) return RV_DEVICE_NOT_OPEN;
+	if ( breakTypeValid_ && breakType == breakType_ ) return true;
 	return setLineProperties( dataBits_, stopBits_, parity_, breakType );
 }
 
@@ -216,41 +328,114 @@ const struct FtdiDevice::usbInformation* FtdiDevice::getUsbInformation() const
 
 /*
  * Attempts to read the requested number of bytes into the given buffer from the
- * device, optionally with the given timeout in milliseconds.
+ * device, optionally with the given timeout in milliseconds (with a timeout of
+ * 0, at most one USB transfer is made).
+ * Reading is done using asynchronous transfers while waiting for libusb events
+ * until a deadline on the monotonic clock, so the calling thread sleeps until
+ * data arrives. Note that the device still completes a transfer at least once
+ * per latency timer period (see setLatencyTimer()), even without data.
  *
  * Returns: the total number of bytes read, DEVICE_NOT_OPEN if the ftdi device
- * is not open, or another value < 0 representing an error code from ftdi_read_data.
- */
-/* FIXME: trouble compiling gettimeofday() in windows? add this:
- * http://www.suacommunity.com/dictionary/gettimeofday-entry.php
+ * is not open, or another value < 0 representing a libusb error code.
  */
 int FtdiDevice::readData( const unsigned char* data, int length, int timeout ) const
 {
 	//fprintf( stderr, "readData: about to read %i bytes.\n", length ); //LOG
 	
+	return readTransfers( data, length, timeout, false );
+}
+
+/*
+ * Like readData(), but returns as soon as any data has been read instead of
+ * waiting for the requested number of bytes. Useful for feeding a stream
+ * parser with whatever the device has to offer.
+ *
+ * Returns: the number of bytes read (0 if the timeout expired), or < 0 on error
+ * (see readData()).
+ */
+int FtdiDevice::readAvailable( const unsigned char* data, int length, int timeout ) const
+{
+	return readTransfers( data, length, timeout, true );
+}
+
+/*
+ * Returns the endpoint of the bulk IN pipe (device to host).
+ * NOTE: libftdi names its endpoints from the device's point of view: out_ep is
+ * the one ftdi_read_data() reads from and in_ep the one ftdi_write_data()
+ * writes to. To not depend on that naming, the endpoint is selected by its
+ * direction bit instead.
+ */
+unsigned char FtdiDevice::getReadEndpoint() const
+{
+	return ( context_->in_ep & LIBUSB_ENDPOINT_IN ) ? context_->in_ep : context_->out_ep;
+}
+
+/*
+ * Returns the endpoint of the bulk OUT pipe (host to device), see getReadEndpoint().
+ */
+unsigned char FtdiDevice::getWriteEndpoint() const
+{
+	return ( context_->in_ep & LIBUSB_ENDPOINT_IN ) ? context_->out_ep : context_->in_ep;
+}
+
+/*
+ * Implementation of readData() and readAvailable(), the latter is selected by
+ * passing partial as true.
+ */
+int FtdiDevice::readTransfers( const unsigned char* data, int length, int timeout, bool partial ) const
+{
 	if ( ! isOpen() ) return RV_DEVICE_NOT_OPEN;
-	struct timeval tNow, tEnd, tOut;
 	
-	tOut.tv_sec = timeout / 1000; tOut.tv_usec = ( timeout % 1000 ) * 1000;
-	gettimeofday( &tNow, 0 );
-	timeradd( &tNow, &tOut, &tEnd );
+	unsigned char* out = const_cast<unsigned char*>( data );
+	int readTotal = takePendingData( out, length );
+	
+	if ( readTransfer_ == 0 ) {
+		readTransfer_ = libusb_alloc_transfer( 0 );
+		if ( readTransfer_ == 0 ) return LIBUSB_ERROR_NO_MEM;
+	}
+	if ( readChunk_.size() < context_->readbuffer_chunksize ) readChunk_.resize( context_->readbuffer_chunksize );
 	
-	int readTotal = 0, readLast = 0;
-	bool reread = ( length > 0 );
+	uint64_t deadline = DmxClock::now() + (uint64_t)timeout * 1000000;
+	bool expired = false;
 	
-	while ( reread ) {
-		readTotal += readLast;
-		if ( readTotal == length ) break;
-		readLast = ftdi_read_data( context_,
-															const_cast<unsigned char*>( data ) + readTotal,
-															length - readTotal );
+	while ( readTotal < length && ! expired && ! ( partial && readTotal > 0 ) ) {
+		int completed = 0;
+		bool cancelled = false;
+		
+		libusb_fill_bulk_transfer( readTransfer_, context_->usb_dev, getReadEndpoint(),
+															&readChunk_[0], readChunk_.size(), readTransferCallback, &completed, 0 );
+		int r = libusb_submit_transfer( readTransfer_ );
+		if ( r < 0 ) return r;
 		
-		gettimeofday( &tNow, 0 );
-		reread = ( readLast >= 0 );
-		if ( reread ) reread = ( readLast > 0 || timercmp( &tNow, &tEnd, < ) );
+		while ( ! completed ) {
+			uint64_t now = DmxClock::now();
+			uint64_t remaining = ( deadline > now ) ? deadline - now : 0;
+			
+			if ( remaining == 0 && timeout > 0 && ! cancelled ) {
+				libusb_cancel_transfer( readTransfer_ );
+				cancelled = true;
+			}
+			
+			//after cancelling (or with a zero timeout), wait for the transfer to finish
+			struct timeval tv = toTimeval( remaining > 0 ? remaining : 1000000000 );
+			r = libusb_handle_events_timeout_completed( context_->usb_ctx, &tv, &completed );
+			if ( r < 0 && r != LIBUSB_ERROR_INTERRUPTED ) {
+				if ( ! cancelled ) libusb_cancel_transfer( readTransfer_ );
+				cancelled = true;
+			}
+		}
+		
+		enum libusb_transfer_status status = readTransfer_->status;
+		if ( status != LIBUSB_TRANSFER_COMPLETED && status != LIBUSB_TRANSFER_CANCELLED &&
+				status != LIBUSB_TRANSFER_TIMED_OUT ) {
+			return LIBUSB_ERROR_IO;
+		}
+		
+		readTotal += storeReadTransfer( out + readTotal, length - readTotal );
+		expired = ( status != LIBUSB_TRANSFER_COMPLETED ) || DmxClock::now() >= deadline;
 	}
 	
-	return readLast < 0 ? readLast : readTotal;
+	return readTotal;
 }
 
 /*
@@ -268,6 +453,119 @@ int FtdiDevice::writeData( const unsigned char* data, int length ) const
 	return ftdi_write_data( context_, const_cast<unsigned char*>( data ), length );
 }
 
+/*
+ * Start writing the given buffer of given length to the device without waiting
+ * for the transfer to finish. Up to WRITES_IN_FLIGHT_MAX writes may be pending
+ * at the same time; they are carried out in order of submission.
+ * Completion is reported through the optional callback from processWrites() or
+ * flushWrites(), together with the submission time and the time the transfer
+ * actually finished (recorded by whichever thread handled the USB event, which
+ * may also be a thread reading from the device). The buffer must remain valid
+ * until then.
+ * Pending writes must be submitted and processed from a single thread.
+ *
+ * Returns: 0 if the write has been submitted, RV_TOO_MANY_WRITES if too many
+ * writes are pending, DEVICE_NOT_OPEN if the ftdi device is not open, or
+ * another value < 0 representing a libusb error code.
+ */
+int FtdiDevice::submitWrite( const unsigned char* data, int length,
+														 writeCallback callback, void* userData ) const
+{
+	if ( ! isOpen() ) return RV_DEVICE_NOT_OPEN;
+	if ( (int)pendingWrites_.size() >= WRITES_IN_FLIGHT_MAX ) return RV_TOO_MANY_WRITES;
+	
+	struct libusb_transfer* transfer = libusb_alloc_transfer( 0 );
+	if ( transfer == 0 ) return LIBUSB_ERROR_NO_MEM;
+	
+	//NOTE: deque elements do not move when others are added or removed, so the transfer can point into it.
+	pendingWrites_.push_back( pendingWrite() );
+	pendingWrite& pw = pendingWrites_.back();
+	pw.transfer = transfer;
+	pw.callback = callback;
+	pw.userData = userData;
+	pw.completion.result = 0;
+	pw.completion.submitTime = DmxClock::now();
+	pw.completion.completeTime = 0;
+	pw.completed = 0;
+	
+	libusb_fill_bulk_transfer( transfer, context_->usb_dev, getWriteEndpoint(),
+														const_cast<unsigned char*>( data ), length, onWriteTransfer,
+														&pw, context_->usb_write_timeout );
+	int r = libusb_submit_transfer( transfer );
+	if ( r < 0 ) {
+		pendingWrites_.pop_back();
+		libusb_free_transfer( transfer );
+		return r;
+	}
+	
+	return 0;
+}
+
+/*
+ * Handle USB events for pending writes for at most the given timeout in
+ * milliseconds (0 only handles events which have already occured), calling the
+ * callbacks of writes which have finished.
+ *
+ * Returns: the number of writes which have finished, DEVICE_NOT_OPEN if the ftdi
+ * device is not open, or another value < 0 representing a libusb error code.
+ */
+int FtdiDevice::processWrites( int timeout ) const
+{
+	if ( ! isOpen() ) return RV_DEVICE_NOT_OPEN;
+	if ( pendingWrites_.empty() ) return 0;
+	
+	uint64_t deadline = DmxClock::now() + (uint64_t)timeout * 1000000;
+	
+	//NOTE: transfers complete in order, so it suffices to wait for the oldest one.
+	pendingWrite& front = pendingWrites_.front();
+	while ( ! front.completed ) {
+		uint64_t now = DmxClock::now();
+		uint64_t remaining = ( deadline > now ) ? deadline - now : 0;
+		struct timeval tv = toTimeval( remaining );
+		
+		int r = libusb_handle_events_timeout_completed( context_->usb_ctx, &tv, &front.completed );
+		if ( r < 0 && r != LIBUSB_ERROR_INTERRUPTED ) return r;
+		if ( remaining == 0 ) break;
+	}
+	
+	return completeWrites();
+}
+
+/*
+ * Wait for all pending writes to finish, calling their callbacks. If no write
+ * has finished for FLUSH_TIMEOUT milliseconds, the remaining ones are cancelled.
+ *
+ * Returns: the number of writes which have finished or a value < 0 on error
+ * (see processWrites()).
+ */
+int FtdiDevice::flushWrites() const
+{
+	static const int FLUSH_TIMEOUT = 1000;
+	int total = 0;
+	bool cancelled = false;
+	
+	while ( ! pendingWrites_.empty() ) {
+		int r = processWrites( FLUSH_TIMEOUT );
+		if ( r < 0 ) return r;
+		if ( r == 0 ) {
+			if ( cancelled ) break;
+			//stalled: cancel the remaining transfers, they still finish through the event loop
+			for ( unsigned int i = 0; i < pendingWrites_.size(); i++ ) {
+				libusb_cancel_transfer( pendingWrites_[i].transfer );
+			}
+			cancelled = true;
+		}
+		total += r;
+	}
+	
+	return total;
+}
+
+int FtdiDevice::getWritesInFlight() const
+{
+	return pendingWrites_.size();
+}
+
 
 
 /* PUBLIC STATIC FUNCTIONS */
@@ -327,6 +625,96 @@ const void FtdiDevice::freeDeviceList()
 
 /* PRIVATE FUNCTIONS */
 
+/*
+ * Copy data received earlier but not yet returned by readData() (including
+ * data left in libftdi's own read buffer) into the given buffer.
+ *
+ * Returns: the number of bytes copied.
+ */
+int FtdiDevice::takePendingData( unsigned char* data, int length ) const
+{
+	int n = 0;
+	
+	if ( context_->readbuffer_remaining > 0 ) {
+		n = ( (int)context_->readbuffer_remaining < length ) ? context_->readbuffer_remaining : length;
+		std::memcpy( data, context_->readbuffer + context_->readbuffer_offset, n );
+		context_->readbuffer_offset += n;
+		context_->readbuffer_remaining -= n;
+	}
+	
+	int p = readPending_.size();
+	if ( p > length - n ) p = length - n;
+	if ( p > 0 ) {
+		std::memcpy( data + n, &readPending_[0], p );
+		readPending_.erase( readPending_.begin(), readPending_.begin() + p );
+		n += p;
+	}
+	
+	return n;
+}
+
+/*
+ * Strip the modem status bytes from the data received by the last read
+ * transfer and copy up to length bytes of it into the given buffer. Any excess
+ * is kept for the next call to readData().
+ *
+ * Returns: the number of bytes copied.
+ */
+int FtdiDevice::storeReadTransfer( unsigned char* data, int length ) const
+{
+	int n = 0;
+	int actual = readTransfer_->actual_length;
+	int packetSize = context_->max_packet_size;
+	
+	for ( int p = 0; p < actual; p += packetSize ) {
+		int chunk = ( actual - p < packetSize ) ? actual - p : packetSize;
+		const unsigned char* payload = &readChunk_[p] + FTDI_STATUS_LENGTH;
+		int payloadLength = chunk - FTDI_STATUS_LENGTH;
+		if ( payloadLength <= 0 ) continue;
+		
+		int c = ( payloadLength < length - n ) ? payloadLength : length - n;
+		std::memcpy( data + n, payload, c );
+		n += c;
+		if ( c < payloadLength ) readPending_.insert( readPending_.end(), payload + c, payload + payloadLength );
+	}
+	
+	return n;
+}
+
+/*
+ * Release finished writes from the front of the queue and call their callbacks.
+ */
+int FtdiDevice::completeWrites() const
+{
+	int count = 0;
+	
+	while ( ! pendingWrites_.empty() && pendingWrites_.front().completed ) {
+		pendingWrite pw = pendingWrites_.front();
+		pendingWrites_.pop_front();
+		
+		libusb_free_transfer( pw.transfer );
+		if ( pw.completion.result < 0 ) hasFtdiError_ = true;
+		
+		if ( pw.callback != 0 ) pw.callback( &pw.completion, pw.userData );
+		count++;
+	}
+	
+	return count;
+}
+
+/*
+ * Transfer callback of submitWrite(), recording the result and the time the
+ * write finished. This runs on whichever thread handles the USB event.
+ */
+void LIBUSB_CALL FtdiDevice::onWriteTransfer( struct libusb_transfer* transfer )
+{
+	pendingWrite* pw = static_cast<pendingWrite*>( transfer->user_data );
+	pw->completion.completeTime = DmxClock::now();
+	pw->completion.result = ( transfer->status == LIBUSB_TRANSFER_COMPLETED ) ?
+			transfer->actual_length : LIBUSB_ERROR_IO;
+	pw->completed = 1;
+}
+
 struct FtdiDevice::usbInformation* FtdiDevice::fetchUsbInformation( ftdi_context* context, struct libusb_device* dev )
 {
 	struct usbInformation* info = new struct usbInformation();
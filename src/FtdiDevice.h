@@ -4,6 +4,8 @@
 #define FTDI_DEVICE_H
 
 #include <cstring>
+#include <deque>
+#include <stdint.h>
 #include <vector>
 
 //NOTE: this attempt to prevent warnings about constructors being hidden does not work
@@ -32,6 +34,10 @@ public:
 	
 	enum FTDI_BREAK_TYPE { BRK_ON = BREAK_ON, BRK_OFF = BREAK_OFF };
 	
+	enum FTDI_BITMODE_TYPE {
+		BMODE_RESET = BITMODE_RESET, BMODE_BITBANG = BITMODE_BITBANG, BMODE_SYNCBB = BITMODE_SYNCBB
+	};
+	
 	enum FTDI_FLOWCTL_TYPE {
 		FLOW_NONE = SIO_DISABLE_FLOW_CTRL, FLOW_RTS_CTS = SIO_RTS_CTS_HS,
 		FLOW_DTR_DSR = SIO_DTR_DSR_HS, FLOW_XON_XOFF = SIO_XON_XOFF_HS
@@ -87,7 +93,17 @@ public:
 	
 	typedef std::vector<deviceInfo> vec_deviceInfo;
 	
+	struct writeCompletion {
+		int result; /* bytes written or < 0 on error */
+		uint64_t submitTime; /* see DmxClock */
+		uint64_t completeTime;
+	};
+	
+	typedef void ( *writeCallback )( const writeCompletion* completion, void* userData );
+	
 	static const int RV_DEVICE_NOT_OPEN;
+	static const int RV_TOO_MANY_WRITES;
+	static const int WRITES_IN_FLIGHT_MAX;
 	
 	
 	FtdiDevice();
@@ -100,6 +116,13 @@ public:
 	int setLineProperties( FTDI_DATABITS_TYPE dataBits, FTDI_STOPBITS_TYPE stopBits,
 												 FTDI_PARITY_TYPE parity, FTDI_BREAK_TYPE breakType = BRK_OFF ) const;
 	int setFlowControl( FTDI_FLOWCTL_TYPE flowCtl ) const;
+	int setBitMode( unsigned char bitMask, FTDI_BITMODE_TYPE mode ) const;
+	int setLatencyTimer( int latency ) const;
+	int getLatencyTimer() const;
+	int setReadChunkSize( unsigned int chunkSize ) const;
+	int getReadChunkSize() const;
+	int setWriteChunkSize( unsigned int chunkSize ) const;
+	int getWriteChunkSize() const;
 	
 	int purgeBuffers( int bufType = RX_TX_BUFFER ) const;
 	int reset() const;
@@ -113,14 +136,31 @@ public:
 	const struct usbInformation* getUsbInformation() const;
 	
 	int readData( const unsigned char* data, int length, int timeout = 0 ) const;
+	int readAvailable( const unsigned char* data, int length, int timeout = 0 ) const;
 	int writeData( const unsigned char* data, int length ) const;
 	
+	int submitWrite( const unsigned char* data, int length,
+									 writeCallback callback = 0, void* userData = 0 ) const;
+	int processWrites( int timeout = 0 ) const;
+	int flushWrites() const;
+	int getWritesInFlight() const;
+	
 	/* static functions */
 	
 	static const vec_deviceInfo* getDeviceList( ftdi_context* c = 0 );
 	static const void freeDeviceList();
 	
 private:
+	struct pendingWrite {
+		struct libusb_transfer* transfer;
+		writeCallback callback;
+		void* userData;
+		writeCompletion completion;
+		int completed; /* set by the transfer callback, see processWrites() */
+	};
+	
+	typedef std::deque<pendingWrite> deq_pendingWrite;
+	
 	static const int USB_VENDOR_ID;
 	static const int USB_PRODUCT_ID;
 	static const int USB_INFO_FIELD_LENGTH;
@@ -132,6 +172,14 @@ private:
 	
 	static struct usbInformation* fetchUsbInformation( ftdi_context* context, struct libusb_device* dev );
 	
+	static void LIBUSB_CALL onWriteTransfer( struct libusb_transfer* transfer );
+	int completeWrites() const;
+	unsigned char getReadEndpoint() const;
+	unsigned char getWriteEndpoint() const;
+	int readTransfers( const unsigned char* data, int length, int timeout, bool partial ) const;
+	int takePendingData( unsigned char* data, int length ) const;
+	int storeReadTransfer( unsigned char* data, int length ) const;
+	
 	struct ftdi_context* context_;
 	const struct usbInformation* usbInfo_;
 	mutable bool hasFtdiError_;
@@ -140,6 +188,13 @@ private:
 	mutable FTDI_STOPBITS_TYPE stopBits_;
 	mutable FTDI_PARITY_TYPE parity_;
 	mutable FTDI_BREAK_TYPE breakType_;	
+	mutable bool breakTypeValid_; /* false after a failed request left the device state unknown */
+	
+	mutable deq_pendingWrite pendingWrites_;
+	
+	mutable struct libusb_transfer* readTransfer_;
+	mutable std::vector<unsigned char> readChunk_;
+	mutable std::vector<unsigned char> readPending_;
 };
 
 #endif /* ! FTDI_DEVICE_H */
@@ -4,8 +4,10 @@
  */
 #include <unistd.h> /* for usleep() */
 #include <typeinfo>
+#include "DmxArtNetDevice.h"
 #include "DmxDevice.h"
 #include "DmxRawDevice.h"
+#include "DmxSacnDevice.h"
 #include "DmxUsbProDevice.h"
 #include "ofxGenericDmx.h"
 
@@ -23,6 +25,8 @@ DmxDevice* ofxGenericDmx::createDevice( DmxDevice::DMX_DEVICE_TYPE type )
 	switch ( type ) {
 		case DmxDevice::DMX_DEVICE_RAW: dev = new DmxRawDevice(); break;
 		case DmxDevice::DMX_DEVICE_ENTTECPRO: dev = new DmxUsbProDevice(); break;
+		case DmxDevice::DMX_DEVICE_ARTNET: dev = new DmxArtNetDevice(); break;
+		case DmxDevice::DMX_DEVICE_SACN: dev = new DmxSacnDevice(); break;
 	}
 	return dev;
 }
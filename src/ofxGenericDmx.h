@@ -6,6 +6,7 @@
 #include <stdint.h>
 #include <vector>
 #include "FtdiDevice.h"
+#include "DmxEngine.h"
 #include "DmxUsbProDevice.h"
 
 class DmxDevice;
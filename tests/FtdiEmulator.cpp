@@ -0,0 +1,600 @@
+/*
+ * Stands in for libftdi and the parts of libusb FtdiDevice uses, so the
+ * library can be exercised without hardware. Linking this file instead of the
+ * real libraries turns every attached EmulatedDevice into an FTDI device found
+ * by FtdiDevice::getDeviceList().
+ *
+ * The timing follows an FT232R on a full speed bus closely enough for latency
+ * and CPU measurements:
+ * - writes finish a fixed latency plus a time per byte after the previous
+ *   write to the same device has finished, and only then reach the device;
+ * - asynchronous bulk reads finish when 62 bytes (one packet's payload) are
+ *   waiting, or otherwise once the latency timer has expired since the first
+ *   waiting byte arrived or, without any data, since the read was submitted.
+ *   Every packet starts with two modem status bytes.
+ * - ftdi_read_data() returns at once with whatever is waiting.
+ * - control requests (e.g. setting a break) take as long as a write without
+ *   data.
+ * Optionally (see setLineTiming()), the serial line behind the chip is timed
+ * as well: written bytes leave at the baud rate (11 bits per byte, as for DMX)
+ * or, in bit-bang mode, one per sample, and a write only finishes once what is
+ * left fits in the transmit FIFO. A break set while bytes are still on their
+ * way out is counted, since it would truncate them.
+ * A read profile (see setReadProfile()) can make the chip reject short latency
+ * timers and reads take longer with larger buffers, to exercise auto-tuning.
+ * Transfers only finish while some thread handles events, as with libusb.
+ */
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <sys/prctl.h>
+#include "DmxClock.h"
+#include "FtdiEmulator.h"
+
+extern "C" {
+	#include "ftdi.h"
+}
+
+const uint64_t FtdiEmulator::WRITE_LATENCY_DEFAULT = 125000; /* in nanoseconds */
+const uint64_t FtdiEmulator::BYTE_TIME_DEFAULT = 1000; /* in nanoseconds */
+const int FtdiEmulator::LATENCY_TIMER_DEFAULT = 16; /* in milliseconds */
+const int FtdiEmulator::TX_FIFO_SIZE = 128; /* as on an FT232R */
+
+namespace {
+	const int PACKET_SIZE = 64;
+	const int STATUS_LENGTH = 2;
+	const unsigned char STATUS_BYTES[STATUS_LENGTH] = { 0x01, 0x60 };
+	
+	struct emulatedPort {
+		EmulatedDevice* device;
+		std::deque<unsigned char> toHost;
+		uint64_t toHostTime; /* arrival of the oldest waiting byte */
+		uint64_t busyUntil; /* end of the last write */
+		uint64_t lineBusyUntil; /* time the last written byte has left the line */
+		int latencyTimer;
+		int baudRate;
+		bool bitBang;
+	};
+	
+	struct pendingTransfer {
+		struct libusb_transfer* transfer;
+		emulatedPort* port;
+		uint64_t submitTime;
+		uint64_t due; /* for writes */
+		bool cancelled;
+	};
+	
+	std::recursive_mutex s_mutex;
+	std::condition_variable_any s_cond;
+	std::vector<emulatedPort*> s_ports;
+	std::vector<pendingTransfer> s_transfers;
+	uint64_t s_writeLatency = FtdiEmulator::WRITE_LATENCY_DEFAULT;
+	uint64_t s_byteTime = FtdiEmulator::BYTE_TIME_DEFAULT;
+	bool s_lineTiming = false;
+	int s_latencyTimerMin = 1;
+	uint64_t s_readBufferByteTime = 0;
+	FtdiEmulator::usbStats s_stats;
+	
+	emulatedPort* portOf( struct ftdi_context* ftdi )
+	{
+		return reinterpret_cast<emulatedPort*>( ftdi->usb_dev );
+	}
+	
+	bool isRead( const struct libusb_transfer* t )
+	{
+		return ( t->endpoint & LIBUSB_ENDPOINT_IN ) != 0;
+	}
+	
+	/* time a byte takes to leave the line, 0 if the line is not timed */
+	uint64_t lineByteTime( const emulatedPort* port )
+	{
+		if ( ! s_lineTiming || port->baudRate <= 0 ) return 0;
+		//libftdi requests 4 times the rate in bit-bang mode, the chip samples at 16 times that
+		if ( port->bitBang ) return 1000000000ULL / ( 64ULL * port->baudRate );
+		return 11 * 1000000000ULL / port->baudRate;
+	}
+	
+	uint64_t scheduleWrite( emulatedPort* port, int length )
+	{
+		uint64_t now = DmxClock::now();
+		uint64_t start = ( port->busyUntil > now ) ? port->busyUntil : now;
+		port->busyUntil = start + s_writeLatency + length * s_byteTime;
+		s_stats.writeCount++;
+		s_stats.bytesWritten += length;
+		
+		uint64_t byteTime = lineByteTime( port );
+		if ( byteTime > 0 ) {
+			//the first byte reaches the chip one write latency after the write started
+			uint64_t arrival = start + s_writeLatency;
+			uint64_t lineStart = ( port->lineBusyUntil > arrival ) ? port->lineBusyUntil : arrival;
+			port->lineBusyUntil = lineStart + length * byteTime;
+			uint64_t fifoFits = port->lineBusyUntil - FtdiEmulator::TX_FIFO_SIZE * byteTime;
+			if ( fifoFits > port->busyUntil ) port->busyUntil = fifoFits;
+		}
+		return port->busyUntil;
+	}
+	
+	/* counts a control request and lets it take as long as a write without data */
+	void controlRequest()
+	{
+		std::unique_lock<std::recursive_mutex> lock( s_mutex );
+		s_stats.controlCount++;
+		uint64_t due = DmxClock::now() + s_writeLatency;
+		lock.unlock();
+		DmxClock::sleepUntil( due );
+	}
+	
+	/* time at which a read finishes */
+	uint64_t readDue( const pendingTransfer& p )
+	{
+		const emulatedPort* port = p.port;
+		uint64_t timer = port->latencyTimer * 1000000ULL;
+		uint64_t due = p.submitTime + timer;
+		if ( (int)port->toHost.size() >= PACKET_SIZE - STATUS_LENGTH ) {
+			due = 0;
+		} else if ( ! port->toHost.empty() ) {
+			due = port->toHostTime + timer;
+		}
+		
+		uint64_t setupDone = p.submitTime + p.transfer->length * s_readBufferByteTime;
+		return ( due > setupDone ) ? due : setupDone;
+	}
+	
+	/* moves waiting bytes into a read buffer, with status bytes per packet */
+	int fillRead( emulatedPort* port, unsigned char* buffer, int length, bool withStatus )
+	{
+		int n = 0;
+		do {
+			if ( withStatus ) {
+				if ( length - n < STATUS_LENGTH ) break;
+				std::memcpy( buffer + n, STATUS_BYTES, STATUS_LENGTH );
+				n += STATUS_LENGTH;
+			}
+			for ( int i = withStatus ? STATUS_LENGTH : 0; i < PACKET_SIZE && n < length && ! port->toHost.empty(); i++ ) {
+				buffer[n++] = port->toHost.front();
+				port->toHost.pop_front();
+			}
+		} while ( n < length && ! port->toHost.empty() );
+		
+		if ( ! port->toHost.empty() ) port->toHostTime = DmxClock::now();
+		return n;
+	}
+	
+	uint64_t dueOf( const pendingTransfer& p )
+	{
+		if ( p.cancelled ) return 0;
+		return isRead( p.transfer ) ? readDue( p ) : p.due;
+	}
+	
+	/* finishes all due transfers, returns how many */
+	int completeDue()
+	{
+		int count = 0;
+		
+		for ( unsigned int i = 0; i < s_transfers.size(); ) {
+			pendingTransfer p = s_transfers[i];
+			if ( dueOf( p ) > DmxClock::now() ) {
+				i++;
+				continue;
+			}
+			s_transfers.erase( s_transfers.begin() + i );
+			
+			struct libusb_transfer* t = p.transfer;
+			if ( p.cancelled ) {
+				t->status = LIBUSB_TRANSFER_CANCELLED;
+				t->actual_length = 0;
+			} else if ( isRead( t ) ) {
+				t->status = LIBUSB_TRANSFER_COMPLETED;
+				t->actual_length = fillRead( p.port, t->buffer, t->length, true );
+			} else {
+				t->status = LIBUSB_TRANSFER_COMPLETED;
+				t->actual_length = t->length;
+				if ( p.port->device != 0 ) p.port->device->receive( t->buffer, t->length );
+			}
+			t->callback( t );
+			count++;
+		}
+		
+		return count;
+	}
+	
+	void waitUntil( std::unique_lock<std::recursive_mutex>& lock, uint64_t deadline )
+	{
+		std::chrono::steady_clock::time_point tp(
+				std::chrono::duration_cast<std::chrono::steady_clock::duration>( std::chrono::nanoseconds( deadline ) ) );
+		s_cond.wait_until( lock, tp );
+	}
+}
+
+
+/*
+ * Make the given device available as the next FTDI device.
+ */
+void FtdiEmulator::attach( EmulatedDevice* device )
+{
+	std::lock_guard<std::recursive_mutex> lock( s_mutex );
+	emulatedPort* port = new emulatedPort();
+	port->device = device;
+	port->toHostTime = 0;
+	port->busyUntil = 0;
+	port->lineBusyUntil = 0;
+	port->latencyTimer = LATENCY_TIMER_DEFAULT;
+	port->baudRate = 0;
+	port->bitBang = false;
+	s_ports.push_back( port );
+}
+
+/*
+ * Remove all devices and reset the timing and statistics. Devices must have
+ * been closed.
+ */
+void FtdiEmulator::detachAll()
+{
+	std::lock_guard<std::recursive_mutex> lock( s_mutex );
+	for ( unsigned int i = 0; i < s_ports.size(); i++ ) delete s_ports[i];
+	s_ports.clear();
+	s_transfers.clear();
+	s_writeLatency = WRITE_LATENCY_DEFAULT;
+	s_byteTime = BYTE_TIME_DEFAULT;
+	s_lineTiming = false;
+	s_latencyTimerMin = 1;
+	s_readBufferByteTime = 0;
+	std::memset( &s_stats, 0, sizeof( s_stats ) );
+}
+
+/*
+ * Set the time a write takes: a fixed latency plus a time per byte, both in
+ * nanoseconds.
+ */
+void FtdiEmulator::setWriteTiming( uint64_t latency, uint64_t byteTime )
+{
+	std::lock_guard<std::recursive_mutex> lock( s_mutex );
+	s_writeLatency = latency;
+	s_byteTime = byteTime;
+}
+
+/*
+ * Enable or disable timing the serial line behind the chip (see above). Only
+ * meant for devices driving the line directly, like DmxRawDevice.
+ */
+void FtdiEmulator::setLineTiming( bool enabled )
+{
+	std::lock_guard<std::recursive_mutex> lock( s_mutex );
+	s_lineTiming = enabled;
+}
+
+/*
+ * Set how reads behave: latency timer values below latencyTimerMin are rejected
+ * and a read finishes no earlier than bufferByteTime nanoseconds per byte of
+ * its buffer after it was submitted.
+ */
+void FtdiEmulator::setReadProfile( int latencyTimerMin, uint64_t bufferByteTime )
+{
+	std::lock_guard<std::recursive_mutex> lock( s_mutex );
+	s_latencyTimerMin = latencyTimerMin;
+	s_readBufferByteTime = bufferByteTime;
+}
+
+/*
+ * Queue bytes sent by the given device for the host to read.
+ */
+void FtdiEmulator::sendToHost( EmulatedDevice* device, const unsigned char* data, int length )
+{
+	std::lock_guard<std::recursive_mutex> lock( s_mutex );
+	for ( unsigned int i = 0; i < s_ports.size(); i++ ) {
+		emulatedPort* port = s_ports[i];
+		if ( port->device != device ) continue;
+		
+		if ( port->toHost.empty() ) port->toHostTime = DmxClock::now();
+		port->toHost.insert( port->toHost.end(), data, data + length );
+	}
+	s_cond.notify_all();
+}
+
+void FtdiEmulator::getStats( usbStats* stats )
+{
+	std::lock_guard<std::recursive_mutex> lock( s_mutex );
+	*stats = s_stats;
+}
+
+
+/*************************
+ * EMULATED C INTERFACES *
+ *************************/
+
+extern "C" {
+
+struct ftdi_context* ftdi_new( void )
+{
+	struct ftdi_context* ftdi = static_cast<struct ftdi_context*>( std::calloc( 1, sizeof( struct ftdi_context ) ) );
+	ftdi->usb_ctx = reinterpret_cast<struct libusb_context*>( ftdi );
+	ftdi->usb_read_timeout = 5000;
+	ftdi->usb_write_timeout = 5000;
+	ftdi->readbuffer_chunksize = 4096;
+	ftdi->writebuffer_chunksize = 4096;
+	ftdi->max_packet_size = PACKET_SIZE;
+	ftdi->in_ep = 0x02;
+	ftdi->out_ep = 0x81;
+	ftdi->error_str = const_cast<char*>( "emulated error" );
+	return ftdi;
+}
+
+void ftdi_free( struct ftdi_context* ftdi )
+{
+	std::free( ftdi );
+}
+
+char* ftdi_get_error_string( struct ftdi_context* ftdi )
+{
+	return ftdi->error_str;
+}
+
+int ftdi_usb_find_all( struct ftdi_context* ftdi, struct ftdi_device_list** devlist, int vendor, int product )
+{
+	std::lock_guard<std::recursive_mutex> lock( s_mutex );
+	struct ftdi_device_list** next = devlist;
+	
+	for ( unsigned int i = 0; i < s_ports.size(); i++ ) {
+		*next = static_cast<struct ftdi_device_list*>( std::calloc( 1, sizeof( struct ftdi_device_list ) ) );
+		(*next)->dev = reinterpret_cast<struct libusb_device*>( s_ports[i] );
+		next = &(*next)->next;
+	}
+	*next = 0;
+	
+	return s_ports.size();
+}
+
+void ftdi_list_free( struct ftdi_device_list** devlist )
+{
+	while ( *devlist != 0 ) {
+		struct ftdi_device_list* next = (*devlist)->next;
+		std::free( *devlist );
+		*devlist = next;
+	}
+}
+
+int ftdi_usb_get_strings( struct ftdi_context* ftdi, struct libusb_device* dev,
+												 char* manufacturer, int mnf_len, char* description, int desc_len,
+												 char* serial, int serial_len )
+{
+	std::lock_guard<std::recursive_mutex> lock( s_mutex );
+	int index = 0;
+	while ( index < (int)s_ports.size() && reinterpret_cast<struct libusb_device*>( s_ports[index] ) != dev ) index++;
+	
+	std::strncpy( manufacturer, "ENTTEC", mnf_len );
+	std::strncpy( description, "DMX USB PRO", desc_len );
+	char buffer[16];
+	std::snprintf( buffer, sizeof( buffer ), "EMU%05d", index );
+	std::strncpy( serial, buffer, serial_len );
+	return 0;
+}
+
+int ftdi_usb_open_dev( struct ftdi_context* ftdi, struct libusb_device* dev )
+{
+	ftdi->usb_dev = reinterpret_cast<struct libusb_device_handle*>( dev );
+	return 0;
+}
+
+int ftdi_usb_close( struct ftdi_context* ftdi )
+{
+	ftdi->usb_dev = 0;
+	return 0;
+}
+
+int ftdi_usb_reset( struct ftdi_context* ftdi )
+{
+	controlRequest();
+	return 0;
+}
+
+int ftdi_usb_purge_rx_buffer( struct ftdi_context* ftdi )
+{
+	controlRequest();
+	std::lock_guard<std::recursive_mutex> lock( s_mutex );
+	portOf( ftdi )->toHost.clear();
+	return 0;
+}
+
+int ftdi_usb_purge_tx_buffer( struct ftdi_context* ftdi )
+{
+	controlRequest();
+	return 0;
+}
+
+int ftdi_usb_purge_buffers( struct ftdi_context* ftdi )
+{
+	ftdi_usb_purge_tx_buffer( ftdi );
+	return ftdi_usb_purge_rx_buffer( ftdi );
+}
+
+int ftdi_set_baudrate( struct ftdi_context* ftdi, int baudrate )
+{
+	controlRequest();
+	std::lock_guard<std::recursive_mutex> lock( s_mutex );
+	ftdi->baudrate = baudrate;
+	if ( portOf( ftdi ) != 0 ) portOf( ftdi )->baudRate = baudrate;
+	return 0;
+}
+
+int ftdi_set_line_property2( struct ftdi_context* ftdi, enum ftdi_bits_type bits,
+														enum ftdi_stopbits_type sbit, enum ftdi_parity_type parity,
+														enum ftdi_break_type break_type )
+{
+	controlRequest(); //the break takes effect once the request has reached the chip
+	std::lock_guard<std::recursive_mutex> lock( s_mutex );
+	emulatedPort* port = portOf( ftdi );
+	if ( port != 0 && break_type == BREAK_ON && lineByteTime( port ) > 0 && port->lineBusyUntil > DmxClock::now() ) {
+		s_stats.breakWhileSendingCount++;
+	}
+	return 0;
+}
+
+int ftdi_setflowctrl( struct ftdi_context* ftdi, int flowctrl )
+{
+	controlRequest();
+	return 0;
+}
+
+int ftdi_setdtr( struct ftdi_context* ftdi, int state )
+{
+	controlRequest();
+	return 0;
+}
+
+int ftdi_setrts( struct ftdi_context* ftdi, int state )
+{
+	controlRequest();
+	return 0;
+}
+
+int ftdi_set_bitmode( struct ftdi_context* ftdi, unsigned char bitmask, unsigned char mode )
+{
+	controlRequest();
+	std::lock_guard<std::recursive_mutex> lock( s_mutex );
+	ftdi->bitbang_enabled = ( mode != BITMODE_RESET );
+	ftdi->bitbang_mode = mode;
+	if ( portOf( ftdi ) != 0 ) portOf( ftdi )->bitBang = ( mode == BITMODE_BITBANG );
+	return 0;
+}
+
+int ftdi_set_latency_timer( struct ftdi_context* ftdi, unsigned char latency )
+{
+	controlRequest();
+	std::lock_guard<std::recursive_mutex> lock( s_mutex );
+	if ( latency < s_latencyTimerMin ) return -1;
+	portOf( ftdi )->latencyTimer = latency;
+	return 0;
+}
+
+int ftdi_get_latency_timer( struct ftdi_context* ftdi, unsigned char* latency )
+{
+	controlRequest();
+	std::lock_guard<std::recursive_mutex> lock( s_mutex );
+	*latency = portOf( ftdi )->latencyTimer;
+	return 0;
+}
+
+int ftdi_read_data_set_chunksize( struct ftdi_context* ftdi, unsigned int chunksize )
+{
+	ftdi->readbuffer_chunksize = chunksize;
+	return 0;
+}
+
+int ftdi_read_data_get_chunksize( struct ftdi_context* ftdi, unsigned int* chunksize )
+{
+	*chunksize = ftdi->readbuffer_chunksize;
+	return 0;
+}
+
+int ftdi_write_data_set_chunksize( struct ftdi_context* ftdi, unsigned int chunksize )
+{
+	ftdi->writebuffer_chunksize = chunksize;
+	return 0;
+}
+
+int ftdi_write_data_get_chunksize( struct ftdi_context* ftdi, unsigned int* chunksize )
+{
+	*chunksize = ftdi->writebuffer_chunksize;
+	return 0;
+}
+
+/* synchronous write: blocks for the duration of the transfer */
+int ftdi_write_data( struct ftdi_context* ftdi, unsigned char* buf, int size )
+{
+	std::unique_lock<std::recursive_mutex> lock( s_mutex );
+	emulatedPort* port = portOf( ftdi );
+	uint64_t due = scheduleWrite( port, size );
+	
+	lock.unlock();
+	prctl( PR_SET_TIMERSLACK, 1 ); //a real completion is not delayed by timer slack
+	DmxClock::sleepUntil( due );
+	lock.lock();
+	
+	if ( port->device != 0 ) port->device->receive( buf, size );
+	return size;
+}
+
+/*
+ * Synchronous read (status bytes stripped) which, like libftdi's, returns
+ * whatever is waiting at once, 0 if nothing is. Callers waiting for data
+ * therefore poll.
+ */
+int ftdi_read_data( struct ftdi_context* ftdi, unsigned char* buf, int size )
+{
+	std::lock_guard<std::recursive_mutex> lock( s_mutex );
+	s_stats.pollCount++;
+	return fillRead( portOf( ftdi ), buf, size, false );
+}
+
+struct libusb_transfer* LIBUSB_CALL libusb_alloc_transfer( int iso_packets )
+{
+	return static_cast<struct libusb_transfer*>( std::calloc( 1, sizeof( struct libusb_transfer ) ) );
+}
+
+void LIBUSB_CALL libusb_free_transfer( struct libusb_transfer* transfer )
+{
+	std::free( transfer );
+}
+
+int LIBUSB_CALL libusb_submit_transfer( struct libusb_transfer* transfer )
+{
+	std::lock_guard<std::recursive_mutex> lock( s_mutex );
+	pendingTransfer p;
+	p.transfer = transfer;
+	p.port = reinterpret_cast<emulatedPort*>( transfer->dev_handle );
+	p.submitTime = DmxClock::now();
+	p.cancelled = false;
+	
+	if ( isRead( transfer ) ) {
+		p.due = 0;
+		s_stats.readTransferCount++;
+	} else {
+		p.due = scheduleWrite( p.port, transfer->length );
+		s_stats.asyncWriteCount++;
+	}
+	
+	s_transfers.push_back( p );
+	s_cond.notify_all();
+	return 0;
+}
+
+int LIBUSB_CALL libusb_cancel_transfer( struct libusb_transfer* transfer )
+{
+	std::lock_guard<std::recursive_mutex> lock( s_mutex );
+	for ( unsigned int i = 0; i < s_transfers.size(); i++ ) {
+		if ( s_transfers[i].transfer == transfer ) {
+			s_transfers[i].cancelled = true;
+			s_cond.notify_all();
+			return 0;
+		}
+	}
+	return LIBUSB_ERROR_NOT_FOUND;
+}
+
+/* handles due transfers, waiting for the first one for at most tv */
+int LIBUSB_CALL libusb_handle_events_timeout_completed( libusb_context* ctx, struct timeval* tv, int* completed )
+{
+	std::unique_lock<std::recursive_mutex> lock( s_mutex );
+	uint64_t deadline = DmxClock::now() + tv->tv_sec * 1000000000ULL + tv->tv_usec * 1000ULL;
+	
+	while ( completed == 0 || *completed == 0 ) {
+		if ( completeDue() > 0 ) break;
+		
+		uint64_t now = DmxClock::now();
+		if ( now >= deadline ) break;
+		
+		uint64_t wake = deadline;
+		for ( unsigned int i = 0; i < s_transfers.size(); i++ ) {
+			uint64_t due = dueOf( s_transfers[i] );
+			if ( due < wake ) wake = due;
+		}
+		if ( wake > now ) waitUntil( lock, wake );
+	}
+	
+	return 0;
+}
+
+}
@@ -0,0 +1,53 @@
+/*
+ */
+#ifndef FTDI_EMULATOR_H
+#define FTDI_EMULATOR_H
+
+#include <stdint.h>
+#include <vector>
+
+/*
+ * A device on the far end of an emulated FTDI chip. Bytes written by the host
+ * are handed to receive() once their USB transfer has finished; the device
+ * answers through FtdiEmulator::sendToHost().
+ */
+class EmulatedDevice {
+public:
+	virtual ~EmulatedDevice() {}
+	virtual void receive( const unsigned char* data, int length ) = 0;
+};
+
+class FtdiEmulator {
+public:
+	struct usbStats {
+		unsigned long writeCount; /* synchronous and asynchronous */
+		unsigned long asyncWriteCount;
+		unsigned long bytesWritten;
+		unsigned long readTransferCount;
+		unsigned long pollCount; /* ftdi_read_data() calls */
+		unsigned long controlCount; /* control requests, e.g. setting a break */
+		unsigned long breakWhileSendingCount; /* breaks truncating data on the line */
+	};
+	
+	static const uint64_t WRITE_LATENCY_DEFAULT;
+	static const uint64_t BYTE_TIME_DEFAULT;
+	static const int LATENCY_TIMER_DEFAULT;
+	static const int TX_FIFO_SIZE;
+	
+	
+	static void attach( EmulatedDevice* device );
+	static void detachAll();
+	
+	static void setWriteTiming( uint64_t latency, uint64_t byteTime );
+	static void setLineTiming( bool enabled );
+	static void setReadProfile( int latencyTimerMin, uint64_t bufferByteTime );
+	static void sendToHost( EmulatedDevice* device, const unsigned char* data, int length );
+	static void getStats( usbStats* stats );
+
+private:
+	FtdiEmulator();
+	FtdiEmulator( const FtdiEmulator& other );
+	FtdiEmulator& operator=( const FtdiEmulator& other );
+};
+
+#endif /* ! FTDI_EMULATOR_H */
@@ -0,0 +1,38 @@
+/*
+ * Minimal helpers shared by the tests: checks which report and count failures,
+ * and process CPU time for measuring how much waiting costs.
+ */
+#ifndef TEST_SUPPORT_H
+#define TEST_SUPPORT_H
+
+#include <cstdio>
+#include <stdint.h>
+#include <time.h>
+
+static int s_failureCount = 0;
+
+#define CHECK( condition ) checkResult( ( condition ), #condition, __FILE__, __LINE__ )
+
+static inline void checkResult( bool ok, const char* text, const char* file, int line )
+{
+	if ( ok ) return;
+	std::fprintf( stderr, "%s:%i: check failed: %s\n", file, line, text );
+	s_failureCount++;
+}
+
+/* Returns: 0 if all checks passed, 1 otherwise, for use as exit status. */
+static inline int testResult( const char* name )
+{
+	std::printf( "%s: %s\n", name, s_failureCount == 0 ? "passed" : "FAILED" );
+	return s_failureCount == 0 ? 0 : 1;
+}
+
+/* Returns: the CPU time used by the process so far, in nanoseconds. */
+static inline uint64_t cpuTime()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &ts );
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif /* ! TEST_SUPPORT_H */
@@ -0,0 +1,247 @@
+/*
+ * Widget side of the DMX USB PRO protocol: parses the packets written by the
+ * host, keeps the last frame sent to each port and answers parameter and
+ * serial number requests. Received DMX is injected with sendDmxInput().
+ * RDM GET requests to the responders added with addRdmResponder() are
+ * acknowledged with an empty reply; others go unanswered, as on a line without
+ * that responder.
+ */
+#include <algorithm>
+#include <cstring>
+#include "DmxRdm.h"
+#include "UsbProEmulator.h"
+
+const uint32_t UsbProEmulator::API_KEY = 0xC0DEF00D;
+
+//private constants (labels of the standard widget are fixed by Enttec's API)
+static const int GET_WIDGET_PARAMS = 3;
+static const int RECEIVED_DMX_PACKET = 5;
+static const int SET_DMX_TX_MODE = 6;
+static const int SEND_DMX_RDM_TX = 7;
+static const int GET_WIDGET_SN = 10;
+static const int SET_API_KEY = 13;
+static const uint32_t SERIAL_NUMBER = 0x12345678;
+
+const int UsbProEmulator::PORT_ASSIGNMENT_LABEL = 141;
+const int UsbProEmulator::SEND_DMX_PORT2_LABEL = 142;
+const int UsbProEmulator::RECEIVED_DMX_PORT2_LABEL = 143;
+const int UsbProEmulator::RECEIVE_DMX_ON_CHANGE_PORT2_LABEL = 144;
+const int UsbProEmulator::RECEIVED_DMX_COS_PORT2_LABEL = 145;
+
+
+UsbProEmulator::UsbProEmulator( bool mk2 )
+: parser_( onPacket, this ), mk2_( mk2 ), repliesEnabled_( true ), keyAccepted_( false ),
+  port2Assigned_( false ), writeCount_( 0 ), combinedWriteCount_( 0 ), requestCount_( 0 ),
+  rdmRequestCount_( 0 ), portsInWrite_( 0 )
+{
+	for ( int p = 0; p < PORT_COUNT; p++ ) {
+		std::memset( output_[p], 0, sizeof( output_[p] ) );
+		outputLength_[p] = 0;
+		frameCount_[p] = 0;
+	}
+}
+
+
+/*
+ * Called with the data of every USB write; counts writes carrying frames for
+ * both ports.
+ */
+void UsbProEmulator::receive( const unsigned char* data, int length )
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	portsInWrite_ = 0;
+	parser_.feed( data, length );
+	
+	writeCount_++;
+	if ( portsInWrite_ == 3 ) combinedWriteCount_++;
+}
+
+/*
+ * Returns the port 2 configuration matching this emulator.
+ */
+DmxUsbProDevice::port2Configuration UsbProEmulator::getPort2Configuration()
+{
+	DmxUsbProDevice::port2Configuration config;
+	config.apiKey = API_KEY;
+	config.portAssignmentLabel = PORT_ASSIGNMENT_LABEL;
+	config.sendDmxLabel = SEND_DMX_PORT2_LABEL;
+	config.receivedDmxLabel = RECEIVED_DMX_PORT2_LABEL;
+	config.receiveDmxOnChangeLabel = RECEIVE_DMX_ON_CHANGE_PORT2_LABEL;
+	config.receivedDmxCosLabel = RECEIVED_DMX_COS_PORT2_LABEL;
+	return config;
+}
+
+/*
+ * Enable or disable answering requests, e.g. to answer them by hand later
+ * using sendPacket().
+ */
+void UsbProEmulator::setRepliesEnabled( bool enabled )
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	repliesEnabled_ = enabled;
+}
+
+/*
+ * Send a packet with the given label and data to the host.
+ */
+void UsbProEmulator::sendPacket( int label, const unsigned char* data, int length )
+{
+	unsigned char packet[DmxUsbProParser::PACKET_MAX_DATA_SIZE + 5];
+	packet[0] = DmxUsbProParser::PACKET_START_CODE;
+	packet[1] = label;
+	packet[2] = length & 0xFF;
+	packet[3] = length >> 8;
+	if ( length > 0 ) std::memcpy( packet + 4, data, length );
+	packet[4 + length] = DmxUsbProParser::PACKET_END_CODE;
+	
+	FtdiEmulator::sendToHost( this, packet, length + 5 );
+}
+
+/*
+ * Send a frame (start code included) as received on the given port (1 or 2).
+ *
+ * Returns: false if the port is not available.
+ */
+bool UsbProEmulator::sendDmxInput( int port, const unsigned char* data, int length )
+{
+	if ( port == 2 && ! isPort2Enabled() ) return false;
+	
+	unsigned char packet[514];
+	packet[0] = 0; /* status: no errors */
+	std::memcpy( packet + 1, data, length );
+	sendPacket( ( port == 1 ) ? RECEIVED_DMX_PACKET : RECEIVED_DMX_PORT2_LABEL, packet, length + 1 );
+	return true;
+}
+
+/*
+ * Let a responder with the given UID answer RDM GET requests.
+ */
+void UsbProEmulator::addRdmResponder( uint64_t uid )
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	rdmResponders_.push_back( uid );
+}
+
+/*
+ * Copy the last frame sent to the given port (1 or 2).
+ *
+ * Returns: the length of the frame.
+ */
+int UsbProEmulator::getOutput( int port, unsigned char* data ) const
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	std::memcpy( data, output_[port - 1], outputLength_[port - 1] );
+	return outputLength_[port - 1];
+}
+
+unsigned long UsbProEmulator::getFrameCount( int port ) const
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	return frameCount_[port - 1];
+}
+
+unsigned long UsbProEmulator::getCombinedWriteCount() const
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	return combinedWriteCount_;
+}
+
+unsigned long UsbProEmulator::getWriteCount() const
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	return writeCount_;
+}
+
+unsigned long UsbProEmulator::getRequestCount() const
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	return requestCount_;
+}
+
+unsigned long UsbProEmulator::getRdmRequestCount() const
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	return rdmRequestCount_;
+}
+
+bool UsbProEmulator::isPort2Enabled() const
+{
+	std::lock_guard<std::mutex> lock( mutex_ );
+	return keyAccepted_ && port2Assigned_;
+}
+
+
+/*********************
+ * PRIVATE FUNCTIONS *
+ *********************/
+
+void UsbProEmulator::onPacket( int label, const unsigned char* data, int length, void* userData )
+{
+	static_cast<UsbProEmulator*>( userData )->handlePacket( label, data, length );
+}
+
+void UsbProEmulator::handlePacket( int label, const unsigned char* data, int length )
+{
+	int port = 0;
+	
+	if ( label == SET_DMX_TX_MODE ) {
+		port = 1;
+	} else if ( mk2_ && label == SEND_DMX_PORT2_LABEL && keyAccepted_ && port2Assigned_ ) {
+		port = 2;
+	} else if ( label == GET_WIDGET_PARAMS ) {
+		requestCount_++;
+		if ( ! repliesEnabled_ ) return;
+		
+		int userLength = ( length >= 2 ) ? data[0] | ( data[1] << 8 ) : 0;
+		unsigned char reply[5 + 512] = { 0 };
+		reply[0] = 44; reply[1] = 1; /* firmware LSB/MSB */
+		reply[2] = 9; reply[3] = 1; reply[4] = 40; /* break, MAB, rate */
+		sendPacket( GET_WIDGET_PARAMS, reply, 5 + userLength );
+	} else if ( label == GET_WIDGET_SN ) {
+		requestCount_++;
+		if ( ! repliesEnabled_ ) return;
+		
+		unsigned char reply[4];
+		for ( int i = 0; i < 4; i++ ) reply[i] = ( SERIAL_NUMBER >> ( 8 * i ) ) & 0xFF;
+		sendPacket( GET_WIDGET_SN, reply, sizeof( reply ) );
+	} else if ( label == SEND_DMX_RDM_TX ) {
+		rdmRequestCount_++;
+		if ( repliesEnabled_ ) answerRdm( data, length );
+	} else if ( mk2_ && label == SET_API_KEY && length == 4 ) {
+		uint32_t key = data[0] | ( data[1] << 8 ) | ( data[2] << 16 ) | ( (uint32_t)data[3] << 24 );
+		keyAccepted_ = ( key == API_KEY );
+	} else if ( mk2_ && label == PORT_ASSIGNMENT_LABEL && keyAccepted_ && length == 2 ) {
+		port2Assigned_ = ( data[1] == 1 );
+	}
+	//SET_WIDGET_PARAMS, RECEIVE_DMX_ON_CHANGE (both ports): accepted silently
+	
+	if ( port != 0 ) {
+		int n = ( length < 513 ) ? length : 513;
+		std::memcpy( output_[port - 1], data, n );
+		outputLength_[port - 1] = n;
+		frameCount_[port - 1]++;
+		portsInWrite_ |= port;
+	}
+}
+
+/* acknowledges a GET request to one of the responders, with the status byte of a received frame */
+void UsbProEmulator::answerRdm( const unsigned char* data, int length )
+{
+	DmxRdm::message msg;
+	if ( DmxRdm::parsePacket( data, length, &msg ) != 0 ) return;
+	if ( msg.commandClass != DmxRdm::GET_COMMAND ) return;
+	if ( std::find( rdmResponders_.begin(), rdmResponders_.end(), msg.destination ) == rdmResponders_.end() ) return;
+	
+	DmxRdm::message reply = msg;
+	reply.source = msg.destination;
+	reply.destination = msg.source;
+	reply.commandClass = DmxRdm::GET_COMMAND_RESPONSE;
+	reply.portId = DmxRdm::RESPONSE_TYPE_ACK;
+	reply.messageCount = 0;
+	reply.dataLength = 0;
+	
+	unsigned char packet[1 + DmxRdm::PACKET_MAX_LENGTH];
+	packet[0] = 0; /* status: no errors */
+	int n = DmxRdm::buildPacket( &reply, packet + 1 );
+	sendPacket( RECEIVED_DMX_PACKET, packet, n + 1 );
+}
@@ -0,0 +1,75 @@
+/*
+ */
+#ifndef USB_PRO_EMULATOR_H
+#define USB_PRO_EMULATOR_H
+
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+#include "DmxUsbProDevice.h"
+#include "DmxUsbProParser.h"
+#include "FtdiEmulator.h"
+
+/*
+ * Emulates the widget side of a DMX USB PRO, optionally with the second port
+ * of a Mk2. The Mk2 labels are not public, so the emulator uses its own; the
+ * matching configuration for DmxUsbProDevice::enablePort2() is returned by
+ * getPort2Configuration().
+ */
+class UsbProEmulator : public EmulatedDevice {
+public:
+	static const uint32_t API_KEY;
+	static const int PORT_COUNT = 2;
+	
+	
+	UsbProEmulator( bool mk2 = false );
+	
+	void receive( const unsigned char* data, int length );
+	
+	static DmxUsbProDevice::port2Configuration getPort2Configuration();
+	
+	void setRepliesEnabled( bool enabled );
+	void sendPacket( int label, const unsigned char* data, int length );
+	bool sendDmxInput( int port, const unsigned char* data, int length );
+	void addRdmResponder( uint64_t uid );
+	
+	int getOutput( int port, unsigned char* data ) const;
+	unsigned long getFrameCount( int port ) const;
+	unsigned long getCombinedWriteCount() const;
+	unsigned long getWriteCount() const;
+	unsigned long getRequestCount() const;
+	unsigned long getRdmRequestCount() const;
+	bool isPort2Enabled() const;
+
+private:
+	static const int PORT_ASSIGNMENT_LABEL;
+	static const int SEND_DMX_PORT2_LABEL;
+	static const int RECEIVED_DMX_PORT2_LABEL;
+	static const int RECEIVE_DMX_ON_CHANGE_PORT2_LABEL;
+	static const int RECEIVED_DMX_COS_PORT2_LABEL;
+	
+	UsbProEmulator( const UsbProEmulator& other );
+	UsbProEmulator& operator=( const UsbProEmulator& other );
+	
+	static void onPacket( int label, const unsigned char* data, int length, void* userData );
+	void handlePacket( int label, const unsigned char* data, int length );
+	void answerRdm( const unsigned char* data, int length );
+	
+	mutable std::mutex mutex_;
+	DmxUsbProParser parser_;
+	bool mk2_;
+	bool repliesEnabled_;
+	bool keyAccepted_;
+	bool port2Assigned_;
+	unsigned char output_[PORT_COUNT][513];
+	int outputLength_[PORT_COUNT];
+	unsigned long frameCount_[PORT_COUNT];
+	unsigned long writeCount_;
+	unsigned long combinedWriteCount_;
+	unsigned long requestCount_;
+	unsigned long rdmRequestCount_;
+	std::vector<uint64_t> rdmResponders_;
+	int portsInWrite_;
+};
+
+#endif /* ! USB_PRO_EMULATOR_H */
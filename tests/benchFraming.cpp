@@ -0,0 +1,98 @@
+/*
+ * Compares the cost of framing a DMX USB PRO packet per frame: the original
+ * implementation (a heap buffer per packet, into which the frame is copied),
+ * writeDmx() (copy into a stack buffer with headroom) and writeDmxFrame()
+ * (header and end code written around the caller's frame buffer in place).
+ * Allocations are counted by replacing the global operator new; the writes
+ * themselves go to the emulated widget, whose cost is included in the times.
+ */
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "DmxClock.h"
+#include "DmxUsbProDevice.h"
+#include "FtdiEmulator.h"
+#include "TestSupport.h"
+#include "UsbProEmulator.h"
+
+static std::atomic<unsigned long> s_allocationCount( 0 );
+
+void* operator new( std::size_t size )
+{
+	s_allocationCount++;
+	void* p = std::malloc( size );
+	if ( p == 0 ) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[]( std::size_t size )
+{
+	return operator new( size );
+}
+
+void operator delete( void* p ) noexcept { std::free( p ); }
+void operator delete[]( void* p ) noexcept { std::free( p ); }
+
+/* exposes the FtdiDevice to re-create the original packet framing */
+class BenchDevice : public DmxUsbProDevice {
+public:
+	int writeDmxLegacy( const unsigned char* data, int length ) const
+	{
+		unsigned char* packet = new unsigned char[5 + length];
+		packet[0] = 0x7E;
+		packet[1] = 6; /* SET_DMX_TX_MODE */
+		packet[2] = length & 0xFF;
+		packet[3] = length >> 8;
+		std::memcpy( packet + 4, data, length );
+		packet[4 + length] = 0xE7;
+		int r = ftdiDevice_->writeData( packet, length + 5 );
+		delete[] packet;
+		return r;
+	}
+};
+
+int main()
+{
+	static const int FRAME_COUNT = 100000;
+	static const int LENGTH = 513;
+	
+	UsbProEmulator widget;
+	FtdiEmulator::attach( &widget );
+	BenchDevice device;
+	CHECK( device.open() );
+	FtdiEmulator::setWriteTiming( 0, 0 );
+	
+	DmxFrameBuffer frame;
+	for ( int i = 0; i < LENGTH; i++ ) frame.data[i] = i;
+	frame.length = LENGTH;
+	
+	const char* names[] = { "original (new[] + copy)", "writeDmx()", "writeDmxFrame()" };
+	const int copied[] = { LENGTH, LENGTH, 0 };
+	unsigned long allocations[3];
+	
+	for ( int mode = 0; mode < 3; mode++ ) {
+		unsigned long a0 = s_allocationCount;
+		uint64_t t0 = DmxClock::now();
+		
+		for ( int i = 0; i < FRAME_COUNT; i++ ) {
+			frame.data[1] = i;
+			if ( mode == 0 ) device.writeDmxLegacy( frame.data, LENGTH );
+			else if ( mode == 1 ) device.writeDmx( frame.data, LENGTH );
+			else device.writeDmxFrame( &frame );
+		}
+		
+		uint64_t t1 = DmxClock::now();
+		allocations[mode] = s_allocationCount - a0;
+		std::printf( "%-24s %6.2f allocations/frame, %3i bytes copied/frame, %6.0f ns/frame\n", names[mode],
+								allocations[mode] / (double)FRAME_COUNT, copied[mode], ( t1 - t0 ) / (double)FRAME_COUNT );
+	}
+	
+	CHECK( allocations[0] == (unsigned long)FRAME_COUNT );
+	CHECK( allocations[1] == 0 && allocations[2] == 0 );
+	CHECK( widget.getFrameCount( 1 ) == 3UL * FRAME_COUNT );
+	
+	device.close();
+	FtdiEmulator::detachAll();
+	return testResult( "benchFraming" );
+}
@@ -0,0 +1,52 @@
+/*
+ * Measures DmxMerger::merge() for 64 universes with 8 sources each, every
+ * source publishing a new frame before each merge and half of the slots set to
+ * LTP, with the merge kernel selected for this CPU.
+ */
+#include <cstdlib>
+#include <vector>
+#include "DmxClock.h"
+#include "DmxKernels.h"
+#include "DmxMerger.h"
+#include "TestSupport.h"
+
+int main()
+{
+	static const int UNIVERSE_COUNT = 64;
+	static const int SOURCE_COUNT = 8;
+	static const int ROUND_COUNT = 500;
+	
+	std::vector<DmxMerger*> mergers;
+	for ( int u = 0; u < UNIVERSE_COUNT; u++ ) {
+		mergers.push_back( new DmxMerger( SOURCE_COUNT ) );
+		mergers[u]->setMode( 1, 256, DmxMerger::MERGE_LTP );
+	}
+	
+	unsigned char data[513];
+	data[0] = 0;
+	for ( int i = 1; i < 513; i++ ) data[i] = std::rand();
+	
+	DmxFrameBuffer frame;
+	uint64_t sum = 0, best = UINT64_MAX;
+	for ( int round = 0; round < ROUND_COUNT; round++ ) {
+		for ( int u = 0; u < UNIVERSE_COUNT; u++ ) {
+			for ( int s = 0; s < SOURCE_COUNT; s++ ) {
+				data[1 + ( round + s ) % 512] = round;
+				mergers[u]->publishSource( s, data, sizeof( data ), 0 );
+			}
+		}
+		
+		uint64_t tStart = DmxClock::now();
+		for ( int u = 0; u < UNIVERSE_COUNT; u++ ) CHECK( mergers[u]->merge( &frame ) == 513 );
+		uint64_t t = DmxClock::now() - tStart;
+		sum += t;
+		if ( t < best ) best = t;
+	}
+	
+	std::printf( "merge of %d universes x %d sources (%s kernel): mean %.1f us, best %.1f us\n",
+							 UNIVERSE_COUNT, SOURCE_COUNT, DmxKernels::getMergeKernelName(),
+							 sum / (double)ROUND_COUNT / 1000.0, best / 1000.0 );
+	
+	for ( int u = 0; u < UNIVERSE_COUNT; u++ ) delete mergers[u];
+	return testResult( "benchMerger" );
+}
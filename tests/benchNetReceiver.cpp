@@ -0,0 +1,105 @@
+/*
+ * Measures DmxNetReceiver on loopback: several sender threads send batches of
+ * prebuilt Art-Net and sACN packets for a thousand universes, and the frames
+ * stored per second and packets per receive call are reported for one and for
+ * several shards.
+ */
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "DmxArtNetDevice.h"
+#include "DmxClock.h"
+#include "DmxNetReceiver.h"
+#include "DmxSacnDevice.h"
+#include "TestSupport.h"
+
+static const int UNIVERSE_COUNT = 1000;
+static const int SENDER_COUNT = 8;
+static const int ROUND_COUNT = 200;
+static const int ROUND_INTERVAL = 2000; /* in microseconds */
+static const int PACKET_STRIDE = 640;
+
+/* exposes the packet building of a device, so packets can be sent in batches */
+template<class D> class PacketBuilder : public D {
+public:
+	int build( int number, unsigned char sequence, unsigned char value, unsigned char* packet ) const
+	{
+		typename D::universe u;
+		std::memset( &u, 0, sizeof( u ) );
+		u.number = number;
+		this->buildHeader( &u );
+		
+		unsigned char frame[513];
+		std::memset( frame, value, sizeof( frame ) );
+		frame[0] = 0;
+		int length = this->setPacketData( u.packet, frame, sizeof( frame ) );
+		this->setSequence( u.packet, sequence );
+		std::memcpy( packet, u.packet, length );
+		return length;
+	}
+};
+
+/* send every SENDER_COUNT-th universe, starting at the given one, each round */
+template<class D> static void sendRounds( int first, int port )
+{
+	PacketBuilder<D> builder;
+	DmxNetSocket socket;
+	struct sockaddr_in address;
+	CHECK( socket.open() );
+	CHECK( socket.resolveAddress( "127.0.0.1", port, &address ) );
+	
+	std::vector<unsigned char> buffer( UNIVERSE_COUNT * PACKET_STRIDE );
+	std::vector<DmxNetSocket::packet> packets;
+	for ( int round = 0; round < ROUND_COUNT; round++ ) {
+		packets.clear();
+		for ( int u = first; u <= UNIVERSE_COUNT; u += SENDER_COUNT ) {
+			unsigned char* data = &buffer[( u - 1 ) * PACKET_STRIDE];
+			DmxNetSocket::packet p = { data, builder.build( u, 1 + round % 255, round, data ), &address, false };
+			packets.push_back( p );
+		}
+		socket.sendBatch( &packets[0], packets.size() );
+		std::this_thread::sleep_for( std::chrono::microseconds( ROUND_INTERVAL ) );
+	}
+}
+
+template<class D> static void measure( DmxNetReceiver::PROTOCOL protocol, const char* name, int shardCount )
+{
+	//not the protocols' ports, so other traffic on the host does not interfere
+	int port = ( protocol == DmxNetReceiver::PROTOCOL_ARTNET ) ? 16454 : 15568;
+	DmxNetReceiver receiver( protocol, port );
+	for ( int u = 1; u <= UNIVERSE_COUNT; u++ ) receiver.addUniverse( u );
+	if ( ! receiver.start( shardCount ) ) {
+		std::printf( "%s: cannot start receiver: %s\n", name, receiver.getLastError() );
+		CHECK( false );
+		return;
+	}
+	
+	uint64_t tStart = DmxClock::now();
+	std::vector<std::thread> senders;
+	for ( int i = 0; i < SENDER_COUNT; i++ ) senders.push_back( std::thread( sendRounds<D>, 1 + i, port ) );
+	for ( int i = 0; i < SENDER_COUNT; i++ ) senders[i].join();
+	double seconds = ( DmxClock::now() - tStart ) / 1e9;
+	
+	std::this_thread::sleep_for( std::chrono::milliseconds( 200 ) );
+	DmxNetReceiver::receiverStats stats;
+	receiver.getStats( &stats );
+	receiver.stop();
+	
+	std::printf( "%s, %d shard(s): %d packets sent, %lu received, %lu frames (%.0f/s), "
+							 "%lu out of order, %.1f packets per call\n",
+							 name, shardCount, UNIVERSE_COUNT * ROUND_COUNT, stats.packetCount, stats.frameCount,
+							 stats.frameCount / seconds, stats.outOfOrderCount,
+							 stats.syscallCount > 0 ? (double)stats.packetCount / stats.syscallCount : 0.0 );
+	CHECK( stats.frameCount > 0 );
+}
+
+int main()
+{
+	measure<DmxArtNetDevice>( DmxNetReceiver::PROTOCOL_ARTNET, "Art-Net", 1 );
+	measure<DmxArtNetDevice>( DmxNetReceiver::PROTOCOL_ARTNET, "Art-Net", 4 );
+	measure<DmxSacnDevice>( DmxNetReceiver::PROTOCOL_SACN, "sACN", 1 );
+	measure<DmxSacnDevice>( DmxNetReceiver::PROTOCOL_SACN, "sACN", 4 );
+	
+	return testResult( "benchNetReceiver" );
+}
@@ -0,0 +1,57 @@
+/*
+ * Measures the cost per packet of DmxSacnArbiter::receivePacket() for a
+ * universe with 8 sources: for a source below the winning priority, which is
+ * skipped without merging, and for the winning source, which causes a merge.
+ */
+#include <cstring>
+#include "DmxClock.h"
+#include "DmxSacnArbiter.h"
+#include "TestSupport.h"
+
+int main()
+{
+	static const int SOURCE_COUNT = 8;
+	static const int PACKET_COUNT = 200000;
+	static const int WINNER = 0;
+	static const int LOSER = 3;
+	
+	DmxSacnArbiter arbiter;
+	CHECK( arbiter.addUniverse( 1 ) == 0 );
+	
+	unsigned char cids[SOURCE_COUNT][16];
+	unsigned char levels[512];
+	DmxNetDevice::packetInfo info = { 1, 0, 100, 0, 0, 0, levels, 512 };
+	uint64_t t = 1000000000;
+	
+	std::memset( cids, 0, sizeof( cids ) );
+	for ( int s = 0; s < SOURCE_COUNT; s++ ) {
+		cids[s][0] = s;
+		std::memset( levels, s, sizeof( levels ) );
+		info.cid = cids[s];
+		info.priority = ( s == WINNER ) ? 200 : 100;
+		arbiter.receivePacket( &info, t );
+	}
+	CHECK( arbiter.getSourceCount( 1 ) == SOURCE_COUNT );
+	
+	uint64_t times[2];
+	for ( int run = 0; run < 2; run++ ) {
+		info.cid = cids[run == 0 ? LOSER : WINNER];
+		info.priority = ( run == 0 ) ? 100 : 200;
+		
+		uint64_t tStart = DmxClock::now();
+		for ( int k = 0; k < PACKET_COUNT; k++ ) {
+			levels[7] = k;
+			info.sequence = ( k + 1 ) & 0xFF;
+			arbiter.receivePacket( &info, t );
+		}
+		times[run] = DmxClock::now() - tStart;
+	}
+	
+	DmxSacnArbiter::arbiterStats stats;
+	arbiter.getStats( &stats );
+	CHECK( stats.skippedCount >= (unsigned long)PACKET_COUNT );
+	
+	std::printf( "per packet with %d sources: lower priority %.0f ns, winning source %.0f ns\n",
+							 SOURCE_COUNT, times[0] / (double)PACKET_COUNT, times[1] / (double)PACKET_COUNT );
+	return testResult( "benchSacnArbiter" );
+}
@@ -0,0 +1,92 @@
+/*
+ * Measures DmxSubscriptionIndex::dispatch() with thousands of subscriptions,
+ * for a single changed slot and for a frame in which every slot changed, and
+ * how long adding a subscription waits while a dispatch runs slow callbacks.
+ */
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include "DmxClock.h"
+#include "DmxSubscriptionIndex.h"
+#include "TestSupport.h"
+
+static unsigned long s_callCount = 0;
+
+static void onChange( int id, const unsigned char* data, int length, void* userData )
+{
+	s_callCount++;
+}
+
+static void onChangeSlowly( int id, const unsigned char* data, int length, void* userData )
+{
+	std::this_thread::sleep_for( std::chrono::microseconds( 100 ) );
+}
+
+static void onChangeRemove( int id, const unsigned char* data, int length, void* userData )
+{
+	static_cast<DmxSubscriptionIndex*>( userData )->remove( id );
+}
+
+int main()
+{
+	static const int SUBSCRIPTION_COUNTS[] = { 1000, 5000, 20000 };
+	static const int DISPATCH_COUNT = 2000;
+	
+	unsigned char data[DmxSubscriptionIndex::SLOT_COUNT] = { 0 };
+	uint64_t oneSlot[DmxSubscriptionIndex::BITMAP_WORDS] = { 0 };
+	uint64_t allSlots[DmxSubscriptionIndex::BITMAP_WORDS];
+	oneSlot[200 / 64] = 1ULL << ( 200 % 64 );
+	std::memset( allSlots, 0xFF, sizeof( allSlots ) );
+	
+	for ( int c = 0; c < 3; c++ ) {
+		DmxSubscriptionIndex index;
+		int count = SUBSCRIPTION_COUNTS[c];
+		for ( int i = 0; i < count; i++ ) {
+			int first = 1 + ( i * 37 ) % 500;
+			index.addRange( first, first + i % 12, onChange );
+		}
+		
+		for ( int mode = 0; mode < 2; mode++ ) {
+			const uint64_t* changed = ( mode == 0 ) ? oneSlot : allSlots;
+			s_callCount = 0;
+			
+			uint64_t t0 = DmxClock::now();
+			for ( int i = 0; i < DISPATCH_COUNT; i++ ) index.dispatch( data, sizeof( data ), changed );
+			uint64_t t1 = DmxClock::now();
+			
+			std::printf( "%5i subscriptions, %-13s %8.2f us/dispatch, %5lu callbacks/dispatch\n", count,
+									mode == 0 ? "1 changed:" : "all changed:", ( t1 - t0 ) / 1e3 / DISPATCH_COUNT,
+									s_callCount / DISPATCH_COUNT );
+		}
+		CHECK( s_callCount == (unsigned long)count * DISPATCH_COUNT );
+	}
+	
+	//callbacks run without the index locked: they may unsubscribe, and adding does not wait for them
+	DmxSubscriptionIndex index;
+	for ( int i = 0; i < 100; i++ ) index.addRange( 1, 512, onChangeRemove, &index );
+	index.dispatch( data, sizeof( data ), allSlots );
+	CHECK( index.getCount() == 0 );
+	
+	for ( int i = 0; i < 100; i++ ) index.addRange( 1, 512, onChangeSlowly );
+	std::atomic<bool> dispatching( true );
+	std::thread dispatcher( [&]() {
+		index.dispatch( data, sizeof( data ), allSlots );
+		dispatching = false;
+	} );
+	
+	uint64_t maxWait = 0;
+	std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+	while ( dispatching ) {
+		uint64_t t0 = DmxClock::now();
+		index.remove( index.addRange( 1, 1, onChange ) );
+		uint64_t wait = DmxClock::now() - t0;
+		if ( wait > maxWait ) maxWait = wait;
+		std::this_thread::sleep_for( std::chrono::microseconds( 200 ) );
+	}
+	dispatcher.join();
+	
+	std::printf( "longest add/remove during a dispatch of 100 slow callbacks: %.1f us\n", maxWait / 1e3 );
+	CHECK( maxWait < 5000000 );
+	
+	return testResult( "benchSubscriptions" );
+}
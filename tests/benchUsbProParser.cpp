@@ -0,0 +1,53 @@
+/*
+ * Measures DmxUsbProParser throughput on a stream of received DMX packets
+ * (label 5, 513 slots), fed whole, in 62 byte chunks (the payload of one USB
+ * packet, so most packets are split and copied) and byte by byte.
+ */
+#include <vector>
+#include "DmxClock.h"
+#include "DmxUsbProParser.h"
+#include "TestSupport.h"
+
+static unsigned long s_checksum = 0;
+
+static void onPacket( int label, const unsigned char* data, int length, void* userData )
+{
+	s_checksum += data[length - 1];
+}
+
+int main()
+{
+	static const int PACKET_COUNT = 20000;
+	static const int DATA_LENGTH = 514; /* receive status and start code plus 512 slots */
+	
+	std::vector<unsigned char> stream;
+	for ( int i = 0; i < PACKET_COUNT; i++ ) {
+		const unsigned char header[] = { 0x7E, 5, DATA_LENGTH & 0xFF, DATA_LENGTH >> 8 };
+		stream.insert( stream.end(), header, header + 4 );
+		for ( int j = 0; j < DATA_LENGTH; j++ ) stream.push_back( ( i + j ) & 0x7F );
+		stream.push_back( 0xE7 );
+	}
+	
+	const int CHUNK_SIZES[] = { (int)stream.size(), 62, 1 };
+	const char* names[] = { "whole stream", "62 byte chunks", "single bytes" };
+	
+	for ( int mode = 0; mode < 3; mode++ ) {
+		DmxUsbProParser parser( onPacket );
+		int chunk = CHUNK_SIZES[mode];
+		
+		uint64_t t0 = DmxClock::now();
+		for ( unsigned int offset = 0; offset < stream.size(); offset += chunk ) {
+			int n = ( stream.size() - offset < (unsigned int)chunk ) ? stream.size() - offset : chunk;
+			parser.feed( &stream[offset], n );
+		}
+		uint64_t t1 = DmxClock::now();
+		
+		double seconds = ( t1 - t0 ) / 1e9;
+		std::printf( "%-16s %8.1f MB/s, %9.0f packets/s\n", names[mode],
+								stream.size() / seconds / 1e6, parser.getPacketCount() / seconds );
+		CHECK( parser.getPacketCount() == (unsigned long)PACKET_COUNT && parser.getErrorCount() == 0 );
+	}
+	
+	std::printf( "(checksum %lu)\n", s_checksum );
+	return testResult( "benchUsbProParser" );
+}
@@ -0,0 +1,145 @@
+/*
+ * Fuzz harness for DmxUsbProParser. Every input is parsed in one piece and in
+ * many random splits, which must yield the same packets, each within
+ * PACKET_MAX_DATA_SIZE. Inputs are the files in the corpus directory
+ * (corpus/usbpro by default, or the first argument) and random mutations of
+ * them; the number of mutations can be given as second argument.
+ * Finally, valid packets separated by random noise must all be recovered.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "DmxUsbProParser.h"
+#include "TestSupport.h"
+
+typedef std::vector<unsigned char> vec_byte;
+
+struct packet {
+	int label;
+	vec_byte data;
+	
+	bool operator==( const packet& other ) const { return label == other.label && data == other.data; }
+};
+
+static void onPacket( int label, const unsigned char* data, int length, void* userData )
+{
+	CHECK( length >= 0 && length <= DmxUsbProParser::PACKET_MAX_DATA_SIZE );
+	packet p;
+	p.label = label;
+	p.data.assign( data, data + length );
+	static_cast<std::vector<packet>*>( userData )->push_back( p );
+}
+
+/* parses the input in chunks of at most maxChunk bytes (0 for a single chunk) */
+static std::vector<packet> parse( const vec_byte& input, int maxChunk )
+{
+	std::vector<packet> packets;
+	DmxUsbProParser parser( onPacket, &packets );
+	
+	int offset = 0, size = input.size();
+	while ( offset < size ) {
+		int n = ( maxChunk > 0 ) ? 1 + std::rand() % maxChunk : size;
+		if ( n > size - offset ) n = size - offset;
+		parser.feed( input.empty() ? 0 : &input[offset], n );
+		offset += n;
+	}
+	CHECK( (int)parser.getPacketCount() == (int)packets.size() );
+	
+	return packets;
+}
+
+/* Returns: false if splitting the input changed the parsed packets. */
+static bool checkSplits( const vec_byte& input, int splitCount )
+{
+	static const int CHUNK_SIZES[] = { 1, 2, 7, 62, 600 };
+	std::vector<packet> whole = parse( input, 0 );
+	
+	for ( int i = 0; i < splitCount; i++ ) {
+		if ( parse( input, CHUNK_SIZES[i % 5] ) != whole ) return false;
+	}
+	return true;
+}
+
+static void mutate( vec_byte* input )
+{
+	static const unsigned char INTERESTING[] = { 0x7E, 0xE7, 0x00, 0xFF, 0x02 };
+	int count = 1 + std::rand() % 8;
+	
+	for ( int i = 0; i < count; i++ ) {
+		int at = input->empty() ? 0 : std::rand() % input->size();
+		unsigned char value = ( std::rand() % 2 ) ? INTERESTING[std::rand() % 5] : std::rand();
+		
+		switch ( std::rand() % 4 ) {
+			case 0: if ( ! input->empty() ) (*input)[at] = value; break;
+			case 1: input->insert( input->begin() + at, value ); break;
+			case 2: if ( ! input->empty() ) input->erase( input->begin() + at ); break;
+			case 3: input->insert( input->begin() + at, input->begin(), input->begin() + at / 2 ); break;
+		}
+	}
+}
+
+static std::vector<vec_byte> readCorpus( const char* path )
+{
+	std::vector<vec_byte> corpus;
+	DIR* dir = opendir( path );
+	if ( dir == 0 ) return corpus;
+	
+	struct dirent* entry;
+	while ( ( entry = readdir( dir ) ) != 0 ) {
+		if ( entry->d_name[0] == '.' ) continue;
+		std::ifstream file( ( std::string( path ) + "/" + entry->d_name ).c_str(), std::ios::binary );
+		corpus.push_back( vec_byte( std::istreambuf_iterator<char>( file ), std::istreambuf_iterator<char>() ) );
+	}
+	closedir( dir );
+	
+	return corpus;
+}
+
+int main( int argc, char** argv )
+{
+	const char* corpusPath = ( argc > 1 ) ? argv[1] : "corpus/usbpro";
+	int mutationCount = ( argc > 2 ) ? std::atoi( argv[2] ) : 20000;
+	std::srand( 1 );
+	
+	std::vector<vec_byte> corpus = readCorpus( corpusPath );
+	CHECK( ! corpus.empty() );
+	
+	for ( unsigned int i = 0; i < corpus.size(); i++ ) CHECK( checkSplits( corpus[i], 50 ) );
+	
+	int failures = 0;
+	for ( int i = 0; i < mutationCount && ! corpus.empty(); i++ ) {
+		vec_byte input = corpus[std::rand() % corpus.size()];
+		mutate( &input );
+		if ( ! checkSplits( input, 5 ) ) failures++;
+	}
+	CHECK( failures == 0 );
+	
+	//packets containing start and end codes, with noise (including start codes) in between
+	static const int PACKET_COUNT = 5000;
+	vec_byte stream;
+	vec_byte payload( 20 );
+	for ( int i = 0; i < 20; i++ ) payload[i] = ( i == 5 ) ? 0x7E : ( i == 9 ) ? 0xE7 : i;
+	for ( int i = 0; i < PACKET_COUNT; i++ ) {
+		int noise = std::rand() % 4;
+		for ( int j = 0; j < noise; j++ ) stream.push_back( ( std::rand() % 3 == 0 ) ? 0x7E : std::rand() );
+		const unsigned char header[] = { 0x7E, 6, 20, 0 };
+		stream.insert( stream.end(), header, header + 4 );
+		stream.insert( stream.end(), payload.begin(), payload.end() );
+		stream.push_back( 0xE7 );
+	}
+	
+	std::vector<packet> packets = parse( stream, 64 );
+	int intact = 0;
+	for ( unsigned int i = 0; i < packets.size(); i++ ) {
+		if ( packets[i].label == 6 && packets[i].data == payload ) intact++;
+	}
+	std::printf( "%u corpus files, %i mutations; recovered %i of %i packets from noise (%u parsed)\n",
+							(unsigned int)corpus.size(), mutationCount, intact, PACKET_COUNT, (unsigned int)packets.size() );
+	CHECK( intact == PACKET_COUNT );
+	
+	return testResult( "fuzzUsbProParser" );
+}
@@ -0,0 +1,66 @@
+/*
+ * Checks that adaptive slot count sends a shrinking frame once more at its
+ * previous length, so the slots being cut off go out as zeroes instead of
+ * holding their last level on the receivers.
+ */
+#include <atomic>
+#include <thread>
+#include "DmxUsbProDevice.h"
+#include "FtdiEmulator.h"
+#include "TestSupport.h"
+#include "UsbProEmulator.h"
+
+/* records the highest slot of each received frame */
+class RecordingWidget : public UsbProEmulator {
+public:
+	RecordingWidget() : sawHighSlotZeroed( false ) {}
+	
+	void receive( const unsigned char* data, int length )
+	{
+		UsbProEmulator::receive( data, length );
+		
+		unsigned char output[513];
+		int outputLength = getOutput( 1, output );
+		if ( outputLength > HIGH_SLOT && output[HIGH_SLOT] == 0 ) sawHighSlotZeroed = true;
+	}
+	
+	static const int HIGH_SLOT = 400;
+	std::atomic<bool> sawHighSlotZeroed;
+};
+
+int main()
+{
+	RecordingWidget widget;
+	FtdiEmulator::attach( &widget );
+	
+	DmxUsbProDevice device;
+	CHECK( device.open() );
+	FtdiEmulator::setWriteTiming( 0, 0 );
+	
+	CHECK( device.setAdaptiveSlotCount( true ) );
+	device.setKeepAliveInterval( 0 );
+	CHECK( device.startOutputThread() );
+	
+	unsigned char frame[513] = { 0 };
+	unsigned char output[513];
+	frame[RecordingWidget::HIGH_SLOT] = 255;
+	device.publishDmx( frame, sizeof( frame ) );
+	std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+	CHECK( widget.getOutput( 1, output ) == RecordingWidget::HIGH_SLOT + 1 );
+	CHECK( output[RecordingWidget::HIGH_SLOT] == 255 );
+	CHECK( ! widget.sawHighSlotZeroed );
+	
+	frame[RecordingWidget::HIGH_SLOT] = 0;
+	frame[10] = 1;
+	device.publishDmx( frame, sizeof( frame ) );
+	std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+	device.stopOutputThread();
+	
+	CHECK( widget.sawHighSlotZeroed );
+	CHECK( widget.getOutput( 1, output ) == DmxDevice::DMX_SLOTS_MIN + 1 );
+	CHECK( output[10] == 1 );
+	
+	device.close();
+	FtdiEmulator::detachAll();
+	return testResult( "testAdaptiveSlotCount" );
+}
@@ -0,0 +1,123 @@
+/*
+ * Publishes hundreds of universes through the output thread of an Art-Net
+ * device and receives them over the loopback interface: every universe must
+ * arrive with every frame and increasing sequence numbers, in batches of few
+ * system calls. A universe whose packet fails to send must go out on the next
+ * tick without being published again.
+ */
+#include <arpa/inet.h>
+#include <thread>
+#include "DmxArtNetDevice.h"
+#include "DmxNetReceiver.h"
+#include "TestSupport.h"
+
+static const int UNIVERSE_COUNT = 300;
+static const int FIRST_UNIVERSE = 1;
+static const int ROUND_COUNT = 20;
+static const int ROUND_TIME = 50; /* in milliseconds, two ticks at the default rate */
+static const int FAILING_HANDLE = 123;
+
+/* gives access to the destination of a universe to make its packets fail */
+class TestArtNetDevice : public DmxArtNetDevice {
+public:
+	void setUniversePort( int handle, int port )
+	{
+		universes_[handle]->address.sin_port = htons( port );
+	}
+};
+
+struct universeLog {
+	int packetCount;
+	int lastSequence;
+	int sequenceErrorCount;
+	int lastValue;
+};
+
+static void onPacket( const DmxNetDevice::packetInfo* info, uint64_t timestamp, void* userData )
+{
+	universeLog* log = static_cast<universeLog*>( userData ) + ( info->universe - FIRST_UNIVERSE );
+	
+	//Art-Net sequence numbers run from 1 to 255
+	int expected = ( log->lastSequence == 255 ) ? 1 : log->lastSequence + 1;
+	if ( log->packetCount > 0 && info->sequence != expected ) log->sequenceErrorCount++;
+	log->lastSequence = info->sequence;
+	log->lastValue = info->slots[0];
+	log->packetCount++;
+}
+
+static void publishRound( TestArtNetDevice* device, unsigned char value )
+{
+	unsigned char frame[513] = { 0 };
+	frame[1] = value;
+	for ( int h = 0; h < UNIVERSE_COUNT; h++ ) CHECK( device->publishUniverse( h, frame, sizeof( frame ) ) == 0 );
+}
+
+int main()
+{
+	universeLog logs[UNIVERSE_COUNT] = {};
+	
+	DmxNetReceiver receiver( DmxNetReceiver::PROTOCOL_ARTNET );
+	for ( int i = 0; i < UNIVERSE_COUNT; i++ ) CHECK( receiver.addUniverse( FIRST_UNIVERSE + i ) >= 0 );
+	receiver.setPacketCallback( onPacket, logs );
+	CHECK( receiver.start() );
+	
+	TestArtNetDevice device;
+	CHECK( device.open( "127.0.0.1", 0, FIRST_UNIVERSE ) );
+	for ( int i = 1; i < UNIVERSE_COUNT; i++ ) CHECK( device.addUniverse( FIRST_UNIVERSE + i ) == i );
+	device.setKeepAliveInterval( 60000 ); //only new frames are sent
+	CHECK( device.startOutputThread() );
+	
+	for ( int r = 1; r <= ROUND_COUNT; r++ ) {
+		publishRound( &device, r );
+		std::this_thread::sleep_for( std::chrono::milliseconds( ROUND_TIME ) );
+	}
+	device.stopOutputThread();
+	std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+	
+	DmxNetDevice::networkStats net;
+	device.getNetworkStats( &net );
+	int complete = 0, sequenceErrors = 0;
+	for ( int i = 0; i < UNIVERSE_COUNT; i++ ) {
+		if ( logs[i].packetCount == ROUND_COUNT && logs[i].lastValue == ROUND_COUNT ) complete++;
+		sequenceErrors += logs[i].sequenceErrorCount;
+	}
+	int callsPerBatch = ( UNIVERSE_COUNT + DmxNetSocket::BATCH_MAX - 1 ) / DmxNetSocket::BATCH_MAX;
+	std::printf( "%i universes, %i rounds: %i complete, %i sequence errors; %lu packets in %lu batches, "
+							"%lu system calls, %.0f us per batch\n", UNIVERSE_COUNT, ROUND_COUNT, complete, sequenceErrors,
+							net.packetCount, net.batchCount, net.syscallCount, net.meanBatchTime );
+	
+	CHECK( complete == UNIVERSE_COUNT );
+	CHECK( sequenceErrors == 0 );
+	CHECK( net.packetCount == (unsigned long)( UNIVERSE_COUNT * ROUND_COUNT ) );
+	CHECK( net.errorCount == 0 );
+	//every round goes out in one batch, except where publishing overlaps a tick
+	CHECK( net.batchCount >= (unsigned long)ROUND_COUNT && net.batchCount <= (unsigned long)( 2 * ROUND_COUNT ) );
+	CHECK( net.syscallCount <= net.batchCount * callsPerBatch );
+	
+	//a failing packet stays staged and is sent on the next tick
+	universeLog* failing = &logs[FAILING_HANDLE];
+	int before = failing->packetCount;
+	device.setUniversePort( FAILING_HANDLE, 0 );
+	publishRound( &device, ROUND_COUNT + 1 );
+	CHECK( device.startOutputThread() );
+	std::this_thread::sleep_for( std::chrono::milliseconds( ROUND_TIME ) );
+	device.stopOutputThread();
+	std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+	
+	device.getNetworkStats( &net );
+	CHECK( net.errorCount > 0 );
+	CHECK( failing->packetCount == before );
+	CHECK( logs[0].lastValue == ROUND_COUNT + 1 );
+	
+	device.setUniversePort( FAILING_HANDLE, DmxArtNetDevice::PORT );
+	CHECK( device.startOutputThread() );
+	std::this_thread::sleep_for( std::chrono::milliseconds( ROUND_TIME ) );
+	device.stopOutputThread();
+	std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+	CHECK( failing->packetCount == before + 1 );
+	CHECK( failing->lastValue == ROUND_COUNT + 1 );
+	
+	device.close();
+	receiver.stop();
+	return testResult( "testArtNetOutput" );
+}
@@ -0,0 +1,63 @@
+/*
+ * Checks that the output thread writes frames through asynchronous transfers
+ * and that the reported send time is the time the transfer took, not the time
+ * its completion happened to be noticed.
+ */
+#include <cstring>
+#include <thread>
+#include "DmxClock.h"
+#include "DmxUsbProDevice.h"
+#include "FtdiEmulator.h"
+#include "TestSupport.h"
+#include "UsbProEmulator.h"
+
+int main()
+{
+	static const uint64_t WRITE_TIME = 2000000; /* in nanoseconds */
+	
+	UsbProEmulator widget;
+	FtdiEmulator::attach( &widget );
+	
+	DmxUsbProDevice device;
+	CHECK( device.open() );
+	CHECK( device.getDefaultRefreshRate() == 40 );
+	
+	FtdiEmulator::setWriteTiming( WRITE_TIME, 0 );
+	FtdiEmulator::usbStats before;
+	FtdiEmulator::getStats( &before );
+	
+	unsigned char frame[513] = { 0 };
+	device.setKeepAliveInterval( 0 );
+	CHECK( device.startOutputThread() );
+	
+	uint64_t end = DmxClock::now() + 1000000000ULL;
+	for ( int i = 0; DmxClock::now() < end; i++ ) {
+		frame[1 + i % 512] = i;
+		device.publishDmx( frame, sizeof( frame ) );
+		std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
+	}
+	device.stopOutputThread();
+	
+	FtdiEmulator::usbStats after;
+	FtdiEmulator::getStats( &after );
+	DmxDevice::latencyStats latency;
+	device.getOutputLatency( &latency );
+	
+	unsigned char output[513];
+	int length = widget.getOutput( 1, output );
+	
+	std::printf( "frames %lu, async writes %lu, send time mean %.0f us max %.0f us, frame latency mean %.0f us\n",
+							latency.frameCount, after.asyncWriteCount - before.asyncWriteCount,
+							latency.meanSendTime, latency.maxSendTime, latency.meanFrameLatency );
+	
+	CHECK( latency.frameCount >= 35 && latency.frameCount <= 42 );
+	CHECK( after.asyncWriteCount - before.asyncWriteCount == latency.frameCount );
+	CHECK( widget.getFrameCount( 1 ) >= latency.frameCount );
+	CHECK( length == 513 && std::memcmp( output, frame, 513 ) == 0 );
+	//completion is handled as it happens: within a millisecond of the transfer time
+	CHECK( latency.meanSendTime >= WRITE_TIME / 1000.0f && latency.meanSendTime < WRITE_TIME / 1000.0f + 1000 );
+	
+	device.close();
+	FtdiEmulator::detachAll();
+	return testResult( "testAsyncOutput" );
+}
@@ -0,0 +1,73 @@
+/*
+ * Checks auto-tuning of a DMX USB PRO against an emulated chip which rejects
+ * latency timers below 4ms and takes longer to read into larger buffers: the
+ * fastest accepted latency timer and the small read chunk size must be chosen.
+ * Reopening the same widget must apply the remembered settings without any
+ * measuring round trips, while another widget is measured on its first open.
+ */
+#include "DmxUsbProDevice.h"
+#include "FtdiEmulator.h"
+#include "TestSupport.h"
+#include "UsbProEmulator.h"
+
+static const int LATENCY_TIMER_MIN = 4; /* in milliseconds */
+static const uint64_t READ_BUFFER_BYTE_TIME = 2000; /* in nanoseconds */
+static const unsigned long PROBE_COUNT = 2 * 3 * 3; /* read chunk sizes * accepted latency timers * probes */
+
+/* exposes the FTDI settings chosen by auto-tuning */
+class TunedDevice : public DmxUsbProDevice {
+public:
+	int getLatencyTimer() const { return ftdiDevice_->getLatencyTimer(); }
+	int getReadChunkSize() const { return ftdiDevice_->getReadChunkSize(); }
+};
+
+static void checkTuned( const TunedDevice& device )
+{
+	CHECK( device.getLatencyTimer() == LATENCY_TIMER_MIN );
+	CHECK( device.getReadChunkSize() == 512 );
+	//a reply waits for the latency timer, reading into 512 bytes takes only 1ms
+	CHECK( device.getRoundTripTime() >= LATENCY_TIMER_MIN * 1000 &&
+				device.getRoundTripTime() < LATENCY_TIMER_MIN * 1000 + 2000 );
+}
+
+int main()
+{
+	UsbProEmulator widgetA, widgetB;
+	FtdiEmulator::attach( &widgetA );
+	FtdiEmulator::attach( &widgetB );
+	FtdiEmulator::setReadProfile( LATENCY_TIMER_MIN, READ_BUFFER_BYTE_TIME );
+	
+	TunedDevice device;
+	CHECK( device.open( 0, 0, 0 ) );
+	unsigned long firstOpenRequests = widgetA.getRequestCount();
+	std::printf( "first open: latency timer %i ms, read chunk size %i, round trip %.0f us, %lu requests\n",
+							device.getLatencyTimer(), device.getReadChunkSize(), device.getRoundTripTime(), firstOpenRequests );
+	checkTuned( device );
+	CHECK( firstOpenRequests > PROBE_COUNT );
+	unsigned long otherRequests = firstOpenRequests - PROBE_COUNT;
+	
+	//the read chunk size is not kept by the chip, so it must be applied again
+	device.close();
+	CHECK( device.open( 0, 0, 0 ) );
+	std::printf( "reopen: latency timer %i ms, read chunk size %i, %lu requests\n",
+							device.getLatencyTimer(), device.getReadChunkSize(), widgetA.getRequestCount() - firstOpenRequests );
+	checkTuned( device );
+	CHECK( widgetA.getRequestCount() - firstOpenRequests <= otherRequests ); //no probes
+	
+	//measuring again on request
+	unsigned long before = widgetA.getRequestCount();
+	CHECK( device.autoTune() );
+	checkTuned( device );
+	CHECK( widgetA.getRequestCount() - before == PROBE_COUNT );
+	device.close();
+	
+	//another widget has its own settings
+	TunedDevice other;
+	CHECK( other.open( 0, 0, 1 ) );
+	checkTuned( other );
+	CHECK( widgetB.getRequestCount() == firstOpenRequests );
+	other.close();
+	
+	FtdiEmulator::detachAll();
+	return testResult( "testAutoTune" );
+}
@@ -0,0 +1,81 @@
+/*
+ * Checks DmxEngine against several emulated widgets: openAll() opens every one
+ * of them as consecutive universes, writeUniverse() reaches the widget mapped
+ * to the universe and no other, and each universe reports its own latency
+ * numbers while all of them send in parallel.
+ */
+#include <cstring>
+#include <thread>
+#include "DmxEngine.h"
+#include "DmxUsbProDevice.h"
+#include "FtdiEmulator.h"
+#include "TestSupport.h"
+#include "UsbProEmulator.h"
+
+int main()
+{
+	static const int WIDGET_COUNT = 3;
+	static const int FIRST_UNIVERSE = 10;
+	static const float RATE = 40;
+	static const uint64_t WRITE_TIME = 10000000; /* in nanoseconds */
+	
+	UsbProEmulator widgets[WIDGET_COUNT];
+	for ( int i = 0; i < WIDGET_COUNT; i++ ) FtdiEmulator::attach( &widgets[i] );
+	
+	DmxEngine engine;
+	CHECK( engine.openAll( true, FIRST_UNIVERSE ) == WIDGET_COUNT );
+	
+	std::vector<int> universes = engine.getUniverses();
+	CHECK( universes.size() == WIDGET_COUNT );
+	for ( unsigned int i = 0; i < universes.size(); i++ ) {
+		CHECK( universes[i] == FIRST_UNIVERSE + (int)i );
+		CHECK( engine.getDevice( universes[i] ) != 0 );
+		CHECK( engine.getDevice( universes[i] )->isOpen() );
+	}
+	CHECK( engine.getDevice( FIRST_UNIVERSE + WIDGET_COUNT ) == 0 );
+	
+	//a universe in use can not be assigned twice
+	DmxUsbProDevice* spare = new DmxUsbProDevice();
+	CHECK( ! engine.addDevice( FIRST_UNIVERSE, spare ) );
+	delete spare;
+	
+	unsigned char frame[513] = { 0 };
+	CHECK( engine.writeUniverse( FIRST_UNIVERSE - 1, frame, sizeof( frame ) ) == DmxEngine::RV_UNIVERSE_UNKNOWN );
+	for ( int i = 0; i < WIDGET_COUNT; i++ ) {
+		frame[1] = FIRST_UNIVERSE + i;
+		frame[512] = 0x80 | i;
+		CHECK( engine.writeUniverse( FIRST_UNIVERSE + i, frame, sizeof( frame ) ) == 0 );
+		engine.getDevice( FIRST_UNIVERSE + i )->setKeepAliveInterval( 0 );
+	}
+	
+	//one universe sending back to back would take WIDGET_COUNT writes per period
+	FtdiEmulator::setWriteTiming( WRITE_TIME, 0 );
+	CHECK( engine.start( RATE ) );
+	CHECK( engine.isRunning() );
+	std::this_thread::sleep_for( std::chrono::seconds( 1 ) );
+	engine.stop();
+	CHECK( ! engine.isRunning() );
+	
+	for ( int i = 0; i < WIDGET_COUNT; i++ ) {
+		unsigned char output[513];
+		CHECK( widgets[i].getOutput( 1, output ) == 513 );
+		CHECK( output[1] == FIRST_UNIVERSE + i && output[512] == ( 0x80 | i ) );
+		
+		DmxDevice::latencyStats latency;
+		CHECK( engine.getLatency( FIRST_UNIVERSE + i, &latency ) );
+		std::printf( "universe %i: frames %lu, send time mean %.0f us max %.0f us\n",
+								FIRST_UNIVERSE + i, latency.frameCount, latency.meanSendTime, latency.maxSendTime );
+		
+		CHECK( latency.frameCount >= 0.85f * RATE && latency.frameCount <= 1.15f * RATE );
+		CHECK( widgets[i].getFrameCount( 1 ) >= latency.frameCount );
+		//each universe only waits for its own writes
+		CHECK( latency.meanSendTime >= WRITE_TIME / 1000.0f && latency.meanSendTime < 1.5f * WRITE_TIME / 1000.0f );
+	}
+	DmxDevice::latencyStats unused;
+	CHECK( ! engine.getLatency( FIRST_UNIVERSE + WIDGET_COUNT, &unused ) );
+	
+	engine.closeAll();
+	CHECK( engine.getUniverses().empty() );
+	FtdiEmulator::detachAll();
+	return testResult( "testEngine" );
+}
@@ -0,0 +1,105 @@
+/*
+ * Captures frames written to a DmxFrameRing with DmxFrameCapture and reads the
+ * file back: it must start with the magic bytes and hold one record per
+ * captured frame (timestamp, length, data) in order. A burst of frames larger
+ * than the ring between two polls must be counted as lost, with the captured
+ * and lost frames adding up to all frames written.
+ */
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "DmxFrameCapture.h"
+#include "DmxFrameRing.h"
+#include "TestSupport.h"
+
+static const char* PATH = "build/testFrameCapture.dmxcap";
+static const int CAPACITY = 16;
+static const int SLOW_FRAME_COUNT = 40;
+static const int BURST_FRAME_COUNT = 10 * CAPACITY;
+
+/* frame n has n + 1 slots with the value n, and n as timestamp */
+static void writeFrame( DmxFrameRing* ring, int n )
+{
+	DmxFrameBuffer* frame = ring->beginWrite();
+	frame->length = 1 + n % 513;
+	std::memset( frame->data, n & 0xFF, frame->length );
+	frame->timestamp = 1000 + n;
+	ring->commitWrite();
+}
+
+static uint64_t readLe( const unsigned char* p, int length )
+{
+	uint64_t v = 0;
+	for ( int i = length - 1; i >= 0; i-- ) v = ( v << 8 ) | p[i];
+	return v;
+}
+
+int main()
+{
+	DmxFrameRing ring( CAPACITY );
+	writeFrame( &ring, 0 ); //written before the capture starts, so not captured
+	
+	DmxFrameCapture capture;
+	CHECK( capture.start( &ring, PATH ) );
+	CHECK( capture.isRunning() );
+	
+	//slow enough for every frame to be captured
+	int n = 1;
+	for ( ; n <= SLOW_FRAME_COUNT; n++ ) {
+		writeFrame( &ring, n );
+		std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+	}
+	std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+	CHECK( capture.getCapturedFrameCount() == SLOW_FRAME_COUNT );
+	CHECK( capture.getLostFrameCount() == 0 );
+	
+	//a burst overruns the ring before the next poll
+	for ( int i = 0; i < BURST_FRAME_COUNT; i++, n++ ) writeFrame( &ring, n );
+	capture.stop();
+	CHECK( ! capture.isRunning() );
+	
+	unsigned long captured = capture.getCapturedFrameCount(), lost = capture.getLostFrameCount();
+	std::printf( "%i frames written: %lu captured, %lu lost\n", SLOW_FRAME_COUNT + BURST_FRAME_COUNT, captured, lost );
+	CHECK( lost >= (unsigned long)( BURST_FRAME_COUNT - CAPACITY ) );
+	CHECK( captured + lost == (unsigned long)( SLOW_FRAME_COUNT + BURST_FRAME_COUNT ) );
+	
+	//read the file back
+	FILE* file = fopen( PATH, "rb" );
+	CHECK( file != 0 );
+	if ( file == 0 ) return testResult( "testFrameCapture" );
+	
+	char magic[8];
+	CHECK( fread( magic, 1, sizeof( magic ), file ) == sizeof( magic ) );
+	CHECK( std::memcmp( magic, "DMXCAP01", sizeof( magic ) ) == 0 );
+	
+	unsigned long records = 0, bad = 0;
+	int last = 0;
+	unsigned char header[10];
+	std::vector<unsigned char> data;
+	while ( fread( header, 1, sizeof( header ), file ) == sizeof( header ) ) {
+		int frameNumber = (int)( readLe( header, 8 ) - 1000 );
+		int length = (int)readLe( header + 8, 2 );
+		data.resize( length );
+		if ( length > 0 && fread( &data[0], 1, length, file ) != (size_t)length ) {
+			bad++;
+			break;
+		}
+		
+		//records are in order, the slow part without gaps
+		bool ok = ( frameNumber > last ) && ( frameNumber > SLOW_FRAME_COUNT || frameNumber == last + 1 );
+		ok = ok && ( length == 1 + frameNumber % 513 );
+		for ( int i = 0; ok && i < length; i++ ) ok = ( data[i] == ( frameNumber & 0xFF ) );
+		if ( ! ok ) bad++;
+		last = frameNumber;
+		records++;
+	}
+	fclose( file );
+	std::remove( PATH );
+	
+	CHECK( records == captured );
+	CHECK( bad == 0 );
+	CHECK( last == n - 1 ); //the newest frames are always captured
+	
+	return testResult( "testFrameCapture" );
+}
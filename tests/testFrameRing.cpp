@@ -0,0 +1,88 @@
+/*
+ * Checks DmxFrameRing: the history of the last frames can be read by sequence
+ * number, frames overwritten after the ring has wrapped are reported as such
+ * instead of being returned, and a reader racing the writer never gets a torn
+ * frame.
+ */
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include "DmxFrameRing.h"
+#include "TestSupport.h"
+
+static const int CAPACITY = 8;
+static const int FRAME_LENGTH = 513;
+
+/* fill the next frame with its sequence number */
+static void writeFrame( DmxFrameRing* ring )
+{
+	uint64_t sequence = ring->getWriteCount();
+	DmxFrameBuffer* frame = ring->beginWrite();
+	std::memset( frame->data, sequence & 0xFF, FRAME_LENGTH );
+	frame->length = FRAME_LENGTH;
+	frame->timestamp = sequence;
+	ring->commitWrite();
+}
+
+/* Returns: true if the frame is complete and matches its sequence number. */
+static bool isFrame( const DmxFrameBuffer* frame, uint64_t sequence )
+{
+	if ( frame->length != FRAME_LENGTH || frame->timestamp != sequence ) return false;
+	for ( int i = 0; i < FRAME_LENGTH; i++ ) {
+		if ( frame->data[i] != ( sequence & 0xFF ) ) return false;
+	}
+	return true;
+}
+
+static void writeFrames( DmxFrameRing* ring, std::atomic<bool>* running )
+{
+	while ( *running ) writeFrame( ring );
+}
+
+int main()
+{
+	DmxFrameRing ring( CAPACITY - 1 ); //rounded up to a power of two
+	DmxFrameBuffer frame;
+	uint64_t sequence;
+	
+	CHECK( ring.getCapacity() == CAPACITY );
+	CHECK( ! ring.readLatest( &frame ) );
+	CHECK( ! ring.read( 0, &frame ) );
+	
+	//history: every frame written so far can be read back
+	for ( int i = 0; i < CAPACITY; i++ ) writeFrame( &ring );
+	CHECK( ring.getWriteCount() == CAPACITY );
+	for ( int i = 0; i < CAPACITY; i++ ) CHECK( ring.read( i, &frame ) && isFrame( &frame, i ) );
+	CHECK( ring.readLatest( &frame, &sequence ) && sequence == CAPACITY - 1 && isFrame( &frame, sequence ) );
+	CHECK( ! ring.read( CAPACITY, &frame ) );
+	
+	//after wrapping, the overwritten frames are gone and the newer ones readable
+	for ( int i = 0; i < CAPACITY + 3; i++ ) writeFrame( &ring );
+	uint64_t count = ring.getWriteCount();
+	for ( uint64_t s = 0; s < count - CAPACITY; s++ ) CHECK( ! ring.read( s, &frame ) );
+	for ( uint64_t s = count - CAPACITY; s < count; s++ ) CHECK( ring.read( s, &frame ) && isFrame( &frame, s ) );
+	CHECK( ring.readLatest( &frame, &sequence ) && sequence == count - 1 && isFrame( &frame, sequence ) );
+	
+	//a reader racing the writer gets complete frames or fails, never a mix of two
+	std::atomic<bool> running( true );
+	std::thread writer( writeFrames, &ring, &running );
+	int readCount = 0, failCount = 0, tornCount = 0;
+	for ( int i = 0; i < 200000; i++ ) {
+		uint64_t latest = ring.getWriteCount();
+		uint64_t s = ( latest > CAPACITY ) ? latest - CAPACITY + i % CAPACITY : 0;
+		if ( ! ring.read( s, &frame ) ) {
+			failCount++;
+			continue;
+		}
+		readCount++;
+		if ( ! isFrame( &frame, s ) ) tornCount++;
+	}
+	running = false;
+	writer.join();
+	
+	std::printf( "racing reads: %i complete, %i overwritten, %i torn\n", readCount, failCount, tornCount );
+	CHECK( readCount > 0 );
+	CHECK( tornCount == 0 );
+	
+	return testResult( "testFrameRing" );
+}
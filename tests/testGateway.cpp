@@ -0,0 +1,137 @@
+/*
+ * Checks DmxNetGateway routes against an emulated DMX USB PRO. Output: Art-Net
+ * frames sent over loopback reach the widget within the 1 ms latency target
+ * (99th percentile) for the emulated USB timing, and a slow USB write does not
+ * hold up the receiver storing frames of other universes. Input: frames
+ * received by the widget are sent to their network universe and arrive back
+ * at the receiver.
+ */
+#include <thread>
+#include "DmxArtNetDevice.h"
+#include "DmxClock.h"
+#include "DmxNetGateway.h"
+#include "DmxNetReceiver.h"
+#include "DmxUsbProDevice.h"
+#include "FtdiEmulator.h"
+#include "TestSupport.h"
+#include "UsbProEmulator.h"
+
+static const int ROUTED_UNIVERSE = 1;
+static const int OTHER_UNIVERSE = 2;
+static const int INPUT_UNIVERSE = 3;
+static const int INPUT_FRAME_COUNT = 100;
+static const float LATENCY_TARGET = 1000; /* 99th percentile, in microseconds */
+static const int LATENCY_ROUND_MAX = 3;
+static const int FRAME_COUNT = 500;
+static const uint64_t SLOW_WRITE_TIME = 20000000; /* in nanoseconds */
+static const uint64_t STORE_TIME_MAX = 5000000; /* in nanoseconds */
+
+/* Returns: the time until the receiver has stored the frame, in nanoseconds. */
+static uint64_t waitForFrame( const DmxNetReceiver* receiver, int universe, unsigned char value, uint64_t start )
+{
+	DmxFrameBuffer frame;
+	while ( ! receiver->readUniverse( universe, &frame ) || frame.data[1] != value ) {
+		if ( DmxClock::now() - start > 1000000000 ) break;
+		std::this_thread::yield();
+	}
+	return DmxClock::now() - start;
+}
+
+int main()
+{
+	UsbProEmulator widget;
+	FtdiEmulator::attach( &widget );
+	
+	DmxUsbProDevice device;
+	CHECK( device.open() );
+	
+	DmxNetReceiver receiver( DmxNetReceiver::PROTOCOL_ARTNET );
+	CHECK( receiver.addUniverse( OTHER_UNIVERSE ) == 0 );
+	CHECK( receiver.addUniverse( INPUT_UNIVERSE ) == 0 );
+	
+	DmxArtNetDevice routed, other, input;
+	CHECK( routed.open( "127.0.0.1", 0, ROUTED_UNIVERSE ) );
+	CHECK( other.open( "127.0.0.1", 0, OTHER_UNIVERSE ) );
+	CHECK( input.open( "127.0.0.1", 0, INPUT_UNIVERSE ) );
+	
+	DmxNetGateway gateway( &receiver );
+	CHECK( gateway.addOutputRoute( ROUTED_UNIVERSE, &device, 1 ) == 0 );
+	CHECK( gateway.addInputRoute( &device, 1, &input ) == 0 );
+	CHECK( gateway.start() );
+	
+	unsigned char frame[513] = { 0 };
+	unsigned char output[513];
+	
+	//default emulated timing: 125 us per transfer plus 1 us per byte; since other work on
+	//the host can delay a whole run of frames, the best of a few rounds is held to the target
+	DmxNetGateway::latencyStats stats;
+	float p99Best = -1;
+	for ( int round = 0; round < LATENCY_ROUND_MAX && ( p99Best < 0 || p99Best >= LATENCY_TARGET ); round++ ) {
+		gateway.resetStats();
+		for ( int i = 0; i < FRAME_COUNT; i++ ) {
+			frame[1] = i;
+			CHECK( routed.writeDmx( frame, sizeof( frame ) ) == 0 );
+			std::this_thread::sleep_for( std::chrono::milliseconds( 2 ) );
+		}
+		std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+		
+		gateway.getOutputLatency( &stats );
+		std::printf( "network to emulated USB: %lu frames, mean %.0f us, p50 %.0f us, p99 %.0f us, max %.0f us\n",
+								 stats.frameCount, stats.meanLatency, stats.p50Latency, stats.p99Latency, stats.maxLatency );
+		CHECK( stats.frameCount > 0 && stats.errorCount == 0 );
+		if ( p99Best < 0 || stats.p99Latency < p99Best ) p99Best = stats.p99Latency;
+	}
+	CHECK( p99Best < LATENCY_TARGET );
+	CHECK( widget.getOutput( 1, output ) == 513 );
+	CHECK( output[1] == (unsigned char)( FRAME_COUNT - 1 ) );
+	
+	//input: every frame received by the widget goes out to the network universe
+	int inputLost = 0;
+	for ( int i = 0; i < INPUT_FRAME_COUNT; i++ ) {
+		frame[1] = i;
+		frame[512] = 255 - i;
+		uint64_t start = DmxClock::now();
+		CHECK( widget.sendDmxInput( 1, frame, sizeof( frame ) ) );
+		waitForFrame( &receiver, INPUT_UNIVERSE, frame[1], start );
+		
+		DmxFrameBuffer received;
+		bool ok = receiver.readUniverse( INPUT_UNIVERSE, &received );
+		if ( ! ok || received.length != 513 || received.data[1] != frame[1] || received.data[512] != frame[512] ) inputLost++;
+	}
+	std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) ); //the last latency is recorded after sending
+	gateway.getInputLatency( &stats );
+	std::printf( "emulated USB to network: %lu frames, mean %.0f us, p50 %.0f us, p99 %.0f us, max %.0f us\n",
+							 stats.frameCount, stats.meanLatency, stats.p50Latency, stats.p99Latency, stats.maxLatency );
+	CHECK( inputLost == 0 );
+	CHECK( stats.frameCount == INPUT_FRAME_COUNT && stats.errorCount == 0 );
+	CHECK( stats.p99Latency < LATENCY_TARGET );
+	
+	//slow writes: frames of the other universe must still be stored right away
+	FtdiEmulator::setWriteTiming( SLOW_WRITE_TIME, 0 );
+	uint64_t storeTimeMax = 0;
+	for ( int i = 0; i < 20; i++ ) {
+		frame[1] = 100 + i;
+		CHECK( routed.writeDmx( frame, sizeof( frame ) ) == 0 );
+		std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+		
+		uint64_t start = DmxClock::now();
+		CHECK( other.writeDmx( frame, sizeof( frame ) ) == 0 );
+		uint64_t storeTime = waitForFrame( &receiver, OTHER_UNIVERSE, frame[1], start );
+		if ( storeTime > storeTimeMax ) storeTimeMax = storeTime;
+	}
+	std::printf( "with %.0f ms USB writes, other universe stored within %.2f ms\n",
+							 SLOW_WRITE_TIME / 1e6, storeTimeMax / 1e6 );
+	CHECK( storeTimeMax < STORE_TIME_MAX );
+	
+	std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+	CHECK( widget.getOutput( 1, output ) == 513 );
+	CHECK( output[1] == 119 );
+	
+	gateway.stop();
+	routed.close();
+	other.close();
+	input.close();
+	device.close();
+	FtdiEmulator::detachAll();
+	return testResult( "testGateway" );
+}
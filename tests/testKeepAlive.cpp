@@ -0,0 +1,117 @@
+/*
+ * Checks the suppression of unchanged frames by the output thread: a DMX USB
+ * PRO, which refreshes the line itself, only gets sent a frame published over
+ * and over again once per keep-alive interval, while a changed frame goes out
+ * at once. A raw device gets sent every frame regardless of the interval, as
+ * it is the one refreshing the line.
+ */
+#include <thread>
+#include "DmxClock.h"
+#include "DmxRawDevice.h"
+#include "DmxUsbProDevice.h"
+#include "FtdiEmulator.h"
+#include "TestSupport.h"
+#include "UsbProEmulator.h"
+
+static const float RATE = 40;
+static const int KEEP_ALIVE_INTERVAL = 300; /* in milliseconds */
+static const int PUBLISH_INTERVAL = 5; /* in milliseconds */
+
+class LineSink : public EmulatedDevice {
+public:
+	void receive( const unsigned char* data, int length ) { /* empty */ }
+};
+
+/* publish the same frame until the given time since start (see DmxClock) */
+static void publishUntil( DmxDevice& device, const unsigned char* frame, uint64_t start, int milliseconds )
+{
+	while ( DmxClock::now() < start + milliseconds * 1000000ULL ) {
+		device.publishDmx( frame, 513 );
+		std::this_thread::sleep_for( std::chrono::milliseconds( PUBLISH_INTERVAL ) );
+	}
+}
+
+static void checkUsbPro()
+{
+	UsbProEmulator widget;
+	FtdiEmulator::attach( &widget );
+	
+	DmxUsbProDevice device;
+	CHECK( device.open() );
+	device.setOutputRate( RATE );
+	device.setKeepAliveInterval( KEEP_ALIVE_INTERVAL );
+	
+	unsigned char frame[513] = { 0 };
+	frame[1] = 1;
+	device.publishDmx( frame, sizeof( frame ) );
+	uint64_t start = DmxClock::now();
+	CHECK( device.startOutputThread() );
+	
+	//within the first interval only the first frame goes out
+	publishUntil( device, frame, start, KEEP_ALIVE_INTERVAL * 2 / 3 );
+	unsigned long sentEarly = device.getSentFrameCount();
+	unsigned long suppressedEarly = device.getSuppressedFrameCount();
+	publishUntil( device, frame, start, KEEP_ALIVE_INTERVAL - 50 );
+	unsigned long sentBeforeExpiry = device.getSentFrameCount();
+	unsigned long suppressedBeforeExpiry = device.getSuppressedFrameCount();
+	
+	//once it has expired, the unchanged frame is sent once more
+	publishUntil( device, frame, start, KEEP_ALIVE_INTERVAL + 100 );
+	unsigned long sentAfterExpiry = device.getSentFrameCount();
+	
+	//a changed frame does not wait for the interval
+	frame[1] = 2;
+	device.publishDmx( frame, sizeof( frame ) );
+	std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+	unsigned long sentAfterChange = device.getSentFrameCount();
+	unsigned char output[513];
+	CHECK( widget.getOutput( 1, output ) == 513 && output[1] == 2 );
+	
+	device.stopOutputThread();
+	std::printf( "usb pro: sent %lu/%lu/%lu/%lu, suppressed %lu/%lu\n", sentEarly, sentBeforeExpiry,
+							sentAfterExpiry, sentAfterChange, suppressedEarly, suppressedBeforeExpiry );
+	
+	CHECK( sentEarly == 1 );
+	CHECK( sentBeforeExpiry == 1 );
+	CHECK( suppressedBeforeExpiry > suppressedEarly && suppressedEarly > 0 );
+	CHECK( suppressedBeforeExpiry >= 0.8f * RATE * ( KEEP_ALIVE_INTERVAL - 50 ) / 1000 - 1 );
+	CHECK( sentAfterExpiry == 2 );
+	CHECK( sentAfterChange == 3 );
+	CHECK( widget.getFrameCount( 1 ) == sentAfterChange );
+	
+	device.close();
+	FtdiEmulator::detachAll();
+}
+
+static void checkRaw()
+{
+	LineSink sink;
+	FtdiEmulator::attach( &sink );
+	
+	DmxRawDevice device;
+	CHECK( device.open() );
+	device.setOutputRate( RATE );
+	device.setKeepAliveInterval( KEEP_ALIVE_INTERVAL );
+	
+	unsigned char frame[513] = { 0 };
+	frame[1] = 1;
+	device.publishDmx( frame, sizeof( frame ) );
+	uint64_t start = DmxClock::now();
+	CHECK( device.startOutputThread() );
+	publishUntil( device, frame, start, 1000 );
+	device.stopOutputThread();
+	
+	std::printf( "raw: sent %lu, suppressed %lu\n", device.getSentFrameCount(), device.getSuppressedFrameCount() );
+	CHECK( device.getSuppressedFrameCount() == 0 );
+	CHECK( device.getSentFrameCount() >= 0.9f * RATE );
+	
+	device.close();
+	FtdiEmulator::detachAll();
+}
+
+int main()
+{
+	checkUsbPro();
+	checkRaw();
+	return testResult( "testKeepAlive" );
+}
@@ -0,0 +1,49 @@
+/*
+ * Checks that the DMX rate reported by DmxUsbProDevice::getLineStats() is the
+ * rate at which frames were actually sent, also when USB writes take longer
+ * than the frame period.
+ */
+#include <thread>
+#include "DmxUsbProDevice.h"
+#include "FtdiEmulator.h"
+#include "TestSupport.h"
+#include "UsbProEmulator.h"
+
+static float measureRate( DmxUsbProDevice* device )
+{
+	unsigned char frame[513] = { 0 };
+	device->publishDmx( frame, sizeof( frame ) );
+	CHECK( device->startOutputThread() );
+	std::this_thread::sleep_for( std::chrono::milliseconds( 1000 ) );
+	
+	DmxUsbProDevice::lineStats stats;
+	device->getLineStats( &stats );
+	device->stopOutputThread();
+	return stats.dmxRate;
+}
+
+int main()
+{
+	UsbProEmulator widget;
+	FtdiEmulator::attach( &widget );
+	
+	DmxUsbProDevice device;
+	CHECK( device.open() );
+	device.setKeepAliveInterval( 0 );
+	device.setOutputRate( 40 );
+	
+	FtdiEmulator::setWriteTiming( 1000000, 0 );
+	float fastRate = measureRate( &device );
+	
+	//writes of 50ms allow 20 frames per second at most (fewer, since frames start on 25ms ticks)
+	FtdiEmulator::setWriteTiming( 50000000, 0 );
+	float slowRate = measureRate( &device );
+	
+	std::printf( "achieved DMX rate at 40Hz: %.1f Hz with 1ms writes, %.1f Hz with 50ms writes\n", fastRate, slowRate );
+	CHECK( fastRate > 36 && fastRate < 42 );
+	CHECK( slowRate > 10 && slowRate < 21 );
+	
+	device.close();
+	FtdiEmulator::detachAll();
+	return testResult( "testLineStats" );
+}
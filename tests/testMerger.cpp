@@ -0,0 +1,104 @@
+/*
+ * Checks the merge kernels selected for this CPU against a plain reference for
+ * random data and lengths, and the HTP/LTP semantics of DmxMerger.
+ */
+#include <cstdlib>
+#include <cstring>
+#include "DmxKernels.h"
+#include "DmxMerger.h"
+#include "TestSupport.h"
+
+static const int BUFFER_LENGTH = 544;
+static const int SOURCE_COUNT = 8;
+static const int ROUND_COUNT = 2000;
+
+/* Returns: the number of bytes differing from the reference. */
+static int checkKernels()
+{
+	unsigned char sources[SOURCE_COUNT][BUFFER_LENGTH];
+	unsigned char ltp[BUFFER_LENGTH], ltpMask[BUFFER_LENGTH], out[BUFFER_LENGTH];
+	unsigned char current[BUFFER_LENGTH], data[BUFFER_LENGTH];
+	unsigned char expectedLtp[BUFFER_LENGTH], previous[BUFFER_LENGTH];
+	const unsigned char* active[SOURCE_COUNT];
+	int mismatches = 0;
+	
+	for ( int round = 0; round < ROUND_COUNT; round++ ) {
+		int count = 1 + std::rand() % SOURCE_COUNT;
+		int length = std::rand() % ( BUFFER_LENGTH + 1 );
+		for ( int s = 0; s < count; s++ ) {
+			for ( int i = 0; i < BUFFER_LENGTH; i++ ) sources[s][i] = std::rand();
+			active[s] = sources[s];
+		}
+		for ( int i = 0; i < BUFFER_LENGTH; i++ ) {
+			ltp[i] = std::rand();
+			ltpMask[i] = ( std::rand() & 1 ) ? 0xFF : 0;
+		}
+		
+		//bytes beyond the length must not be touched
+		std::memset( out, 0xAA, sizeof( out ) );
+		DmxKernels::mergeHtpLtp( out, active, count, ltp, ltpMask, length );
+		for ( int i = 0; i < BUFFER_LENGTH; i++ ) {
+			unsigned char expected = 0xAA;
+			if ( i < length ) {
+				expected = 0;
+				for ( int s = 0; s < count; s++ ) if ( sources[s][i] > expected ) expected = sources[s][i];
+				if ( ltpMask[i] ) expected = ltp[i];
+			}
+			if ( out[i] != expected ) mismatches++;
+		}
+		
+		//few values, so some bytes change and some do not
+		for ( int i = 0; i < BUFFER_LENGTH; i++ ) {
+			current[i] = std::rand() & 3;
+			data[i] = std::rand() & 3;
+		}
+		std::memcpy( expectedLtp, ltp, sizeof( ltp ) );
+		std::memcpy( previous, current, sizeof( current ) );
+		DmxKernels::updateLtp( ltp, current, data, length );
+		for ( int i = 0; i < BUFFER_LENGTH; i++ ) {
+			if ( i < length && data[i] != previous[i] ) expectedLtp[i] = data[i];
+			unsigned char expectedCurrent = ( i < length ) ? data[i] : previous[i];
+			if ( ltp[i] != expectedLtp[i] || current[i] != expectedCurrent ) mismatches++;
+		}
+	}
+	
+	return mismatches;
+}
+
+int main()
+{
+	std::srand( 1 );
+	std::printf( "merge kernel: %s\n", DmxKernels::getMergeKernelName() );
+	CHECK( checkKernels() == 0 );
+	
+	DmxMerger merger( 2 );
+	CHECK( merger.setMode( 10, 19, DmxMerger::MERGE_LTP ) == 0 );
+	unsigned char a[513] = { 0 }, b[513] = { 0 };
+	DmxFrameBuffer frame;
+	
+	a[1] = 100;
+	b[1] = 50;
+	a[10] = 200;
+	CHECK( merger.publishSource( 0, a, sizeof( a ), 1000 ) == 0 );
+	CHECK( merger.merge( &frame ) == 513 );
+	b[10] = 30;
+	CHECK( merger.publishSource( 1, b, sizeof( b ), 2000 ) == 0 );
+	CHECK( merger.merge( &frame ) == 513 );
+	CHECK( frame.data[1] == 100 ); /* HTP: highest */
+	CHECK( frame.data[10] == 30 ); /* LTP: latest change */
+	
+	a[1] = 10;
+	a[10] = 201;
+	CHECK( merger.publishSource( 0, a, sizeof( a ), 3000 ) == 0 );
+	merger.merge( &frame );
+	CHECK( frame.data[1] == 50 );
+	CHECK( frame.data[10] == 201 );
+	
+	//a released source no longer counts for HTP, LTP slots keep their value
+	CHECK( merger.releaseSource( 1 ) == 0 );
+	merger.merge( &frame );
+	CHECK( frame.data[1] == 10 );
+	CHECK( frame.data[10] == 201 );
+	
+	return testResult( "testMerger" );
+}
@@ -0,0 +1,61 @@
+/*
+ * Checks that a receiver with several shards decodes every broadcast packet
+ * once, although Linux delivers a copy to each SO_REUSEPORT socket, and that
+ * unicast packets still reach it.
+ */
+#include <thread>
+#include "DmxArtNetDevice.h"
+#include "DmxNetReceiver.h"
+#include "TestSupport.h"
+
+static const int SHARD_COUNT = 4;
+static const int UNIVERSE = 1;
+static const int FRAME_COUNT = 50;
+
+/* write frames with a counting first slot, spaced so none are dropped */
+static void sendFrames( const char* host, unsigned char* frame, int* value )
+{
+	DmxArtNetDevice device;
+	CHECK( device.open( host, 0, UNIVERSE ) );
+	
+	for ( int i = 0; i < FRAME_COUNT; i++ ) {
+		frame[1] = ++*value;
+		CHECK( device.writeDmx( frame, 513 ) == 0 );
+		std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+	}
+	device.close();
+}
+
+int main()
+{
+	DmxNetReceiver receiver( DmxNetReceiver::PROTOCOL_ARTNET );
+	CHECK( receiver.addUniverse( UNIVERSE ) == 0 );
+	CHECK( receiver.start( SHARD_COUNT ) );
+	
+	unsigned char frame[513] = { 0 };
+	DmxFrameBuffer received;
+	int value = 0;
+	
+	sendFrames( "127.255.255.255", frame, &value );
+	std::this_thread::sleep_for( std::chrono::milliseconds( 200 ) );
+	
+	DmxNetReceiver::receiverStats stats;
+	receiver.getStats( &stats );
+	CHECK( stats.frameCount == FRAME_COUNT );
+	CHECK( stats.outOfOrderCount == 0 );
+	CHECK( stats.duplicateCount == ( SHARD_COUNT - 1 ) * FRAME_COUNT );
+	CHECK( receiver.readUniverse( UNIVERSE, &received ) );
+	CHECK( received.data[1] == value );
+	
+	sendFrames( "127.0.0.1", frame, &value );
+	std::this_thread::sleep_for( std::chrono::milliseconds( 200 ) );
+	
+	receiver.getStats( &stats );
+	CHECK( stats.frameCount == 2 * FRAME_COUNT );
+	CHECK( stats.duplicateCount == ( SHARD_COUNT - 1 ) * FRAME_COUNT );
+	CHECK( receiver.readUniverse( UNIVERSE, &received ) );
+	CHECK( received.data[1] == value );
+	
+	receiver.stop();
+	return testResult( "testNetReceiver" );
+}
@@ -0,0 +1,70 @@
+/*
+ * Checks the refresh rate of a raw device on an emulated FT232R with a timed
+ * serial line: in bit-bang mode (the default), every frame is a single write
+ * without control requests and full universes reach the default refresh rate;
+ * in UART mode, the two break requests per frame never truncate the previous
+ * frame and the lower default rate is still reached.
+ */
+#include <thread>
+#include "DmxRawDevice.h"
+#include "FtdiEmulator.h"
+#include "TestSupport.h"
+
+class LineSink : public EmulatedDevice {
+public:
+	void receive( const unsigned char* data, int length ) { /* empty */ }
+};
+
+static void measure( DmxRawDevice& device, const char* mode )
+{
+	unsigned char frame[513] = { 0 };
+	device.setKeepAliveInterval( 0 ); //send every frame, even if unchanged
+	device.publishDmx( frame, sizeof( frame ) );
+	
+	FtdiEmulator::usbStats before, after;
+	FtdiEmulator::getStats( &before );
+	
+	CHECK( device.startOutputThread() );
+	std::this_thread::sleep_for( std::chrono::seconds( 1 ) );
+	device.stopOutputThread();
+	
+	FtdiEmulator::getStats( &after );
+	unsigned long frames = device.getSentFrameCount(); //counted from the thread start
+	float rate = device.getSentFrameRate();
+	float writesPerFrame = frames > 0 ? (float)( after.writeCount - before.writeCount ) / frames : 0;
+	float requestsPerFrame = frames > 0 ? (float)( after.controlCount - before.controlCount ) / frames : 0;
+	std::printf( "%s: %.2f frames/s (default %.2f), %.2f writes and %.2f control requests per frame\n",
+							mode, rate, device.getDefaultRefreshRate(), writesPerFrame, requestsPerFrame );
+	
+	CHECK( frames > 0 );
+	CHECK( rate >= 0.9f * device.getDefaultRefreshRate() );
+	CHECK( writesPerFrame == 1 );
+	CHECK( after.breakWhileSendingCount == before.breakWhileSendingCount );
+	
+	if ( device.getOutputMode() == DmxRawDevice::OUTPUT_MODE_BITBANG ) {
+		CHECK( requestsPerFrame == 0 );
+	} else {
+		CHECK( requestsPerFrame == 2 );
+	}
+}
+
+int main()
+{
+	LineSink sink;
+	FtdiEmulator::attach( &sink );
+	FtdiEmulator::setLineTiming( true );
+	
+	DmxRawDevice device;
+	CHECK( device.open() );
+	CHECK( device.getOutputMode() == DmxRawDevice::OUTPUT_MODE_BITBANG );
+	CHECK( device.getDefaultRefreshRate() == DmxRawDevice::OUTPUT_RATE_MAX );
+	measure( device, "bit-bang" );
+	
+	CHECK( device.setOutputMode( DmxRawDevice::OUTPUT_MODE_UART ) );
+	CHECK( device.getDefaultRefreshRate() < DmxRawDevice::OUTPUT_RATE_MAX );
+	measure( device, "uart" );
+	
+	device.close();
+	FtdiEmulator::detachAll();
+	return testResult( "testRawDevice" );
+}
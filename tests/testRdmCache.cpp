@@ -0,0 +1,137 @@
+/*
+ * Checks how DmxRdmCache collects deferred and long replies from a simulated
+ * responder: ACK_TIMER replies are collected with GET QUEUED_MESSAGE, and
+ * responders which keep sending ACK_OVERFLOW or ACK_TIMER are given up on.
+ * Requests with too much parameter data are rejected before being queued.
+ */
+#include <vector>
+#include "DmxClock.h"
+#include "DmxRdm.h"
+#include "DmxRdmCache.h"
+#include "TestSupport.h"
+
+static const uint64_t UID_TIMER = 0x10;				/* ACK_TIMER, then the reply via QUEUED_MESSAGE */
+static const uint64_t UID_OVERFLOW = 0x11;		/* ACK_OVERFLOW forever */
+static const uint64_t UID_TIMER_LOOP = 0x12;	/* ACK_TIMER forever */
+
+class SimulatedResponders : public DmxRdmTransport {
+public:
+	SimulatedResponders() : requestCount( 0 ), queuedRequestCount( 0 ) {}
+	
+	int sendRdm( const unsigned char* request, int length, TRANSACTION_TYPE type,
+							unsigned char* response, int maxLength )
+	{
+		DmxRdm::message msg;
+		if ( DmxRdm::parsePacket( request, length, &msg ) != 0 ) return -1;
+		requestCount++;
+		
+		DmxRdm::message reply = msg;
+		reply.source = msg.destination;
+		reply.destination = msg.source;
+		reply.commandClass = DmxRdm::GET_COMMAND_RESPONSE;
+		reply.portId = DmxRdm::RESPONSE_TYPE_ACK;
+		reply.dataLength = 0;
+		
+		if ( msg.pid == DmxRdm::PID_QUEUED_MESSAGE ) queuedRequestCount++;
+		
+		if ( msg.destination == UID_TIMER ) {
+			if ( msg.pid == DmxRdm::PID_DEVICE_LABEL ) {
+				setTimer( &reply );
+			} else if ( queuedRequestCount == 1 ) {
+				reply.pid = DmxRdm::PID_STATUS_MESSAGES; //nothing queued yet
+			} else {
+				reply.pid = DmxRdm::PID_DEVICE_LABEL;
+				reply.dataLength = 5;
+				for ( int i = 0; i < 5; i++ ) reply.data[i] = "label"[i];
+			}
+		} else if ( msg.destination == UID_OVERFLOW ) {
+			reply.portId = DmxRdm::RESPONSE_TYPE_ACK_OVERFLOW;
+			reply.dataLength = DmxRdm::DATA_MAX_LENGTH;
+		} else if ( msg.destination == UID_TIMER_LOOP ) {
+			reply.pid = DmxRdm::PID_DEVICE_INFO; //the queued message is another ACK_TIMER
+			setTimer( &reply );
+		}
+		
+		return DmxRdm::buildPacket( &reply, response );
+	}
+	
+	int requestCount;
+	int queuedRequestCount;
+
+private:
+	static void setTimer( DmxRdm::message* reply )
+	{
+		reply->portId = DmxRdm::RESPONSE_TYPE_ACK_TIMER;
+		reply->dataLength = 2;
+		reply->data[0] = reply->data[1] = 0; //ready right away
+	}
+};
+
+struct result {
+	int code;
+	std::vector<unsigned char> data;
+	bool done;
+};
+
+static void onReply( uint64_t uid, unsigned int pid, int code, const unsigned char* data, int length, void* userData )
+{
+	result* r = static_cast<result*>( userData );
+	r->code = code;
+	r->data.assign( data, data + length );
+	r->done = true;
+}
+
+static void processUntilDone( DmxRdmCache* cache, const result* r )
+{
+	uint64_t end = DmxClock::now() + 2000000000ULL;
+	while ( ! r->done && DmxClock::now() < end ) cache->process();
+}
+
+int main()
+{
+	SimulatedResponders responders;
+	DmxRdmCache cache( &responders, 0x454E00000001ULL );
+	
+	result timer = { 0, std::vector<unsigned char>(), false };
+	cache.get( UID_TIMER, DmxRdm::PID_DEVICE_LABEL, onReply, &timer );
+	processUntilDone( &cache, &timer );
+	std::printf( "ACK_TIMER: result %i after %i requests (%i QUEUED_MESSAGE)\n",
+							timer.code, responders.requestCount, responders.queuedRequestCount );
+	CHECK( timer.done && timer.code == 0 );
+	CHECK( timer.data.size() == 5 && timer.data[0] == 'l' );
+	CHECK( responders.queuedRequestCount == 2 );
+	CHECK( cache.get( UID_TIMER, DmxRdm::PID_DEVICE_LABEL, 0 ) );
+	
+	result overflow = { 0, std::vector<unsigned char>(), false };
+	responders.requestCount = 0;
+	cache.get( UID_OVERFLOW, DmxRdm::PID_SUPPORTED_PARAMETERS, onReply, &overflow );
+	processUntilDone( &cache, &overflow );
+	std::printf( "endless ACK_OVERFLOW: result %i after %i requests\n", overflow.code, responders.requestCount );
+	CHECK( overflow.done && overflow.code == DmxRdmCache::RV_RESPONSE_TOO_LONG );
+	
+	result loop = { 0, std::vector<unsigned char>(), false };
+	responders.requestCount = 0;
+	cache.get( UID_TIMER_LOOP, DmxRdm::PID_DEVICE_INFO, onReply, &loop );
+	processUntilDone( &cache, &loop );
+	std::printf( "endless ACK_TIMER: result %i after %i requests\n", loop.code, responders.requestCount );
+	CHECK( loop.done && loop.code == DmxRdmCache::RV_TOO_MANY_ROUND_TRIPS );
+	CHECK( cache.getQueueLength() == 0 );
+	
+	//parameter data which does not fit in a request is rejected without queueing
+	unsigned char tooLong[DmxRdm::DATA_MAX_LENGTH + 1] = { 0 };
+	result rejected = { 0, std::vector<unsigned char>(), false };
+	responders.requestCount = 0;
+	CHECK( cache.get( UID_TIMER, DmxRdm::PID_DEVICE_LABEL, tooLong, sizeof( tooLong ), onReply, &rejected ) );
+	CHECK( rejected.done && rejected.code == DmxRdmCache::RV_REQUEST_TOO_LONG );
+	CHECK( cache.getQueueLength() == 0 );
+	cache.process();
+	CHECK( responders.requestCount == 0 );
+	
+	result longest = { 0, std::vector<unsigned char>(), false };
+	CHECK( ! cache.get( UID_TIMER, DmxRdm::PID_DEVICE_LABEL, tooLong, DmxRdm::DATA_MAX_LENGTH, onReply, &longest ) );
+	CHECK( cache.getQueueLength() == 1 );
+	processUntilDone( &cache, &longest );
+	CHECK( longest.done );
+	
+	return testResult( "testRdmCache" );
+}
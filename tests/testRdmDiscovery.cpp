@@ -0,0 +1,121 @@
+/*
+ * Runs RDM discovery against a simulated population of responders: a full
+ * discovery of 200 responders, a rediscovery after one responder has been
+ * replaced and the statistics reported when the transport fails midway.
+ * Responders answering a DISC_UNIQUE_BRANCH together garble the response, as
+ * overlapping transmissions on the line would.
+ */
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+#include "DmxRdm.h"
+#include "DmxRdmDiscovery.h"
+#include "TestSupport.h"
+
+class SimulatedLine : public DmxRdmTransport {
+public:
+	SimulatedLine() : requestCount( 0 ), failAfter( -1 ) {}
+	
+	int sendRdm( const unsigned char* request, int length, TRANSACTION_TYPE type,
+							unsigned char* response, int maxLength )
+	{
+		DmxRdm::message msg;
+		if ( DmxRdm::parsePacket( request, length, &msg ) != 0 ) return -1;
+		if ( failAfter >= 0 && requestCount >= failAfter ) return -2;
+		requestCount++;
+		
+		if ( msg.pid == DmxRdm::PID_DISC_UN_MUTE ) {
+			muted.assign( uids.size(), false );
+			return 0;
+		}
+		
+		if ( msg.pid == DmxRdm::PID_DISC_MUTE ) {
+			for ( size_t i = 0; i < uids.size(); i++ ) {
+				if ( uids[i] != msg.destination ) continue;
+				muted[i] = true;
+				
+				DmxRdm::message reply = msg;
+				reply.source = msg.destination;
+				reply.destination = msg.source;
+				reply.commandClass = DmxRdm::DISCOVERY_COMMAND_RESPONSE;
+				reply.portId = 0;
+				reply.dataLength = 2;
+				reply.data[0] = reply.data[1] = 0;
+				return DmxRdm::buildPacket( &reply, response );
+			}
+			return 0;
+		}
+		
+		//DISC_UNIQUE_BRANCH
+		uint64_t lower = DmxRdm::readUid( msg.data ), upper = DmxRdm::readUid( msg.data + 6 );
+		std::vector<uint64_t> answering;
+		for ( size_t i = 0; i < uids.size(); i++ ) {
+			if ( ! muted[i] && uids[i] >= lower && uids[i] <= upper ) answering.push_back( uids[i] );
+		}
+		if ( answering.empty() ) return 0;
+		
+		int n = DmxRdm::encodeDiscoveryResponse( answering[0], response );
+		for ( size_t i = 1; i < answering.size(); i++ ) {
+			unsigned char other[DmxRdm::DISCOVERY_RESPONSE_LENGTH];
+			DmxRdm::encodeDiscoveryResponse( answering[i], other );
+			for ( int k = 0; k < n; k++ ) response[k] &= other[k]; //the line is driven low by any sender
+		}
+		return n;
+	}
+	
+	std::vector<uint64_t> uids;
+	std::vector<bool> muted;
+	int requestCount;
+	int failAfter;
+};
+
+int main()
+{
+	static const int POPULATION = 200;
+	
+	SimulatedLine line;
+	std::srand( 1 );
+	for ( int i = 0; i < POPULATION; i++ ) {
+		line.uids.push_back( (uint64_t)( 0x4100 + std::rand() % 8 ) << 32 | (uint32_t)std::rand() );
+	}
+	line.muted.assign( line.uids.size(), false );
+	
+	DmxRdmDiscovery discovery( &line, 0x454E00000001ULL );
+	DmxRdmDiscovery::discoveryStats stats;
+	std::vector<uint64_t> expected;
+	
+	int found = discovery.discover();
+	discovery.getStats( &stats );
+	expected = line.uids;
+	std::sort( expected.begin(), expected.end() );
+	std::printf( "full: %i responders, %lu branches, %lu collisions, %lu mutes, %i requests\n",
+							found, stats.branchCount, stats.collisionCount, stats.muteCount, line.requestCount );
+	CHECK( found == POPULATION && discovery.getUids() == expected );
+	CHECK( stats.foundCount == (unsigned long)POPULATION );
+	
+	//replace one responder: known ones are re-muted, only the new one is searched for
+	line.uids.erase( line.uids.begin() + 5 );
+	line.uids.push_back( 0x123456789AULL );
+	line.muted.assign( line.uids.size(), false );
+	line.requestCount = 0;
+	
+	found = discovery.discover();
+	discovery.getStats( &stats );
+	expected = line.uids;
+	std::sort( expected.begin(), expected.end() );
+	std::printf( "rediscovery: %i responders, %lu branches, %lu mutes, %lu new, %lu lost, %i requests\n",
+							found, stats.branchCount, stats.muteCount, stats.foundCount, stats.lostCount, line.requestCount );
+	CHECK( found == POPULATION && discovery.getUids() == expected );
+	CHECK( stats.foundCount == 1 && stats.lostCount == 1 );
+	CHECK( stats.branchCount < 100 );
+	
+	//a transport error midway still reports how long the run took
+	DmxRdmDiscovery failing( &line, 0x454E00000001ULL );
+	line.requestCount = 0;
+	line.failAfter = 50;
+	CHECK( failing.discover() < 0 );
+	failing.getStats( &stats );
+	CHECK( stats.duration > 0 );
+	
+	return testResult( "testRdmDiscovery" );
+}
@@ -0,0 +1,87 @@
+/*
+ * Sends a burst of queued RDM GET requests through the output thread of an
+ * emulated DMX USB PRO with a minimum DMX rate set: the widget must keep
+ * receiving frames at least at that rate while the queue drains, and every
+ * request must be answered within a bounded time.
+ */
+#include <atomic>
+#include <thread>
+#include "DmxClock.h"
+#include "DmxRdm.h"
+#include "DmxRdmCache.h"
+#include "DmxUsbProDevice.h"
+#include "FtdiEmulator.h"
+#include "TestSupport.h"
+#include "UsbProEmulator.h"
+
+static const int RESPONDER_COUNT = 20;
+static const unsigned int PIDS[] = { DmxRdm::PID_DEVICE_INFO, DmxRdm::PID_DEVICE_LABEL, DmxRdm::PID_DMX_START_ADDRESS };
+static const float OUTPUT_RATE = 40;
+static const float MINIMUM_RATE = 30;
+static const uint64_t FIRST_UID = 0x454E00001000ULL;
+
+static void onReply( uint64_t uid, unsigned int pid, int result, const unsigned char* data, int length, void* userData )
+{
+	if ( result == 0 ) ( *static_cast<std::atomic<int>*>( userData ) )++;
+}
+
+int main()
+{
+	UsbProEmulator widget;
+	FtdiEmulator::attach( &widget );
+	for ( int i = 0; i < RESPONDER_COUNT; i++ ) widget.addRdmResponder( FIRST_UID + i );
+	
+	DmxUsbProDevice device;
+	CHECK( device.open() );
+	device.setKeepAliveInterval( 0 );
+	device.setOutputRate( OUTPUT_RATE );
+	device.setMinimumDmxRate( MINIMUM_RATE );
+	
+	unsigned char frame[513] = { 0 };
+	device.publishDmx( frame, sizeof( frame ) );
+	CHECK( device.startOutputThread() );
+	std::this_thread::sleep_for( std::chrono::milliseconds( 200 ) );
+	
+	//queue the whole burst at once
+	static const int PID_COUNT = sizeof( PIDS ) / sizeof( PIDS[0] );
+	std::atomic<int> answered( 0 );
+	DmxRdmCache* cache = device.getRdmCache();
+	for ( int i = 0; i < RESPONDER_COUNT; i++ ) {
+		for ( int p = 0; p < PID_COUNT; p++ ) cache->get( FIRST_UID + i, PIDS[p], onReply, &answered );
+	}
+	
+	//count the frames the widget receives until the queue has drained
+	unsigned long frames0 = widget.getFrameCount( 1 );
+	uint64_t t0 = DmxClock::now(), end = t0 + 10000000000ULL;
+	while ( answered < RESPONDER_COUNT * PID_COUNT && DmxClock::now() < end ) {
+		std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
+	}
+	uint64_t t1 = DmxClock::now();
+	float drainRate = ( widget.getFrameCount( 1 ) - frames0 ) * 1000000000.0f / ( t1 - t0 );
+	
+	DmxUsbProDevice::lineStats stats;
+	device.getLineStats( &stats );
+	device.stopOutputThread();
+	
+	std::printf( "%i GETs answered in %.0f ms (%lu transactions of %.2f ms), DMX at %.1f Hz (worst %.1f Hz, "
+							"minimum %.0f Hz), queue latency mean %.1f ms, max %.1f ms\n",
+							answered.load(), ( t1 - t0 ) / 1000000.0f, stats.rdmTransactionCount, stats.rdmTransactionTime,
+							drainRate, stats.dmxRateMin, MINIMUM_RATE, stats.meanRdmQueueLatency, stats.maxRdmQueueLatency );
+	
+	CHECK( answered == RESPONDER_COUNT * PID_COUNT );
+	CHECK( widget.getRdmRequestCount() >= (unsigned long)( RESPONDER_COUNT * PID_COUNT ) );
+	CHECK( stats.rdmQueueLength == 0 );
+	CHECK( stats.rdmTransactionCount >= (unsigned long)( RESPONDER_COUNT * PID_COUNT ) );
+	
+	//the line is shared: DMX stays above the minimum rate, RDM still gets through;
+	//a single transaction delayed by the scheduler may stretch the longest burst a little
+	CHECK( drainRate >= MINIMUM_RATE );
+	CHECK( stats.dmxRateMin >= 0.85f * MINIMUM_RATE );
+	CHECK( stats.rdmTransactionTime > 0 && stats.rdmTransactionTime < 1000.0f / MINIMUM_RATE );
+	CHECK( stats.maxRdmQueueLatency > 0 && stats.maxRdmQueueLatency <= ( t1 - t0 ) / 1000000.0f );
+	CHECK( stats.meanRdmQueueLatency <= stats.maxRdmQueueLatency );
+	
+	device.close();
+	FtdiEmulator::detachAll();
+	return testResult( "testRdmLine" );
+}
@@ -0,0 +1,142 @@
+/*
+ * Compares the CPU time spent waiting for input by FtdiDevice::readAvailable()
+ * with that of the polling loop readData() used before (repeated
+ * ftdi_read_data() calls until the timeout, checked with gettimeofday()).
+ * The emulated device sends 100 bytes every 25ms, like a DMX input at 40Hz.
+ *
+ * The emulated ftdi_read_data() returns 0 at once while nothing is waiting, so
+ * the old loop keeps a core busy, whereas readAvailable() sleeps until its
+ * transfers complete.
+ */
+#include <atomic>
+#include <cstring>
+#include <sys/time.h>
+#include <thread>
+#include "DmxClock.h"
+#include "FtdiDevice.h"
+#include "FtdiEmulator.h"
+#include "TestSupport.h"
+
+extern "C" {
+	#include "ftdi.h"
+}
+
+class SilentDevice : public EmulatedDevice {
+public:
+	void receive( const unsigned char* data, int length ) {}
+};
+
+static const int CHUNK_LENGTH = 100;
+static const int CHUNK_INTERVAL = 25; /* in milliseconds */
+static const int RUN_TIME = 1000; /* in milliseconds */
+
+/* the former FtdiDevice::readData() */
+static int legacyReadData( struct ftdi_context* context, unsigned char* data, int length, int timeout )
+{
+	struct timeval tNow, tEnd, tOut;
+	
+	tOut.tv_sec = timeout / 1000; tOut.tv_usec = ( timeout % 1000 ) * 1000;
+	gettimeofday( &tNow, 0 );
+	timeradd( &tNow, &tOut, &tEnd );
+	
+	int readTotal = 0, readLast = 0;
+	bool reread = ( length > 0 );
+	
+	while ( reread ) {
+		readTotal += readLast;
+		if ( readTotal == length ) break;
+		readLast = ftdi_read_data( context, data + readTotal, length - readTotal );
+		
+		gettimeofday( &tNow, 0 );
+		reread = ( readLast >= 0 );
+		if ( reread ) reread = ( readLast > 0 || timercmp( &tNow, &tEnd, < ) );
+	}
+	
+	return readLast < 0 ? readLast : readTotal;
+}
+
+static void sendChunks( EmulatedDevice* device, std::atomic<bool>* running )
+{
+	unsigned char chunk[CHUNK_LENGTH];
+	std::memset( chunk, 0x55, sizeof( chunk ) );
+	
+	uint64_t next = DmxClock::now();
+	while ( *running ) {
+		FtdiEmulator::sendToHost( device, chunk, sizeof( chunk ) );
+		next += CHUNK_INTERVAL * 1000000ULL;
+		DmxClock::sleepUntil( next );
+	}
+}
+
+/* runs the given reader for RUN_TIME while chunks arrive, returns the bytes read */
+template <typename Reader>
+static long measure( EmulatedDevice* device, Reader read, float* cpuPercentage, unsigned long* wakeups )
+{
+	FtdiEmulator::usbStats before, after;
+	FtdiEmulator::getStats( &before );
+	std::atomic<bool> running( true );
+	std::thread sender( sendChunks, device, &running );
+	
+	unsigned char buffer[4096];
+	long total = 0;
+	uint64_t t0 = DmxClock::now(), c0 = cpuTime();
+	uint64_t end = t0 + RUN_TIME * 1000000ULL;
+	while ( DmxClock::now() < end ) {
+		int r = read( buffer, sizeof( buffer ) );
+		if ( r > 0 ) total += r;
+	}
+	uint64_t t1 = DmxClock::now(), c1 = cpuTime();
+	
+	running = false;
+	sender.join();
+	FtdiEmulator::getStats( &after );
+	
+	*cpuPercentage = 100.0f * ( c1 - c0 ) / ( t1 - t0 );
+	*wakeups = ( after.readTransferCount - before.readTransferCount ) + ( after.pollCount - before.pollCount );
+	return total;
+}
+
+int main()
+{
+	static const int LATENCY_TIMERS[] = { 16, 1 };
+	
+	SilentDevice device;
+	FtdiEmulator::attach( &device );
+	
+	for ( unsigned int i = 0; i < sizeof( LATENCY_TIMERS ) / sizeof( LATENCY_TIMERS[0] ); i++ ) {
+		int latency = LATENCY_TIMERS[i];
+		float cpuEvent, cpuPolling;
+		unsigned long wakeupsEvent, wakeupsPolling;
+		
+		FtdiDevice ftdi;
+		CHECK( ftdi.open() );
+		CHECK( ftdi.setLatencyTimer( latency ) );
+		long bytesEvent = measure( &device, [&]( unsigned char* b, int n ) { return ftdi.readAvailable( b, n, 100 ); },
+															&cpuEvent, &wakeupsEvent );
+		ftdi.close();
+		
+		struct ftdi_context* context = ftdi_new();
+		struct ftdi_device_list* list;
+		CHECK( ftdi_usb_find_all( context, &list, 0, 0 ) == 1 );
+		ftdi_usb_open_dev( context, list->dev );
+		ftdi_list_free( &list );
+		ftdi_set_latency_timer( context, latency );
+		long bytesPolling = measure( &device, [&]( unsigned char* b, int n ) { return legacyReadData( context, b, CHUNK_LENGTH, 100 ); },
+																&cpuPolling, &wakeupsPolling );
+		ftdi_usb_close( context );
+		ftdi_free( context );
+		
+		std::printf( "latency timer %2i ms: event-driven %5.2f%% CPU, %4lu wakeups, %5li bytes; "
+								"polling %5.2f%% CPU, %4lu wakeups, %5li bytes\n", latency,
+								cpuEvent, wakeupsEvent, bytesEvent, cpuPolling, wakeupsPolling, bytesPolling );
+		
+		long expected = ( RUN_TIME / CHUNK_INTERVAL ) * CHUNK_LENGTH;
+		CHECK( bytesEvent >= expected - 2 * CHUNK_LENGTH && bytesEvent <= expected + CHUNK_LENGTH );
+		CHECK( bytesPolling >= expected - 2 * CHUNK_LENGTH && bytesPolling <= expected + CHUNK_LENGTH );
+		CHECK( cpuEvent < 5.0f );
+		CHECK( cpuPolling > 80.0f );
+	}
+	
+	FtdiEmulator::detachAll();
+	return testResult( "testReadCpu" );
+}
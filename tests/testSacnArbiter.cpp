@@ -0,0 +1,117 @@
+/*
+ * Checks DmxSacnArbiter with packets from three sources: priority arbitration,
+ * HTP among sources of equal priority, skipping packets which cannot change
+ * the result, per-address priority, stream termination, and holding or fading
+ * out a lost source.
+ */
+#include <cstring>
+#include "DmxSacnArbiter.h"
+#include "TestSupport.h"
+
+static const int UNIVERSE = 1;
+static const uint64_t MS = 1000000; /* in nanoseconds */
+static const unsigned char OPTION_TERMINATED = 0x40;
+
+static unsigned char s_cids[3][16] = { { 1 }, { 2 }, { 3 } };
+static int s_sequences[3];
+
+static int send( DmxSacnArbiter* arbiter, int source, int priority, unsigned char startCode,
+								 const unsigned char* slots, uint64_t timestamp, unsigned char options = 0 )
+{
+	DmxNetDevice::packetInfo info;
+	info.universe = UNIVERSE;
+	info.sequence = s_sequences[source]++ & 0xFF;
+	info.priority = priority;
+	info.options = options;
+	info.cid = s_cids[source];
+	info.startCode = startCode;
+	info.slots = slots;
+	info.slotCount = 512;
+	return arbiter->receivePacket( &info, timestamp );
+}
+
+/* Returns: the level of the given slot (1 to 512), or -1 if there is no output. */
+static int output( const DmxSacnArbiter* arbiter, int slot )
+{
+	DmxFrameBuffer frame;
+	if ( ! arbiter->readUniverse( UNIVERSE, &frame ) ) return -1;
+	return frame.data[slot];
+}
+
+int main()
+{
+	enum { A, B, C };
+	uint64_t t = 1000 * MS;
+	unsigned char a[512], b[512], c[512], priorities[512];
+	std::memset( a, 100, sizeof( a ) );
+	std::memset( b, 200, sizeof( b ) );
+	std::memset( c, 50, sizeof( c ) );
+	
+	DmxSacnArbiter arbiter;
+	CHECK( arbiter.addUniverse( UNIVERSE ) == 0 );
+	send( &arbiter, A, 100, 0, a, t );
+	CHECK( output( &arbiter, 1 ) == 100 );
+	send( &arbiter, B, 50, 0, b, t );
+	CHECK( output( &arbiter, 1 ) == 100 ); /* lower priority */
+	send( &arbiter, C, 100, 0, c, t );
+	CHECK( output( &arbiter, 1 ) == 100 ); /* equal priority, HTP */
+	c[0] = 150;
+	send( &arbiter, C, 100, 0, c, t );
+	CHECK( output( &arbiter, 1 ) == 150 );
+	CHECK( output( &arbiter, 2 ) == 100 );
+	
+	//packets of a source below the winning priority do not cause a merge
+	DmxSacnArbiter::arbiterStats before, after;
+	arbiter.getStats( &before );
+	for ( int i = 0; i < 1000; i++ ) {
+		b[5] = i;
+		send( &arbiter, B, 50, 0, b, t );
+	}
+	arbiter.getStats( &after );
+	CHECK( after.skippedCount - before.skippedCount == 1000 );
+	CHECK( after.mergeCount == before.mergeCount );
+	
+	//per-address priority lets B win slot 3 only
+	std::memset( priorities, 0, sizeof( priorities ) );
+	priorities[2] = 150;
+	send( &arbiter, B, 50, DmxSacnArbiter::START_CODE_PRIORITY, priorities, t );
+	CHECK( output( &arbiter, 3 ) == 200 );
+	CHECK( output( &arbiter, 1 ) == 150 );
+	
+	//after A and C terminate, B only sources slot 3
+	send( &arbiter, A, 100, 0, a, t, OPTION_TERMINATED );
+	send( &arbiter, C, 100, 0, c, t, OPTION_TERMINATED );
+	CHECK( output( &arbiter, 1 ) == 0 );
+	CHECK( output( &arbiter, 3 ) == 200 );
+	CHECK( arbiter.getSourceCount( UNIVERSE ) == 1 );
+	
+	//a lost source fades out over the given time
+	DmxSacnArbiter fading;
+	CHECK( fading.addUniverse( UNIVERSE ) == 0 );
+	fading.setSourceLoss( DmxSacnArbiter::LOSS_FADE, 1000 );
+	std::memset( s_sequences, 0, sizeof( s_sequences ) );
+	send( &fading, A, 100, 0, a, t );
+	fading.update( t + 2600 * MS );
+	CHECK( output( &fading, 1 ) == 100 );
+	fading.update( t + 3100 * MS );
+	CHECK( output( &fading, 1 ) >= 45 && output( &fading, 1 ) <= 55 );
+	fading.update( t + 3700 * MS );
+	CHECK( output( &fading, 1 ) == 0 );
+	CHECK( fading.getSourceCount( UNIVERSE ) == 0 );
+	
+	//a lost source held forever keeps winning over a lower priority
+	DmxSacnArbiter holding;
+	CHECK( holding.addUniverse( UNIVERSE ) == 0 );
+	holding.setSourceLoss( DmxSacnArbiter::LOSS_HOLD, 0 );
+	std::memset( s_sequences, 0, sizeof( s_sequences ) );
+	send( &holding, A, 100, 0, a, t );
+	send( &holding, B, 50, 0, b, t );
+	holding.update( t + 2600 * MS );
+	CHECK( output( &holding, 1 ) == 100 );
+	send( &holding, B, 50, 0, b, t + 2700 * MS );
+	holding.update( t + 5000 * MS );
+	CHECK( output( &holding, 1 ) == 100 );
+	CHECK( holding.getSourceCount( UNIVERSE ) == 2 );
+	
+	return testResult( "testSacnArbiter" );
+}
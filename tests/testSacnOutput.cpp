@@ -0,0 +1,94 @@
+/*
+ * Sends 512 universes through the output thread of an sACN device to a
+ * DmxNetReceiver over the loopback interface (unicast, since a socket can only
+ * join a limited number of multicast groups). Every universe must be received
+ * close to the default refresh rate, and closing the device must send three
+ * stream terminated packets for each of them.
+ */
+#include <atomic>
+#include <thread>
+#include "DmxClock.h"
+#include "DmxNetReceiver.h"
+#include "DmxSacnDevice.h"
+#include "TestSupport.h"
+
+static const int UNIVERSE_COUNT = 512;
+static const int FIRST_UNIVERSE = DmxSacnDevice::UNIVERSE_MIN;
+static const int RUN_TIME = 1000; /* in milliseconds */
+static const int TERMINATION_PACKET_COUNT = 3; /* as recommended by E1.31 */
+
+struct universeLog {
+	std::atomic<int> packetCount;
+	std::atomic<int> terminatedCount;
+};
+
+static void onPacket( const DmxNetDevice::packetInfo* info, uint64_t timestamp, void* userData )
+{
+	universeLog* log = static_cast<universeLog*>( userData ) + ( info->universe - FIRST_UNIVERSE );
+	if ( info->options & DmxSacnDevice::OPTION_STREAM_TERMINATED ) log->terminatedCount++;
+	else log->packetCount++;
+}
+
+/* publishes a new frame for every universe, faster than the output rate */
+static void publishFrames( DmxSacnDevice* device, std::atomic<bool>* running )
+{
+	unsigned char frame[513] = { 0 };
+	while ( *running ) {
+		frame[1]++;
+		for ( int h = 0; h < UNIVERSE_COUNT; h++ ) device->publishUniverse( h, frame, sizeof( frame ) );
+		std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
+	}
+}
+
+int main()
+{
+	static universeLog logs[UNIVERSE_COUNT];
+	
+	DmxNetReceiver receiver( DmxNetReceiver::PROTOCOL_SACN );
+	for ( int i = 0; i < UNIVERSE_COUNT; i++ ) CHECK( receiver.addUniverse( FIRST_UNIVERSE + i ) >= 0 );
+	receiver.setPacketCallback( onPacket, logs );
+	CHECK( receiver.start() );
+	
+	DmxSacnDevice device;
+	CHECK( device.open( "127.0.0.1", 0, FIRST_UNIVERSE ) );
+	for ( int i = 1; i < UNIVERSE_COUNT; i++ ) CHECK( device.addUniverse( FIRST_UNIVERSE + i ) == i );
+	CHECK( device.startOutputThread() );
+	
+	std::atomic<bool> running( true );
+	std::thread publisher( publishFrames, &device, &running );
+	uint64_t t0 = DmxClock::now();
+	std::this_thread::sleep_for( std::chrono::milliseconds( RUN_TIME ) );
+	running = false;
+	publisher.join();
+	device.stopOutputThread();
+	uint64_t t1 = DmxClock::now();
+	std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+	
+	float seconds = ( t1 - t0 ) / 1000000000.0f;
+	float rateMin = -1, rateSum = 0;
+	for ( int i = 0; i < UNIVERSE_COUNT; i++ ) {
+		float rate = logs[i].packetCount / seconds;
+		if ( rateMin < 0 || rate < rateMin ) rateMin = rate;
+		rateSum += rate;
+	}
+	DmxNetDevice::networkStats net;
+	device.getNetworkStats( &net );
+	std::printf( "%i universes: %.1f Hz mean, %.1f Hz minimum (default %.0f Hz); %lu batches, %.0f us per batch\n",
+							UNIVERSE_COUNT, rateSum / UNIVERSE_COUNT, rateMin, device.getDefaultRefreshRate(),
+							net.batchCount, net.meanBatchTime );
+	CHECK( rateMin >= 0.9f * device.getDefaultRefreshRate() );
+	CHECK( net.errorCount == 0 );
+	
+	//closing terminates every stream sent so far
+	device.close();
+	std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+	int terminatedOk = 0;
+	for ( int i = 0; i < UNIVERSE_COUNT; i++ ) {
+		if ( logs[i].terminatedCount == TERMINATION_PACKET_COUNT ) terminatedOk++;
+	}
+	std::printf( "%i of %i universes terminated with %i packets\n", terminatedOk, UNIVERSE_COUNT, TERMINATION_PACKET_COUNT );
+	CHECK( terminatedOk == UNIVERSE_COUNT );
+	
+	receiver.stop();
+	return testResult( "testSacnOutput" );
+}
@@ -0,0 +1,143 @@
+/*
+ * Checks the bit-bang waveform of a raw device. DmxKernels::renderSerialBits()
+ * must match a plain bit by bit rendering (start bit, 8 data bits least
+ * significant first, 2 stop bits) for every byte value, pin mask and length,
+ * without writing past the end. The waveform written by DmxRawDevice must start
+ * with a break and mark-after-break of the configured length and decode back to
+ * the frame the way a receiver would sample it.
+ */
+#include <cstring>
+#include <vector>
+#include "DmxKernels.h"
+#include "DmxRawDevice.h"
+#include "FtdiEmulator.h"
+#include "TestSupport.h"
+
+static const int BITS_PER_SLOT = 11;
+static const unsigned char GUARD = 0x5A;
+
+class LineRecorder : public EmulatedDevice {
+public:
+	void receive( const unsigned char* data, int length ) { samples.insert( samples.end(), data, data + length ); }
+	
+	std::vector<unsigned char> samples;
+};
+
+static int renderReference( const unsigned char* data, int length, unsigned char* samples, unsigned char pinMask )
+{
+	int n = 0;
+	for ( int i = 0; i < length; i++ ) {
+		samples[n++] = 0;
+		for ( int bit = 0; bit < 8; bit++ ) samples[n++] = ( data[i] & ( 1 << bit ) ) ? pinMask : 0;
+		samples[n++] = pinMask;
+		samples[n++] = pinMask;
+	}
+	return n;
+}
+
+static void checkKernel()
+{
+	static const int LENGTH_MAX = 513;
+	static const unsigned char PIN_MASKS[] = { 0x01, 0x80, 0xFF };
+	//every length up to a few words, plus the odd and full universe sizes used in practice
+	std::vector<int> lengths;
+	for ( int length = 0; length <= 40; length++ ) lengths.push_back( length );
+	lengths.push_back( 256 );
+	lengths.push_back( 257 );
+	lengths.push_back( LENGTH_MAX );
+	
+	unsigned char data[LENGTH_MAX];
+	uint32_t seed = 12345;
+	for ( int i = 0; i < LENGTH_MAX; i++ ) {
+		//the first 256 bytes take every value, the rest is pseudo random
+		seed = seed * 1103515245 + 12345;
+		data[i] = ( i < 256 ) ? i : seed >> 24;
+	}
+	
+	std::vector<unsigned char> expected( LENGTH_MAX * BITS_PER_SLOT );
+	std::vector<unsigned char> samples( LENGTH_MAX * BITS_PER_SLOT + 16 );
+	for ( unsigned int m = 0; m < sizeof( PIN_MASKS ); m++ ) {
+		for ( unsigned int l = 0; l < lengths.size(); l++ ) {
+			int length = lengths[l];
+			std::memset( &samples[0], GUARD, samples.size() );
+			
+			int n = DmxKernels::renderSerialBits( data, length, &samples[0], PIN_MASKS[m] );
+			CHECK( n == renderReference( data, length, &expected[0], PIN_MASKS[m] ) );
+			CHECK( n == length * BITS_PER_SLOT );
+			CHECK( n == 0 || std::memcmp( &samples[0], &expected[0], n ) == 0 );
+			CHECK( samples[n] == GUARD && samples[samples.size() - 1] == GUARD );
+		}
+	}
+}
+
+/* decode slots as a receiver would: wait for a start bit, then sample one bit per sample */
+static std::vector<unsigned char> decode( const unsigned char* samples, int count, unsigned char pinMask )
+{
+	std::vector<unsigned char> slots;
+	int i = 0;
+	while ( i + BITS_PER_SLOT <= count ) {
+		if ( samples[i] != 0 ) {
+			i++; //idle or mark time between slots
+			continue;
+		}
+		unsigned char value = 0;
+		for ( int bit = 0; bit < 8; bit++ ) {
+			if ( samples[i + 1 + bit] == pinMask ) value |= 1 << bit;
+		}
+		if ( samples[i + 9] != pinMask || samples[i + 10] != pinMask ) break; //framing error
+		slots.push_back( value );
+		i += BITS_PER_SLOT;
+	}
+	return slots;
+}
+
+static void checkDevice( DmxRawDevice& device, LineRecorder& line, float breakTime, float mabTime )
+{
+	static const unsigned char TX_PIN = 0x01;
+	int breakSamples = ( breakTime + 3 ) / 4, mabSamples = ( mabTime + 3 ) / 4;
+	
+	unsigned char frame[513];
+	for ( int i = 0; i < 513; i++ ) frame[i] = ( i * 37 ) ^ ( i >> 3 );
+	frame[0] = 0;
+	
+	device.setBreakTiming( breakTime, mabTime );
+	line.samples.clear();
+	CHECK( device.writeDmx( frame, sizeof( frame ) ) == 513 );
+	CHECK( (int)line.samples.size() == breakSamples + mabSamples + 513 * BITS_PER_SLOT );
+	if ( (int)line.samples.size() <= breakSamples + mabSamples ) return;
+	
+	const unsigned char* s = &line.samples[0];
+	int lowCount = 0, highCount = 0;
+	while ( lowCount < (int)line.samples.size() && s[lowCount] == 0 ) lowCount++;
+	while ( lowCount + highCount < (int)line.samples.size() && s[lowCount + highCount] == TX_PIN ) highCount++;
+	CHECK( lowCount == breakSamples );
+	CHECK( device.getMeasuredBreakTime() == breakSamples * 4.0f && breakSamples * 4.0f >= breakTime );
+	//the start bit of slot 0 ends the MAB
+	CHECK( highCount == mabSamples );
+	CHECK( device.getMeasuredMabTime() == mabSamples * 4.0f && mabSamples * 4.0f >= mabTime );
+	
+	std::vector<unsigned char> slots = decode( s + breakSamples + mabSamples,
+																						line.samples.size() - breakSamples - mabSamples, TX_PIN );
+	CHECK( slots.size() == 513 );
+	CHECK( slots.size() == 513 && std::memcmp( &slots[0], frame, 513 ) == 0 );
+}
+
+int main()
+{
+	checkKernel();
+	
+	LineRecorder line;
+	FtdiEmulator::attach( &line );
+	FtdiEmulator::setWriteTiming( 0, 0 );
+	
+	DmxRawDevice device;
+	CHECK( device.open() );
+	CHECK( device.getOutputMode() == DmxRawDevice::OUTPUT_MODE_BITBANG );
+	checkDevice( device, line, DmxRawDevice::BREAK_TIME_DEFAULT, DmxRawDevice::MAB_TIME_DEFAULT );
+	checkDevice( device, line, 90, 10 ); //rounded up to whole samples
+	checkDevice( device, line, 176, 8 );
+	
+	device.close();
+	FtdiEmulator::detachAll();
+	return testResult( "testSerialBits" );
+}
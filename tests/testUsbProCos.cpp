@@ -0,0 +1,119 @@
+/*
+ * Injects change-of-state packets (label 9) into an emulated DMX USB PRO with
+ * input started for changes only: the changed values must be patched into the
+ * resident universe at the right slots, across several blocks of the change
+ * bit array and with a start offset above 0, and values for slots past 512
+ * must be ignored. The slots flagged by takeChangedSlots() must be exactly
+ * those changed.
+ */
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "DmxClock.h"
+#include "DmxUsbProDevice.h"
+#include "FtdiEmulator.h"
+#include "TestSupport.h"
+#include "UsbProEmulator.h"
+
+static const int RECEIVED_DMX_COS_TYPE = 9;
+static const int BLOCK_SLOTS = 8; /* slots per unit of the start offset */
+static const int PACKET_SLOTS = 40; /* slots covered by the change bit array */
+
+/*
+ * Send a change-of-state packet starting at the given block, with the given
+ * slots (all within the packet's range) changed to their number plus offset,
+ * and patch the expected universe and bitmap accordingly.
+ */
+static void sendChanges( UsbProEmulator* widget, int block, const std::vector<int>& slots, int offset,
+												unsigned char* universe, uint64_t* bitmap )
+{
+	unsigned char packet[6 + PACKET_SLOTS] = { 0 };
+	int n = 6;
+	packet[0] = block;
+	for ( unsigned int i = 0; i < slots.size(); i++ ) {
+		int bit = slots[i] - block * BLOCK_SLOTS;
+		packet[1 + bit / 8] |= 1 << ( bit % 8 );
+	}
+	//values follow in slot order, as the widget sends them
+	for ( int bit = 0; bit < PACKET_SLOTS; bit++ ) {
+		if ( ( packet[1 + bit / 8] & ( 1 << ( bit % 8 ) ) ) == 0 ) continue;
+		int slot = block * BLOCK_SLOTS + bit;
+		packet[n++] = ( slot + offset ) & 0xFF;
+		if ( slot < DmxUsbProDevice::INPUT_UNIVERSE_LENGTH ) {
+			universe[slot] = ( slot + offset ) & 0xFF;
+			bitmap[slot / 64] |= (uint64_t)1 << ( slot % 64 );
+		}
+	}
+	widget->sendPacket( RECEIVED_DMX_COS_TYPE, packet, n );
+}
+
+/* collect changed slots until the expected number has been flagged or a timeout */
+static int takeChanges( DmxUsbProDevice* device, uint64_t* bitmap, int expected )
+{
+	std::memset( bitmap, 0, DmxUsbProDevice::SLOT_BITMAP_WORDS * sizeof( uint64_t ) );
+	int count = 0;
+	uint64_t end = DmxClock::now() + 500000000ULL;
+	while ( count < expected && DmxClock::now() < end ) {
+		count += device->takeChangedSlots( bitmap );
+		std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+	}
+	std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+	return count + device->takeChangedSlots( bitmap );
+}
+
+static void check( DmxUsbProDevice* device, const unsigned char* universe, const uint64_t* expected, int expectedCount )
+{
+	static const int WORDS = DmxUsbProDevice::SLOT_BITMAP_WORDS;
+	uint64_t bitmap[WORDS];
+	CHECK( takeChanges( device, bitmap, expectedCount ) == expectedCount );
+	CHECK( std::memcmp( bitmap, expected, sizeof( bitmap ) ) == 0 );
+	
+	unsigned char frame[DmxUsbProDevice::INPUT_UNIVERSE_LENGTH];
+	CHECK( device->readDmx( frame, sizeof( frame ) ) == DmxUsbProDevice::INPUT_UNIVERSE_LENGTH );
+	CHECK( std::memcmp( frame, universe, sizeof( frame ) ) == 0 );
+}
+
+int main()
+{
+	static const int WORDS = DmxUsbProDevice::SLOT_BITMAP_WORDS;
+	UsbProEmulator widget;
+	FtdiEmulator::attach( &widget );
+	
+	DmxUsbProDevice device;
+	CHECK( device.open() );
+	CHECK( device.startInput( true ) );
+	
+	unsigned char universe[DmxUsbProDevice::INPUT_UNIVERSE_LENGTH] = { 0 };
+	uint64_t expected[WORDS];
+	
+	//first block, changes in the first and last byte of the change bit array
+	std::memset( expected, 0, sizeof( expected ) );
+	int first[] = { 1, 2, 3, 39 };
+	sendChanges( &widget, 0, std::vector<int>( first, first + 4 ), 100, universe, expected );
+	check( &device, universe, expected, 4 );
+	
+	//start offset above 0, changes spread over all five bytes of the bit array
+	std::memset( expected, 0, sizeof( expected ) );
+	int spread[] = { 100, 109, 117, 125, 133, 135 };
+	sendChanges( &widget, 100 / BLOCK_SLOTS, std::vector<int>( spread, spread + 6 ), 7, universe, expected );
+	check( &device, universe, expected, 6 );
+	
+	//two packets before the changes are taken: flags accumulate, values are the latest
+	std::memset( expected, 0, sizeof( expected ) );
+	int again[] = { 2, 3 };
+	sendChanges( &widget, 0, std::vector<int>( again, again + 2 ), 50, universe, expected );
+	int other[] = { 64, 65 };
+	sendChanges( &widget, 64 / BLOCK_SLOTS, std::vector<int>( other, other + 2 ), 1, universe, expected );
+	check( &device, universe, expected, 4 );
+	
+	//the last block reaches past slot 512: those values are dropped
+	std::memset( expected, 0, sizeof( expected ) );
+	int end[] = { 505, 511, 512, 513, 520, 543 };
+	sendChanges( &widget, 504 / BLOCK_SLOTS, std::vector<int>( end, end + 6 ), 3, universe, expected );
+	check( &device, universe, expected, 3 );
+	
+	device.stopInput();
+	device.close();
+	FtdiEmulator::detachAll();
+	return testResult( "testUsbProCos" );
+}
@@ -0,0 +1,98 @@
+/*
+ * Feeds full frames into port 1 of an emulated DMX USB PRO with input started
+ * for every frame: each frame must show up in the input ring in order (see
+ * getInputFrames()), as the latest frame for readDmx() and in the capture
+ * file, and the status byte of received packets must be counted.
+ */
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include "DmxClock.h"
+#include "DmxFrameRing.h"
+#include "DmxUsbProDevice.h"
+#include "FtdiEmulator.h"
+#include "TestSupport.h"
+#include "UsbProEmulator.h"
+
+static const char* CAPTURE_PATH = "build/testUsbProInput.dmxcap";
+static const int FRAME_COUNT = 20;
+static const int RECEIVED_DMX_PACKET = 5;
+
+/* wait until the ring holds the given number of frames, at most 1 second */
+static bool waitForFrames( const DmxFrameRing* ring, uint64_t count )
+{
+	uint64_t end = DmxClock::now() + 1000000000ULL;
+	while ( ring->getWriteCount() < count && DmxClock::now() < end ) {
+		std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+	}
+	return ring->getWriteCount() >= count;
+}
+
+int main()
+{
+	UsbProEmulator widget;
+	FtdiEmulator::attach( &widget );
+	
+	DmxUsbProDevice device;
+	CHECK( device.open() );
+	CHECK( ! device.startCapture( CAPTURE_PATH ) ); //input is not running
+	CHECK( device.startInput( false ) );
+	CHECK( device.startCapture( CAPTURE_PATH ) );
+	
+	const DmxFrameRing* ring = device.getInputFrames( 1 );
+	CHECK( ring != 0 && device.getInputFrames( 3 ) == 0 );
+	
+	unsigned char frame[513];
+	for ( int n = 0; n < FRAME_COUNT; n++ ) {
+		frame[0] = 0;
+		for ( int i = 1; i < 513; i++ ) frame[i] = ( n + i ) & 0xFF;
+		CHECK( widget.sendDmxInput( 1, frame, sizeof( frame ) ) );
+		CHECK( waitForFrames( ring, n + 1 ) );
+	}
+	
+	//the ring holds the history, readDmx() the latest frame
+	DmxFrameBuffer received;
+	int badCount = 0;
+	for ( int n = 0; n < FRAME_COUNT && n < ring->getCapacity(); n++ ) {
+		bool ok = ring->read( n, &received ) && received.length == 513 && received.data[0] == 0;
+		for ( int i = 1; ok && i < 513; i++ ) ok = ( received.data[i] == ( ( n + i ) & 0xFF ) );
+		if ( ! ok ) badCount++;
+	}
+	CHECK( badCount == 0 );
+	
+	unsigned char latest[513];
+	CHECK( device.readDmx( latest, sizeof( latest ) ) == 513 );
+	CHECK( std::memcmp( latest, frame, sizeof( frame ) ) == 0 );
+	
+	//a short frame and the status bits of the widget
+	unsigned char packet[1 + 25] = { 0 };
+	packet[0] = 0x01 | 0x02; /* queue overflow, overrun */
+	packet[24] = 42; /* slot 23 */
+	widget.sendPacket( RECEIVED_DMX_PACKET, packet, sizeof( packet ) );
+	CHECK( waitForFrames( ring, FRAME_COUNT + 1 ) );
+	CHECK( device.readDmx( latest, sizeof( latest ) ) == 25 );
+	CHECK( latest[23] == 42 );
+	
+	DmxUsbProDevice::inputStats stats;
+	device.getInputStats( &stats );
+	CHECK( stats.frameCount == FRAME_COUNT + 1 );
+	CHECK( stats.queueOverflowCount == 1 );
+	CHECK( stats.overrunCount == 1 );
+	
+	//every frame went to the capture file: magic and one record per frame
+	device.stopInput();
+	CHECK( ! device.isCapturing() );
+	FILE* file = fopen( CAPTURE_PATH, "rb" );
+	CHECK( file != 0 );
+	if ( file != 0 ) {
+		fseek( file, 0, SEEK_END );
+		long size = ftell( file );
+		CHECK( size == 8 + FRAME_COUNT * ( 10 + 513 ) + ( 10 + 25 ) );
+		fclose( file );
+		std::remove( CAPTURE_PATH );
+	}
+	
+	device.close();
+	FtdiEmulator::detachAll();
+	return testResult( "testUsbProInput" );
+}
@@ -0,0 +1,81 @@
+/*
+ * Checks the second port of an emulated DMX USB PRO Mk2: frames published for
+ * both ports go out in one combined transfer, a port 2 frame goes out while
+ * port 1 has nothing published, and input received on port 2 is routed to it.
+ */
+#include <cstring>
+#include <thread>
+#include "DmxUsbProDevice.h"
+#include "FtdiEmulator.h"
+#include "TestSupport.h"
+#include "UsbProEmulator.h"
+
+int main()
+{
+	UsbProEmulator widget( true );
+	FtdiEmulator::attach( &widget );
+	
+	DmxUsbProDevice device;
+	CHECK( device.open() );
+	FtdiEmulator::setWriteTiming( 0, 0 );
+	
+	DmxUsbProDevice::port2Configuration config = UsbProEmulator::getPort2Configuration();
+	CHECK( device.enablePort2( &config ) );
+	CHECK( widget.isPort2Enabled() );
+	
+	unsigned char frame1[513] = { 0 };
+	unsigned char frame2[513] = { 0 };
+	unsigned char output[513];
+	device.setKeepAliveInterval( 0 );
+	
+	//port 2 only: port 1 never gets a frame
+	CHECK( device.startOutputThread() );
+	frame2[1] = 22;
+	CHECK( device.publishDmxPort2( frame2, sizeof( frame2 ) ) == 0 );
+	std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+	CHECK( widget.getOutput( 2, output ) == 513 );
+	CHECK( output[1] == 22 );
+	CHECK( widget.getFrameCount( 1 ) == 0 );
+	
+	//both ports: published together, written in one transfer
+	frame1[1] = 11;
+	frame2[1] = 23;
+	device.stopOutputThread();
+	CHECK( device.publishDmxPort2( frame2, sizeof( frame2 ) ) == 0 );
+	device.publishDmx( frame1, sizeof( frame1 ) );
+	CHECK( device.startOutputThread() );
+	std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+	device.stopOutputThread();
+	CHECK( widget.getCombinedWriteCount() > 0 );
+	CHECK( widget.getOutput( 1, output ) == 513 );
+	CHECK( output[1] == 11 );
+	CHECK( widget.getOutput( 2, output ) == 513 );
+	CHECK( output[1] == 23 );
+	
+	//port 2 only again: the unchanged port 1 frame must not hold it back
+	frame2[1] = 24;
+	device.setKeepAliveInterval( 1000 );
+	CHECK( device.startOutputThread() );
+	std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+	CHECK( device.publishDmxPort2( frame2, sizeof( frame2 ) ) == 0 );
+	std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+	device.stopOutputThread();
+	CHECK( widget.getOutput( 2, output ) == 513 );
+	CHECK( output[1] == 24 );
+	
+	//input on port 2 is stored for port 2 only
+	CHECK( device.startInput() );
+	unsigned char input[25] = { 0 };
+	input[5] = 99;
+	CHECK( widget.sendDmxInput( 2, input, sizeof( input ) ) );
+	std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+	unsigned char read[25] = { 0 };
+	CHECK( device.readDmx( 2, read, sizeof( read ) ) == (int)sizeof( input ) );
+	CHECK( std::memcmp( read, input, sizeof( input ) ) == 0 );
+	CHECK( device.readDmx( 1, read, sizeof( read ) ) == 0 );
+	device.stopInput();
+	
+	device.close();
+	FtdiEmulator::detachAll();
+	return testResult( "testUsbProMk2" );
+}
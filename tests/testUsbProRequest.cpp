@@ -0,0 +1,32 @@
+/*
+ * Checks that replies to requests made while the input thread is running are
+ * not lost when they arrive before the requesting thread starts waiting.
+ */
+#include "DmxClock.h"
+#include "DmxUsbProDevice.h"
+#include "FtdiEmulator.h"
+#include "TestSupport.h"
+#include "UsbProEmulator.h"
+
+int main()
+{
+	UsbProEmulator widget;
+	FtdiEmulator::attach( &widget );
+	
+	DmxUsbProDevice device;
+	CHECK( device.open() );
+	CHECK( device.startInput() );
+	
+	//the emulated widget replies as soon as the request has been written
+	uint64_t t0 = DmxClock::now();
+	CHECK( device.fetchExtendedInfo() );
+	uint64_t t1 = DmxClock::now();
+	CHECK( ( device.getRdmUid() & 0xFFFFFFFF ) != 1 ); /* the serial number, not the fallback */
+	
+	std::printf( "serial number request with input running took %.2f ms\n", ( t1 - t0 ) / 1e6 );
+	CHECK( t1 - t0 < 20000000 );
+	
+	device.close();
+	FtdiEmulator::detachAll();
+	return testResult( "testUsbProRequest" );
+}